@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+namespace atlas {
+
+// Redis values of cached products are the indexed document in a compact,
+// versioned binary form:
+//
+//   byte 0   format version (kCacheValueVersion)
+//   byte 1   flags; kCacheValueCompressed: the body is zlib-compressed
+//   body     MessagePack of the document; when compressed, the body is the
+//            MessagePack size (4 bytes, little-endian) and the zlib stream
+//
+// Values written before this format are JSON text. They start with '{',
+// which is never a version byte, and decode as well.
+constexpr uint8_t kCacheValueVersion = 1;
+constexpr uint8_t kCacheValueCompressed = 0x01;
+
+// Encode a document. MessagePack bodies larger than `compress_above` bytes
+// are compressed, if that makes them smaller; 0 never compresses.
+std::string encodeCacheValue(const nlohmann::json& document, size_t compress_above = 1024);
+
+// Decode a cache value. Throws std::invalid_argument if it is malformed or
+// of a newer format version.
+nlohmann::json decodeCacheValue(const std::string& value);
+
+} // namespace atlas
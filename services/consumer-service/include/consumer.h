@@ -1,9 +1,20 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 #include <nlohmann/json.hpp>
 #include <librdkafka/rdkafkacpp.h>
+#include "version_cache.h"
+#include "offset_tracker.h"
+#include "bounded_queue.h"
 
 namespace atlas {
 
@@ -16,6 +27,43 @@ struct ProductEvent {
     nlohmann::json data;
 };
 
+// Indices (ascending) of the events left after coalescing: the highest
+// `version` of each product, the later one on ties. Only the survivor of a
+// burst of updates to one product needs writing; the rest would be
+// overwritten (or skipped as stale) anyway.
+std::vector<size_t> coalesceEvents(const std::vector<ProductEvent>& events);
+
+// Worker lane (0 .. lanes-1) that handles every event of a product, so
+// events of one product are always written in Kafka order
+size_t laneFor(const std::string& product_id, size_t lanes);
+
+// One action of an ES _bulk request
+struct BulkOperation {
+    enum class Type { Index, Delete };
+    Type type;
+    std::string id;
+    std::string source;    // JSON document; empty for deletes
+    int64_t version = -1;  // external version ES orders writes by; < 0: none
+};
+
+// Outcome of one _bulk item
+struct BulkItemResult {
+    int status = 0;      // item HTTP status; 0 if the request itself failed
+    std::string result;  // "created", "updated", "deleted", "not_found", ...
+    std::string error;
+
+    // Deleting a document that is already gone counts as done
+    bool ok() const { return (status >= 200 && status < 300) || result == "not_found"; }
+
+    // Version conflict: ES already holds this version of the document or a
+    // newer one, so the write is stale
+    bool conflict() const { return status == 409; }
+
+    // Throttled, server-side and transport failures may succeed if resent;
+    // anything else (conflicts, mapping errors, bad documents) never will
+    bool retryable() const { return status == 0 || status == 429 || status >= 500; }
+};
+
 class ElasticsearchWriter {
 public:
     ElasticsearchWriter(const std::string& host, int port);
@@ -31,6 +79,30 @@ public:
     // Delete document
     bool deleteDocument(const std::string& index, const std::string& id);
 
+    // Apply `operations` in order with one _bulk request. Items that fail
+    // with a retryable status are resent on their own, with exponential
+    // backoff, up to `max_retries` attempts in all. Results line up with
+    // `operations`.
+    std::vector<BulkItemResult> bulk(const std::string& index, const std::vector<BulkOperation>& operations,
+                                     int max_retries = 3);
+
+    // NDJSON body of a _bulk request. Versioned operations use
+    // version_type=external: ES applies them only if their version is
+    // higher than the stored one and answers 409 otherwise. An index first
+    // written without external versions must be reindexed before use (see
+    // README), and deletes only hold for index.gc_deletes.
+    static std::string buildBulkBody(const std::string& index, const std::vector<BulkOperation>& operations);
+
+    // Per-item results of a _bulk response for `count` operations; items
+    // the response doesn't mention are reported as transport failures
+    static std::vector<BulkItemResult> parseBulkResponse(const nlohmann::json& response, size_t count);
+
+    // Which of the failed `pending` items to resend: the retryable ones,
+    // except those a later successful write of the same ID already replaced
+    static std::vector<size_t> itemsToRetry(const std::vector<BulkOperation>& operations,
+                                            const std::vector<BulkItemResult>& results,
+                                            const std::vector<size_t>& pending);
+
 private:
     std::string host_;
     int port_;
@@ -42,7 +114,9 @@ private:
 
 class RedisClient {
 public:
-    RedisClient(const std::string& host, int port);
+    // Up to `pool_size` connections, opened on demand; one is opened up
+    // front so a bad address fails here. Safe to share between threads.
+    RedisClient(const std::string& host, int port, size_t pool_size = 1, int timeout_ms = 1000);
     ~RedisClient();
 
     // Set cache entry
@@ -51,13 +125,40 @@ public:
     // Delete cache entry
     bool del(const std::string& key);
     
-    // Get cache entry
+    // Get cache entry; empty if missing
     std::string get(const std::string& key);
 
+    // SET every entry, with an expiry of `ttl_seconds` unless it is <= 0,
+    // in one pipelined round trip. Results line up with `entries`.
+    std::vector<bool> msetWithTtl(const std::vector<std::pair<std::string, std::string>>& entries,
+                                  int ttl_seconds = 0);
+
+    // DEL every key in one pipelined round trip; false if any DEL failed
+    bool mdel(const std::vector<std::string>& keys);
+
+    // Arguments of one SET. Keys and values are passed as binary-safe
+    // arguments, so spaces, newlines and NUL bytes survive.
+    static std::vector<std::string> setCommand(const std::string& key, const std::string& value,
+                                               int ttl_seconds = 0);
+
 private:
     std::string host_;
     int port_;
-    void* context_; // Redis context (using void* to avoid exposing hiredis in header)
+    size_t pool_size_;
+    int timeout_ms_;
+    std::mutex pool_mutex_;
+    std::condition_variable pool_available_;
+    std::vector<void*> idle_;  // Redis contexts (void* to avoid exposing hiredis in header)
+    size_t open_ = 0;          // connections idle or lent out
+
+    void* connect();
+    void* acquire();
+    void release(void* context, bool broken);
+
+    // Send `commands` in one round trip and return their replies (nullptr
+    // where none arrived). A broken connection is replaced and the
+    // pipeline sent once more, which is safe for SET and DEL.
+    std::vector<void*> pipeline(const std::vector<std::vector<std::string>>& commands);
 };
 
 class ProductEventConsumer {
@@ -68,34 +169,118 @@ public:
     // Start consuming events
     void run();
     
-    // Stop consumer
+    // Stop consumer: run() finishes the current batch, commits its offsets
+    // and closes. Safe to call from a signal handler.
     void stop();
 
 private:
+    // The events of one consumed batch that hash to one lane
+    struct LaneBatch {
+        std::vector<std::unique_ptr<RdKafka::Message>> messages;
+        std::vector<ProductEvent> events;  // events[i] is parsed from messages[i]
+    };
+
+    // A worker thread with its own ES client. Lanes share the version
+    // cache, the offset tracker and the Redis connection pool.
+    struct Lane {
+        explicit Lane(size_t queue_capacity) : queue(queue_capacity) {}
+        size_t id = 0;
+        std::unique_ptr<ElasticsearchWriter> es_writer;
+        BoundedQueue<LaneBatch> queue;
+        std::thread worker;
+    };
+
+    class KafkaCallbacks;
+    std::unique_ptr<KafkaCallbacks> callbacks_;  // must outlive consumer_ and dlq_producer_
     std::unique_ptr<RdKafka::KafkaConsumer> consumer_;
-    std::unique_ptr<ElasticsearchWriter> es_writer_;
-    std::unique_ptr<RedisClient> redis_client_;
     std::unique_ptr<RdKafka::Producer> dlq_producer_;
+    std::unique_ptr<RedisClient> redis_client_;
+    int cache_ttl_seconds_;         // Redis expiry of cached products; <= 0: none
+    size_t cache_compress_above_;   // compress cache values larger than this; 0: never
+    std::vector<std::unique_ptr<Lane>> lanes_;
+    std::mutex lanes_mutex_;
+    std::condition_variable lanes_idle_;
+    size_t lane_batches_pending_ = 0;  // pushed to a lane and not yet finished
     
     std::string topic_;
     std::string dlq_topic_;
-    bool running_;
+    std::string index_;
+    size_t batch_size_;      // messages per batch at most
+    int batch_timeout_ms_;   // how long to wait for a batch to fill
+    bool coalesce_;          // write only the newest event per product per batch
+    std::unique_ptr<VersionCache> versions_;  // newest version ES confirmed, per product
+    std::string version_snapshot_path_;       // empty: no snapshots
+    int version_snapshot_interval_ms_;
+    std::thread snapshot_thread_;
+    OffsetTracker offsets_;
+    size_t commit_every_;      // async commit after this many finished messages...
+    int commit_interval_ms_;   // ...or this long, whichever comes first
+    std::chrono::steady_clock::time_point next_commit_;
+    bool closed_ = false;
+    std::atomic<bool> running_;
+    std::mutex log_mutex_;
+    std::mutex metrics_mutex_;
+    std::map<std::string, int> counters_;
     
-    // Process single event
-    bool processEvent(const ProductEvent& event);
-    
-    // Check idempotency (compare version/updated_at)
-    bool shouldProcess(const ProductEvent& event, const nlohmann::json& existing_doc);
+    // Drain up to batch_size_ messages, waiting at most batch_timeout_ms_
+    // once the first has arrived. Each message is tracked as in flight.
+    std::vector<std::unique_ptr<RdKafka::Message>> consumeBatch();
+
+    // Parse a batch and hand each event to its product's lane. Unparseable
+    // messages go to the DLQ and are finished here. Blocks while a lane's
+    // queue is full.
+    void dispatchBatch(std::vector<std::unique_ptr<RdKafka::Message>> messages);
+
+    // Worker thread of a lane: write each batch, then finish its messages
+    void runLane(Lane& lane);
+
+    // Write a lane batch's events to ES with one _bulk request, then Redis
+    // with one pipelined round trip each for sets and deletes. Redis gets
+    // the indexed document, encoded by encodeCacheValue.
+    // Stale events are skipped, by the version cache or by ES itself.
+    // Permanently failed writes go to the DLQ. Returns the messages sent
+    // there; their delivery reports finish them, so the caller must not.
+    std::unordered_set<const RdKafka::Message*> processBatch(Lane& lane, LaneBatch& batch);
+
+    // Wait until every batch handed to a lane is finished
+    void drainLanes();
+
+    // Close the lane queues and join the workers once they have drained
+    void stopLanes();
+
+    // Commit every partition watermark that advanced; asynchronously in the
+    // loop, synchronously on rebalance and shutdown
+    void commitOffsets(bool sync);
+
+    // Rebalance: commit what revoked partitions finished before giving them up
+    void onRebalance(RdKafka::KafkaConsumer* consumer, RdKafka::ErrorCode err,
+                     std::vector<RdKafka::TopicPartition*>& partitions);
+
+    // An async commit failed: resend those offsets with the next one
+    void onOffsetCommit(RdKafka::ErrorCode err, const std::vector<RdKafka::TopicPartition*>& offsets);
     
-    // Send to DLQ
-    void sendToDLQ(const std::string& event_data, const std::string& error_reason);
+    // Write the version cache to its snapshot file (best effort)
+    void saveVersionSnapshot();
+
+    // Send `source` to the DLQ. Its delivery report finishes it; a failed
+    // delivery is sent again. While the producer refuses the message, this
+    // retries with backoff. If the consumer is stopping and it still
+    // refuses, the source stays unfinished and is read again after a restart.
+    void sendToDLQ(const RdKafka::Message& source, const std::string& error_reason);
+
+    // One produce() to the DLQ topic; `source` is the opaque of the
+    // delivery report
+    RdKafka::ErrorCode produceToDLQ(const void* payload, size_t len, void* source);
+
+    // A DLQ delivery report: finish the source message, or resend
+    void onDlqDelivery(RdKafka::Message& message);
     
     // Parse event from JSON
     ProductEvent parseEvent(const std::string& json_str);
     
-    // Logging and metrics
+    // Logging and metrics; safe to call from any thread
     void logEvent(const std::string& level, const std::string& message);
-    void incrementCounter(const std::string& metric);
+    void incrementCounter(const std::string& metric, int count = 1);
 };
 
 } // namespace atlas
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <cstdint>
+
+namespace atlas {
+
+struct PartitionOffset {
+    std::string topic;
+    int32_t partition;
+    int64_t offset;  // next offset to consume, as Kafka commits it
+};
+
+// Per-partition commit watermarks for at-least-once delivery when messages
+// finish out of order. Each partition's watermark is one past the longest
+// run of finished messages from the start, so committing it never skips a
+// message that is still being processed. Safe to call from any thread.
+class OffsetTracker {
+public:
+    // A consumed message is now in flight. Offsets must rise per partition;
+    // anything at or below one already tracked is ignored.
+    void track(const std::string& topic, int32_t partition, int64_t offset);
+
+    // A tracked message is finished: written, skipped or in the DLQ
+    void complete(const std::string& topic, int32_t partition, int64_t offset);
+
+    // Watermarks that advanced since they were last taken; the caller
+    // commits them
+    std::vector<PartitionOffset> takeCommittable();
+
+    // The commit of `offsets` failed: hand them out again next time,
+    // unless a later watermark has been taken since
+    void commitFailed(const std::vector<PartitionOffset>& offsets);
+
+    // Drop a revoked partition; its late completions are ignored
+    void forget(const std::string& topic, int32_t partition);
+
+    // Messages finished since the watermarks were last taken
+    size_t uncommitted() const;
+    size_t inFlight() const;
+
+private:
+    struct Partition {
+        std::deque<std::pair<int64_t, bool>> in_flight;  // ascending offsets; true once finished
+        int64_t watermark = -1;                          // every offset below is finished
+        int64_t taken = -1;                              // last watermark handed out
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::pair<std::string, int32_t>, Partition> partitions_;
+    size_t uncommitted_ = 0;
+};
+
+} // namespace atlas
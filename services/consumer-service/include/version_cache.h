@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+
+namespace atlas {
+
+// Bounded LRU map of product_id -> the newest version ES has confirmed for
+// it. ES enforces ordering itself (external versioning); this only saves
+// the round trip for events that are obviously stale, such as Kafka
+// redeliveries after a restart. Evicting an entry is always safe: the
+// event then goes to ES, which answers 409 if it is stale.
+//
+// Hash-partitioned over shards with one lock each, so concurrent writers
+// rarely share a lock.
+class VersionCache {
+public:
+    explicit VersionCache(size_t capacity, size_t shards = 16);
+    ~VersionCache();
+
+    // Whether ES is known to hold `version` or newer for the product
+    bool isStale(const std::string& product_id, int64_t version);
+
+    // Record that ES holds at least `version` for the product
+    void update(const std::string& product_id, int64_t version);
+
+    size_t size() const;
+
+    // Write every entry as "product_id<TAB>version" lines, atomically
+    // (through a temporary file). Throws std::runtime_error on failure.
+    size_t save(const std::string& path) const;
+
+    // Merge a snapshot into the cache; returns the entries read. A missing
+    // file reads nothing, so the first start is simply cold. Throws
+    // std::invalid_argument on a malformed line.
+    size_t load(const std::string& path);
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        size_t capacity;
+        std::list<std::pair<std::string, int64_t>> lru;  // most recently used at front
+        std::unordered_map<std::string, std::list<std::pair<std::string, int64_t>>::iterator> index;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    Shard& shardFor(const std::string& product_id) const;
+};
+
+} // namespace atlas
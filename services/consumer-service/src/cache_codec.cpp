@@ -0,0 +1,90 @@
+#include "cache_codec.h"
+#include <zlib.h>
+#include <stdexcept>
+#include <vector>
+
+namespace atlas {
+
+// Larger claimed sizes are treated as corruption rather than allocated
+static const uint32_t kMaxDecodedSize = 64 * 1024 * 1024;
+
+std::string encodeCacheValue(const nlohmann::json& document, size_t compress_above) {
+    std::vector<uint8_t> packed = nlohmann::json::to_msgpack(document);
+
+    std::string value;
+    value.push_back(static_cast<char>(kCacheValueVersion));
+    if (compress_above > 0 && packed.size() > compress_above && packed.size() <= kMaxDecodedSize) {
+        uLongf compressed_size = compressBound(packed.size());
+        std::string compressed(compressed_size, '\0');
+        // Level 1: values are written far more often than large ones are read
+        if (compress2(reinterpret_cast<Bytef*>(&compressed[0]), &compressed_size, packed.data(), packed.size(), 1) ==
+                Z_OK &&
+            compressed_size + 4 < packed.size()) {
+            value.push_back(static_cast<char>(kCacheValueCompressed));
+            uint32_t size = static_cast<uint32_t>(packed.size());
+            for (int shift = 0; shift < 32; shift += 8) {
+                value.push_back(static_cast<char>((size >> shift) & 0xff));
+            }
+            value.append(compressed, 0, compressed_size);
+            return value;
+        }
+    }
+    value.push_back(0);
+    value.append(packed.begin(), packed.end());
+    return value;
+}
+
+nlohmann::json decodeCacheValue(const std::string& value) {
+    if (value.empty()) {
+        throw std::invalid_argument("Empty cache value");
+    }
+    if (value[0] == '{') {
+        try {
+            return nlohmann::json::parse(value);
+        } catch (const nlohmann::json::exception& e) {
+            throw std::invalid_argument("Malformed JSON cache value: " + std::string(e.what()));
+        }
+    }
+
+    uint8_t version = static_cast<uint8_t>(value[0]);
+    if (version != kCacheValueVersion) {
+        throw std::invalid_argument("Unsupported cache value version " + std::to_string(version));
+    }
+    if (value.size() < 2) {
+        throw std::invalid_argument("Truncated cache value");
+    }
+    uint8_t flags = static_cast<uint8_t>(value[1]);
+
+    std::string body;
+    const char* data = value.data() + 2;
+    size_t size = value.size() - 2;
+    if (flags & kCacheValueCompressed) {
+        if (size < 4) {
+            throw std::invalid_argument("Truncated cache value");
+        }
+        uint32_t decoded_size = 0;
+        for (int i = 0; i < 4; ++i) {
+            decoded_size |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+        }
+        if (decoded_size > kMaxDecodedSize) {
+            throw std::invalid_argument("Cache value too large: " + std::to_string(decoded_size) + " bytes");
+        }
+        body.resize(decoded_size);
+        uLongf body_size = decoded_size;
+        if (uncompress(reinterpret_cast<Bytef*>(&body[0]), &body_size,
+                       reinterpret_cast<const Bytef*>(data + 4), size - 4) != Z_OK ||
+            body_size != decoded_size) {
+            throw std::invalid_argument("Corrupt compressed cache value");
+        }
+        data = body.data();
+        size = body.size();
+    }
+
+    try {
+        return nlohmann::json::from_msgpack(data, data + size);
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument("Malformed cache value: " + std::string(e.what()));
+    }
+}
+
+} // namespace atlas
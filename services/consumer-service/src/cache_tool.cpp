@@ -0,0 +1,60 @@
+// Print cached products as JSON. Redis values are binary (see
+// cache_codec.h), so redis-cli shows them only as escaped bytes.
+//
+//   ./cache_tool P123
+//   ./cache_tool --host redis --port 6379 P123 P124
+
+#include "consumer.h"
+#include "cache_codec.h"
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+    std::string host = "localhost";
+    int port = 6379;
+    std::vector<std::string> product_ids;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--host" && has_value) {
+                host = argv[++i];
+            } else if (arg == "--port" && has_value) {
+                port = std::stoi(argv[++i]);
+            } else {
+                product_ids.push_back(arg);
+            }
+        }
+    } catch (const std::exception&) {
+        product_ids.clear();
+    }
+    if (product_ids.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [--host <host>] [--port <port>] <product_id>..." << std::endl;
+        return 2;
+    }
+
+    int status = 0;
+    try {
+        atlas::RedisClient redis(host, port);
+        for (const auto& product_id : product_ids) {
+            std::string value = redis.get("product:" + product_id);
+            if (value.empty()) {
+                std::cerr << product_id << ": not cached" << std::endl;
+                status = 1;
+                continue;
+            }
+            try {
+                std::cout << atlas::decodeCacheValue(value).dump(2) << std::endl;
+            } catch (const std::invalid_argument& e) {
+                std::cerr << product_id << ": " << e.what() << std::endl;
+                status = 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return status;
+}
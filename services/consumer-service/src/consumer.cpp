@@ -1,15 +1,42 @@
 #include "consumer.h"
+#include "cache_codec.h"
 #include <curl/curl.h>
 #include <hiredis/hiredis.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include <thread>
 #include <chrono>
 #include <cmath>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
 #include <yaml-cpp/yaml.h>
 
 namespace atlas {
 
+std::vector<size_t> coalesceEvents(const std::vector<ProductEvent>& events) {
+    std::unordered_map<std::string, size_t> newest;
+    for (size_t i = 0; i < events.size(); ++i) {
+        auto inserted = newest.emplace(events[i].product_id, i);
+        size_t& current = inserted.first->second;
+        if (!inserted.second && events[i].version >= events[current].version) {
+            current = i;
+        }
+    }
+    std::vector<size_t> survivors;
+    survivors.reserve(newest.size());
+    for (const auto& entry : newest) survivors.push_back(entry.second);
+    std::sort(survivors.begin(), survivors.end());
+    return survivors;
+}
+
+size_t laneFor(const std::string& product_id, size_t lanes) {
+    return lanes > 1 ? std::hash<std::string>()(product_id) % lanes : 0;
+}
+
 // CURL callback
 static size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* userp) {
     userp->append((char*)contents, size * nmemb);
@@ -119,67 +146,327 @@ bool ElasticsearchWriter::deleteDocument(const std::string& index, const std::st
     }
 }
 
+std::string ElasticsearchWriter::buildBulkBody(const std::string& index,
+                                               const std::vector<BulkOperation>& operations) {
+    std::string body;
+    for (const auto& operation : operations) {
+        bool is_delete = operation.type == BulkOperation::Type::Delete;
+        nlohmann::json metadata = {{"_index", index}, {"_id", operation.id}};
+        if (operation.version >= 0) {
+            metadata["version"] = operation.version;
+            metadata["version_type"] = "external";
+        }
+        nlohmann::json action = {{is_delete ? "delete" : "index", std::move(metadata)}};
+        body += action.dump();
+        body += '\n';
+        if (!is_delete) {
+            body += operation.source;
+            body += '\n';
+        }
+    }
+    return body;
+}
+
+std::vector<BulkItemResult> ElasticsearchWriter::parseBulkResponse(const nlohmann::json& response, size_t count) {
+    std::vector<BulkItemResult> results(count);
+    if (!response.contains("items") || !response["items"].is_array()) {
+        for (auto& result : results) result.error = "Malformed _bulk response";
+        return results;
+    }
+    const auto& items = response["items"];
+    for (size_t i = 0; i < count; ++i) {
+        if (i >= items.size() || !items[i].is_object() || items[i].empty()) {
+            results[i].error = "Missing from _bulk response";
+            continue;
+        }
+        // Each item is {"<action>": {...}}
+        const auto& item = items[i].begin().value();
+        results[i].status = item.value("status", 0);
+        results[i].result = item.value("result", "");
+        if (item.contains("error")) {
+            const auto& error = item["error"];
+            results[i].error = error.is_object()
+                ? error.value("type", "") + ": " + error.value("reason", "")
+                : error.dump();
+        }
+    }
+    return results;
+}
+
+std::vector<size_t> ElasticsearchWriter::itemsToRetry(const std::vector<BulkOperation>& operations,
+                                                      const std::vector<BulkItemResult>& results,
+                                                      const std::vector<size_t>& pending) {
+    std::unordered_map<std::string, size_t> last_written;
+    for (size_t i = 0; i < operations.size(); ++i) {
+        if (results[i].ok()) last_written[operations[i].id] = i;
+    }
+    std::vector<size_t> retry;
+    for (size_t i : pending) {
+        auto it = last_written.find(operations[i].id);
+        if (results[i].retryable() && (it == last_written.end() || it->second < i)) {
+            retry.push_back(i);
+        }
+    }
+    return retry;
+}
+
+std::vector<BulkItemResult> ElasticsearchWriter::bulk(const std::string& index,
+                                                      const std::vector<BulkOperation>& operations,
+                                                      int max_retries) {
+    std::vector<BulkItemResult> results(operations.size());
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < operations.size(); ++i) pending.push_back(i);
+
+    for (int attempt = 1; !pending.empty(); ++attempt) {
+        std::vector<BulkOperation> batch;
+        batch.reserve(pending.size());
+        for (size_t i : pending) batch.push_back(operations[i]);
+
+        std::vector<BulkItemResult> batch_results;
+        try {
+            std::string response = performRequest(base_url_ + "/_bulk", "POST", buildBulkBody(index, batch));
+            batch_results = parseBulkResponse(nlohmann::json::parse(response), batch.size());
+        } catch (const std::exception& e) {
+            batch_results.assign(batch.size(), BulkItemResult());
+            for (auto& result : batch_results) result.error = e.what();
+        }
+
+        std::vector<size_t> failed;
+        for (size_t j = 0; j < pending.size(); ++j) {
+            results[pending[j]] = batch_results[j];
+            if (!batch_results[j].ok()) failed.push_back(pending[j]);
+        }
+
+        // A retryable item that a later write of the same ID has already
+        // replaced is as good as written; resending it would undo that write
+        pending = itemsToRetry(operations, results, failed);
+        std::unordered_set<size_t> resend(pending.begin(), pending.end());
+        for (size_t i : failed) {
+            if (results[i].retryable() && resend.count(i) == 0) {
+                results[i] = BulkItemResult();
+                results[i].status = 200;
+                results[i].result = "superseded";
+            }
+        }
+
+        if (pending.empty() || attempt >= max_retries) {
+            break;
+        }
+        // Exponential backoff: 100ms, 200ms, 400ms, ...
+        int backoff_ms = 100 * std::pow(2, attempt - 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoff_ms));
+    }
+    return results;
+}
+
 // RedisClient implementation
-RedisClient::RedisClient(const std::string& host, int port)
-    : host_(host), port_(port) {
-    redisContext* c = redisConnect(host.c_str(), port);
+RedisClient::RedisClient(const std::string& host, int port, size_t pool_size, int timeout_ms)
+    : host_(host), port_(port), pool_size_(std::max<size_t>(1, pool_size)), timeout_ms_(timeout_ms) {
+    void* context = connect();
+    if (context == nullptr) {
+        throw std::runtime_error("Failed to connect to Redis");
+    }
+    idle_.push_back(context);
+    open_ = 1;
+}
+
+RedisClient::~RedisClient() {
+    for (void* context : idle_) {
+        redisFree(static_cast<redisContext*>(context));
+    }
+}
+
+void* RedisClient::connect() {
+    struct timeval timeout = {timeout_ms_ / 1000, (timeout_ms_ % 1000) * 1000};
+    redisContext* c = redisConnectWithTimeout(host_.c_str(), port_, timeout);
     if (c == nullptr || c->err) {
         if (c) {
             std::cerr << "Redis connection error: " << c->errstr << std::endl;
             redisFree(c);
         }
-        throw std::runtime_error("Failed to connect to Redis");
+        return nullptr;
     }
-    context_ = c;
+    // Commands time out too, so a hung server fails the pipeline instead of the lane
+    redisSetTimeout(c, timeout);
+    return c;
 }
 
-RedisClient::~RedisClient() {
-    if (context_) {
-        redisFree(static_cast<redisContext*>(context_));
+void* RedisClient::acquire() {
+    std::unique_lock<std::mutex> lock(pool_mutex_);
+    pool_available_.wait(lock, [this]() { return !idle_.empty() || open_ < pool_size_; });
+    if (!idle_.empty()) {
+        void* context = idle_.back();
+        idle_.pop_back();
+        return context;
+    }
+    open_++;
+    lock.unlock();
+
+    // Connect outside the lock; a failed connect frees the slot again
+    void* context = connect();
+    if (context == nullptr) {
+        lock.lock();
+        open_--;
+        pool_available_.notify_one();
     }
+    return context;
 }
 
-bool RedisClient::set(const std::string& key, const std::string& value) {
-    redisContext* c = static_cast<redisContext*>(context_);
-    redisReply* reply = (redisReply*)redisCommand(c, "SET %s %s", key.c_str(), value.c_str());
-    
-    if (reply == nullptr) {
-        return false;
+void RedisClient::release(void* context, bool broken) {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    if (broken) {
+        // Replies may be half read: drop the connection, the next acquire reconnects
+        redisFree(static_cast<redisContext*>(context));
+        open_--;
+    } else {
+        idle_.push_back(context);
     }
-    
-    bool success = (reply->type == REDIS_REPLY_STATUS && 
-                    std::string(reply->str) == "OK");
-    freeReplyObject(reply);
-    return success;
+    pool_available_.notify_one();
 }
 
-bool RedisClient::del(const std::string& key) {
-    redisContext* c = static_cast<redisContext*>(context_);
-    redisReply* reply = (redisReply*)redisCommand(c, "DEL %s", key.c_str());
-    
-    if (reply == nullptr) {
-        return false;
+std::vector<void*> RedisClient::pipeline(const std::vector<std::vector<std::string>>& commands) {
+    std::vector<void*> replies(commands.size(), nullptr);
+    for (int attempt = 0; attempt < 2 && !commands.empty(); ++attempt) {
+        redisContext* c = static_cast<redisContext*>(acquire());
+        if (c == nullptr) {
+            continue;
+        }
+
+        bool broken = false;
+        for (const auto& command : commands) {
+            std::vector<const char*> argv;
+            std::vector<size_t> lengths;
+            for (const auto& arg : command) {
+                argv.push_back(arg.data());
+                lengths.push_back(arg.size());
+            }
+            if (redisAppendCommandArgv(c, static_cast<int>(argv.size()), argv.data(), lengths.data()) != REDIS_OK) {
+                broken = true;
+                break;
+            }
+        }
+        // The first redisGetReply flushes every appended command at once
+        for (size_t i = 0; i < commands.size() && !broken; ++i) {
+            if (redisGetReply(c, &replies[i]) != REDIS_OK) {
+                broken = true;
+            }
+        }
+        release(c, broken);
+        if (!broken) {
+            break;
+        }
+        for (auto& reply : replies) {
+            if (reply) freeReplyObject(reply);
+            reply = nullptr;
+        }
     }
-    
-    bool success = (reply->type == REDIS_REPLY_INTEGER);
-    freeReplyObject(reply);
-    return success;
+    return replies;
+}
+
+std::vector<std::string> RedisClient::setCommand(const std::string& key, const std::string& value, int ttl_seconds) {
+    std::vector<std::string> command = {"SET", key, value};
+    if (ttl_seconds > 0) {
+        command.push_back("EX");
+        command.push_back(std::to_string(ttl_seconds));
+    }
+    return command;
+}
+
+static bool isOkStatus(const void* reply) {
+    const redisReply* r = static_cast<const redisReply*>(reply);
+    return r != nullptr && r->type == REDIS_REPLY_STATUS && std::string(r->str, r->len) == "OK";
+}
+
+static bool isInteger(const void* reply) {
+    const redisReply* r = static_cast<const redisReply*>(reply);
+    return r != nullptr && r->type == REDIS_REPLY_INTEGER;
+}
+
+bool RedisClient::set(const std::string& key, const std::string& value) {
+    return msetWithTtl({{key, value}})[0];
+}
+
+bool RedisClient::del(const std::string& key) {
+    return mdel({key});
 }
 
 std::string RedisClient::get(const std::string& key) {
-    redisContext* c = static_cast<redisContext*>(context_);
-    redisReply* reply = (redisReply*)redisCommand(c, "GET %s", key.c_str());
-    
-    if (reply == nullptr || reply->type != REDIS_REPLY_STRING) {
-        if (reply) freeReplyObject(reply);
-        return "";
+    void* reply = pipeline({{"GET", key}})[0];
+    const redisReply* r = static_cast<const redisReply*>(reply);
+    std::string value;
+    if (r != nullptr && r->type == REDIS_REPLY_STRING) {
+        value.assign(r->str, r->len);
     }
-    
-    std::string value(reply->str);
-    freeReplyObject(reply);
+    if (reply) freeReplyObject(reply);
     return value;
 }
 
+std::vector<bool> RedisClient::msetWithTtl(const std::vector<std::pair<std::string, std::string>>& entries,
+                                           int ttl_seconds) {
+    // MSET cannot set expiries, so this is one SET per entry, pipelined
+    std::vector<std::vector<std::string>> commands;
+    commands.reserve(entries.size());
+    for (const auto& entry : entries) {
+        commands.push_back(setCommand(entry.first, entry.second, ttl_seconds));
+    }
+    auto replies = pipeline(commands);
+    std::vector<bool> stored(entries.size());
+    for (size_t i = 0; i < replies.size(); ++i) {
+        stored[i] = isOkStatus(replies[i]);
+        if (replies[i]) freeReplyObject(replies[i]);
+    }
+    return stored;
+}
+
+bool RedisClient::mdel(const std::vector<std::string>& keys) {
+    // A few large DELs rather than one per key
+    const size_t keys_per_command = 1000;
+    std::vector<std::vector<std::string>> commands;
+    for (size_t start = 0; start < keys.size(); start += keys_per_command) {
+        std::vector<std::string> command = {"DEL"};
+        size_t end = std::min(keys.size(), start + keys_per_command);
+        command.insert(command.end(), keys.begin() + start, keys.begin() + end);
+        commands.push_back(std::move(command));
+    }
+    bool deleted = true;
+    for (void* reply : pipeline(commands)) {
+        deleted = deleted && isInteger(reply);
+        if (reply) freeReplyObject(reply);
+    }
+    return deleted;
+}
+
+// librdkafka calls the consumer callbacks from inside consume(), on the
+// consumer thread, and DLQ delivery reports from inside the producer's
+// poll() and flush(), on whichever thread calls them
+class ProductEventConsumer::KafkaCallbacks : public RdKafka::RebalanceCb, public RdKafka::OffsetCommitCb,
+                                             public RdKafka::DeliveryReportCb {
+public:
+    explicit KafkaCallbacks(ProductEventConsumer& owner) : owner_(owner) {}
+
+    void rebalance_cb(RdKafka::KafkaConsumer* consumer, RdKafka::ErrorCode err,
+                      std::vector<RdKafka::TopicPartition*>& partitions) override {
+        owner_.onRebalance(consumer, err, partitions);
+    }
+
+    void offset_commit_cb(RdKafka::ErrorCode err, std::vector<RdKafka::TopicPartition*>& offsets) override {
+        owner_.onOffsetCommit(err, offsets);
+    }
+
+    void dr_cb(RdKafka::Message& message) override {
+        owner_.onDlqDelivery(message);
+    }
+
+private:
+    ProductEventConsumer& owner_;
+};
+
+// Optional settings fall back to a default when left out of the config
+template <typename T>
+static T configValue(const YAML::Node& section, const std::string& key, const T& fallback) {
+    return section && section[key] ? section[key].as<T>() : fallback;
+}
+
 // ProductEventConsumer implementation
 ProductEventConsumer::ProductEventConsumer(const std::string& config_file)
     : running_(false) {
@@ -194,9 +481,33 @@ ProductEventConsumer::ProductEventConsumer(const std::string& config_file)
     
     std::string es_host = config["elasticsearch"]["host"].as<std::string>();
     int es_port = config["elasticsearch"]["port"].as<int>();
+    index_ = configValue<std::string>(config["elasticsearch"], "index", "products");
     
     std::string redis_host = config["redis"]["host"].as<std::string>();
     int redis_port = config["redis"]["port"].as<int>();
+
+    batch_size_ = std::max(1, configValue(config["consumer"], "batch_size", 500));
+    batch_timeout_ms_ = std::max(0, configValue(config["consumer"], "batch_timeout_ms", 100));
+    coalesce_ = configValue(config["consumer"], "coalesce", true);
+    commit_every_ = std::max(1, configValue(config["consumer"], "commit_every", 1000));
+    commit_interval_ms_ = std::max(0, configValue(config["consumer"], "commit_interval_ms", 1000));
+    int lanes = std::max(1, configValue(config["consumer"], "lanes", 4));
+    int lane_queue_batches = std::max(1, configValue(config["consumer"], "lane_queue_batches", 4));
+
+    versions_ = std::make_unique<VersionCache>(
+        std::max(1, configValue(config["version_cache"], "capacity", 1000000)));
+    version_snapshot_path_ = configValue<std::string>(config["version_cache"], "snapshot_path", "");
+    version_snapshot_interval_ms_ = configValue(config["version_cache"], "snapshot_interval_ms", 60000);
+    if (!version_snapshot_path_.empty()) {
+        try {
+            size_t loaded = versions_->load(version_snapshot_path_);
+            logEvent("INFO", "Loaded " + std::to_string(loaded) + " product versions from " +
+                     version_snapshot_path_);
+        } catch (const std::exception& e) {
+            // ES still rejects stale writes; starting cold only costs round trips
+            logEvent("ERROR", "Ignoring version snapshot: " + std::string(e.what()));
+        }
+    }
     
     // Initialize Kafka consumer
     std::string errstr;
@@ -206,6 +517,9 @@ ProductEventConsumer::ProductEventConsumer(const std::string& config_file)
     conf->set("group.id", group_id, errstr);
     conf->set("enable.auto.commit", "false", errstr); // Manual commit
     conf->set("auto.offset.reset", "earliest", errstr);
+    callbacks_ = std::make_unique<KafkaCallbacks>(*this);
+    conf->set("rebalance_cb", static_cast<RdKafka::RebalanceCb*>(callbacks_.get()), errstr);
+    conf->set("offset_commit_cb", static_cast<RdKafka::OffsetCommitCb*>(callbacks_.get()), errstr);
     
     consumer_.reset(RdKafka::KafkaConsumer::create(conf, errstr));
     if (!consumer_) {
@@ -224,172 +538,512 @@ ProductEventConsumer::ProductEventConsumer(const std::string& config_file)
     // Initialize DLQ producer
     RdKafka::Conf* producer_conf = RdKafka::Conf::create(RdKafka::Conf::CONF_GLOBAL);
     producer_conf->set("bootstrap.servers", kafka_brokers, errstr);
+    producer_conf->set("dr_cb", static_cast<RdKafka::DeliveryReportCb*>(callbacks_.get()), errstr);
     
     dlq_producer_.reset(RdKafka::Producer::create(producer_conf, errstr));
     delete producer_conf;
     
-    // Initialize ES and Redis clients
-    es_writer_ = std::make_unique<ElasticsearchWriter>(es_host, es_port);
-    redis_client_ = std::make_unique<RedisClient>(redis_host, redis_port);
+    // Lanes share a Redis connection pool, by default one connection each
+    redis_client_ = std::make_unique<RedisClient>(
+        redis_host, redis_port, std::max(1, configValue(config["redis"], "pool_size", lanes)),
+        std::max(1, configValue(config["redis"], "timeout_ms", 1000)));
+    cache_ttl_seconds_ = configValue(config["redis"], "ttl_seconds", 0);
+    cache_compress_above_ = std::max(0, configValue(config["redis"], "compress_above_bytes", 1024));
+
+    // Initialize the lanes, each with its own ES client
+    for (int i = 0; i < lanes; ++i) {
+        auto lane = std::make_unique<Lane>(lane_queue_batches);
+        lane->id = i;
+        lane->es_writer = std::make_unique<ElasticsearchWriter>(es_host, es_port);
+        lanes_.push_back(std::move(lane));
+    }
     
-    logEvent("INFO", "Consumer initialized successfully");
+    logEvent("INFO", "Consumer initialized successfully with " + std::to_string(lanes) + " lanes");
 }
 
 ProductEventConsumer::~ProductEventConsumer() {
     stop();
+    stopLanes();
+    if (snapshot_thread_.joinable()) {
+        snapshot_thread_.join();
+    }
+    if (consumer_ && !closed_) {
+        consumer_->close();
+    }
 }
 
 void ProductEventConsumer::run() {
     running_ = true;
     logEvent("INFO", "Starting consumer loop");
+
+    // Snapshot the version cache in the background, so a restart starts warm
+    if (!version_snapshot_path_.empty() && version_snapshot_interval_ms_ > 0) {
+        snapshot_thread_ = std::thread([this]() {
+            auto next = std::chrono::steady_clock::now() + std::chrono::milliseconds(version_snapshot_interval_ms_);
+            while (running_) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                if (std::chrono::steady_clock::now() >= next) {
+                    saveVersionSnapshot();
+                    next += std::chrono::milliseconds(version_snapshot_interval_ms_);
+                }
+            }
+        });
+    }
     
+    for (auto& lane : lanes_) {
+        Lane* worker = lane.get();
+        lane->worker = std::thread([this, worker]() { runLane(*worker); });
+    }
+
+    // This thread only consumes and dispatches; the lanes write in parallel
+    // and finish messages out of order, which the offset tracker allows for
+    next_commit_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(commit_interval_ms_);
     while (running_) {
-        RdKafka::Message* msg = consumer_->consume(1000); // 1 second timeout
-        
+        auto messages = consumeBatch();
+        if (!messages.empty()) {
+            dispatchBatch(std::move(messages));
+        }
+
+        // Serve DLQ delivery reports: they finish the messages sent there
+        if (dlq_producer_) {
+            dlq_producer_->poll(0);
+        }
+
+        // No broker round trip per batch: commits go out in the background
+        // every commit_every_ messages or commit_interval_ms_
+        if (offsets_.uncommitted() >= commit_every_ || std::chrono::steady_clock::now() >= next_commit_) {
+            commitOffsets(false);
+        }
+    }
+
+    // Whatever the lanes finish is committed before the partitions are given up
+    stopLanes();
+    commitOffsets(true);
+    consumer_->close();
+    closed_ = true;
+
+    if (snapshot_thread_.joinable()) {
+        snapshot_thread_.join();
+    }
+    if (!version_snapshot_path_.empty()) {
+        saveVersionSnapshot();
+    }
+    
+    logEvent("INFO", "Consumer stopped");
+}
+
+void ProductEventConsumer::saveVersionSnapshot() {
+    try {
+        versions_->save(version_snapshot_path_);
+    } catch (const std::exception& e) {
+        logEvent("ERROR", "Saving version snapshot failed: " + std::string(e.what()));
+    }
+}
+
+std::vector<std::unique_ptr<RdKafka::Message>> ProductEventConsumer::consumeBatch() {
+    std::vector<std::unique_ptr<RdKafka::Message>> batch;
+    auto deadline = std::chrono::steady_clock::now();
+    while (running_ && batch.size() < batch_size_) {
+        int timeout_ms = 1000; // wait up to a second for the first message
+        if (!batch.empty()) {
+            timeout_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count());
+            if (timeout_ms <= 0) {
+                break;
+            }
+        }
+
+        std::unique_ptr<RdKafka::Message> msg(consumer_->consume(timeout_ms));
         if (msg->err() == RdKafka::ERR_NO_ERROR) {
-            std::string payload(static_cast<const char*>(msg->payload()), msg->len());
-            
-            try {
-                ProductEvent event = parseEvent(payload);
-                bool success = processEvent(event);
-                
-                if (success) {
-                    // Manually commit offset only after successful processing
-                    consumer_->commitSync(msg);
-                    incrementCounter("events_processed");
-                    logEvent("INFO", "Successfully processed event: " + event.event_id);
-                } else {
-                    // Send to DLQ after repeated failures
-                    sendToDLQ(payload, "Processing failed after retries");
-                    consumer_->commitSync(msg); // Commit to avoid reprocessing
-                    incrementCounter("events_failed");
-                }
-                
-            } catch (const std::exception& e) {
-                logEvent("ERROR", "Failed to parse event: " + std::string(e.what()));
-                sendToDLQ(payload, "Parse error: " + std::string(e.what()));
-                consumer_->commitSync(msg);
-                incrementCounter("events_parse_error");
+            offsets_.track(msg->topic_name(), msg->partition(), msg->offset());
+            if (batch.empty()) {
+                deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(batch_timeout_ms_);
             }
-        } else if (msg->err() != RdKafka::ERR__TIMED_OUT) {
+            batch.push_back(std::move(msg));
+        } else if (msg->err() == RdKafka::ERR__TIMED_OUT) {
+            if (batch.empty()) {
+                break;
+            }
+        } else if (msg->err() != RdKafka::ERR__PARTITION_EOF) {
             logEvent("ERROR", "Kafka error: " + msg->errstr());
         }
-        
-        delete msg;
     }
-    
-    logEvent("INFO", "Consumer stopped");
+    return batch;
 }
 
-void ProductEventConsumer::stop() {
-    running_ = false;
-    if (consumer_) {
-        consumer_->close();
+void ProductEventConsumer::dispatchBatch(std::vector<std::unique_ptr<RdKafka::Message>> messages) {
+    std::vector<LaneBatch> batches(lanes_.size());
+    for (auto& msg : messages) {
+        std::string payload(static_cast<const char*>(msg->payload()), msg->len());
+        try {
+            ProductEvent event = parseEvent(payload);
+            LaneBatch& batch = batches[laneFor(event.product_id, lanes_.size())];
+            batch.events.push_back(std::move(event));
+            batch.messages.push_back(std::move(msg));
+        } catch (const std::exception& e) {
+            logEvent("ERROR", "Failed to parse event: " + std::string(e.what()));
+            incrementCounter("events_parse_error");
+            // Finished by its DLQ delivery report
+            sendToDLQ(*msg, "Parse error: " + std::string(e.what()));
+        }
+    }
+
+    for (size_t i = 0; i < lanes_.size(); ++i) {
+        if (batches[i].messages.empty()) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(lanes_mutex_);
+            lane_batches_pending_++;
+        }
+        if (!lanes_[i]->queue.push(std::move(batches[i]))) {
+            // Lanes already stopped: the messages stay uncommitted and are
+            // read again after a restart
+            std::lock_guard<std::mutex> lock(lanes_mutex_);
+            lane_batches_pending_--;
+        }
     }
 }
 
-bool ProductEventConsumer::processEvent(const ProductEvent& event) {
-    try {
-        // Step 1: Fetch existing document from ES
-        nlohmann::json existing_doc = es_writer_->getDocument("products", event.product_id);
-        
-        // Step 2: Check idempotency
-        if (!shouldProcess(event, existing_doc)) {
-            logEvent("INFO", "Skipping event due to idempotency check: " + event.event_id);
-            return true; // Not an error, just skip
-        }
-        
-        // Step 3: Process based on event type
-        bool es_success = false;
-        
+void ProductEventConsumer::runLane(Lane& lane) {
+    LaneBatch batch;
+    while (lane.queue.pop(batch)) {
+        std::unordered_set<const RdKafka::Message*> dead_lettered;
+        try {
+            dead_lettered = processBatch(lane, batch);
+        } catch (const std::exception& e) {
+            // Unexpected (e.g. a document that cannot be serialized): park
+            // the whole batch rather than losing it or stopping the lane
+            logEvent("ERROR", "Lane " + std::to_string(lane.id) + " failed a batch: " + e.what());
+            for (const auto& msg : batch.messages) {
+                sendToDLQ(*msg, "Processing error: " + std::string(e.what()));
+                dead_lettered.insert(msg.get());
+            }
+            incrementCounter("events_failed", static_cast<int>(batch.messages.size()));
+        }
+
+        // Every other message in the batch is written or skipped. Messages
+        // sent to the DLQ are finished by their delivery reports.
+        for (const auto& msg : batch.messages) {
+            if (dead_lettered.count(msg.get()) == 0) {
+                offsets_.complete(msg->topic_name(), msg->partition(), msg->offset());
+            }
+        }
+        batch = LaneBatch();
+        {
+            std::lock_guard<std::mutex> lock(lanes_mutex_);
+            lane_batches_pending_--;
+        }
+        lanes_idle_.notify_all();
+    }
+}
+
+void ProductEventConsumer::drainLanes() {
+    std::unique_lock<std::mutex> lock(lanes_mutex_);
+    lanes_idle_.wait(lock, [this]() { return lane_batches_pending_ == 0; });
+}
+
+void ProductEventConsumer::stopLanes() {
+    for (auto& lane : lanes_) {
+        lane->queue.close();
+    }
+    for (auto& lane : lanes_) {
+        if (lane->worker.joinable()) {
+            lane->worker.join();
+        }
+    }
+}
+
+// Current UTC time as ISO 8601 with milliseconds, e.g. 2025-12-10T10:00:00.123Z
+static std::string utcTimestamp() {
+    auto now = std::chrono::system_clock::now();
+    std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+    std::tm utc = {};
+    gmtime_r(&seconds, &utc);
+    std::ostringstream stamp;
+    stamp << std::put_time(&utc, "%Y-%m-%dT%H:%M:%S") << '.' << std::setw(3) << std::setfill('0') << millis << 'Z';
+    return stamp.str();
+}
+
+std::unordered_set<const RdKafka::Message*> ProductEventConsumer::processBatch(Lane& lane, LaneBatch& batch) {
+    std::vector<ProductEvent>& events = batch.events;
+    std::vector<const RdKafka::Message*> sources; // message of each event
+    for (const auto& msg : batch.messages) sources.push_back(msg.get());
+
+    // Superseded updates are finished here: their offsets are committed with
+    // the batch, after the surviving write has landed
+    int coalesced = 0;
+    if (coalesce_) {
+        auto survivors = coalesceEvents(events);
+        coalesced = static_cast<int>(events.size() - survivors.size());
+        for (size_t i = 0; i < survivors.size(); ++i) {
+            if (survivors[i] != i) {
+                events[i] = std::move(events[survivors[i]]);
+                sources[i] = sources[survivors[i]];
+            }
+        }
+        events.resize(survivors.size());
+        sources.resize(survivors.size());
+    }
+    // Step 1: Check idempotency locally. ES enforces it anyway (external
+    // versions), but a version it is known to hold needs no round trip.
+    // Within the batch, later events must beat the earlier ones too.
+    std::vector<BulkOperation> operations;
+    std::vector<size_t> written; // event of each operation
+    std::unordered_map<std::string, int64_t> batch_versions;
+    int skipped = 0;
+    // When the write happened, as opposed to the event's updated_at: the
+    // search service's local indexes pull changes by it
+    std::string indexed_at = utcTimestamp();
+    for (size_t i = 0; i < events.size(); ++i) {
+        ProductEvent& event = events[i];
+        auto batched = batch_versions.find(event.product_id);
+        if ((batched != batch_versions.end() && event.version <= batched->second) ||
+            versions_->isStale(event.product_id, event.version)) {
+            skipped++;
+            continue;
+        }
+        batch_versions[event.product_id] = event.version;
+
+        // Step 2: Build the versioned write
         if (event.event_type == "delete") {
-            es_success = es_writer_->deleteDocument("products", event.product_id);
+            operations.push_back({BulkOperation::Type::Delete, event.product_id, "", event.version});
         } else {
-            // create or update
-            nlohmann::json doc = event.data;
+            // create or update: the document is built in place, once, and
+            // shared by the ES write and the Redis value
+            nlohmann::json& doc = event.data;
             doc["version"] = event.version;
             doc["updated_at"] = event.updated_at;
+            doc["indexed_at"] = indexed_at;
             doc["product_id"] = event.product_id;
-            
-            es_success = es_writer_->upsertDocument("products", event.product_id, doc);
+            operations.push_back({BulkOperation::Type::Index, event.product_id, doc.dump(), event.version});
+        }
+        written.push_back(i);
+    }
+
+    // Step 3: One _bulk request for the batch; only failed items are resent
+    auto results = lane.es_writer->bulk(index_, operations);
+
+    // Step 4: Collect the cache updates of the writes that landed
+    std::unordered_map<std::string, size_t> cache_updates;  // key -> index in cache_order
+    std::vector<const ProductEvent*> cache_order;
+    int processed = 0;
+    int failed = 0;
+    std::unordered_set<const RdKafka::Message*> dead_lettered;
+    for (size_t j = 0; j < operations.size(); ++j) {
+        const ProductEvent& event = events[written[j]];
+        if (results[j].conflict()) {
+            // ES holds this version or a newer one: a stale event
+            versions_->update(event.product_id, event.version);
+            skipped++;
+            continue;
         }
-        
-        if (!es_success) {
-            return false;
+        if (!results[j].ok()) {
+            // Send to DLQ after repeated or permanent failures
+            sendToDLQ(*sources[written[j]],
+                      "ES bulk write failed (status " + std::to_string(results[j].status) + "): " +
+                      results[j].error);
+            dead_lettered.insert(sources[written[j]]);
+            failed++;
+            continue;
         }
-        
-        // Step 4: Update Redis cache
+
+        versions_->update(event.product_id, event.version);
+
+        // Only the newest write of a product decides its cache entry, so
+        // sets and deletes touch different keys and can go in any order
         std::string cache_key = "product:" + event.product_id;
-        
-        if (event.event_type == "delete") {
-            redis_client_->del(cache_key);
+        auto inserted = cache_updates.emplace(cache_key, cache_order.size());
+        if (inserted.second) {
+            cache_order.push_back(&event);
         } else {
-            // On update failure, delete key to force reload
-            if (!redis_client_->set(cache_key, event.data.dump())) {
-                redis_client_->del(cache_key);
-            }
+            cache_order[inserted.first->second] = &event;
         }
-        
-        return true;
-        
-    } catch (const std::exception& e) {
-        logEvent("ERROR", "Error processing event: " + std::string(e.what()));
-        return false;
+        processed++;
     }
-}
 
-bool ProductEventConsumer::shouldProcess(const ProductEvent& event, const nlohmann::json& existing_doc) {
-    if (existing_doc.empty() || !existing_doc.contains("_source")) {
-        return true; // No existing document, process the event
-    }
-    
-    auto source = existing_doc["_source"];
-    
-    // Compare version
-    if (source.contains("version")) {
-        int existing_version = source["version"];
-        if (event.version <= existing_version) {
-            return false; // Older or same version, skip
+    // Step 5: Update Redis in two pipelined round trips
+    std::vector<std::pair<std::string, std::string>> sets;
+    std::vector<std::string> deletes;
+    for (const ProductEvent* event : cache_order) {
+        std::string cache_key = "product:" + event->product_id;
+        if (event->event_type == "delete") {
+            deletes.push_back(std::move(cache_key));
+        } else {
+            sets.emplace_back(std::move(cache_key), encodeCacheValue(event->data, cache_compress_above_));
         }
     }
-    
-    // Compare updated_at timestamp
-    if (source.contains("updated_at")) {
-        std::string existing_updated_at = source["updated_at"];
-        if (event.updated_at <= existing_updated_at) {
-            return false; // Older or same timestamp, skip
+    auto stored = redis_client_->msetWithTtl(sets, cache_ttl_seconds_);
+    for (size_t i = 0; i < sets.size(); ++i) {
+        // On update failure, delete key to force reload
+        if (!stored[i]) deletes.push_back(sets[i].first);
+    }
+    if (!redis_client_->mdel(deletes)) {
+        logEvent("ERROR", "Redis invalidation failed for a batch of " + std::to_string(deletes.size()) + " keys");
+        incrementCounter("cache_errors");
+    }
+
+    incrementCounter("events_processed", processed);
+    incrementCounter("events_skipped", skipped + coalesced);
+    incrementCounter("events_coalesced", coalesced);
+    incrementCounter("events_failed", failed);
+    logEvent("INFO", "Lane " + std::to_string(lane.id) + " processed batch of " +
+             std::to_string(batch.messages.size()) + " messages: " +
+             std::to_string(processed) + " written, " + std::to_string(skipped + coalesced) + " skipped (" +
+             std::to_string(coalesced) + " coalesced), " + std::to_string(failed) + " failed");
+    return dead_lettered;
+}
+
+void ProductEventConsumer::commitOffsets(bool sync) {
+    next_commit_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(commit_interval_ms_);
+
+    // A message sent to the DLQ is finished by its delivery report, so a
+    // watermark never passes one the DLQ doesn't hold yet. Before giving
+    // up partitions, wait for the reports of what is still in flight; the
+    // periodic commit takes what has been delivered so far.
+    if (sync && dlq_producer_) {
+        RdKafka::ErrorCode flushed = dlq_producer_->flush(10000);
+        if (flushed != RdKafka::ERR_NO_ERROR) {
+            logEvent("ERROR", "DLQ flush did not finish, committing delivered messages only: " +
+                     RdKafka::err2str(flushed));
         }
     }
-    
-    return true;
+
+    auto committable = offsets_.takeCommittable();
+    if (committable.empty()) {
+        return;
+    }
+
+    std::vector<RdKafka::TopicPartition*> partitions;
+    for (const auto& offset : committable) {
+        partitions.push_back(RdKafka::TopicPartition::create(offset.topic, offset.partition, offset.offset));
+    }
+    RdKafka::ErrorCode err = sync ? consumer_->commitSync(partitions) : consumer_->commitAsync(partitions);
+    RdKafka::TopicPartition::destroy(partitions);
+    if (err != RdKafka::ERR_NO_ERROR) {
+        logEvent("ERROR", "Offset commit failed: " + RdKafka::err2str(err));
+        offsets_.commitFailed(committable);
+    }
 }
 
-void ProductEventConsumer::sendToDLQ(const std::string& event_data, const std::string& error_reason) {
-    nlohmann::json dlq_message = {
-        {"original_event", event_data},
-        {"error_reason", error_reason},
-        {"timestamp", std::time(nullptr)}
-    };
-    
-    std::string payload = dlq_message.dump();
-    
-    RdKafka::ErrorCode err = dlq_producer_->produce(
+void ProductEventConsumer::onRebalance(RdKafka::KafkaConsumer* consumer, RdKafka::ErrorCode err,
+                                       std::vector<RdKafka::TopicPartition*>& partitions) {
+    if (err == RdKafka::ERR__ASSIGN_PARTITIONS) {
+        logEvent("INFO", "Assigned " + std::to_string(partitions.size()) + " partitions");
+        consumer->assign(partitions);
+        return;
+    }
+
+    // Revoked (or lost): let the lanes finish what was dispatched, so every
+    // dispatched message of these partitions can be committed now. Messages
+    // of them already consumed into the next batch are forgotten; the new
+    // owner reads them again from the committed offset.
+    logEvent("INFO", "Revoking " + std::to_string(partitions.size()) + " partitions");
+    drainLanes();
+    if (err == RdKafka::ERR__REVOKE_PARTITIONS) {
+        commitOffsets(true);
+    }
+    for (const auto* partition : partitions) {
+        offsets_.forget(partition->topic(), partition->partition());
+    }
+    consumer->unassign();
+}
+
+void ProductEventConsumer::onOffsetCommit(RdKafka::ErrorCode err,
+                                          const std::vector<RdKafka::TopicPartition*>& offsets) {
+    if (err == RdKafka::ERR_NO_ERROR || err == RdKafka::ERR__NO_OFFSET) {
+        return;
+    }
+    logEvent("ERROR", "Offset commit failed: " + RdKafka::err2str(err));
+    std::vector<PartitionOffset> failed;
+    for (const auto* partition : offsets) {
+        failed.push_back({partition->topic(), partition->partition(), partition->offset()});
+    }
+    offsets_.commitFailed(failed);
+}
+
+void ProductEventConsumer::stop() {
+    running_ = false;
+}
+
+// Source message of a DLQ message, carried through the producer as its
+// opaque until the delivery report finishes it
+struct DlqSource {
+    std::string topic;
+    int32_t partition;
+    int64_t offset;
+};
+
+RdKafka::ErrorCode ProductEventConsumer::produceToDLQ(const void* payload, size_t len, void* source) {
+    return dlq_producer_->produce(
         dlq_topic_,
         RdKafka::Topic::PARTITION_UA,
         RdKafka::Producer::RK_MSG_COPY,
-        const_cast<char*>(payload.c_str()),
-        payload.size(),
+        const_cast<void*>(payload),
+        len,
         nullptr, 0,
-        nullptr
+        0,
+        source
     );
+}
+
+void ProductEventConsumer::sendToDLQ(const RdKafka::Message& source, const std::string& error_reason) {
+    nlohmann::json dlq_message = {
+        {"original_event", std::string(static_cast<const char*>(source.payload()), source.len())},
+        {"error_reason", error_reason},
+        {"timestamp", std::time(nullptr)}
+    };
     
-    if (err != RdKafka::ERR_NO_ERROR) {
-        logEvent("ERROR", "Failed to send to DLQ: " + RdKafka::err2str(err));
+    std::string payload = dlq_message.dump();
+    auto* opaque = new DlqSource{source.topic_name(), source.partition(), source.offset()};
+
+    // A refused message is retried until the producer takes it. Skipping it
+    // would lose the event, and holding it back would stall its partition's
+    // watermark while later messages pile up behind it; waiting here pushes
+    // back on the lane and, once its queue fills, on consumption.
+    int backoff_ms = 100;
+    for (int attempt = 1;; ++attempt) {
+        RdKafka::ErrorCode err = produceToDLQ(payload.data(), payload.size(), opaque);
+        if (err == RdKafka::ERR_NO_ERROR) {
+            break;
+        }
+        incrementCounter("dlq_errors");
+        if (!running_ && attempt >= 5) {
+            // Shutting down: the source stays unfinished and is read again
+            logEvent("ERROR", "Failed to send to DLQ, leaving the offset uncommitted: " + RdKafka::err2str(err));
+            delete opaque;
+            return;
+        }
+        logEvent("ERROR", "Failed to send to DLQ, retrying in " + std::to_string(backoff_ms) + "ms: " +
+                 RdKafka::err2str(err));
+        // Serving delivery reports meanwhile makes room in a full local queue
+        dlq_producer_->poll(backoff_ms);
+        backoff_ms = std::min(backoff_ms * 2, 5000);
     }
-    
+
     dlq_producer_->poll(0);
 }
 
+void ProductEventConsumer::onDlqDelivery(RdKafka::Message& message) {
+    auto* source = static_cast<DlqSource*>(message.msg_opaque());
+    if (message.err() == RdKafka::ERR_NO_ERROR) {
+        offsets_.complete(source->topic, source->partition, source->offset);
+        delete source;
+        return;
+    }
+
+    // The producer's own retries ran out: send it again. Its slot in the
+    // local queue was just freed, so this is rarely refused.
+    incrementCounter("dlq_errors");
+    logEvent("ERROR", "DLQ delivery failed, resending: " + message.errstr());
+    RdKafka::ErrorCode err = produceToDLQ(message.payload(), message.len(), source);
+    if (err != RdKafka::ERR_NO_ERROR) {
+        logEvent("ERROR", "DLQ resend refused, leaving the offset uncommitted: " + RdKafka::err2str(err));
+        delete source;
+    }
+}
+
 ProductEvent ProductEventConsumer::parseEvent(const std::string& json_str) {
     nlohmann::json j = nlohmann::json::parse(json_str);
     
@@ -408,18 +1062,30 @@ void ProductEventConsumer::logEvent(const std::string& level, const std::string&
     auto now = std::chrono::system_clock::now();
     auto time_t = std::chrono::system_clock::to_time_t(now);
     
-    std::cout << "[" << std::put_time(std::localtime(&time_t), "%Y-%m-%d %H:%M:%S") << "] "
-              << "[" << level << "] " << message << std::endl;
+    std::tm local_time;
+    localtime_r(&time_t, &local_time);
+    std::ostringstream line;
+    line << "[" << std::put_time(&local_time, "%Y-%m-%d %H:%M:%S") << "] "
+         << "[" << level << "] " << message << "\n";
+
+    // Whole lines only, whichever lane logs
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    std::cout << line.str() << std::flush;
 }
 
-void ProductEventConsumer::incrementCounter(const std::string& metric) {
+void ProductEventConsumer::incrementCounter(const std::string& metric, int count) {
     // In production, this would send to Prometheus, StatsD, etc.
     // For now, just log
-    static std::map<std::string, int> counters;
-    counters[metric]++;
+    int before, after;
+    {
+        std::lock_guard<std::mutex> lock(metrics_mutex_);
+        before = counters_[metric];
+        after = counters_[metric] += count;
+    }
     
-    if (counters[metric] % 100 == 0) {
-        logEvent("METRICS", metric + ": " + std::to_string(counters[metric]));
+    // Log each time the counter passes a multiple of 100
+    if (before / 100 != after / 100) {
+        logEvent("METRICS", metric + ": " + std::to_string(after));
     }
 }
 
@@ -0,0 +1,79 @@
+#include "offset_tracker.h"
+#include <algorithm>
+
+namespace atlas {
+
+void OffsetTracker::track(const std::string& topic, int32_t partition, int64_t offset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Partition& state = partitions_[{topic, partition}];
+    int64_t last = state.in_flight.empty() ? state.watermark - 1 : state.in_flight.back().first;
+    if (offset > last) {
+        state.in_flight.emplace_back(offset, false);
+    }
+}
+
+void OffsetTracker::complete(const std::string& topic, int32_t partition, int64_t offset) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = partitions_.find({topic, partition});
+    if (found == partitions_.end()) {
+        return;
+    }
+    Partition& state = found->second;
+    auto it = std::lower_bound(state.in_flight.begin(), state.in_flight.end(), std::make_pair(offset, false));
+    if (it == state.in_flight.end() || it->first != offset || it->second) {
+        return;
+    }
+    it->second = true;
+    uncommitted_++;
+    while (!state.in_flight.empty() && state.in_flight.front().second) {
+        state.watermark = state.in_flight.front().first + 1;
+        state.in_flight.pop_front();
+    }
+}
+
+std::vector<PartitionOffset> OffsetTracker::takeCommittable() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<PartitionOffset> offsets;
+    for (auto& entry : partitions_) {
+        Partition& state = entry.second;
+        if (state.watermark > state.taken) {
+            offsets.push_back({entry.first.first, entry.first.second, state.watermark});
+            state.taken = state.watermark;
+        }
+    }
+    uncommitted_ = 0;
+    return offsets;
+}
+
+void OffsetTracker::commitFailed(const std::vector<PartitionOffset>& offsets) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& offset : offsets) {
+        auto found = partitions_.find({offset.topic, offset.partition});
+        if (found != partitions_.end() && found->second.taken == offset.offset) {
+            found->second.taken = -1;
+        }
+    }
+}
+
+void OffsetTracker::forget(const std::string& topic, int32_t partition) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    partitions_.erase({topic, partition});
+}
+
+size_t OffsetTracker::uncommitted() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return uncommitted_;
+}
+
+size_t OffsetTracker::inFlight() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t count = 0;
+    for (const auto& entry : partitions_) {
+        for (const auto& message : entry.second.in_flight) {
+            count += message.second ? 0 : 1;
+        }
+    }
+    return count;
+}
+
+} // namespace atlas
@@ -0,0 +1,120 @@
+#include "version_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+
+namespace atlas {
+
+VersionCache::VersionCache(size_t capacity, size_t shards) {
+    shards = std::max<size_t>(1, std::min(shards, std::max<size_t>(1, capacity)));
+    for (size_t i = 0; i < shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+        shards_.back()->capacity = std::max<size_t>(1, capacity / shards);
+    }
+}
+
+VersionCache::~VersionCache() = default;
+
+VersionCache::Shard& VersionCache::shardFor(const std::string& product_id) const {
+    return *shards_[std::hash<std::string>()(product_id) % shards_.size()];
+}
+
+bool VersionCache::isStale(const std::string& product_id, int64_t version) {
+    Shard& shard = shardFor(product_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(product_id);
+    if (it == shard.index.end()) {
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return version <= it->second->second;
+}
+
+void VersionCache::update(const std::string& product_id, int64_t version) {
+    Shard& shard = shardFor(product_id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(product_id);
+    if (it != shard.index.end()) {
+        it->second->second = std::max(it->second->second, version);
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    if (shard.index.size() >= shard.capacity) {
+        shard.index.erase(shard.lru.back().first);
+        shard.lru.pop_back();
+    }
+    shard.lru.emplace_front(product_id, version);
+    shard.index[product_id] = shard.lru.begin();
+}
+
+size_t VersionCache::size() const {
+    size_t count = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        count += shard->index.size();
+    }
+    return count;
+}
+
+size_t VersionCache::save(const std::string& path) const {
+    std::string temporary = path + ".tmp";
+    size_t count = 0;
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot write version snapshot: " + temporary);
+        }
+        // One shard locked at a time, so writers are held up only briefly.
+        // Least recently used first, so a smaller cache loading this keeps
+        // the most recent entries.
+        for (const auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            for (auto it = shard->lru.rbegin(); it != shard->lru.rend(); ++it) {
+                file << it->first << '\t' << it->second << '\n';
+            }
+            count += shard->lru.size();
+        }
+        if (!file.good()) {
+            throw std::runtime_error("Cannot write version snapshot: " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace " + path);
+    }
+    return count;
+}
+
+size_t VersionCache::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return 0;
+    }
+    size_t count = 0;
+    std::string line;
+    for (size_t line_number = 1; std::getline(file, line); ++line_number) {
+        size_t tab = line.rfind('\t');
+        if (line.empty()) {
+            continue;
+        }
+        try {
+            if (tab == std::string::npos || tab == 0) {
+                throw std::invalid_argument("missing version");
+            }
+            size_t parsed = 0;
+            int64_t version = std::stoll(line.substr(tab + 1), &parsed);
+            if (parsed != line.size() - tab - 1) {
+                throw std::invalid_argument("trailing characters");
+            }
+            update(line.substr(0, tab), version);
+            count++;
+        } catch (const std::logic_error& e) {
+            throw std::invalid_argument(path + ":" + std::to_string(line_number) + ": " + e.what());
+        }
+    }
+    return count;
+}
+
+} // namespace atlas
@@ -1,6 +1,15 @@
 #include <gtest/gtest.h>
 #include "consumer.h"
+#include "version_cache.h"
+#include "offset_tracker.h"
+#include "bounded_queue.h"
+#include "cache_codec.h"
 #include <nlohmann/json.hpp>
+#include <cstdio>
+#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <thread>
 
 using namespace atlas;
 using json = nlohmann::json;
@@ -95,6 +104,332 @@ TEST_F(ConsumerTest, ManualOffsetCommit) {
     // Would require Kafka test harness
 }
 
+TEST_F(ConsumerTest, BulkBodyIsNdjson) {
+    std::vector<BulkOperation> operations = {
+        {BulkOperation::Type::Index, "P1", R"({"title":"Laptop"})"},
+        {BulkOperation::Type::Delete, "P\"2", ""},
+    };
+    std::string body = ElasticsearchWriter::buildBulkBody("products", operations);
+
+    std::vector<json> lines;
+    size_t start = 0;
+    for (size_t end; (end = body.find('\n', start)) != std::string::npos; start = end + 1) {
+        lines.push_back(json::parse(body.substr(start, end - start)));
+    }
+    EXPECT_EQ(start, body.size()); // newline-terminated
+    ASSERT_EQ(lines.size(), 3u);
+    EXPECT_EQ(lines[0]["index"]["_index"], "products");
+    EXPECT_EQ(lines[0]["index"]["_id"], "P1");
+    EXPECT_EQ(lines[1]["title"], "Laptop");
+    EXPECT_EQ(lines[2]["delete"]["_id"], "P\"2");
+}
+
+TEST_F(ConsumerTest, BulkResponsePerItemResults) {
+    json response = {
+        {"errors", true},
+        {"items", {
+            {{"index", {{"_id", "P1"}, {"status", 201}, {"result", "created"}}}},
+            {{"index", {{"_id", "P2"}, {"status", 429},
+                        {"error", {{"type", "es_rejected_execution_exception"}, {"reason", "queue full"}}}}}},
+            {{"index", {{"_id", "P3"}, {"status", 400},
+                        {"error", {{"type", "mapper_parsing_exception"}, {"reason", "bad price"}}}}}},
+            {{"delete", {{"_id", "P4"}, {"status", 404}, {"result", "not_found"}}}},
+        }}
+    };
+    auto results = ElasticsearchWriter::parseBulkResponse(response, 5);
+    ASSERT_EQ(results.size(), 5u);
+    EXPECT_TRUE(results[0].ok());
+    EXPECT_FALSE(results[1].ok());
+    EXPECT_TRUE(results[1].retryable());
+    EXPECT_EQ(results[1].error, "es_rejected_execution_exception: queue full");
+    EXPECT_FALSE(results[2].ok());
+    EXPECT_FALSE(results[2].retryable()); // permanent: straight to the DLQ
+    EXPECT_TRUE(results[3].ok());         // already deleted
+    EXPECT_FALSE(results[4].ok());        // not in the response
+    EXPECT_TRUE(results[4].retryable());
+}
+
+TEST_F(ConsumerTest, BulkRetriesOnlyFailedItems) {
+    std::vector<BulkOperation> operations = {
+        {BulkOperation::Type::Index, "P1", "{}"},
+        {BulkOperation::Type::Index, "P2", "{}"},
+        {BulkOperation::Type::Index, "P3", "{}"},
+        {BulkOperation::Type::Index, "P1", "{}"},
+        {BulkOperation::Type::Index, "P4", "{}"},
+    };
+    std::vector<BulkItemResult> results(5);
+    results[0].status = 503; // replaced by item 3, which landed
+    results[1].status = 429;
+    results[2].status = 400;
+    results[3].status = 200;
+    results[4].status = 0;
+    auto retry = ElasticsearchWriter::itemsToRetry(operations, results, {0, 1, 2, 4});
+    EXPECT_EQ(retry, (std::vector<size_t>{1, 4}));
+}
+
+static ProductEvent makeEvent(const std::string& product_id, int version, const std::string& type = "update") {
+    ProductEvent event;
+    event.product_id = product_id;
+    event.event_id = product_id + "-v" + std::to_string(version);
+    event.event_type = type;
+    event.version = version;
+    event.updated_at = "2025-12-11T00:00:00Z";
+    return event;
+}
+
+TEST_F(ConsumerTest, CoalesceKeepsNewestVersionPerProduct) {
+    std::vector<ProductEvent> events = {
+        makeEvent("P1", 1), makeEvent("P2", 7), makeEvent("P1", 3), makeEvent("P1", 2),
+        makeEvent("P3", 1), makeEvent("P2", 7, "delete"), makeEvent("P1", 4, "delete"),
+    };
+    auto survivors = coalesceEvents(events);
+    // P3 v1, P2's later v7 (the delete), P1 v4
+    EXPECT_EQ(survivors, (std::vector<size_t>{4, 5, 6}));
+    EXPECT_TRUE(coalesceEvents({}).empty());
+}
+
+TEST_F(ConsumerTest, BulkWritesUseExternalVersions) {
+    std::vector<BulkOperation> operations = {
+        {BulkOperation::Type::Index, "P1", "{}", 12},
+        {BulkOperation::Type::Delete, "P2", "", 4},
+        {BulkOperation::Type::Index, "P3", "{}"},
+    };
+    std::string body = ElasticsearchWriter::buildBulkBody("products", operations);
+    std::vector<json> actions;
+    size_t start = 0;
+    for (size_t end; (end = body.find('\n', start)) != std::string::npos; start = end + 1) {
+        actions.push_back(json::parse(body.substr(start, end - start)));
+    }
+    ASSERT_EQ(actions.size(), 5u);
+    EXPECT_EQ(actions[0]["index"]["version"], 12);
+    EXPECT_EQ(actions[0]["index"]["version_type"], "external");
+    EXPECT_EQ(actions[2]["delete"]["version"], 4);
+    EXPECT_FALSE(actions[3]["index"].contains("version"));
+
+    json response = {{"items", {
+        {{"index", {{"status", 409}, {"error", {{"type", "version_conflict_engine_exception"}}}}}}
+    }}};
+    auto results = ElasticsearchWriter::parseBulkResponse(response, 1);
+    EXPECT_TRUE(results[0].conflict());
+    EXPECT_FALSE(results[0].ok());
+    EXPECT_FALSE(results[0].retryable());
+}
+
+TEST_F(ConsumerTest, VersionCacheSkipsKnownVersions) {
+    VersionCache cache(100, 4);
+    EXPECT_FALSE(cache.isStale("P1", 1));
+    cache.update("P1", 5);
+    EXPECT_TRUE(cache.isStale("P1", 4));
+    EXPECT_TRUE(cache.isStale("P1", 5));
+    EXPECT_FALSE(cache.isStale("P1", 6));
+    cache.update("P1", 3); // never moves backwards
+    EXPECT_TRUE(cache.isStale("P1", 5));
+    EXPECT_FALSE(cache.isStale("P2", 1));
+}
+
+TEST_F(ConsumerTest, VersionCacheIsBounded) {
+    VersionCache cache(10, 1);
+    for (int i = 0; i < 10; ++i) cache.update("P" + std::to_string(i), 1);
+    EXPECT_TRUE(cache.isStale("P0", 1)); // P0 is now most recently used
+    cache.update("P10", 1);
+    EXPECT_EQ(cache.size(), 10u);
+    EXPECT_TRUE(cache.isStale("P0", 1));
+    EXPECT_FALSE(cache.isStale("P1", 1)); // least recently used, evicted
+}
+
+TEST_F(ConsumerTest, VersionCacheSnapshotRoundTrip) {
+    std::string path = "./test-versions.tsv";
+    VersionCache cache(100);
+    cache.update("P1", 5);
+    cache.update("P\t2", 9); // IDs may contain tabs; the version is after the last one
+    EXPECT_EQ(cache.save(path), 2u);
+
+    VersionCache restored(100);
+    EXPECT_EQ(restored.load(path), 2u);
+    EXPECT_TRUE(restored.isStale("P1", 5));
+    EXPECT_TRUE(restored.isStale("P\t2", 9));
+    EXPECT_FALSE(restored.isStale("P\t2", 10));
+
+    {
+        std::ofstream file(path);
+        file << "P1\tfive\n";
+    }
+    EXPECT_THROW(restored.load(path), std::invalid_argument);
+    std::remove(path.c_str());
+    EXPECT_EQ(restored.load(path), 0u); // missing: start cold
+    EXPECT_THROW(cache.save("./no-such-dir/versions.tsv"), std::runtime_error);
+}
+
+TEST_F(ConsumerTest, OffsetTrackerWatermarkWaitsForGaps) {
+    OffsetTracker tracker;
+    for (int64_t offset = 10; offset < 14; ++offset) tracker.track("products", 0, offset);
+    tracker.track("products", 1, 7);
+    EXPECT_EQ(tracker.inFlight(), 5u);
+
+    // 11 and 12 finish first: nothing is committable until 10 is done
+    tracker.complete("products", 0, 12);
+    tracker.complete("products", 0, 11);
+    EXPECT_EQ(tracker.uncommitted(), 2u);
+    EXPECT_TRUE(tracker.takeCommittable().empty());
+
+    tracker.complete("products", 0, 10);
+    tracker.complete("products", 1, 7);
+    auto offsets = tracker.takeCommittable();
+    ASSERT_EQ(offsets.size(), 2u);
+    EXPECT_EQ(offsets[0].partition, 0);
+    EXPECT_EQ(offsets[0].offset, 13); // next to consume; 13 is still in flight
+    EXPECT_EQ(offsets[1].partition, 1);
+    EXPECT_EQ(offsets[1].offset, 8);
+    EXPECT_EQ(tracker.uncommitted(), 0u);
+    EXPECT_EQ(tracker.inFlight(), 1u);
+    EXPECT_TRUE(tracker.takeCommittable().empty()); // nothing advanced since
+}
+
+TEST_F(ConsumerTest, OffsetTrackerRetriesFailedCommits) {
+    OffsetTracker tracker;
+    tracker.track("products", 0, 0);
+    tracker.track("products", 0, 1);
+    tracker.complete("products", 0, 0);
+    auto first = tracker.takeCommittable();
+    ASSERT_EQ(first.size(), 1u);
+
+    tracker.commitFailed(first);
+    auto retried = tracker.takeCommittable();
+    ASSERT_EQ(retried.size(), 1u);
+    EXPECT_EQ(retried[0].offset, 1);
+
+    // A late failure of an older commit does not resend a newer watermark
+    tracker.complete("products", 0, 1);
+    auto second = tracker.takeCommittable();
+    ASSERT_EQ(second.size(), 1u);
+    EXPECT_EQ(second[0].offset, 2);
+    tracker.commitFailed(first);
+    EXPECT_TRUE(tracker.takeCommittable().empty());
+}
+
+TEST_F(ConsumerTest, OffsetTrackerForgetsRevokedPartitions) {
+    OffsetTracker tracker;
+    tracker.track("products", 0, 5);
+    tracker.track("products", 0, 5); // redelivered: ignored
+    EXPECT_EQ(tracker.inFlight(), 1u);
+    tracker.forget("products", 0);
+    tracker.complete("products", 0, 5); // finished after the revoke
+    EXPECT_EQ(tracker.uncommitted(), 0u);
+    EXPECT_TRUE(tracker.takeCommittable().empty());
+}
+
+TEST_F(ConsumerTest, LaneForKeepsEachProductOnOneLane) {
+    std::vector<size_t> used(4, 0);
+    for (int i = 0; i < 1000; ++i) {
+        std::string product_id = "P" + std::to_string(i);
+        size_t lane = laneFor(product_id, 4);
+        ASSERT_LT(lane, 4u);
+        EXPECT_EQ(laneFor(product_id, 4), lane);
+        used[lane]++;
+    }
+    for (size_t count : used) EXPECT_GT(count, 150u); // roughly even spread
+    EXPECT_EQ(laneFor("P1", 1), 0u);
+}
+
+TEST_F(ConsumerTest, BoundedQueueBlocksWhenFull) {
+    BoundedQueue<int> queue(2);
+    EXPECT_TRUE(queue.push(1));
+    EXPECT_TRUE(queue.push(2));
+
+    std::atomic<bool> pushed(false);
+    std::thread producer([&]() {
+        queue.push(3);
+        pushed = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(pushed); // waits for room
+
+    int item = 0;
+    ASSERT_TRUE(queue.pop(item));
+    EXPECT_EQ(item, 1);
+    producer.join();
+    EXPECT_TRUE(pushed);
+    EXPECT_EQ(queue.size(), 2u);
+}
+
+TEST_F(ConsumerTest, BoundedQueueDrainsAfterClose) {
+    BoundedQueue<int> queue(4);
+    queue.push(1);
+    queue.push(2);
+    queue.close();
+    EXPECT_FALSE(queue.push(3));
+
+    int item = 0;
+    ASSERT_TRUE(queue.pop(item));
+    EXPECT_EQ(item, 1);
+    ASSERT_TRUE(queue.pop(item));
+    EXPECT_EQ(item, 2);
+    EXPECT_FALSE(queue.pop(item)); // closed and empty: the worker exits
+
+    BoundedQueue<int> idle(1);
+    std::thread worker([&]() {
+        int unused = 0;
+        EXPECT_FALSE(idle.pop(unused));
+    });
+    idle.close(); // wakes a worker waiting on an empty queue
+    worker.join();
+}
+
+TEST_F(ConsumerTest, RedisSetCommandIsBinarySafe) {
+    std::string value("{\"title\": \"Blue Shirt\"}\n\0tail", 29);
+    auto command = RedisClient::setCommand("product:P 1", value);
+    ASSERT_EQ(command.size(), 3u); // no expiry
+    EXPECT_EQ(command[0], "SET");
+    EXPECT_EQ(command[1], "product:P 1");
+    EXPECT_EQ(command[2], value);
+    EXPECT_EQ(command[2].size(), 29u); // spaces, newline and NUL kept
+
+    command = RedisClient::setCommand("product:P1", "{}", 3600);
+    ASSERT_EQ(command.size(), 5u);
+    EXPECT_EQ(command[3], "EX");
+    EXPECT_EQ(command[4], "3600");
+}
+
+TEST_F(ConsumerTest, CacheValueRoundTrip) {
+    json doc = {{"title", "Blue Shirt"}, {"price", 19.99}, {"version", 3}, {"product_id", "P1"}};
+    std::string value = encodeCacheValue(doc);
+    EXPECT_EQ(static_cast<uint8_t>(value[0]), kCacheValueVersion);
+    EXPECT_EQ(value[1], 0); // small: not compressed
+    EXPECT_LT(value.size(), doc.dump().size());
+    EXPECT_EQ(decodeCacheValue(value), doc);
+
+    // Values written as JSON text before the binary format still decode
+    EXPECT_EQ(decodeCacheValue(doc.dump()), doc);
+}
+
+TEST_F(ConsumerTest, CacheValueCompressesLargeDocuments) {
+    json doc = {{"product_id", "P1"}, {"description", ""}};
+    for (int i = 0; i < 200; ++i) doc["description"] = doc["description"].get<std::string>() + "Soft cotton shirt. ";
+    std::string value = encodeCacheValue(doc, 1024);
+    EXPECT_EQ(value[1], static_cast<char>(kCacheValueCompressed));
+    EXPECT_LT(value.size(), doc.dump().size() / 4);
+    EXPECT_EQ(decodeCacheValue(value), doc);
+
+    std::string uncompressed = encodeCacheValue(doc, 0);
+    EXPECT_EQ(uncompressed[1], 0);
+    EXPECT_EQ(decodeCacheValue(uncompressed), doc);
+}
+
+TEST_F(ConsumerTest, CacheValueRejectsMalformedInput) {
+    std::string value = encodeCacheValue({{"title", "Shirt"}});
+    EXPECT_THROW(decodeCacheValue(""), std::invalid_argument);
+    EXPECT_THROW(decodeCacheValue(value.substr(0, value.size() - 2)), std::invalid_argument);
+    std::string newer = value;
+    newer[0] = static_cast<char>(kCacheValueVersion + 1);
+    EXPECT_THROW(decodeCacheValue(newer), std::invalid_argument);
+
+    json doc = {{"description", std::string(4000, 'x')}};
+    std::string compressed = encodeCacheValue(doc);
+    ASSERT_EQ(compressed[1], static_cast<char>(kCacheValueCompressed));
+    compressed[compressed.size() / 2] ^= 0x5a;
+    EXPECT_THROW(decodeCacheValue(compressed), std::invalid_argument);
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -0,0 +1,128 @@
+// Microbenchmark for LtrModel: per-hit scoring cost of a tree ensemble over
+// a rerank window, QuickScorer vs. plain node traversal.
+//
+//   ./ltr_bench [--trees=300] [--depth=6] [--window=100] [--iterations=1000]
+//               [--request-budget-us=1000] [--budget-ns=0]
+//
+// Exits non-zero if QuickScorer scoring exceeds the per-hit budget, so it can
+// gate changes to the model layout. The budget is what one request may spend
+// on LTR (1ms of the ~15ms p50 by default) spread over the window;
+// --budget-ns sets a per-hit budget directly instead.
+
+#include "ltr_model.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using atlas::LtrModel;
+using atlas::kNumLtrFeatures;
+
+static int intArg(int argc, char** argv, const char* name, int default_value) {
+    std::string prefix = std::string("--") + name + "=";
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], prefix.c_str(), prefix.size()) == 0) {
+            return std::stoi(argv[i] + prefix.size());
+        }
+    }
+    return default_value;
+}
+
+// Random complete tree in XGBoost dump format
+static nlohmann::json randomTree(std::mt19937& rng, int depth, int& next_id) {
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int id = next_id++;
+    if (depth == 0) {
+        return {{"nodeid", id}, {"leaf", unit(rng) - 0.5f}};
+    }
+    int feature = static_cast<int>(rng() % kNumLtrFeatures);
+    auto left = randomTree(rng, depth - 1, next_id);
+    auto right = randomTree(rng, depth - 1, next_id);
+    return {
+        {"nodeid", id},
+        {"split", "f" + std::to_string(feature)},
+        {"split_condition", unit(rng)},
+        {"yes", left["nodeid"]},
+        {"no", right["nodeid"]},
+        {"missing", left["nodeid"]},
+        {"children", {left, right}}
+    };
+}
+
+template <typename Fn>
+static double nsPerHit(Fn&& fn, int iterations, int window) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        fn();
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / (static_cast<double>(iterations) * window);
+}
+
+int main(int argc, char** argv) {
+    int trees = intArg(argc, argv, "trees", 300);
+    int depth = intArg(argc, argv, "depth", 6);
+    int window = intArg(argc, argv, "window", 100);
+    int iterations = intArg(argc, argv, "iterations", 1000);
+    int request_budget_us = intArg(argc, argv, "request-budget-us", 1000);
+    int budget_ns = intArg(argc, argv, "budget-ns", 0);
+    if (budget_ns <= 0) {
+        budget_ns = request_budget_us * 1000 / std::max(window, 1);
+    }
+
+    std::mt19937 rng(42);
+    nlohmann::json ensemble = nlohmann::json::array();
+    for (int t = 0; t < trees; ++t) {
+        int next_id = 0;
+        ensemble.push_back(randomTree(rng, depth, next_id));
+    }
+    auto model = LtrModel::fromJson(ensemble);
+
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<float> features(static_cast<size_t>(window) * kNumLtrFeatures);
+    for (auto& value : features) {
+        value = unit(rng);
+    }
+    std::vector<double> scores(window);
+
+    // Both paths must agree before timing means anything
+    model->score(features.data(), window, scores.data());
+    for (int doc = 0; doc < window; ++doc) {
+        double expected = model->scoreTraversal(&features[doc * kNumLtrFeatures]);
+        if (std::fabs(expected - scores[doc]) > 1e-6) {
+            std::cerr << "Score mismatch at doc " << doc << ": " << scores[doc]
+                      << " vs " << expected << std::endl;
+            return 2;
+        }
+    }
+
+    double sink = 0.0;
+    double quick_ns = nsPerHit([&]() {
+        model->score(features.data(), window, scores.data());
+        sink += scores[0];
+    }, iterations, window);
+    double traversal_ns = nsPerHit([&]() {
+        for (int doc = 0; doc < window; ++doc) {
+            sink += model->scoreTraversal(&features[doc * kNumLtrFeatures]);
+        }
+    }, iterations, window);
+
+    std::cout << "Trees: " << trees << " (depth " << depth << "), window: " << window
+              << ", QuickScorer: " << (model->usesQuickScorer() ? "yes" : "no") << std::endl;
+    std::cout << std::fixed << std::setprecision(1)
+              << "  quickscorer: " << quick_ns << " ns/hit" << std::endl
+              << "  traversal:   " << traversal_ns << " ns/hit" << std::endl
+              << "  budget:      " << budget_ns << " ns/hit" << std::endl;
+    if (sink == 42.0) std::cout << std::endl;  // keep the work observable
+
+    if (quick_ns > budget_ns) {
+        std::cerr << "Over budget" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+
+namespace atlas {
+
+// One step of the degradation ladder. Each level keeps everything the
+// previous level dropped and sheds one more expensive feature.
+struct SearchPlan {
+    int level;
+    const char* name;
+    int rerank_window;          // hits that get the full rerank; 0 = all
+    bool include_description;   // fetch `description` from ES
+    bool cache_only_head;       // serve stale cached pages; only head queries may miss to ES
+    int terminate_after;        // ES per-shard doc limit; 0 = off
+
+    static SearchPlan forLevel(int level);
+    static SearchPlan normal() { return forLevel(0); }
+};
+
+struct BrownoutConfig {
+    double queue_delay_ms = 50.0;  // step down when smoothed queueing delay exceeds this
+    double es_rtt_ms = 250.0;      // ... or smoothed ES round trip exceeds this
+    double recover_ratio = 0.6;    // step back up once both are below ratio * threshold
+    int dwell_ms = 2000;           // minimum time between level changes
+    double ewma_alpha = 0.2;       // weight of the newest sample
+    int idle_half_life_ms = 1000;  // a signal with no new samples halves this often; 0 = never
+};
+
+// Tracks queueing delay and ES RTT and picks the current SearchPlan.
+// Levels move one step at a time with hysteresis, so degradation reverses
+// automatically as load recedes instead of flapping. A signal that stops
+// being sampled (keep-alive connections never requeue; shed requests never
+// reach ES) decays toward zero instead of holding its last value.
+class BrownoutController {
+public:
+    static constexpr int kMaxLevel = 4;
+
+    explicit BrownoutController(const BrownoutConfig& config = BrownoutConfig());
+
+    void recordQueueDelay(double ms, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    void recordEsRtt(double ms, std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    // Re-evaluate the level and return the plan to use for a new request
+    SearchPlan currentPlan(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+    int level();
+    double queueDelayMs(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+    double esRttMs(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+private:
+    // `ewma` as of `now`, decayed for the time since it was last sampled
+    double decayed(double ewma, std::chrono::steady_clock::time_point sampled_at,
+                   std::chrono::steady_clock::time_point now) const;
+
+    BrownoutConfig config_;
+
+    std::mutex mutex_;
+    double queue_delay_ewma_;
+    double es_rtt_ewma_;
+    std::chrono::steady_clock::time_point queue_delay_sampled_at_;
+    std::chrono::steady_clock::time_point es_rtt_sampled_at_;
+    int level_;
+    std::chrono::steady_clock::time_point last_change_;
+};
+
+} // namespace atlas
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+
+namespace atlas {
+
+// MinHash signatures over character shingles of a title. Titles are
+// lowercased to alphanumeric words first, so "Gaming-Laptop PRO" and
+// "gaming laptop pro" shingle alike. The fraction of equal positions in two
+// signatures estimates the Jaccard similarity of their shingle sets.
+class MinHasher {
+public:
+    explicit MinHasher(size_t num_hashes = 64, size_t shingle_chars = 4, uint64_t seed = 0x5eed);
+
+    size_t numHashes() const { return multipliers_.size(); }
+
+    // `numHashes()` values; empty for a title with no alphanumerics
+    std::vector<uint32_t> signature(const std::string& title) const;
+
+    static double similarity(const uint32_t* a, const uint32_t* b, size_t num_hashes);
+
+private:
+    size_t shingle_chars_;
+    std::vector<uint64_t> multipliers_;  // odd; h_i(x) = (a_i * x + b_i) >> 32
+    std::vector<uint64_t> offsets_;
+};
+
+// Union-find safe to call from many threads at once: path halving with
+// compare-and-swap, and roots linked toward the smaller index, so a
+// cluster's root is always its lowest-indexed member whatever the order of
+// unions.
+class ConcurrentUnionFind {
+public:
+    explicit ConcurrentUnionFind(size_t size);
+
+    uint32_t find(uint32_t x);
+    // True if the two were in different sets
+    bool unite(uint32_t a, uint32_t b);
+    size_t size() const { return parent_.size(); }
+
+private:
+    std::vector<std::atomic<uint32_t>> parent_;
+};
+
+struct DedupOptions {
+    size_t num_hashes = 64;
+    size_t bands = 16;           // num_hashes / bands rows per band
+    size_t shingle_chars = 4;
+    double threshold = 0.8;      // estimated Jaccard similarity to merge
+    size_t bucket_window = 8;    // earlier bucket members compared per title
+    size_t threads = 0;          // 0: hardware concurrency
+};
+
+// Signatures of `titles`, computed on `threads` threads, flattened:
+// num_hashes values per title (all-max for titles with no shingles)
+std::vector<uint32_t> computeSignatures(const std::vector<std::string>& titles, const MinHasher& hasher,
+                                        size_t threads);
+
+// Near-duplicate clusters: result[i] is the lowest index in title i's
+// cluster (i itself for a singleton).
+//
+// Each band of every signature is hashed; bands are processed in parallel,
+// each sorted by hash so titles sharing a bucket sit together. Within a
+// bucket, each title is checked against up to `bucket_window` members
+// before it, and merged if the full signatures agree on `threshold` of
+// their values. Transitive merges come from the union-find, so a large
+// bucket of duplicates costs O(window) per title rather than O(bucket^2).
+std::vector<uint32_t> clusterSignatures(const std::vector<uint32_t>& signatures, size_t count,
+                                        const DedupOptions& options);
+
+std::vector<uint32_t> clusterNearDuplicates(const std::vector<std::string>& titles,
+                                            const DedupOptions& options = DedupOptions());
+
+// Product ID -> cluster table for collapsing duplicates at query time.
+// Loaded from "product_id<TAB>cluster_id" lines (dedup_tool output); only
+// products in multi-member clusters are listed.
+class DuplicateClusters {
+public:
+    // Throws std::runtime_error if the file can't be read
+    static std::shared_ptr<const DuplicateClusters> load(const std::string& path);
+
+    void add(const std::string& product_id, const std::string& cluster_id);
+
+    // Dense cluster number of a product, 0 if it has no duplicates
+    uint32_t cluster(const std::string& product_id) const {
+        auto it = clusters_.find(product_id);
+        return it == clusters_.end() ? 0 : it->second;
+    }
+
+    size_t products() const { return clusters_.size(); }
+    size_t clusterCount() const { return cluster_ids_.size(); }
+
+    // Hash of the file contents, mixed into the ranking version
+    uint64_t fingerprint() const { return fingerprint_; }
+
+private:
+    std::unordered_map<std::string, uint32_t> clusters_;
+    std::unordered_map<std::string, uint32_t> cluster_ids_;  // cluster ID -> dense number
+    uint64_t fingerprint_ = 0;
+};
+
+} // namespace atlas
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+namespace atlas {
+
+// int8 dot-product kernels. All take vectors padded to a multiple of
+// kEmbeddingAlign bytes with zeros, so none of them has a tail loop.
+enum class DotKernel {
+    Scalar,
+    Avx2,        // vpmaddubsw + vpmaddwd, 32 bytes per step
+    Avx512Vnni,  // vpdpbusd, 64 bytes per step
+};
+
+constexpr size_t kEmbeddingAlign = 64;
+
+// Fastest kernel this CPU supports (checked once at runtime)
+DotKernel bestDotKernel();
+const char* dotKernelName(DotKernel kernel);
+
+// Sum of a[i] * b[i] for `n` int8 values (n a multiple of kEmbeddingAlign).
+// Values must lie in [-127, 127], which quantize() guarantees.
+int32_t dotInt8(const int8_t* a, const int8_t* b, size_t n, DotKernel kernel);
+
+// An L2-normalized vector quantized symmetrically: x ~= scale * values[i]
+struct QuantizedVector {
+    std::vector<int8_t> values;  // zero padded to the store's stride
+    float scale = 0.0f;
+};
+
+// Read-only store of int8-quantized embeddings keyed by string (product ID,
+// or normalized query for precomputed head-query embeddings), memory-mapped
+// so a large catalog costs page cache rather than heap and opens instantly.
+//
+// File layout (little-endian, every section 64-byte aligned):
+//   header   "ATLSEMB1", uint32 dim, uint32 stride, uint64 count,
+//            uint64 scales_offset, uint64 vectors_offset, uint64 keys_offset
+//   scales   float[count]
+//   vectors  int8[count][stride], rows zero padded from dim to stride
+//   keys     count x (uint32 length, bytes), in row order
+//
+// Vectors are L2-normalized before quantization, so the dot product of two
+// rows times both scales is their cosine similarity.
+class EmbeddingStore {
+public:
+    // Throws std::runtime_error if the file can't be opened or mapped and
+    // std::invalid_argument if it isn't a well-formed store
+    static std::shared_ptr<const EmbeddingStore> open(const std::string& path);
+
+    // Normalize, quantize and write `vectors` (each of `dim` floats) as a
+    // store file. Throws std::invalid_argument on a dimension mismatch.
+    static void write(const std::string& path, size_t dim,
+                      const std::vector<std::pair<std::string, std::vector<float>>>& vectors);
+
+    ~EmbeddingStore();
+    EmbeddingStore(const EmbeddingStore&) = delete;
+    EmbeddingStore& operator=(const EmbeddingStore&) = delete;
+
+    size_t dim() const { return dim_; }
+    size_t stride() const { return stride_; }
+    size_t size() const { return count_; }
+
+    // Row of `key`, or -1 if the store has no embedding for it
+    int64_t find(std::string_view key) const;
+    std::string_view key(size_t row) const { return keys_[row]; }
+    const int8_t* vector(size_t row) const { return vectors_ + row * stride_; }
+    float scale(size_t row) const { return scales_[row]; }
+
+    // Normalize and quantize `dim()` floats, padded to stride()
+    QuantizedVector quantize(const float* values) const;
+    QuantizedVector quantize(size_t row) const;
+
+    // Cosine similarity of a quantized query with a row, or of two rows
+    float similarity(const QuantizedVector& query, size_t row) const;
+    float similarity(size_t a, size_t b) const;
+
+    DotKernel kernel() const { return kernel_; }
+
+private:
+    EmbeddingStore() = default;
+
+    void* mapping_ = nullptr;
+    size_t mapping_size_ = 0;
+    size_t dim_ = 0;
+    size_t stride_ = 0;
+    size_t count_ = 0;
+    const float* scales_ = nullptr;
+    const int8_t* vectors_ = nullptr;
+    std::vector<std::string_view> keys_;  // into the mapping
+    std::unordered_map<std::string_view, uint32_t> rows_;
+    DotKernel kernel_ = DotKernel::Scalar;
+};
+
+// Hierarchical navigable small world graph over an EmbeddingStore, for
+// approximate nearest-neighbor candidates by cosine similarity.
+//
+// Built in memory from every row of the store; only neighbor lists are
+// held here, the vectors stay in the mapping. Searches are thread safe.
+class HnswIndex {
+public:
+    // `m` links per node per layer (2m on the bottom layer);
+    // `ef_construction` candidates kept while linking each insert
+    HnswIndex(std::shared_ptr<const EmbeddingStore> store, size_t m = 16,
+              size_t ef_construction = 100, uint64_t seed = 42);
+
+    struct Neighbor {
+        uint32_t row;
+        float similarity;
+    };
+
+    // Up to `k` rows most similar to `query`, most similar first. `ef`
+    // (at least k) trades recall for time.
+    std::vector<Neighbor> search(const QuantizedVector& query, size_t k, size_t ef) const;
+
+    const EmbeddingStore& store() const { return *store_; }
+    size_t size() const { return levels_.size(); }
+
+private:
+    std::shared_ptr<const EmbeddingStore> store_;
+    size_t m_;
+    size_t ef_construction_;
+    int max_level_ = -1;
+    uint32_t entry_point_ = 0;
+    std::vector<uint8_t> levels_;                      // top layer of each row
+    std::vector<uint32_t> bottom_links_;               // 2m slots per row
+    std::vector<uint32_t> bottom_counts_;
+    std::vector<std::vector<std::vector<uint32_t>>> upper_links_;  // [row][level - 1]
+
+    void links(uint32_t row, int level, const uint32_t** begin, size_t* count) const;
+    void setLinks(uint32_t row, int level, const std::vector<uint32_t>& links);
+
+    // Greedy walk down the upper layers to the best entry for `level`
+    template <typename Similarity>
+    uint32_t descend(const Similarity& similarity, int level) const;
+    // Best-first search of one layer, `ef` results most similar first
+    template <typename Similarity, typename Visited>
+    std::vector<Neighbor> searchLayer(const Similarity& similarity, uint32_t entry, size_t ef,
+                                      int level, Visited& visited) const;
+    // The paper's heuristic: skip a candidate closer to an already chosen
+    // neighbor than to the node, which keeps links spread across clusters
+    std::vector<uint32_t> selectNeighbors(const std::vector<Neighbor>& candidates,
+                                          size_t max_links) const;
+    void insert(uint32_t row, int level, std::vector<uint32_t>& visited_marks, uint32_t& mark);
+};
+
+} // namespace atlas
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+#include "search_service.h"
+
+namespace atlas {
+
+// Kernels summing popcount(x[i] & y[i]) over dense bitmap words
+enum class PopcountKernel {
+    Scalar,         // __builtin_popcountll without -mpopcnt: a libgcc call per word
+    Popcnt,         // popcnt, one word per step
+    Avx512Vpopcnt,  // vpopcntq (AVX-512 VPOPCNTDQ), 8 words per step
+};
+
+// Fastest kernel this CPU supports (checked once at runtime)
+PopcountKernel bestPopcountKernel();
+const char* popcountKernelName(PopcountKernel kernel);
+
+// Sum of popcount(x[i] & y[i]) for `n` words (n a multiple of 8)
+uint64_t andPopcount(const uint64_t* x, const uint64_t* y, size_t n, PopcountKernel kernel);
+
+// Compressed bitmap of 32-bit doc ordinals in the roaring layout: one
+// container per 65536-ordinal chunk, kept as a sorted array of low 16 bits
+// while sparse and as a 1024-word bitmap once it holds more than 4096.
+class RoaringBitmap {
+public:
+    void add(uint32_t value);
+    void remove(uint32_t value);
+    bool contains(uint32_t value) const;
+
+    uint64_t cardinality() const;
+
+    // |this AND other| without materializing the intersection. Dense
+    // containers are intersected word by word with popcount.
+    uint64_t andCardinality(const RoaringBitmap& other) const;
+
+    bool empty() const { return containers_.empty(); }
+
+    // Call fn(value) for every value, in ascending order
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (const auto& container : containers_) {
+            uint32_t high = static_cast<uint32_t>(container.key) << 16;
+            if (!container.is_bitmap) {
+                for (uint16_t low : container.array) fn(high | low);
+                continue;
+            }
+            for (size_t word = 0; word < kBitmapWords; ++word) {
+                for (uint64_t bits = container.bitmap[word]; bits != 0; bits &= bits - 1) {
+                    fn(high | static_cast<uint32_t>(word * 64 + __builtin_ctzll(bits)));
+                }
+            }
+        }
+    }
+
+private:
+    static constexpr size_t kArrayMax = 4096;
+    static constexpr size_t kBitmapWords = 1024;
+
+    struct Container {
+        uint16_t key;                  // high 16 bits
+        std::vector<uint16_t> array;   // sorted; used while !is_bitmap
+        std::vector<uint64_t> bitmap;  // kBitmapWords words once dense
+        uint32_t cardinality = 0;
+        bool is_bitmap = false;
+
+        bool contains(uint16_t low) const;
+        void add(uint16_t low);
+        void remove(uint16_t low);
+    };
+
+    std::vector<Container> containers_;  // sorted by key
+
+    Container* find(uint16_t key);
+    const Container* find(uint16_t key) const;
+    static uint64_t andCardinality(const Container& a, const Container& b);
+};
+
+// Local attribute index for facet counts: attribute value -> bitmap of dense
+// doc ordinals, one map per facet field. Counting a result set is one
+// bitmap intersection per value instead of an ES aggregation.
+//
+// Fed from the products index like TitleIndex: a full scan swapped in on
+// rebuild, then pulls of documents updated since the newest `updated_at`.
+class FacetIndex {
+public:
+    explicit FacetIndex(const std::vector<std::string>& fields);
+
+    const std::vector<std::string>& fields() const { return fields_; }
+
+    // Replace a product's values; a field may be missing, a string or an
+    // array of strings
+    void upsert(const std::string& id, const nlohmann::json& source);
+    void remove(const std::string& id);
+
+    size_t size() const;
+
+    // Bitmap of the ordinals of these products (unknown IDs are skipped)
+    RoaringBitmap candidates(const std::vector<std::string>& ids) const;
+
+    // Counts of `field` values within `candidates`, highest first, at most
+    // `top_n`. Unknown fields give an empty list. Costs one posting-list
+    // intersection per value of the field, or one lookup per candidate when
+    // there are fewer candidates than values, whichever is smaller.
+    std::vector<FacetCount> counts(const std::string& field, const RoaringBitmap& candidates,
+                                   size_t top_n) const;
+
+    // Candidates and counts for each of `fields` under one lock, so a
+    // concurrent rebuild can't renumber ordinals in between
+    std::vector<FacetResult> facets(const std::vector<std::string>& ids,
+                                    const std::vector<std::string>& fields, size_t top_n) const;
+
+    // See TitleIndex::refresh
+    size_t refresh(ElasticsearchClient& es, bool full = false);
+
+private:
+    struct Tables {
+        std::unordered_map<std::string, uint32_t> by_id;
+        std::vector<uint32_t> free_ordinals;
+        uint32_t next_ordinal = 0;
+        // Per field (same order as fields_): value -> docs
+        std::vector<std::unordered_map<std::string, RoaringBitmap>> postings;
+        // Per ordinal: (field, value) pairs, to clear bits on update
+        std::unordered_map<uint32_t, std::vector<std::pair<size_t, std::string>>> doc_values;
+
+        void upsert(const std::vector<std::string>& fields, const std::string& id,
+                    const nlohmann::json& source);
+        void remove(const std::string& id);
+    };
+
+    std::vector<std::string> fields_;
+    mutable std::shared_mutex mutex_;
+    Tables tables_;
+    IndexSyncWatermark watermark_;
+
+    RoaringBitmap candidatesLocked(const std::vector<std::string>& ids) const;
+    std::vector<FacetCount> countsLocked(const std::string& field, const RoaringBitmap& candidates,
+                                         size_t top_n) const;
+};
+
+} // namespace atlas
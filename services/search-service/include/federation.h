@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <nlohmann/json.hpp>
+#include "search_service.h"
+
+namespace atlas {
+
+// One index on one cluster taking part in a federated search
+struct BackendConfig {
+    std::string name;
+    std::string host;
+    int port;
+    std::string index;
+    int deadline_ms;
+};
+
+// Scatter-gather over several ES indexes/clusters. Each query is sent to all
+// backends concurrently (curl multi, on the calling thread) with a hard
+// per-backend deadline, and ES is asked to stop early enough to return the
+// hits it has by then (partial results); scores are
+// normalized per backend (divided by that backend's max_score, since BM25
+// scores aren't comparable across indexes) and merged with a k-way heap.
+// Backends that fail or miss their deadline are dropped and the merged
+// response is flagged partial.
+class FederatedSearcher {
+public:
+    explicit FederatedSearcher(const std::vector<BackendConfig>& backends);
+    ~FederatedSearcher();
+
+    // Returns an ES-shaped response (hits.total, hits.hits, took, _shards,
+    // timed_out) plus a "federation" object with per-backend status
+    nlohmann::json search(const std::string& query, int size, const SearchFilters& filters,
+                          const EsQueryOptions& options);
+
+    size_t backendCount() const { return backends_.size(); }
+
+    // Parse "name=host:port/index[@deadline_ms],..." (deadline defaults to
+    // `default_deadline_ms`). Throws std::invalid_argument on malformed input.
+    static std::vector<BackendConfig> parseBackends(const std::string& spec, int default_deadline_ms);
+
+    // ES `timeout` for a backend with this client deadline: short enough
+    // that ES's partial response still arrives before the deadline
+    static int esTimeoutMs(int deadline_ms);
+
+    // Merge per-backend hit lists (each sorted by descending _score) into the top k
+    static std::vector<nlohmann::json> mergeTopK(const std::vector<std::vector<nlohmann::json>>& hit_lists,
+                                                 size_t k);
+
+    static std::vector<BackendStatus> parseBackendStatuses(const nlohmann::json& merged_response);
+
+private:
+    std::vector<BackendConfig> backends_;
+    std::vector<std::unique_ptr<ElasticsearchClient>> clients_;
+};
+
+} // namespace atlas
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <optional>
+#include "search_service.h"
+
+namespace atlas {
+
+// Candidate set fetched from ES for one search-as-you-type session
+struct CandidateSet {
+    std::string normalized_query;
+    std::string filters_key;
+    std::vector<SearchResult> candidates;  // ranked, possibly narrowed by later keystrokes
+    std::chrono::steady_clock::time_point fetched_at;
+};
+
+// Per-session candidate sets for search-as-you-type. When the next keystroke
+// refines the previous query ("blu" -> "blue" -> "blue s"), the session's
+// candidates are filtered and rescored locally instead of asking ES again.
+// The candidates are not a superset of the refinement's ES hits (ES matches
+// whole words, so "blu" may find nothing where "blue" finds plenty), which
+// is why a set is only used while a full page of it survives.
+class IncrementalSessionStore {
+public:
+    IncrementalSessionStore(size_t max_sessions, int max_age_ms);
+
+    // The session's candidate set if `normalized_query` refines its query,
+    // the filters are unchanged and the set is not older than max_age_ms
+    std::optional<CandidateSet> lookup(const std::string& session,
+                                       const std::string& normalized_query,
+                                       const std::string& filters_key);
+
+    void store(const std::string& session, const CandidateSet& candidates);
+
+    size_t size();
+
+    // True if `next` extends `previous` ("blu" -> "blue", "blue" -> "blue s")
+    static bool isRefinement(const std::string& previous, const std::string& next);
+
+private:
+    struct Entry {
+        std::string session;
+        CandidateSet candidates;
+    };
+
+    size_t max_sessions_;
+    std::chrono::milliseconds max_age_;
+
+    std::mutex mutex_;
+    std::list<Entry> lru_;  // most recently used at front
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+} // namespace atlas
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+namespace atlas {
+
+// Features the reranker computes for each hit in the rerank window, in the
+// order of the feature matrix passed to LtrModel::score
+enum LtrFeature : int {
+    kLtrEsScore,      // ES _score
+    kLtrRecency,      // e^(-days/30)
+    kLtrTitleMatch,   // fraction of query terms in the title (1.0 on phrase match)
+    kLtrEsRank,       // 0-based position in ES order
+    kLtrQueryTerms,   // number of query terms
+    kLtrTitleTerms,   // number of title words
+    kLtrSemantic,     // query/product embedding cosine similarity (0 without embeddings)
+    kLtrCategoryProximity,  // taxonomy proximity to the predicted category (0 without a taxonomy)
+    kNumLtrFeatures
+};
+
+const char* ltrFeatureName(int feature);
+
+// Gradient-boosted tree ensemble for learned-to-rank reranking.
+//
+// Loads XGBoost (`dump_model(..., dump_format="json")`, optionally wrapped as
+// {"base_score": b, "trees": [...]}) and LightGBM (`dump_model()`) JSON.
+// Split features are named after LtrFeature (`es_score`, `recency`, ...) or
+// given as XGBoost's default `f<index>`.
+//
+// Evaluation uses QuickScorer: per feature, all split nodes of all trees
+// sorted by threshold in contiguous arrays. A document walks each feature's
+// list only up to its value, ANDing a 64-bit leaf mask into the owning
+// tree for every false split; each tree's exit leaf is then the lowest set
+// bit. No pointer chasing and no unpredictable branches per tree. Ensembles
+// with a tree over 64 leaves fall back to a flattened node-array traversal.
+class LtrModel {
+public:
+    // Throws std::runtime_error if the file can't be read and
+    // std::invalid_argument if the model is malformed or uses unknown features
+    static std::shared_ptr<const LtrModel> load(const std::string& path);
+    static std::shared_ptr<const LtrModel> fromJson(const nlohmann::json& model);
+
+    // Score `num_docs` rows of kNumLtrFeatures floats (row-major) into `out`
+    void score(const float* features, size_t num_docs, double* out) const;
+
+    // Reference traversal over the node array, for tests and benchmarks
+    double scoreTraversal(const float* features) const;
+
+    size_t treeCount() const { return roots_.size(); }
+    bool usesQuickScorer() const { return quick_scorer_; }
+
+    // Stable hash of the model, mixed into the ranking version
+    uint64_t fingerprint() const { return fingerprint_; }
+
+private:
+    // Flattened tree nodes: internal nodes go left when x[feature] <= threshold
+    struct Node {
+        int32_t feature;  // -1 for a leaf
+        float threshold;
+        uint32_t left;
+        uint32_t right;
+        float leaf_value;
+    };
+
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> roots_;
+    double base_score_ = 0.0;
+    uint64_t fingerprint_ = 0;
+
+    // QuickScorer split node: 16 bytes, so a feature's splits stream through
+    // the cache as one array
+    struct Split {
+        float threshold;
+        uint32_t tree;
+        uint64_t mask;  // zeros at the node's left-subtree leaves
+    };
+
+    bool quick_scorer_ = false;
+    std::vector<uint32_t> feature_offsets_;  // kNumLtrFeatures + 1, into splits_
+    std::vector<Split> splits_;              // grouped by feature, thresholds ascending
+    std::vector<float> leaf_values_;         // 64 per tree, in left-to-right leaf order
+
+    void buildQuickScorer();
+    uint32_t addXgboostNode(const nlohmann::json& node);
+    uint32_t addLightgbmNode(const nlohmann::json& node, const std::vector<int>& feature_map);
+};
+
+} // namespace atlas
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+
+namespace atlas {
+
+struct QueryCount {
+    std::string query;
+    double count;  // decayed occurrences as of now; overestimates by at most `error`
+    double error;
+};
+
+struct TrendingQuery {
+    std::string query;
+    double recent_rate;    // per second, over the last few trend half-lives
+    double baseline_rate;  // per second, over the last few heavy-hitter half-lives
+};
+
+struct QueryStatsConfig {
+    size_t capacity = 4096;          // Space-Saving counters, across all shards
+    size_t sketch_width = 2048;      // Count-Min counters per row, per shard
+    size_t sketch_depth = 4;
+    size_t shards = 16;
+    double half_life_s = 3600.0;     // heavy hitters
+    double trend_half_life_s = 300.0;  // Count-Min recent counts
+    size_t max_query_bytes = 128;    // longer queries are tracked by their prefix
+};
+
+// Streaming query frequencies in fixed memory, however many distinct
+// queries arrive.
+//
+// Space-Saving keeps `capacity` counters. A query without one takes over the
+// smallest, inheriting its count as the error bound, so every query heavier
+// than 1/capacity of the stream is guaranteed a counter. A Count-Min sketch
+// (conservative update) estimates recent counts of any query, tracked or
+// not. Both decay exponentially with forward decay: an occurrence at time t
+// adds 2^(t / half-life) relative to a landmark, so nothing is rewritten as
+// time passes and counters are rescaled only when the weights grow large.
+//
+// Queries are hash-partitioned over shards with one lock each, so threads
+// recording different queries rarely meet. Callers pass normalized queries.
+class QueryStats {
+public:
+    // `clock` returns seconds on any monotonic scale (tests inject one)
+    explicit QueryStats(const QueryStatsConfig& config = QueryStatsConfig(),
+                        std::function<double()> clock = nullptr);
+    ~QueryStats();
+
+    void record(const std::string& query);
+
+    // Decayed count with the trend half-life (Count-Min; never underestimates)
+    double recentCount(const std::string& query) const;
+
+    // Heaviest queries by decayed count, heaviest first
+    std::vector<QueryCount> top(size_t k) const;
+
+    // Tracked queries whose recent rate is at least `min_ratio` times their
+    // baseline rate, with at least `min_recent` recent occurrences, by how
+    // far the recent rate exceeds the baseline
+    std::vector<TrendingQuery> trending(size_t k, double min_ratio = 2.0, double min_recent = 5.0) const;
+
+    // Write the `k` heaviest queries in warm-up file format (atomically,
+    // through a temporary file). Throws std::runtime_error on failure.
+    size_t writeTopQueries(const std::string& path, size_t k) const;
+
+    // Fixed footprint of the counters, sketches and tracked query text
+    size_t memoryBytes() const;
+    size_t tracked() const;
+
+private:
+    struct Shard;
+
+    QueryStatsConfig config_;
+    std::function<double()> clock_;
+    double decay_;        // ln 2 / half_life_s
+    double trend_decay_;  // ln 2 / trend_half_life_s
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    Shard& shardFor(uint64_t hash) const { return *shards_[hash % shards_.size()]; }
+    std::string key(const std::string& query) const;
+};
+
+} // namespace atlas
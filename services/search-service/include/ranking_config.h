@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+namespace atlas {
+
+// Tunable rerank weights, feature settings and the ES query template. A
+// loaded config is immutable: the service publishes each one as a new
+// snapshot (see RcuPtr) and every request ranks with the snapshot it
+// started with.
+//
+// Loaded from JSON; keys left out keep the base config's values:
+//   {"version": "2026-10-18.1",
+//    "weights": {"es_score": 0.7, "recency": 0.2, "title_match": 0.1,
+//                "semantic": 0.2, "category": 0.1},
+//    "recency_decay_days": 30,
+//    "query": {"fields": ["title^3", "description"], "type": "best_fields"}}
+struct RankingConfig {
+    std::string version;               // reported with every response
+    double es_weight = 0.7;
+    double recency_weight = 0.2;
+    double title_match_weight = 0.1;
+    double semantic_weight = 0.2;      // applies when the semantic rerank is enabled
+    double taxonomy_weight = 0.1;      // applies when a taxonomy is loaded
+    double recency_decay_days = 30.0;  // recency = e^(-days / recency_decay_days)
+    std::vector<std::string> query_fields = {"title^3", "description"};
+    std::string match_type = "best_fields";
+    uint64_t fingerprint = 0;          // hash of everything but `version`
+
+    // Throws std::runtime_error if the file can't be read and
+    // std::invalid_argument on malformed or out-of-range values
+    static RankingConfig load(const std::string& path, const RankingConfig& base);
+    static RankingConfig fromJson(const nlohmann::json& config, const RankingConfig& base);
+    static RankingConfig load(const std::string& path) { return load(path, RankingConfig()); }
+    static RankingConfig fromJson(const nlohmann::json& config) { return fromJson(config, RankingConfig()); }
+
+    // Settings in the file format, without `version`
+    nlohmann::json toJson() const;
+
+    // Compute the fingerprint; a missing version becomes its hex form
+    void seal();
+};
+
+} // namespace atlas
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace atlas {
+
+// Epoch-based reclamation for read-copy-update objects.
+//
+// Readers announce the global epoch in a per-thread slot on entry and clear
+// it on exit: one store and a fence, with no shared counter written. A
+// writer unlinks the old object, bumps the epoch, and frees the object once
+// every slot is either idle or announces a later epoch, since only readers
+// that entered before the bump can still hold it.
+//
+// One domain serves the whole process, so a thread needs a single slot no
+// matter how many RcuPtrs it reads. Slots of exited threads are reused.
+class EpochDomain {
+public:
+    static EpochDomain& instance();
+
+    // Read-side critical section on the calling thread; nestable. Prefer
+    // RcuReadGuard.
+    void enter();
+    void leave();
+
+    // Delete `object` with `deleter` once no reader can still see it. The
+    // object must already be unreachable for new readers.
+    void retire(void* object, void (*deleter)(void*));
+
+    // Free whatever no reader can see any more; returns the number of
+    // objects still waiting
+    size_t reclaim();
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+private:
+    struct alignas(64) Reader {
+        std::atomic<uint64_t> epoch{0};  // 0 while outside a critical section
+        std::atomic<bool> in_use{false};
+        Reader* next = nullptr;          // readers are never freed, only reused
+    };
+
+    struct Retired {
+        void* object;
+        void (*deleter)(void*);
+        uint64_t epoch;  // epoch current when the object was unlinked
+    };
+
+    std::atomic<uint64_t> epoch_{1};
+    std::atomic<Reader*> readers_{nullptr};
+    std::mutex retired_mutex_;
+    std::vector<Retired> retired_;
+
+    EpochDomain() = default;  // never destroyed, see instance()
+
+    Reader* acquireReader();
+    static void releaseReader(Reader* reader);
+    size_t reclaimLocked();
+
+    friend struct ThreadReader;
+};
+
+class RcuReadGuard {
+public:
+    RcuReadGuard() { EpochDomain::instance().enter(); }
+    ~RcuReadGuard() { EpochDomain::instance().leave(); }
+
+    RcuReadGuard(const RcuReadGuard&) = delete;
+    RcuReadGuard& operator=(const RcuReadGuard&) = delete;
+};
+
+// Pointer to an immutable object that is read constantly and replaced
+// rarely. Readers load it inside an RcuReadGuard without locks or reference
+// counts; publish() swaps in a new object and retires the old one.
+template <typename T>
+class RcuPtr {
+public:
+    explicit RcuPtr(std::unique_ptr<const T> initial = nullptr) : current_(initial.release()) {}
+
+    // No reader may still be using this pointer
+    ~RcuPtr() { delete current_.load(std::memory_order_relaxed); }
+
+    RcuPtr(const RcuPtr&) = delete;
+    RcuPtr& operator=(const RcuPtr&) = delete;
+
+    // Valid until the enclosing RcuReadGuard ends
+    const T* get() const { return current_.load(std::memory_order_seq_cst); }
+
+    void publish(std::unique_ptr<const T> next) {
+        const T* previous = current_.exchange(next.release(), std::memory_order_seq_cst);
+        if (previous) {
+            EpochDomain::instance().retire(const_cast<T*>(previous),
+                                           [](void* object) { delete static_cast<T*>(object); });
+        }
+    }
+
+private:
+    std::atomic<const T*> current_;
+};
+
+} // namespace atlas
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "search_service.h"
+#include "snippets.h"
+
+namespace atlas {
+
+enum class ResponseFormat {
+    Json,
+    Cbor,
+    MessagePack
+};
+
+enum class ContentEncoding {
+    Identity,
+    Gzip,
+    Deflate
+};
+
+// Pick the response format from an Accept header (JSON unless the client
+// prefers application/cbor or application/msgpack)
+ResponseFormat negotiateFormat(const std::string& accept);
+
+// Pick gzip/deflate from an Accept-Encoding header, honoring q-values
+ContentEncoding negotiateEncoding(const std::string& accept_encoding);
+
+const char* contentTypeFor(ResponseFormat format);
+const char* contentEncodingName(ContentEncoding encoding);
+
+// Strong ETag for one representation of a result page: the page hash plus
+// format, explain flag, negotiated encoding and highlight mode, e.g. "9f2c...-j1g"
+std::string makeETag(uint64_t results_hash, ResponseFormat format, bool explain,
+                     ContentEncoding encoding, HighlightMode highlight = HighlightMode::None);
+
+// If-None-Match check ("*" or a list of tags; W/ prefixes compared weakly)
+bool etagMatches(const std::string& if_none_match, const std::string& etag);
+
+// Compress with zlib (gzip or zlib-wrapped deflate)
+std::string compressBody(const std::string& body, ContentEncoding encoding);
+
+// Streaming encoder: values are appended straight to the output buffer, no
+// intermediate DOM. Container sizes are required up front because CBOR and
+// MessagePack are length-prefixed.
+class ResponseWriter {
+public:
+    explicit ResponseWriter(ResponseFormat format);
+
+    void beginObject(size_t num_fields);
+    void endObject();
+    void beginArray(size_t num_items);
+    void endArray();
+
+    void key(const std::string& name);
+    void value(const std::string& str);
+    void value(const char* str) { value(std::string(str)); }
+    void value(double number);
+    void value(int64_t number);
+    void value(int number) { value(static_cast<int64_t>(number)); }
+    void value(bool flag);
+
+    std::string take() { return std::move(out_); }
+
+private:
+    ResponseFormat format_;
+    std::string out_;
+
+    // JSON only: whether the current container needs a comma before the next element
+    std::vector<bool> needs_comma_;
+    bool after_key_;
+
+    void beforeValue();
+    void writeString(const std::string& str);
+    void writeCborHeader(uint8_t major_type, uint64_t length);
+    void writeBigEndian(uint64_t value, int bytes);
+};
+
+// Encode a /search response. The per-hit score breakdown (es_score,
+// recency_score, title_match_score) is only written when `explain` is set;
+// a per-hit `highlight` object only when `highlight` is not None.
+std::string encodeSearchResponse(const SearchResponse& response, const std::string& query,
+                                 int size, bool explain, ResponseFormat format,
+                                 HighlightMode highlight = HighlightMode::None);
+
+} // namespace atlas
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <optional>
+#include "search_service.h"
+
+namespace atlas {
+
+// Bounded LRU cache of ranked result pages with a short TTL. Entries expire
+// quickly because the consumer keeps updating products underneath them.
+class ResultCache {
+public:
+    ResultCache(size_t capacity, int ttl_ms);
+
+    // Returns the cached page if present and not expired. Expired pages stay
+    // until evicted and are returned when `allow_stale` is set (brownout).
+    std::optional<SearchResponse> get(const std::string& key, bool allow_stale = false);
+
+    void put(const std::string& key, const SearchResponse& response);
+
+    size_t size();
+
+private:
+    struct Entry {
+        std::string key;
+        SearchResponse response;
+        std::chrono::steady_clock::time_point expires_at;
+    };
+
+    size_t capacity_;
+    std::chrono::milliseconds ttl_;
+
+    std::mutex mutex_;
+    std::list<Entry> lru_;  // most recently used at front
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+};
+
+} // namespace atlas
@@ -3,7 +3,15 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <cstdint>
+#include <functional>
 #include <nlohmann/json.hpp>
+#include "brownout.h"
+#include "rcu.h"
+#include "ranking_config.h"
 
 namespace atlas {
 
@@ -16,47 +24,461 @@ struct SearchResult {
     double recency_score;
     double title_match_score;
     std::string updated_at;
+    int64_t version = 0;  // product version written by the consumer
+    bool pinned = false;  // exact title match from the local index, not ranked by ES
+    double semantic_score = 0.0;  // query/product embedding cosine similarity
+    bool ann = false;     // nearest-neighbor candidate from the HNSW index, not matched by ES
+    std::string category;         // first `category` value, for the taxonomy boost
+    double category_score = 0.0;  // taxonomy proximity to the query's predicted category
+};
+
+// Structured filters. These run in ES filter context (no scoring), so ES
+// caches them as bitsets and the reranker never sees them.
+struct SearchFilters {
+    std::vector<std::string> categories;  // match any
+    std::optional<double> min_price;
+    std::optional<double> max_price;
+    std::optional<bool> in_stock;
+
+    bool empty() const {
+        return categories.empty() && !min_price && !max_price && !in_stock;
+    }
+};
+
+// Per-query execution stats reported by Elasticsearch
+struct EsQueryStats {
+    int took_ms = 0;
+    bool timed_out = false;
+    int shards_total = 0;
+    int shards_successful = 0;
+    int shards_skipped = 0;
+    int shards_failed = 0;
+};
+
+// Outcome of one backend in a federated search
+struct BackendStatus {
+    std::string name;
+    bool ok = false;
+    int took_ms = 0;
+    int hits = 0;
+    std::string error;
+};
+
+struct FacetCount {
+    std::string value;
+    int count;
+};
+
+struct FacetResult {
+    std::string field;
+    std::vector<FacetCount> values;  // highest count first
 };
 
 struct SearchResponse {
     std::vector<SearchResult> results;
     int total;
+    bool total_lower_bound = false;  // answered from the title index or a session's candidates: ES was not counted
     int latency_ms;
+    EsQueryStats es_stats;
+    uint64_t results_hash = 0;  // hash of result IDs, versions and ranking version
+    bool cache_hit = false;
+    std::string plan = "normal";  // brownout plan that served the request
+    bool partial = false;         // some federated backends failed or timed out
+    bool incremental = false;     // served from the session's candidate set, no ES call
+    bool shed = false;            // cache miss for a tail query under brownout: ES was not asked
+    int pinned = 0;               // leading results pinned by the exact-title index
+    int ann = 0;                  // trailing results from the HNSW index
+    int collapsed = 0;            // hits dropped as near-duplicates of a higher one
+    bool semantic = false;        // a query embedding was available for the rerank
+    std::string corrected_query;  // set when the page is for a spelling-corrected query
+    std::string predicted_category;  // category the taxonomy boost ranked toward, if any
+    std::string config_version;   // version of the ranking config that ranked the page
+    std::vector<BackendStatus> backends;  // empty unless federated
+    std::vector<FacetResult> facets;      // empty unless requested
+    bool facets_sampled = false;          // counted over the top facet window, not every match
+};
+
+// Per-request knobs for cheaper ES queries (set by brownout plans)
+struct EsQueryOptions {
+    bool include_description = true;  // false: exclude `description` from _source
+    int terminate_after = 0;           // per-shard doc collection limit; 0 = off
+    int client_timeout_ms = 0;         // hard HTTP deadline; 0 = default (10s)
+    bool ids_only = false;             // no _source at all (facet candidate lists)
+    std::vector<std::string> exclude_ids;  // already on the page (pinned); must_not match
+    // multi_match template, from the ranking config
+    std::vector<std::string> query_fields = {"title^3", "description"};
+    std::string match_type = "best_fields";
+};
+
+// Normalize a query for hashing/caching: lowercase, trim, collapse whitespace
+std::string normalizeQuery(const std::string& query);
+
+// FNV-1a 64-bit: stable across processes and replicas, unlike std::hash
+uint64_t stableHash(const std::string& data);
+
+// First value of a `category` field that may be a string or an array
+std::string firstCategory(const nlohmann::json& source);
+
+class ElasticsearchClient;
+
+// Where the local indexes' delta pulls (title, facet, spelling) resume. It
+// follows `indexed_at`, which the consumer stamps when it writes a document
+// (falling back to `updated_at` for documents from before that), not the
+// event's own timestamp: a replayed or late event carries an old
+// `updated_at` but is indexed now. Stamps still don't become searchable in
+// order (parallel lanes, bulk retries, ES refresh lag), so each pull goes
+// back kOverlap before the newest stamp seen. Re-applying those documents
+// is harmless.
+class IndexSyncWatermark {
+public:
+    static constexpr const char* kOverlap = "60s";  // ES date math
+
+    // Fields a scan must fetch for observe()
+    static const std::vector<std::string>& fields();
+
+    // Range query for the next pull; match_all before anything was seen
+    nlohmann::json query() const;
+
+    // Note a scanned document's stamp
+    void observe(const nlohmann::json& source);
+
+    const std::string& newest() const { return newest_; }
+
+private:
+    std::string newest_;  // ISO 8601 UTC sorts lexicographically
+};
+
+// One search of ElasticsearchClient::searchConcurrently and its outcome
+struct ConcurrentSearch {
+    ElasticsearchClient* client;
+    int timeout_ms;          // ES-side `timeout`
+    EsQueryOptions options;  // client_timeout_ms is the hard deadline
+    nlohmann::json response;
+    std::string error;       // empty on success
+    int elapsed_ms = 0;
 };
 
 class ElasticsearchClient {
 public:
-    ElasticsearchClient(const std::string& host, int port);
+    ElasticsearchClient(const std::string& host, int port, const std::string& index = "products");
     ~ElasticsearchClient();
 
+    const std::string& index() const { return index_; }
+
     // Perform multi_match search
-    nlohmann::json search(const std::string& query, int size, int timeout_ms = 5000);
+    nlohmann::json search(const std::string& query, int size, int timeout_ms = 5000,
+                          const SearchFilters& filters = SearchFilters(),
+                          const EsQueryOptions& options = EsQueryOptions());
+
+    // Run one search per entry at the same time from the calling thread,
+    // over a single curl multi handle. Each entry gets its own deadline, so
+    // this returns once the slowest one has answered or timed out.
+    static void searchConcurrently(std::vector<ConcurrentSearch>& searches, const std::string& query,
+                                   int size, const SearchFilters& filters);
+
+    // Build the request body: multi_match, wrapped in bool.filter when filtered
+    static nlohmann::json buildSearchBody(const std::string& query, int size, int timeout_ms,
+                                          const SearchFilters& filters,
+                                          const EsQueryOptions& options = EsQueryOptions());
+
+    // Route identical queries to the same shard copies via `preference` so
+    // the per-shard request cache and page cache stay warm (default: on)
+    void setShardAffinity(bool enabled) { shard_affinity_ = enabled; }
+
+    // Stable `preference` value for a query (hash of the normalized query)
+    static std::string preferenceKey(const std::string& query);
+
+    // True if the request body is deterministic and safe for the shard
+    // request cache (no `now`-relative date math)
+    static bool isCacheable(const nlohmann::json& search_body);
+
+    // Extract took/timed_out/_shards from a search response
+    static EsQueryStats parseQueryStats(const nlohmann::json& es_response);
+
+    // Fetch documents by ID with _mget: {"docs": [{"_id", "found", "_source"}]}
+    // in request order
+    nlohmann::json getDocuments(const std::vector<std::string>& ids,
+                                const EsQueryOptions& options = EsQueryOptions());
+
+    // Visit every document matching `query` in index order with the scroll
+    // API, fetching only `source_fields`. Returns the number of hits visited.
+    size_t scan(const nlohmann::json& query, const std::vector<std::string>& source_fields,
+                const std::function<void(const nlohmann::json& hit)>& visit, int batch_size = 1000);
+
+    // Open up to `connections` keep-alive connections in parallel and park
+    // them in the pool. Returns the number of connections that succeeded.
+    int warmConnections(int connections);
 
 private:
     std::string host_;
     int port_;
+    std::string index_;
     std::string base_url_;
+    bool shard_affinity_ = true;
+
+    // Pool of idle CURL easy handles (using void* to avoid exposing curl in header).
+    // A reused handle keeps its connection and DNS cache alive between requests.
+    std::mutex pool_mutex_;
+    std::vector<void*> idle_handles_;
+
+    void* acquireHandle();
+    void releaseHandle(void* handle);
     
+    // URL of a search for `query` with this request body
+    std::string searchUrl(const std::string& query, const nlohmann::json& search_body) const;
+
+    // Set up a (reset) handle for one request; the caller frees `headers`
+    static void prepareHandle(void* handle, const std::string& url, const std::string& post_data,
+                              long timeout_ms, const char* method, void*& headers, std::string& response);
+
     // HTTP request helper
-    std::string performRequest(const std::string& url, const std::string& post_data = "");
+    std::string performRequest(const std::string& url, const std::string& post_data = "",
+                               long timeout_ms = 10000, const char* method = nullptr);
 };
 
+class ResultCache;
+class FederatedSearcher;
+class IncrementalSessionStore;
+class TitleIndex;
+class FacetIndex;
+class LtrModel;
+class EmbeddingStore;
+class SpellingIndex;
+class Taxonomy;
+class QueryStats;
+class DuplicateClusters;
+class HnswIndex;
+struct QuantizedVector;
+
 class SearchService {
 public:
     SearchService(const std::string& es_host, int es_port);
     ~SearchService();
 
-    // Main search endpoint
-    SearchResponse search(const std::string& query, int size = 10);
+    // Main search endpoint. `query_vector` is the caller's embedding of the
+    // query, used by the semantic rerank when there's no precomputed one.
+    SearchResponse search(const std::string& query, int size = 10,
+                          const SearchFilters& filters = SearchFilters(),
+                          const std::vector<float>& query_vector = {});
+
+    // Warm-up before taking traffic: open pooled ES connections, then replay
+    // the queries in `queries_file` (may be empty) to warm ES caches and our
+    // own code paths. Marks the service ready when done, even if some
+    // queries failed. Returns the number of queries replayed.
+    int warmUp(const std::string& queries_file, int connections = 4);
+
+    // Readiness (distinct from liveness): true once warmUp() has completed
+    bool isReady() const { return ready_.load(); }
+
+    // Load warm-up queries: one per line, blank lines and '#' comments skipped
+    static std::vector<std::string> loadWarmupQueries(const std::string& path);
+
+    // Cache ranked pages for `ttl_ms`, keyed by normalized query, size and filters
+    void enableResultCache(size_t capacity, int ttl_ms);
+
+    // Degrade expensive features under overload (see BrownoutController)
+    void enableBrownout(const BrownoutConfig& config);
+    BrownoutController* brownout() { return brownout_.get(); }
+
+    // Fan every query out to these backends instead of the single ES client
+    void enableFederation(std::unique_ptr<FederatedSearcher> federation);
+
+    // Search-as-you-type: keep up to `candidate_count` ranked candidates per
+    // session so refining keystrokes are answered locally
+    void enableIncrementalSearch(size_t max_sessions, int max_age_ms, int candidate_count);
+
+    // Search within a typing session. If `query` refines the session's previous
+    // query, its candidates are filtered and rescored with the title-match
+    // kernel; ES is only asked when too few remain or the set is stale.
+    SearchResponse searchIncremental(const std::string& session, const std::string& query,
+                                     int size = 10, const SearchFilters& filters = SearchFilters(),
+                                     const std::vector<float>& query_vector = {});
+
+    // Navigational fast path: queries that exactly name at most `max_pinned`
+    // products (by normalized title) pin them to the top of the page. If they
+    // fill the page, ES is not asked at all; otherwise ES only fills the rest.
+    void enableTitleIndex(size_t max_pinned);
+    TitleIndex* titleIndex() { return title_index_.get(); }
+
+    // Facet counts from a local bitmap index over `fields` (e.g. category,
+    // brand) instead of ES aggregations. Counts cover the top `window`
+    // matches of a query, at most `top_n` values per field.
+    void enableFacets(const std::vector<std::string>& fields, int window, size_t top_n);
+    FacetIndex* facetIndex() { return facet_index_.get(); }
+
+    // Facet counts for the matches of `query`: one ids-only ES query for the
+    // top window, intersected with the attribute bitmaps. Empty when facets
+    // are disabled or brownout has shed anything. Sets `sampled` if there
+    // were more matches than the window.
+    std::vector<FacetResult> facetCounts(const std::string& query, const SearchFilters& filters,
+                                         const std::vector<std::string>& fields, bool* sampled);
+
+    // Mix facet counts into a page hash, so the ETag changes with them
+    static uint64_t hashFacets(uint64_t results_hash, const std::vector<FacetResult>& facets);
+
+    // Spelling correction instead of ES fuzziness: when a query matches
+    // fewer than `min_hits` documents, or no hit's title matches any query
+    // term, unknown terms are corrected against a local SymSpell index
+    // (see SpellingIndex) and the corrected query is searched once. Its page
+    // is served if it does better.
+    void enableSpelling(int max_edit_distance, int min_hits);
+    SpellingIndex* spellingIndex() { return spelling_.get(); }
+
+    // Scan the products index into the title, facet and spelling indexes;
+    // see TitleIndex::refresh. Returns the number of documents scanned.
+    size_t refreshLocalIndexes(bool full = false);
+
+    // Replace the linear rerank formula with a tree ensemble over the rerank
+    // window (see LtrModel). The model's fingerprint joins the ranking version.
+    void enableLtr(std::shared_ptr<const LtrModel> model);
+
+    // Semantic similarity as a rerank signal: the cosine similarity of int8
+    // query and product embeddings, added to the linear score with the
+    // config's semantic weight and given to LTR models as the `semantic`
+    // feature. Query embeddings come from `queries` (keyed by normalized
+    // query; may be null) or from the caller. Products without an embedding
+    // score 0.
+    void enableSemantic(std::shared_ptr<const EmbeddingStore> products,
+                        std::shared_ptr<const EmbeddingStore> queries);
+
+    // Embedding dimension callers must supply, 0 if semantic rerank is off
+    size_t semanticDim() const;
+
+    // When ES returns less than a page for an unfiltered query with an
+    // embedding, fill the rest with nearest neighbors from `index` (built
+    // over the product embeddings). Safe to call while serving, so the
+    // index can be built in the background.
+    void enableAnnCandidates(std::shared_ptr<const HnswIndex> index, size_t ef_search);
+
+    // Boost hits whose category is close to the query's predicted category
+    // in `taxonomy`: score += weight * depth(lca) / depth of the deeper one,
+    // with the config's category weight. The prediction comes from the
+    // taxonomy's head-query map, else from the ES-score-weighted category
+    // vote of the rerank window.
+    void enableTaxonomy(std::shared_ptr<const Taxonomy> taxonomy);
+
+    // Swap in a reloaded taxonomy while serving
+    void setTaxonomy(std::shared_ptr<const Taxonomy> taxonomy);
+
+    // Count every query served after warm-up in `stats` (top queries,
+    // trending, warm-up lists). Pages are only cached for queries seen
+    // `cache_admit_count` times recently (decayed), so one-off tail queries
+    // don't evict head pages; 0 caches everything.
+    void enableQueryStats(std::shared_ptr<QueryStats> stats, double cache_admit_count);
+    QueryStats* queryStats() { return query_stats_.get(); }
+
+    // Show one listing per near-duplicate cluster (see dedup_tool): ES is
+    // asked for `overfetch` more hits than the page needs, and in ES order
+    // only the first hit of each cluster is kept, before the rerank. Hits
+    // sharing a cluster with a pinned hit are dropped too.
+    void enableDedup(std::shared_ptr<const DuplicateClusters> clusters, double overfetch);
+
+    // Swap in a reloaded cluster table while serving
+    void setDuplicateClusters(std::shared_ptr<const DuplicateClusters> clusters);
+
+    // Search with an explicit plan instead of the brownout controller's choice
+    SearchResponse searchWithPlan(const std::string& query, int size,
+                                  const SearchFilters& filters, const SearchPlan& plan,
+                                  const std::vector<float>& query_vector = {});
+
+    // Publish new weights and query template while serving. Requests in
+    // flight finish with the snapshot they started with; the old one is
+    // freed once the last of them is done. Defaults until first called.
+    void setRankingConfig(RankingConfig config);
+
+    // Copy of the current snapshot
+    RankingConfig rankingConfig() const;
+
+    // Bumped whenever the ranking formula or its weights change
+    uint64_t rankingConfigVersion() const;
+
+    // Hash of the page identity: result IDs and versions in rank order, total,
+    // ranking version and the brownout level that shaped the page content.
+    // Stable while the ranked page is unchanged.
+    static uint64_t computeResultsHash(const SearchResponse& response, uint64_t ranking_version,
+                                       int plan_level = 0);
 
 private:
     std::unique_ptr<ElasticsearchClient> es_client_;
+    std::unique_ptr<ResultCache> result_cache_;
+    std::unique_ptr<BrownoutController> brownout_;
+    std::unique_ptr<FederatedSearcher> federation_;
+    std::unique_ptr<IncrementalSessionStore> sessions_;
+    int incremental_candidates_ = 100;
+    std::unique_ptr<TitleIndex> title_index_;
+    size_t max_pinned_ = 3;
+    std::unique_ptr<FacetIndex> facet_index_;
+    int facet_window_ = 1000;
+    size_t facet_top_n_ = 10;
+    std::unique_ptr<SpellingIndex> spelling_;
+    int spelling_min_hits_ = 3;
+    std::shared_ptr<const LtrModel> ltr_model_;
+    std::shared_ptr<const EmbeddingStore> product_embeddings_;
+    std::shared_ptr<const EmbeddingStore> query_embeddings_;
+    std::shared_ptr<const HnswIndex> ann_index_;  // std::atomic_load/store: set while serving
+    size_t ann_ef_search_ = 64;
+    std::shared_ptr<const Taxonomy> taxonomy_;   // std::atomic_load/store: hot-swapped
+    RcuPtr<RankingConfig> ranking_config_;        // read once per request under RcuReadGuard
+    std::shared_ptr<QueryStats> query_stats_;
+    double cache_admit_count_ = 0.0;
+    std::shared_ptr<const DuplicateClusters> dedup_clusters_;  // std::atomic_load/store: hot-swapped
+    double dedup_overfetch_ = 0.5;
+    std::atomic<bool> ready_{false};
 
-    // Reranking: score = 0.7 * es_score + 0.2 * recency + 0.1 * title_match
-    double calculateRerankedScore(double es_score, const std::string& updated_at, 
-                                   const std::string& title, const std::string& query);
+    uint64_t rankingConfigVersion(const RankingConfig& config) const;
+
+    // Reranking: score = es_weight * es_score + recency_weight * recency
+    // + title_match_weight * title_match (0.7 / 0.2 / 0.1 by default)
+    double calculateRerankedScore(const RankingConfig& config, double es_score,
+                                  const std::string& updated_at, const std::string& title,
+                                  const std::string& query);
     
-    double calculateRecencyScore(const std::string& updated_at);
+    // Quantized embedding of `query`: precomputed, else the caller's, else none
+    std::optional<QuantizedVector> queryEmbedding(const std::string& query,
+                                                  const std::vector<float>& supplied) const;
+
+    // Set semantic_score on the first `count` results and add it to their
+    // score; zero when `query` is null
+    void applySemantic(const RankingConfig& config, std::vector<SearchResult>& results, size_t count,
+                       const QuantizedVector* query) const;
+
+    // Set category_score on the first `count` results and add the boost to
+    // their score; returns the predicted category ("" if none). A non-empty
+    // `prediction` is used instead of predicting one.
+    std::string applyTaxonomy(const RankingConfig& config, std::vector<SearchResult>& results,
+                              size_t count, const std::string& query,
+                              const std::string& prediction = "") const;
+
+    // Run the semantic, taxonomy and LTR stages over the pinned hits and
+    // order them by the result; `prediction` as for applyTaxonomy. Returns
+    // the category they were boosted toward.
+    std::string rankPinned(const RankingConfig& config, std::vector<SearchResult>& pinned,
+                           const std::string& query, const QuantizedVector* embedding,
+                           const std::string& prediction);
+
+    // Append up to `page_size - results` nearest neighbors not already on
+    // the page, nor in a duplicate cluster on it (best effort: errors leave
+    // the page as it is)
+    void appendAnnCandidates(const RankingConfig& config, SearchResponse& response,
+                             const std::vector<SearchResult>& pinned, int page_size,
+                             const QuantizedVector& query, const EsQueryOptions& options,
+                             const std::string& text_query, const DuplicateClusters* clusters);
+
+    // Overwrite the score of the first `count` results with the LTR model's
+    void applyLtr(std::vector<SearchResult>& results, size_t count, const std::string& query);
+
+    double calculateRecencyScore(const RankingConfig& config, const std::string& updated_at);
+
+    // Count a served query (not warm-up replays)
+    void recordQuery(const std::string& query);
+
+    // Whether a page for `query` is worth a result cache slot. Every page is
+    // during warm-up.
+    bool admitToCache(const std::string& query) const;
+
+    // Whether `query` is recent head traffic, the only kind a cache_only_head
+    // plan still sends to ES on a miss. Without query stats, none is.
+    bool isHeadQuery(const std::string& query) const;
     double calculateTitleMatchScore(const std::string& title, const std::string& query);
 };
 
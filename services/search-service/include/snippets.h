@@ -0,0 +1,68 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace atlas {
+
+enum class HighlightMode {
+    None,
+    Markup,   // fragments with matches wrapped in <em>...</em>, HTML-escaped
+    Offsets   // byte offsets into the original fields
+};
+
+// "markup"/"true"/"1" -> Markup, "offsets" -> Offsets, anything else -> None
+HighlightMode parseHighlightMode(const std::string& value);
+
+// Half-open byte range [begin, end)
+struct TextSpan {
+    size_t begin;
+    size_t end;
+};
+
+struct Snippet {
+    std::vector<TextSpan> title_matches;
+    TextSpan fragment{0, 0};                // window of the description
+    std::vector<TextSpan> fragment_matches;  // offsets into the description, inside `fragment`
+};
+
+// Generates highlights locally instead of asking ES for them. Built once per
+// query and reused for every hit on the page.
+//
+// Terms are found with a first-byte prefilter: 16 bytes at a time are
+// compared against every distinct first byte of the query terms (SSE2 where
+// available), and only candidate positions at a word start are verified.
+// Terms match case-insensitively as word prefixes, so a partly typed last
+// word still highlights.
+class SnippetGenerator {
+public:
+    explicit SnippetGenerator(const std::string& query, size_t fragment_size = 150);
+
+    // Matches in `text`, in order, non-overlapping; longer terms win
+    std::vector<TextSpan> findMatches(const std::string& text) const;
+
+    // Title matches, plus the description window of at most fragment_size
+    // bytes covering the most distinct terms (then the most matches). With
+    // no match the window is the start of the description.
+    Snippet makeSnippet(const std::string& title, const std::string& description) const;
+
+    // `text[window]` HTML-escaped, with `matches` wrapped in <em>...</em>
+    static std::string markup(const std::string& text, TextSpan window,
+                              const std::vector<TextSpan>& matches);
+
+private:
+    std::vector<std::string> terms_;    // lowercase, longest first
+    std::vector<uint8_t> first_bytes_;  // distinct first bytes of terms_
+    bool is_first_byte_[256] = {};
+    size_t fragment_size_;
+
+    void scan(const std::string& text, std::vector<TextSpan>& spans,
+              std::vector<size_t>* term_ids) const;
+    size_t matchAt(const std::string& lower, size_t pos, size_t* term_index) const;
+    TextSpan bestWindow(const std::string& text, const std::vector<TextSpan>& matches,
+                        const std::vector<size_t>& term_ids) const;
+};
+
+} // namespace atlas
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+#include "search_service.h"
+
+namespace atlas {
+
+struct SpellingSuggestion {
+    std::string term;
+    int distance;        // optimal string alignment (Damerau-Levenshtein) distance
+    uint64_t frequency;  // occurrences in the catalog plus query log counts
+};
+
+// Local spelling correction with symmetric deletes (SymSpell): every
+// vocabulary word is indexed under each string reachable by deleting up to
+// `max_edit_distance` characters from its first `prefix_length`. A lookup
+// generates the same deletes of the input, so only words sharing a delete
+// are ever compared, with no per-character alphabet expansion. Candidates
+// are verified with a bounded edit distance and ranked by distance, then
+// frequency.
+//
+// The vocabulary is catalog words (title, category, brand) scanned from the
+// products index, plus query-log terms seen often enough to trust.
+class SpellingIndex {
+public:
+    explicit SpellingIndex(int max_edit_distance = 2, size_t prefix_length = 7);
+
+    // Add `frequency` occurrences of `word` (lowercased by the caller)
+    void addWord(const std::string& word, uint64_t frequency = 1);
+
+    // Query log lines are "query<TAB>count" or just "query" (count 1).
+    // Terms already in the vocabulary get the counts added; new terms are
+    // only added at `min_count` or more, so rare typos in the log don't
+    // become "correct" words. Kept across rebuilds. Returns terms added.
+    size_t loadQueryLog(const std::string& path, uint64_t min_count);
+
+    bool contains(const std::string& word) const;
+    size_t size() const;
+
+    // Vocabulary words within the edit distance of `word`, best first. The
+    // allowed distance shrinks for short words (1 up to 4 characters).
+    std::vector<SpellingSuggestion> lookup(const std::string& word, size_t max_results = 5) const;
+
+    // The normalized query with each unknown alphabetic term (3+ letters)
+    // replaced by its best suggestion; nullopt if nothing changed. Known
+    // words, numbers and model codes are left alone.
+    std::optional<std::string> correct(const std::string& query) const;
+
+    // Full: rebuild the vocabulary from a scan of the products index, then
+    // re-apply the query log. Incremental: only add words not seen before
+    // from products updated since the last scan, so updates don't inflate
+    // frequencies. Returns documents scanned. Call from one thread at a time.
+    size_t refresh(ElasticsearchClient& es, bool full = false);
+
+    // Lowercase alphanumeric runs
+    static std::vector<std::string> tokenize(const std::string& text);
+
+    // Optimal string alignment distance, or max_distance + 1 once it's
+    // certain to exceed max_distance
+    static int editDistance(const std::string& a, const std::string& b, int max_distance);
+
+private:
+    struct Tables {
+        std::vector<std::string> words;
+        std::vector<uint64_t> frequencies;
+        std::unordered_map<std::string, uint32_t> by_word;
+        std::unordered_map<uint64_t, std::vector<uint32_t>> deletes;  // delete hash -> words
+
+        void add(const std::string& word, uint64_t frequency, int max_edit_distance,
+                 size_t prefix_length);
+    };
+
+    int max_edit_distance_;
+    size_t prefix_length_;
+    mutable std::shared_mutex mutex_;
+    Tables tables_;
+    std::unordered_map<std::string, uint64_t> query_log_;  // applied again after each rebuild
+    uint64_t query_log_min_count_ = 0;
+    IndexSyncWatermark watermark_;
+
+    void applyQueryLog(Tables& tables) const;
+    std::vector<SpellingSuggestion> lookupLocked(const std::string& word, size_t max_results) const;
+};
+
+} // namespace atlas
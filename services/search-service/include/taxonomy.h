@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+#include <nlohmann/json.hpp>
+
+namespace atlas {
+
+// Category tree preprocessed for constant-time ancestry queries.
+//
+// An iterative DFS writes the Euler tour: every node each time the walk
+// enters or returns to it, 2n - 1 entries. The LCA of two nodes is the
+// shallowest node in the tour between their first visits. That range
+// minimum is answered by a sparse table of power-of-two windows, in O(1)
+// with two overlapping lookups. Built in O(n log n) at load time.
+//
+// Loaded from JSON:
+//   {"categories": [{"id": "electronics"}, {"id": "laptops", "parent": "electronics"}, ...],
+//    "queries": {"gaming laptop": "laptops", ...}}
+// `queries` optionally maps normalized head queries to their predicted
+// category. Top-level categories hang off an implicit root at depth 0.
+class Taxonomy {
+public:
+    // Throws std::runtime_error if the file can't be read and
+    // std::invalid_argument on unknown parents, duplicates or cycles
+    static std::shared_ptr<const Taxonomy> load(const std::string& path);
+    static std::shared_ptr<const Taxonomy> fromJson(const nlohmann::json& taxonomy);
+
+    // Node of a category ID, or -1
+    int node(const std::string& category) const;
+    const std::string& category(int node) const { return ids_[node]; }
+    size_t size() const { return ids_.size(); }
+
+    int depth(int node) const { return depths_[node]; }
+    int lca(int a, int b) const;
+    int distance(int a, int b) const { return depths_[a] + depths_[b] - 2 * depths_[lca(a, b)]; }
+
+    // Share of the deeper node's path that the two have in common:
+    // depth(lca) / max(depth). 1 for the same category, 0 when they only
+    // meet at the root.
+    double proximity(int a, int b) const;
+
+    // Predicted category node for a normalized query from `queries`, or -1
+    int predictedCategory(const std::string& normalized_query) const;
+
+    // Stable hash of the source JSON, mixed into the ranking version
+    uint64_t fingerprint() const { return fingerprint_; }
+
+private:
+    std::vector<std::string> ids_;            // node 0 is the implicit root
+    std::unordered_map<std::string, int> nodes_;
+    std::vector<int> depths_;
+    std::vector<int> first_visit_;            // node -> first index in euler_
+    std::vector<int> euler_;                  // node per tour step
+    std::vector<std::vector<int>> sparse_;    // [k][i]: shallowest node in euler_[i, i + 2^k)
+    std::vector<uint8_t> log2_;               // floor(log2(length)) for range lengths
+    std::unordered_map<std::string, int> query_categories_;
+    uint64_t fingerprint_ = 0;
+
+    void build(const std::vector<int>& parents);
+    int shallower(int a, int b) const { return depths_[a] <= depths_[b] ? a : b; }
+};
+
+} // namespace atlas
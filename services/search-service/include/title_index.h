@@ -0,0 +1,78 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <shared_mutex>
+#include <cstdint>
+#include "search_service.h"
+
+namespace atlas {
+
+// The few fields needed to serve a product without asking ES. Only the start
+// of the description is kept, enough for a snippet, so the index stays small.
+struct TitleEntry {
+    std::string id;
+    std::string title;
+    std::string updated_at;
+    int64_t version = 0;
+    std::string category;     // first category, for the taxonomy boost
+    std::string description;  // first TitleIndex::kDescriptionBytes bytes
+};
+
+// In-memory index from normalized product title to products, for
+// navigational queries ("iphone 15 pro max 256gb") that name one product
+// exactly. Keys are 64-bit hashes of the normalized title; a hit is
+// confirmed against the stored title, so collisions never leak through.
+//
+// Built by scanning the products index the consumer writes, then kept up to
+// date by pulling documents changed since the last scan. Deletions are only
+// seen by a full rebuild.
+class TitleIndex {
+public:
+    // Description bytes kept per product: about two snippet fragments
+    static constexpr size_t kDescriptionBytes = 300;
+
+
+    // Products with this exact normalized title, at most `limit`; empty if
+    // there are more than `limit` (the title is not specific enough to pin)
+    std::vector<TitleEntry> lookup(const std::string& query, size_t limit) const;
+
+    void upsert(const TitleEntry& entry);
+    void remove(const std::string& id);
+
+    size_t size() const;
+
+    // Pull products indexed since the last pull, with an overlap (see
+    // IndexSyncWatermark; everything on the first call). `full` rescans everything into fresh
+    // tables and swaps them in, dropping deleted products. Returns the
+    // number of documents scanned. Call from one thread at a time.
+    size_t refresh(ElasticsearchClient& es, bool full = false);
+
+    // Lowercase, punctuation to spaces, whitespace collapsed:
+    // "iPhone 15 Pro Max, 256GB" -> "iphone 15 pro max 256gb"
+    static std::string normalizeTitle(const std::string& title);
+
+    // At most kDescriptionBytes of `description`, cut at a UTF-8 boundary
+    static std::string descriptionPrefix(const std::string& description);
+
+private:
+    struct Tables {
+        std::vector<TitleEntry> entries;  // by ordinal; removed slots have an empty id
+        std::vector<uint32_t> free_slots;
+        std::unordered_map<std::string, uint32_t> by_id;
+        std::unordered_map<uint64_t, std::vector<uint32_t>> by_title;  // normalized title hash -> ordinals
+
+        void upsert(const TitleEntry& entry);
+        void remove(const std::string& id);
+    };
+
+    mutable std::shared_mutex mutex_;
+    Tables tables_;
+    IndexSyncWatermark watermark_;  // only touched by refresh()
+
+    static uint64_t titleKey(const std::string& normalized_title);
+    static TitleEntry entryFromHit(const nlohmann::json& hit);
+};
+
+} // namespace atlas
@@ -0,0 +1,95 @@
+#include "brownout.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace atlas {
+
+SearchPlan SearchPlan::forLevel(int level) {
+    switch (level) {
+        case 0:  return {0, "normal", 0, true, false, 0};
+        case 1:  return {1, "reduced_rerank", 10, true, false, 0};
+        case 2:  return {2, "no_description", 10, false, false, 0};
+        case 3:  return {3, "cache_only_head", 10, false, true, 0};
+        default: return {4, "terminate_after", 10, false, true, 1000};
+    }
+}
+
+BrownoutController::BrownoutController(const BrownoutConfig& config)
+    : config_(config),
+      queue_delay_ewma_(0.0),
+      es_rtt_ewma_(0.0),
+      queue_delay_sampled_at_(std::chrono::steady_clock::now()),
+      es_rtt_sampled_at_(queue_delay_sampled_at_),
+      level_(0),
+      last_change_(queue_delay_sampled_at_) {}
+
+double BrownoutController::decayed(double ewma, std::chrono::steady_clock::time_point sampled_at,
+                                   std::chrono::steady_clock::time_point now) const {
+    if (config_.idle_half_life_ms <= 0 || now <= sampled_at) {
+        return ewma;
+    }
+    double idle_ms = std::chrono::duration<double, std::milli>(now - sampled_at).count();
+    return ewma * std::exp2(-idle_ms / config_.idle_half_life_ms);
+}
+
+void BrownoutController::recordQueueDelay(double ms, std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_delay_ewma_ = decayed(queue_delay_ewma_, queue_delay_sampled_at_, now);
+    queue_delay_ewma_ += config_.ewma_alpha * (ms - queue_delay_ewma_);
+    queue_delay_sampled_at_ = std::max(queue_delay_sampled_at_, now);
+}
+
+void BrownoutController::recordEsRtt(double ms, std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    es_rtt_ewma_ = decayed(es_rtt_ewma_, es_rtt_sampled_at_, now);
+    es_rtt_ewma_ += config_.ewma_alpha * (ms - es_rtt_ewma_);
+    es_rtt_sampled_at_ = std::max(es_rtt_sampled_at_, now);
+}
+
+SearchPlan BrownoutController::currentPlan(std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    double queue_delay = decayed(queue_delay_ewma_, queue_delay_sampled_at_, now);
+    double es_rtt = decayed(es_rtt_ewma_, es_rtt_sampled_at_, now);
+
+    // Pressure > 1 means at least one signal is over its threshold
+    double pressure = std::max(queue_delay / config_.queue_delay_ms,
+                               es_rtt / config_.es_rtt_ms);
+
+    if (now - last_change_ >= std::chrono::milliseconds(config_.dwell_ms)) {
+        int previous = level_;
+        if (pressure > 1.0 && level_ < kMaxLevel) {
+            level_++;
+        } else if (pressure < config_.recover_ratio && level_ > 0) {
+            level_--;
+        }
+
+        if (level_ != previous) {
+            last_change_ = now;
+            std::cout << "Brownout level " << previous << " -> " << level_
+                      << " (" << SearchPlan::forLevel(level_).name
+                      << ", queue_delay=" << queue_delay << "ms"
+                      << ", es_rtt=" << es_rtt << "ms)" << std::endl;
+        }
+    }
+
+    return SearchPlan::forLevel(level_);
+}
+
+int BrownoutController::level() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return level_;
+}
+
+double BrownoutController::queueDelayMs(std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return decayed(queue_delay_ewma_, queue_delay_sampled_at_, now);
+}
+
+double BrownoutController::esRttMs(std::chrono::steady_clock::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return decayed(es_rtt_ewma_, es_rtt_sampled_at_, now);
+}
+
+} // namespace atlas
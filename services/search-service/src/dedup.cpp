@@ -0,0 +1,246 @@
+#include "dedup.h"
+#include "search_service.h"
+#include "spelling.h"
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace atlas {
+
+static uint64_t splitMix64(uint64_t& state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static size_t resolveThreads(size_t threads) {
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    return std::max<size_t>(1, threads);
+}
+
+// Run `work(i)` for i in [0, count) on up to `threads` threads, handing out
+// indices one at a time so uneven items don't leave threads idle
+template <typename Work>
+static void parallelFor(size_t count, size_t threads, Work work) {
+    threads = std::min(resolveThreads(threads), std::max<size_t>(1, count));
+    if (threads == 1) {
+        for (size_t i = 0; i < count; ++i) work(i);
+        return;
+    }
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) work(i);
+        });
+    }
+    for (auto& thread : pool) thread.join();
+}
+
+MinHasher::MinHasher(size_t num_hashes, size_t shingle_chars, uint64_t seed)
+    : shingle_chars_(std::max<size_t>(1, shingle_chars)) {
+    uint64_t state = seed;
+    for (size_t i = 0; i < num_hashes; ++i) {
+        multipliers_.push_back(splitMix64(state) | 1);
+        offsets_.push_back(splitMix64(state));
+    }
+}
+
+std::vector<uint32_t> MinHasher::signature(const std::string& title) const {
+    std::string text;
+    for (const auto& word : SpellingIndex::tokenize(title)) {
+        if (!text.empty()) text += ' ';
+        text += word;
+    }
+    if (text.empty()) {
+        return {};
+    }
+
+    std::vector<uint32_t> result(multipliers_.size(), std::numeric_limits<uint32_t>::max());
+    size_t shingles = text.size() > shingle_chars_ ? text.size() - shingle_chars_ + 1 : 1;
+    size_t length = std::min(shingle_chars_, text.size());
+    for (size_t start = 0; start < shingles; ++start) {
+        // FNV-1a of the shingle, then one multiply-shift hash per position
+        uint64_t shingle = 14695981039346656037ULL;
+        for (size_t i = start; i < start + length; ++i) {
+            shingle = (shingle ^ static_cast<unsigned char>(text[i])) * 1099511628211ULL;
+        }
+        for (size_t i = 0; i < result.size(); ++i) {
+            uint32_t value = static_cast<uint32_t>((multipliers_[i] * shingle + offsets_[i]) >> 32);
+            result[i] = std::min(result[i], value);
+        }
+    }
+    return result;
+}
+
+double MinHasher::similarity(const uint32_t* a, const uint32_t* b, size_t num_hashes) {
+    size_t equal = 0;
+    for (size_t i = 0; i < num_hashes; ++i) {
+        equal += a[i] == b[i];
+    }
+    return num_hashes == 0 ? 0.0 : static_cast<double>(equal) / num_hashes;
+}
+
+ConcurrentUnionFind::ConcurrentUnionFind(size_t size) : parent_(size) {
+    for (size_t i = 0; i < size; ++i) {
+        parent_[i].store(static_cast<uint32_t>(i), std::memory_order_relaxed);
+    }
+}
+
+uint32_t ConcurrentUnionFind::find(uint32_t x) {
+    for (;;) {
+        uint32_t parent = parent_[x].load(std::memory_order_acquire);
+        if (parent == x) {
+            return x;
+        }
+        // Path halving: point x at its grandparent. Losing the race to
+        // another thread is fine, it only made the path shorter.
+        uint32_t grandparent = parent_[parent].load(std::memory_order_acquire);
+        if (parent != grandparent) {
+            parent_[x].compare_exchange_weak(parent, grandparent, std::memory_order_release,
+                                             std::memory_order_relaxed);
+        }
+        x = grandparent;
+    }
+}
+
+bool ConcurrentUnionFind::unite(uint32_t a, uint32_t b) {
+    for (;;) {
+        a = find(a);
+        b = find(b);
+        if (a == b) {
+            return false;
+        }
+        if (a < b) {
+            std::swap(a, b);
+        }
+        // Link the larger root under the smaller; retry if `a` stopped
+        // being a root in the meantime
+        uint32_t expected = a;
+        if (parent_[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel)) {
+            return true;
+        }
+    }
+}
+
+std::vector<uint32_t> computeSignatures(const std::vector<std::string>& titles, const MinHasher& hasher,
+                                        size_t threads) {
+    size_t num_hashes = hasher.numHashes();
+    std::vector<uint32_t> signatures(titles.size() * num_hashes, std::numeric_limits<uint32_t>::max());
+    // Chunks of titles rather than single ones keep the handout cheap
+    const size_t kChunk = 1024;
+    size_t chunks = (titles.size() + kChunk - 1) / kChunk;
+    parallelFor(chunks, threads, [&](size_t chunk) {
+        size_t end = std::min(titles.size(), (chunk + 1) * kChunk);
+        for (size_t i = chunk * kChunk; i < end; ++i) {
+            auto signature = hasher.signature(titles[i]);
+            std::copy(signature.begin(), signature.end(), signatures.begin() + i * num_hashes);
+        }
+    });
+    return signatures;
+}
+
+std::vector<uint32_t> clusterSignatures(const std::vector<uint32_t>& signatures, size_t count,
+                                        const DedupOptions& options) {
+    size_t num_hashes = count == 0 ? options.num_hashes : signatures.size() / count;
+    size_t bands = std::max<size_t>(1, std::min(options.bands, num_hashes));
+    size_t rows = num_hashes / bands;
+    if (count > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("Too many titles to cluster");
+    }
+
+    // Titles without shingles have an all-max signature and match nothing
+    std::vector<uint32_t> present;
+    present.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t* signature = &signatures[i * num_hashes];
+        if (num_hashes > 0 && signature[0] != std::numeric_limits<uint32_t>::max()) {
+            present.push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    ConcurrentUnionFind sets(count);
+    parallelFor(bands, options.threads, [&](size_t band) {
+        std::vector<std::pair<uint64_t, uint32_t>> buckets;
+        buckets.reserve(present.size());
+        for (uint32_t i : present) {
+            uint64_t hash = 14695981039346656037ULL ^ band;
+            const uint32_t* values = &signatures[i * num_hashes + band * rows];
+            for (size_t r = 0; r < rows; ++r) {
+                hash = (hash ^ values[r]) * 1099511628211ULL;
+            }
+            buckets.emplace_back(hash, i);
+        }
+        std::sort(buckets.begin(), buckets.end());
+
+        for (size_t start = 0; start < buckets.size();) {
+            size_t end = start + 1;
+            while (end < buckets.size() && buckets[end].first == buckets[start].first) end++;
+            for (size_t j = start + 1; j < end; ++j) {
+                uint32_t current = buckets[j].second;
+                size_t first = j > start + options.bucket_window ? j - options.bucket_window : start;
+                for (size_t k = j; k-- > first;) {
+                    uint32_t earlier = buckets[k].second;
+                    if (sets.find(current) == sets.find(earlier)) {
+                        break;
+                    }
+                    if (MinHasher::similarity(&signatures[current * num_hashes],
+                                              &signatures[earlier * num_hashes],
+                                              num_hashes) >= options.threshold) {
+                        sets.unite(current, earlier);
+                        break;
+                    }
+                }
+            }
+            start = end;
+        }
+    });
+
+    std::vector<uint32_t> result(count);
+    for (size_t i = 0; i < count; ++i) {
+        result[i] = sets.find(static_cast<uint32_t>(i));
+    }
+    return result;
+}
+
+std::vector<uint32_t> clusterNearDuplicates(const std::vector<std::string>& titles,
+                                            const DedupOptions& options) {
+    MinHasher hasher(options.num_hashes, options.shingle_chars);
+    auto signatures = computeSignatures(titles, hasher, options.threads);
+    return clusterSignatures(signatures, titles.size(), options);
+}
+
+std::shared_ptr<const DuplicateClusters> DuplicateClusters::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot read duplicate clusters: " + path);
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+
+    auto result = std::make_shared<DuplicateClusters>();
+    std::string line;
+    while (std::getline(contents, line)) {
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos || line[0] == '#') {
+            continue;
+        }
+        result->add(line.substr(0, tab), line.substr(tab + 1));
+    }
+    result->fingerprint_ = stableHash(contents.str());
+    return result;
+}
+
+void DuplicateClusters::add(const std::string& product_id, const std::string& cluster_id) {
+    auto it = cluster_ids_.emplace(cluster_id, static_cast<uint32_t>(cluster_ids_.size() + 1)).first;
+    clusters_[product_id] = it->second;
+    fingerprint_ = stableHash(std::to_string(fingerprint_) + '\t' + product_id + '\t' + cluster_id);
+}
+
+} // namespace atlas
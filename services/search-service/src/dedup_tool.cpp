@@ -0,0 +1,241 @@
+// Cluster near-duplicate product listings for ATLAS_DEDUP_CLUSTERS from
+// JSON lines:
+//
+//   {"id": "prod-1", "title": "Acme Gaming Laptop 15\" 16GB"}
+//
+// Writes "product_id<TAB>cluster_id" for every product in a cluster of two
+// or more; the cluster ID is the ID of the cluster's first product in the
+// input. The output is replaced atomically, so a running service never
+// reloads half a file.
+//
+// With --signatures, MinHash signatures are kept in a cache file between
+// runs and only products that are new or retitled are hashed again.
+//
+//   ./dedup_tool products.jsonl clusters.tsv
+//   ./dedup_tool --threshold 0.85 --signatures sigs.bin products.jsonl clusters.tsv
+
+#include "dedup.h"
+#include "search_service.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Signature cache: header, then per product its ID, title hash and signature
+static const char kCacheMagic[8] = {'A', 'T', 'L', 'M', 'H', 'S', 'G', '1'};
+
+struct CachedSignature {
+    uint64_t title_hash;
+    std::vector<uint32_t> values;
+};
+
+template <typename T>
+static bool readValue(std::istream& in, T& value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+template <typename T>
+static void writeValue(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Empty when the file is missing, unreadable or made with other settings
+static std::unordered_map<std::string, CachedSignature> readCache(const std::string& path,
+                                                                  const atlas::DedupOptions& options) {
+    std::unordered_map<std::string, CachedSignature> cache;
+    std::ifstream in(path, std::ios::binary);
+    char magic[8];
+    uint32_t num_hashes = 0, shingle_chars = 0;
+    uint64_t count = 0;
+    if (!in.read(magic, sizeof(magic)) || std::string(magic, 8) != std::string(kCacheMagic, 8) ||
+        !readValue(in, num_hashes) || !readValue(in, shingle_chars) || !readValue(in, count) ||
+        num_hashes != options.num_hashes || shingle_chars != options.shingle_chars) {
+        return cache;
+    }
+    cache.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint32_t id_length = 0;
+        CachedSignature entry;
+        if (!readValue(in, id_length)) break;
+        std::string id(id_length, '\0');
+        entry.values.resize(num_hashes);
+        if (!in.read(&id[0], id_length) || !readValue(in, entry.title_hash) ||
+            !in.read(reinterpret_cast<char*>(entry.values.data()), num_hashes * sizeof(uint32_t))) {
+            std::cerr << "Signature cache " << path << " is truncated; rehashing the rest" << std::endl;
+            break;
+        }
+        cache.emplace(std::move(id), std::move(entry));
+    }
+    return cache;
+}
+
+static void writeCache(const std::string& path, const atlas::DedupOptions& options,
+                       const std::vector<std::string>& ids, const std::vector<uint64_t>& title_hashes,
+                       const std::vector<uint32_t>& signatures) {
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        out.write(kCacheMagic, sizeof(kCacheMagic));
+        writeValue(out, static_cast<uint32_t>(options.num_hashes));
+        writeValue(out, static_cast<uint32_t>(options.shingle_chars));
+        writeValue(out, static_cast<uint64_t>(ids.size()));
+        for (size_t i = 0; i < ids.size(); ++i) {
+            writeValue(out, static_cast<uint32_t>(ids[i].size()));
+            out.write(ids[i].data(), ids[i].size());
+            writeValue(out, title_hashes[i]);
+            out.write(reinterpret_cast<const char*>(&signatures[i * options.num_hashes]),
+                      options.num_hashes * sizeof(uint32_t));
+        }
+        if (!out.good()) {
+            throw std::runtime_error("Cannot write signature cache: " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace " + path);
+    }
+}
+
+static void writeClusters(const std::string& path, const std::vector<std::string>& ids,
+                          const std::vector<uint32_t>& roots, size_t& products, size_t& clusters) {
+    std::vector<uint32_t> sizes(ids.size(), 0);
+    for (uint32_t root : roots) sizes[root]++;
+
+    std::string temporary = path + ".tmp";
+    products = clusters = 0;
+    {
+        std::ofstream out(temporary, std::ios::trunc);
+        out << "# product_id\tcluster_id (near-duplicate titles)\n";
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (sizes[roots[i]] < 2) continue;
+            out << ids[i] << '\t' << ids[roots[i]] << '\n';
+            products++;
+            clusters += roots[i] == i;
+        }
+        if (!out.good()) {
+            throw std::runtime_error("Cannot write clusters: " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace " + path);
+    }
+}
+
+int main(int argc, char** argv) {
+    atlas::DedupOptions options;
+    std::string cache_path;
+    std::vector<std::string> paths;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--threshold" && has_value) {
+                options.threshold = std::stod(argv[++i]);
+            } else if (arg == "--hashes" && has_value) {
+                options.num_hashes = std::stoul(argv[++i]);
+            } else if (arg == "--bands" && has_value) {
+                options.bands = std::stoul(argv[++i]);
+            } else if (arg == "--threads" && has_value) {
+                options.threads = std::stoul(argv[++i]);
+            } else if (arg == "--signatures" && has_value) {
+                cache_path = argv[++i];
+            } else {
+                paths.push_back(arg);
+            }
+        }
+    } catch (const std::exception&) {
+        paths.clear();
+    }
+    if (paths.size() != 2 || options.num_hashes == 0 || options.bands == 0) {
+        std::cerr << "Usage: " << argv[0] << " [--threshold <0..1>] [--hashes <n>] [--bands <n>]"
+                  << " [--threads <n>] [--signatures <cache>] <products.jsonl> <clusters.tsv>" << std::endl;
+        return 2;
+    }
+
+    std::ifstream input(paths[0]);
+    if (!input.is_open()) {
+        std::cerr << "Cannot read " << paths[0] << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> ids;
+    std::vector<std::string> titles;
+    std::unordered_set<std::string> seen;
+    std::string line;
+    for (size_t line_number = 1; std::getline(input, line); ++line_number) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        try {
+            auto record = nlohmann::json::parse(line);
+            std::string id = record.at("id").get<std::string>();
+            if (!seen.insert(id).second) {
+                continue;  // first listing wins
+            }
+            ids.push_back(std::move(id));
+            titles.push_back(record.value("title", ""));
+        } catch (const nlohmann::json::exception& e) {
+            std::cerr << paths[0] << ":" << line_number << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    seen.clear();
+
+    // Reuse cached signatures of unchanged titles; hash only the rest
+    atlas::MinHasher hasher(options.num_hashes, options.shingle_chars);
+    std::vector<uint64_t> title_hashes(titles.size());
+    std::vector<uint32_t> signatures(titles.size() * options.num_hashes);
+    std::vector<size_t> stale;
+    {
+        std::unordered_map<std::string, CachedSignature> cache;
+        if (!cache_path.empty()) {
+            cache = readCache(cache_path, options);
+        }
+        for (size_t i = 0; i < titles.size(); ++i) {
+            title_hashes[i] = atlas::stableHash(titles[i]);
+            auto it = cache.find(ids[i]);
+            if (it != cache.end() && it->second.title_hash == title_hashes[i]) {
+                std::copy(it->second.values.begin(), it->second.values.end(),
+                          signatures.begin() + i * options.num_hashes);
+            } else {
+                stale.push_back(i);
+            }
+        }
+    }
+    std::vector<std::string> stale_titles;
+    stale_titles.reserve(stale.size());
+    for (size_t i : stale) stale_titles.push_back(std::move(titles[i]));
+    titles.clear();
+    titles.shrink_to_fit();
+    auto fresh = atlas::computeSignatures(stale_titles, hasher, options.threads);
+    for (size_t j = 0; j < stale.size(); ++j) {
+        std::copy(fresh.begin() + j * options.num_hashes, fresh.begin() + (j + 1) * options.num_hashes,
+                  signatures.begin() + stale[j] * options.num_hashes);
+    }
+
+    size_t products = 0, clusters = 0;
+    try {
+        auto roots = atlas::clusterSignatures(signatures, ids.size(), options);
+        writeClusters(paths[1], ids, roots, products, clusters);
+        if (!cache_path.empty()) {
+            writeCache(cache_path, options, ids, title_hashes, signatures);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Clustered " << ids.size() << " products (" << stale.size() << " hashed) in "
+              << seconds << "s: " << products << " products in " << clusters << " clusters written to "
+              << paths[1] << std::endl;
+    return 0;
+}
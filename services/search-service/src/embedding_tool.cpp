@@ -0,0 +1,72 @@
+// Build an embeddings store for the semantic rerank from JSON lines:
+//
+//   {"id": "prod-1", "vector": [0.12, -0.03, ...]}
+//
+// Keys are product IDs for ATLAS_PRODUCT_EMBEDDINGS and queries for
+// ATLAS_QUERY_EMBEDDINGS; queries are normalized the way the service looks
+// them up.
+//
+//   ./embedding_tool products.jsonl products.emb
+//   ./embedding_tool --queries head_queries.jsonl queries.emb
+
+#include "embeddings.h"
+#include "search_service.h"
+#include <nlohmann/json.hpp>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+    bool queries = false;
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--queries") {
+            queries = true;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+    if (paths.size() != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--queries] <input.jsonl> <output.emb>" << std::endl;
+        return 2;
+    }
+
+    std::ifstream input(paths[0]);
+    if (!input.is_open()) {
+        std::cerr << "Cannot read " << paths[0] << std::endl;
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, std::vector<float>>> vectors;
+    size_t dim = 0;
+    std::string line;
+    for (size_t line_number = 1; std::getline(input, line); ++line_number) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        try {
+            auto record = nlohmann::json::parse(line);
+            std::string key = record.at("id").get<std::string>();
+            auto values = record.at("vector").get<std::vector<float>>();
+            if (dim == 0) {
+                dim = values.size();
+            }
+            vectors.emplace_back(queries ? atlas::normalizeQuery(key) : key, std::move(values));
+        } catch (const nlohmann::json::exception& e) {
+            std::cerr << paths[0] << ":" << line_number << ": " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    try {
+        atlas::EmbeddingStore::write(paths[1], dim, vectors);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    std::cout << "Wrote " << vectors.size() << " embeddings of dimension " << dim
+              << " to " << paths[1] << std::endl;
+    return 0;
+}
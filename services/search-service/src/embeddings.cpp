@@ -0,0 +1,538 @@
+#include "embeddings.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <queue>
+#include <random>
+#include <stdexcept>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ATLAS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace atlas {
+
+// Dot-product kernels
+
+static int32_t dotScalar(const int8_t* a, const int8_t* b, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += static_cast<int32_t>(a[i]) * b[i];
+    }
+    return sum;
+}
+
+#ifdef ATLAS_X86_KERNELS
+// Compiled for AVX2 / AVX-512 regardless of -march and only called after the
+// runtime CPU check, so one binary runs everywhere
+
+__attribute__((target("avx2")))
+static int32_t dotAvx2(const int8_t* a, const int8_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    for (size_t i = 0; i < n; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        // vpmaddubsw multiplies unsigned by signed bytes: move a's sign onto
+        // b. Pair sums stay within 2 * 127 * 127, so nothing saturates.
+        __m256i pairs = _mm256_maddubs_epi16(_mm256_sign_epi8(va, va), _mm256_sign_epi8(vb, va));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, ones));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_hadd_epi32(sum, sum);
+    sum = _mm_hadd_epi32(sum, sum);
+    return _mm_cvtsi128_si32(sum);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static int32_t dotAvx512Vnni(const int8_t* a, const int8_t* b, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < n; i += 64) {
+        __m512i va = _mm512_loadu_si512(a + i);
+        __m512i vb = _mm512_loadu_si512(b + i);
+        // vpdpbusd is also unsigned x signed; AVX-512 has no vpsignb, so
+        // negate b under a's sign mask instead
+        __mmask64 negative = _mm512_movepi8_mask(va);
+        __m512i signed_b = _mm512_mask_sub_epi8(vb, negative, _mm512_setzero_si512(), vb);
+        acc = _mm512_dpbusd_epi32(acc, _mm512_abs_epi8(va), signed_b);
+    }
+    // Spill and add: cheaper to read than a shuffle ladder, and done once
+    alignas(64) int32_t lanes[16];
+    _mm512_store_si512(lanes, acc);
+    int32_t sum = 0;
+    for (int32_t lane : lanes) {
+        sum += lane;
+    }
+    return sum;
+}
+#endif
+
+DotKernel bestDotKernel() {
+#ifdef ATLAS_X86_KERNELS
+    static const DotKernel best = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw")) {
+            return DotKernel::Avx512Vnni;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return DotKernel::Avx2;
+        }
+        return DotKernel::Scalar;
+    }();
+    return best;
+#else
+    return DotKernel::Scalar;
+#endif
+}
+
+const char* dotKernelName(DotKernel kernel) {
+    switch (kernel) {
+        case DotKernel::Avx2: return "avx2";
+        case DotKernel::Avx512Vnni: return "avx512-vnni";
+        default: return "scalar";
+    }
+}
+
+int32_t dotInt8(const int8_t* a, const int8_t* b, size_t n, DotKernel kernel) {
+#ifdef ATLAS_X86_KERNELS
+    switch (kernel) {
+        case DotKernel::Avx512Vnni: return dotAvx512Vnni(a, b, n);
+        case DotKernel::Avx2: return dotAvx2(a, b, n);
+        default: break;
+    }
+#else
+    (void)kernel;
+#endif
+    return dotScalar(a, b, n);
+}
+
+// EmbeddingStore implementation
+
+static const char kMagic[8] = {'A', 'T', 'L', 'S', 'E', 'M', 'B', '1'};
+
+struct StoreHeader {
+    char magic[8];
+    uint32_t dim;
+    uint32_t stride;
+    uint64_t count;
+    uint64_t scales_offset;
+    uint64_t vectors_offset;
+    uint64_t keys_offset;
+};
+
+static size_t alignUp(size_t value) {
+    return (value + kEmbeddingAlign - 1) / kEmbeddingAlign * kEmbeddingAlign;
+}
+
+// L2-normalize and quantize `dim` floats into `out` (stride bytes, zero
+// padded). Returns the scale; a zero vector quantizes to zeros with scale 0.
+static float quantizeInto(const float* values, size_t dim, size_t stride, int8_t* out) {
+    double norm = 0.0;
+    float max_abs = 0.0f;
+    for (size_t i = 0; i < dim; ++i) {
+        norm += static_cast<double>(values[i]) * values[i];
+        max_abs = std::max(max_abs, std::fabs(values[i]));
+    }
+    std::memset(out, 0, stride);
+    if (norm <= 0.0 || max_abs <= 0.0f) {
+        return 0.0f;
+    }
+    norm = std::sqrt(norm);
+
+    // Symmetric range [-127, 127]: the SIMD kernels rely on never seeing -128
+    float scale = static_cast<float>(max_abs / norm / 127.0);
+    for (size_t i = 0; i < dim; ++i) {
+        float quantized = std::round(static_cast<float>(values[i] / norm) / scale);
+        out[i] = static_cast<int8_t>(std::clamp(quantized, -127.0f, 127.0f));
+    }
+    return scale;
+}
+
+std::shared_ptr<const EmbeddingStore> EmbeddingStore::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open embeddings: " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot stat embeddings: " + path);
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    if (size < sizeof(StoreHeader)) {
+        ::close(fd);
+        throw std::invalid_argument("Embeddings file too short: " + path);
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Cannot map embeddings: " + path);
+    }
+
+    // Owns the mapping from here on, so every throw below unmaps it
+    std::shared_ptr<EmbeddingStore> store(new EmbeddingStore());
+    store->mapping_ = mapping;
+    store->mapping_size_ = size;
+    store->kernel_ = bestDotKernel();
+
+    const char* base = static_cast<const char*>(mapping);
+    StoreHeader header;
+    std::memcpy(&header, base, sizeof(header));
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        throw std::invalid_argument("Not an embeddings file: " + path);
+    }
+    if (header.dim == 0 || header.stride < header.dim || header.stride % kEmbeddingAlign != 0 ||
+        header.scales_offset % kEmbeddingAlign != 0 || header.vectors_offset % kEmbeddingAlign != 0 ||
+        header.scales_offset < sizeof(StoreHeader) ||
+        header.scales_offset + header.count * sizeof(float) > header.vectors_offset ||
+        header.vectors_offset + header.count * header.stride > header.keys_offset ||
+        header.keys_offset > size) {
+        throw std::invalid_argument("Corrupt embeddings header: " + path);
+    }
+
+    store->dim_ = header.dim;
+    store->stride_ = header.stride;
+    store->count_ = header.count;
+    store->scales_ = reinterpret_cast<const float*>(base + header.scales_offset);
+    store->vectors_ = reinterpret_cast<const int8_t*>(base + header.vectors_offset);
+
+    store->keys_.reserve(header.count);
+    store->rows_.reserve(header.count);
+    size_t offset = header.keys_offset;
+    for (uint64_t row = 0; row < header.count; ++row) {
+        uint32_t length;
+        if (offset + sizeof(length) > size) {
+            throw std::invalid_argument("Truncated embeddings keys: " + path);
+        }
+        std::memcpy(&length, base + offset, sizeof(length));
+        offset += sizeof(length);
+        if (offset + length > size) {
+            throw std::invalid_argument("Truncated embeddings keys: " + path);
+        }
+        std::string_view key(base + offset, length);
+        offset += length;
+        store->keys_.push_back(key);
+        store->rows_.emplace(key, static_cast<uint32_t>(row));
+    }
+    return store;
+}
+
+void EmbeddingStore::write(const std::string& path, size_t dim,
+                           const std::vector<std::pair<std::string, std::vector<float>>>& vectors) {
+    if (dim == 0) {
+        throw std::invalid_argument("Embedding dimension must be positive");
+    }
+    StoreHeader header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.dim = static_cast<uint32_t>(dim);
+    header.stride = static_cast<uint32_t>(alignUp(dim));
+    header.count = vectors.size();
+    header.scales_offset = alignUp(sizeof(StoreHeader));
+    header.vectors_offset = header.scales_offset + alignUp(vectors.size() * sizeof(float));
+    header.keys_offset = header.vectors_offset + vectors.size() * header.stride;
+
+    std::vector<float> scales(vectors.size());
+    std::vector<int8_t> quantized(vectors.size() * header.stride);
+    for (size_t row = 0; row < vectors.size(); ++row) {
+        if (vectors[row].second.size() != dim) {
+            throw std::invalid_argument("Embedding for '" + vectors[row].first + "' has " +
+                                        std::to_string(vectors[row].second.size()) +
+                                        " dimensions, expected " + std::to_string(dim));
+        }
+        scales[row] = quantizeInto(vectors[row].second.data(), dim, header.stride,
+                                   &quantized[row * header.stride]);
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot write embeddings: " + path);
+    }
+    std::vector<char> padding(kEmbeddingAlign, 0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(padding.data(), header.scales_offset - sizeof(header));
+    file.write(reinterpret_cast<const char*>(scales.data()), scales.size() * sizeof(float));
+    file.write(padding.data(), header.vectors_offset - header.scales_offset - scales.size() * sizeof(float));
+    file.write(reinterpret_cast<const char*>(quantized.data()), quantized.size());
+    for (const auto& [key, values] : vectors) {
+        uint32_t length = static_cast<uint32_t>(key.size());
+        file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        file.write(key.data(), key.size());
+    }
+    if (!file) {
+        throw std::runtime_error("Failed writing embeddings: " + path);
+    }
+}
+
+EmbeddingStore::~EmbeddingStore() {
+    if (mapping_) {
+        munmap(mapping_, mapping_size_);
+    }
+}
+
+int64_t EmbeddingStore::find(std::string_view key) const {
+    auto it = rows_.find(key);
+    return it == rows_.end() ? -1 : static_cast<int64_t>(it->second);
+}
+
+QuantizedVector EmbeddingStore::quantize(const float* values) const {
+    QuantizedVector vector;
+    vector.values.resize(stride_);
+    vector.scale = quantizeInto(values, dim_, stride_, vector.values.data());
+    return vector;
+}
+
+QuantizedVector EmbeddingStore::quantize(size_t row) const {
+    QuantizedVector vector;
+    vector.values.assign(this->vector(row), this->vector(row) + stride_);
+    vector.scale = scales_[row];
+    return vector;
+}
+
+float EmbeddingStore::similarity(const QuantizedVector& query, size_t row) const {
+    return static_cast<float>(dotInt8(query.values.data(), vector(row), stride_, kernel_)) *
+           query.scale * scales_[row];
+}
+
+float EmbeddingStore::similarity(size_t a, size_t b) const {
+    return static_cast<float>(dotInt8(vector(a), vector(b), stride_, kernel_)) *
+           scales_[a] * scales_[b];
+}
+
+// HnswIndex implementation
+
+namespace {
+
+struct MoreSimilar {
+    bool operator()(const HnswIndex::Neighbor& a, const HnswIndex::Neighbor& b) const {
+        return a.similarity > b.similarity;
+    }
+};
+
+struct LessSimilar {
+    bool operator()(const HnswIndex::Neighbor& a, const HnswIndex::Neighbor& b) const {
+        return a.similarity < b.similarity;
+    }
+};
+
+// Visited set for the single-threaded build: one mark per row, a new mark
+// value per layer search, so nothing is cleared between searches
+struct MarkVisited {
+    std::vector<uint32_t>& marks;
+    uint32_t mark;
+    bool insert(uint32_t row) {
+        if (marks[row] == mark) return false;
+        marks[row] = mark;
+        return true;
+    }
+};
+
+// Visited set for concurrent queries, sized by what the search touches
+struct SetVisited {
+    std::unordered_set<uint32_t> rows;
+    bool insert(uint32_t row) { return rows.insert(row).second; }
+};
+
+} // namespace
+
+HnswIndex::HnswIndex(std::shared_ptr<const EmbeddingStore> store, size_t m, size_t ef_construction,
+                     uint64_t seed)
+    : store_(std::move(store)), m_(std::max<size_t>(m, 2)),
+      ef_construction_(std::max(ef_construction, m_)) {
+    size_t count = store_->size();
+    levels_.resize(count);
+    bottom_links_.assign(count * 2 * m_, 0);
+    bottom_counts_.assign(count, 0);
+    upper_links_.resize(count);
+
+    // Layer of each node drawn from an exponential distribution, so each
+    // layer holds about 1/m of the one below
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    double level_mult = 1.0 / std::log(static_cast<double>(m_));
+
+    std::vector<uint32_t> marks(count, 0);
+    uint32_t mark = 0;
+    for (uint32_t row = 0; row < count; ++row) {
+        int level = std::min(static_cast<int>(-std::log(1.0 - uniform(rng)) * level_mult), 31);
+        levels_[row] = static_cast<uint8_t>(level);
+        upper_links_[row].resize(level);
+        insert(row, level, marks, mark);
+    }
+}
+
+void HnswIndex::links(uint32_t row, int level, const uint32_t** begin, size_t* count) const {
+    if (level == 0) {
+        *begin = &bottom_links_[row * 2 * m_];
+        *count = bottom_counts_[row];
+    } else {
+        const auto& layer = upper_links_[row][level - 1];
+        *begin = layer.data();
+        *count = layer.size();
+    }
+}
+
+void HnswIndex::setLinks(uint32_t row, int level, const std::vector<uint32_t>& links) {
+    if (level == 0) {
+        std::copy(links.begin(), links.end(), &bottom_links_[row * 2 * m_]);
+        bottom_counts_[row] = static_cast<uint32_t>(links.size());
+    } else {
+        upper_links_[row][level - 1] = links;
+    }
+}
+
+template <typename Similarity>
+uint32_t HnswIndex::descend(const Similarity& similarity, int level) const {
+    uint32_t current = entry_point_;
+    float best = similarity(current);
+    for (int layer = max_level_; layer > level; --layer) {
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            const uint32_t* neighbors;
+            size_t count;
+            links(current, layer, &neighbors, &count);
+            for (size_t i = 0; i < count; ++i) {
+                float candidate = similarity(neighbors[i]);
+                if (candidate > best) {
+                    best = candidate;
+                    current = neighbors[i];
+                    moved = true;
+                }
+            }
+        }
+    }
+    return current;
+}
+
+template <typename Similarity, typename Visited>
+std::vector<HnswIndex::Neighbor> HnswIndex::searchLayer(const Similarity& similarity, uint32_t entry,
+                                                        size_t ef, int level, Visited& visited) const {
+    // Frontier pops the most similar; results pops the least similar
+    std::priority_queue<Neighbor, std::vector<Neighbor>, LessSimilar> frontier;
+    std::priority_queue<Neighbor, std::vector<Neighbor>, MoreSimilar> results;
+
+    visited.insert(entry);
+    Neighbor start{entry, similarity(entry)};
+    frontier.push(start);
+    results.push(start);
+
+    while (!frontier.empty()) {
+        Neighbor current = frontier.top();
+        if (results.size() >= ef && current.similarity < results.top().similarity) {
+            break;  // nothing left that can improve the results
+        }
+        frontier.pop();
+
+        const uint32_t* neighbors;
+        size_t count;
+        links(current.row, level, &neighbors, &count);
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t row = neighbors[i];
+            if (!visited.insert(row)) {
+                continue;
+            }
+            float score = similarity(row);
+            if (results.size() < ef || score > results.top().similarity) {
+                frontier.push({row, score});
+                results.push({row, score});
+                if (results.size() > ef) {
+                    results.pop();
+                }
+            }
+        }
+    }
+
+    std::vector<Neighbor> ordered(results.size());
+    for (size_t i = ordered.size(); i-- > 0;) {
+        ordered[i] = results.top();
+        results.pop();
+    }
+    return ordered;
+}
+
+std::vector<uint32_t> HnswIndex::selectNeighbors(const std::vector<Neighbor>& candidates,
+                                                 size_t max_links) const {
+    std::vector<uint32_t> selected;
+    for (const auto& candidate : candidates) {
+        if (selected.size() >= max_links) {
+            break;
+        }
+        bool diverse = std::all_of(selected.begin(), selected.end(), [&](uint32_t chosen) {
+            return store_->similarity(candidate.row, chosen) < candidate.similarity;
+        });
+        if (diverse) {
+            selected.push_back(candidate.row);
+        }
+    }
+    return selected;
+}
+
+void HnswIndex::insert(uint32_t row, int level, std::vector<uint32_t>& visited_marks, uint32_t& mark) {
+    if (max_level_ < 0) {
+        entry_point_ = row;
+        max_level_ = level;
+        return;
+    }
+
+    auto similarity = [&](uint32_t other) { return store_->similarity(row, other); };
+    uint32_t entry = descend(similarity, level);
+
+    for (int layer = std::min(level, max_level_); layer >= 0; --layer) {
+        MarkVisited visited{visited_marks, ++mark};
+        auto candidates = searchLayer(similarity, entry, ef_construction_, layer, visited);
+        auto selected = selectNeighbors(candidates, m_);
+        setLinks(row, layer, selected);
+
+        // Link back, re-pruning neighbors that are already full
+        size_t max_links = layer == 0 ? 2 * m_ : m_;
+        for (uint32_t neighbor : selected) {
+            const uint32_t* existing;
+            size_t count;
+            links(neighbor, layer, &existing, &count);
+            std::vector<uint32_t> updated(existing, existing + count);
+            if (count < max_links) {
+                updated.push_back(row);
+            } else {
+                std::vector<Neighbor> pool;
+                pool.reserve(count + 1);
+                for (uint32_t other : updated) {
+                    pool.push_back({other, store_->similarity(neighbor, other)});
+                }
+                pool.push_back({row, store_->similarity(neighbor, row)});
+                std::sort(pool.begin(), pool.end(), MoreSimilar());
+                updated = selectNeighbors(pool, max_links);
+            }
+            setLinks(neighbor, layer, updated);
+        }
+        entry = candidates.front().row;
+    }
+
+    if (level > max_level_) {
+        max_level_ = level;
+        entry_point_ = row;
+    }
+}
+
+std::vector<HnswIndex::Neighbor> HnswIndex::search(const QuantizedVector& query, size_t k,
+                                                   size_t ef) const {
+    if (max_level_ < 0 || k == 0) {
+        return {};
+    }
+    auto similarity = [&](uint32_t row) { return store_->similarity(query, row); };
+    uint32_t entry = descend(similarity, 0);
+    SetVisited visited;
+    auto results = searchLayer(similarity, entry, std::max(ef, k), 0, visited);
+    if (results.size() > k) {
+        results.resize(k);
+    }
+    return results;
+}
+
+} // namespace atlas
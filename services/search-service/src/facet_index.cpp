@@ -0,0 +1,468 @@
+#include "facet_index.h"
+#include <algorithm>
+#include <mutex>
+#include <string_view>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ATLAS_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace atlas {
+
+// AND-popcount kernels
+
+static uint64_t andPopcountScalar(const uint64_t* x, const uint64_t* y, size_t n) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        count += static_cast<uint64_t>(__builtin_popcountll(x[i] & y[i]));
+    }
+    return count;
+}
+
+#ifdef ATLAS_X86_KERNELS
+// Same as embeddings.cpp: compiled for the instruction regardless of -march
+// and only called after the runtime CPU check
+
+__attribute__((target("popcnt")))
+static uint64_t andPopcountPopcnt(const uint64_t* x, const uint64_t* y, size_t n) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        count += static_cast<uint64_t>(__builtin_popcountll(x[i] & y[i]));
+    }
+    return count;
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static uint64_t andPopcountAvx512(const uint64_t* x, const uint64_t* y, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < n; i += 8) {
+        __m512i vx = _mm512_loadu_si512(x + i);
+        __m512i vy = _mm512_loadu_si512(y + i);
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(_mm512_and_si512(vx, vy)));
+    }
+    // Spill and add, as in dotAvx512Vnni (GCC 12's _mm512_reduce_add_epi64
+    // also trips -Wuninitialized)
+    alignas(64) uint64_t lanes[8];
+    _mm512_store_si512(lanes, acc);
+    uint64_t count = 0;
+    for (uint64_t lane : lanes) {
+        count += lane;
+    }
+    return count;
+}
+#endif
+
+PopcountKernel bestPopcountKernel() {
+#ifdef ATLAS_X86_KERNELS
+    static const PopcountKernel best = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512vpopcntdq")) {
+            return PopcountKernel::Avx512Vpopcnt;
+        }
+        if (__builtin_cpu_supports("popcnt")) {
+            return PopcountKernel::Popcnt;
+        }
+        return PopcountKernel::Scalar;
+    }();
+    return best;
+#else
+    return PopcountKernel::Scalar;
+#endif
+}
+
+const char* popcountKernelName(PopcountKernel kernel) {
+    switch (kernel) {
+        case PopcountKernel::Popcnt: return "popcnt";
+        case PopcountKernel::Avx512Vpopcnt: return "avx512-vpopcntdq";
+        default: return "scalar";
+    }
+}
+
+uint64_t andPopcount(const uint64_t* x, const uint64_t* y, size_t n, PopcountKernel kernel) {
+#ifdef ATLAS_X86_KERNELS
+    switch (kernel) {
+        case PopcountKernel::Avx512Vpopcnt: return andPopcountAvx512(x, y, n);
+        case PopcountKernel::Popcnt: return andPopcountPopcnt(x, y, n);
+        default: break;
+    }
+#else
+    (void)kernel;
+#endif
+    return andPopcountScalar(x, y, n);
+}
+
+// RoaringBitmap implementation
+
+bool RoaringBitmap::Container::contains(uint16_t low) const {
+    if (is_bitmap) {
+        return (bitmap[low >> 6] >> (low & 63)) & 1;
+    }
+    return std::binary_search(array.begin(), array.end(), low);
+}
+
+void RoaringBitmap::Container::add(uint16_t low) {
+    if (is_bitmap) {
+        uint64_t bit = uint64_t(1) << (low & 63);
+        if (!(bitmap[low >> 6] & bit)) {
+            bitmap[low >> 6] |= bit;
+            cardinality++;
+        }
+        return;
+    }
+
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it != array.end() && *it == low) {
+        return;
+    }
+    array.insert(it, low);
+    cardinality++;
+
+    if (array.size() > kArrayMax) {
+        // Dense now: a bitmap is smaller and intersects faster
+        bitmap.assign(kBitmapWords, 0);
+        for (uint16_t value : array) {
+            bitmap[value >> 6] |= uint64_t(1) << (value & 63);
+        }
+        array.clear();
+        array.shrink_to_fit();
+        is_bitmap = true;
+    }
+}
+
+void RoaringBitmap::Container::remove(uint16_t low) {
+    if (is_bitmap) {
+        uint64_t bit = uint64_t(1) << (low & 63);
+        if (bitmap[low >> 6] & bit) {
+            bitmap[low >> 6] &= ~bit;
+            cardinality--;
+        }
+        if (cardinality <= kArrayMax / 2) {
+            // Back to an array, with hysteresis so add/remove don't thrash
+            for (size_t word = 0; word < kBitmapWords; ++word) {
+                for (uint64_t bits = bitmap[word]; bits; bits &= bits - 1) {
+                    array.push_back(static_cast<uint16_t>(word * 64 + __builtin_ctzll(bits)));
+                }
+            }
+            bitmap.clear();
+            bitmap.shrink_to_fit();
+            is_bitmap = false;
+        }
+        return;
+    }
+
+    auto it = std::lower_bound(array.begin(), array.end(), low);
+    if (it != array.end() && *it == low) {
+        array.erase(it);
+        cardinality--;
+    }
+}
+
+RoaringBitmap::Container* RoaringBitmap::find(uint16_t key) {
+    auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+        [](const Container& c, uint16_t k) { return c.key < k; });
+    return it != containers_.end() && it->key == key ? &*it : nullptr;
+}
+
+const RoaringBitmap::Container* RoaringBitmap::find(uint16_t key) const {
+    return const_cast<RoaringBitmap*>(this)->find(key);
+}
+
+void RoaringBitmap::add(uint32_t value) {
+    uint16_t key = static_cast<uint16_t>(value >> 16);
+    auto it = std::lower_bound(containers_.begin(), containers_.end(), key,
+        [](const Container& c, uint16_t k) { return c.key < k; });
+    if (it == containers_.end() || it->key != key) {
+        Container container;
+        container.key = key;
+        it = containers_.insert(it, std::move(container));
+    }
+    it->add(static_cast<uint16_t>(value & 0xFFFF));
+}
+
+void RoaringBitmap::remove(uint32_t value) {
+    uint16_t key = static_cast<uint16_t>(value >> 16);
+    Container* container = find(key);
+    if (!container) {
+        return;
+    }
+    container->remove(static_cast<uint16_t>(value & 0xFFFF));
+    if (container->cardinality == 0) {
+        containers_.erase(containers_.begin() + (container - containers_.data()));
+    }
+}
+
+bool RoaringBitmap::contains(uint32_t value) const {
+    const Container* container = find(static_cast<uint16_t>(value >> 16));
+    return container && container->contains(static_cast<uint16_t>(value & 0xFFFF));
+}
+
+uint64_t RoaringBitmap::cardinality() const {
+    uint64_t total = 0;
+    for (const auto& container : containers_) {
+        total += container.cardinality;
+    }
+    return total;
+}
+
+uint64_t RoaringBitmap::andCardinality(const Container& a, const Container& b) {
+    if (a.is_bitmap && b.is_bitmap) {
+        return andPopcount(a.bitmap.data(), b.bitmap.data(), kBitmapWords, bestPopcountKernel());
+    }
+    if (a.is_bitmap || b.is_bitmap) {
+        const Container& dense = a.is_bitmap ? a : b;
+        const Container& sparse = a.is_bitmap ? b : a;
+        uint64_t count = 0;
+        for (uint16_t value : sparse.array) {
+            count += (dense.bitmap[value >> 6] >> (value & 63)) & 1;
+        }
+        return count;
+    }
+
+    // Two sorted arrays: merge
+    uint64_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < a.array.size() && j < b.array.size()) {
+        if (a.array[i] < b.array[j]) {
+            i++;
+        } else if (a.array[i] > b.array[j]) {
+            j++;
+        } else {
+            count++;
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+
+uint64_t RoaringBitmap::andCardinality(const RoaringBitmap& other) const {
+    uint64_t count = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < containers_.size() && j < other.containers_.size()) {
+        uint16_t a = containers_[i].key;
+        uint16_t b = other.containers_[j].key;
+        if (a < b) {
+            i++;
+        } else if (a > b) {
+            j++;
+        } else {
+            count += andCardinality(containers_[i], other.containers_[j]);
+            i++;
+            j++;
+        }
+    }
+    return count;
+}
+
+// FacetIndex implementation
+
+FacetIndex::FacetIndex(const std::vector<std::string>& fields) : fields_(fields) {
+    tables_.postings.resize(fields_.size());
+}
+
+void FacetIndex::Tables::remove(const std::string& id) {
+    auto it = by_id.find(id);
+    if (it == by_id.end()) {
+        return;
+    }
+    uint32_t ordinal = it->second;
+    by_id.erase(it);
+
+    auto values = doc_values.find(ordinal);
+    if (values != doc_values.end()) {
+        for (const auto& [field, value] : values->second) {
+            auto posting = postings[field].find(value);
+            if (posting != postings[field].end()) {
+                posting->second.remove(ordinal);
+                if (posting->second.empty()) {
+                    postings[field].erase(posting);
+                }
+            }
+        }
+        doc_values.erase(values);
+    }
+    free_ordinals.push_back(ordinal);
+}
+
+void FacetIndex::Tables::upsert(const std::vector<std::string>& fields, const std::string& id,
+                                const nlohmann::json& source) {
+    // Keep the ordinal: it may sit in a caller's candidate bitmap
+    uint32_t ordinal;
+    auto it = by_id.find(id);
+    if (it != by_id.end()) {
+        ordinal = it->second;
+        remove(id);
+        free_ordinals.pop_back();
+    } else if (!free_ordinals.empty()) {
+        ordinal = free_ordinals.back();
+        free_ordinals.pop_back();
+    } else {
+        ordinal = next_ordinal++;
+    }
+    by_id[id] = ordinal;
+
+    auto& values = doc_values[ordinal];
+    for (size_t field = 0; field < fields.size(); ++field) {
+        if (!source.contains(fields[field])) {
+            continue;
+        }
+        const auto& node = source[fields[field]];
+        auto addValue = [&](const nlohmann::json& item) {
+            if (item.is_string() && !item.get_ref<const std::string&>().empty()) {
+                const auto& value = item.get_ref<const std::string&>();
+                postings[field][value].add(ordinal);
+                // Once per value, so tallying doc_values matches the bitmaps
+                if (std::find(values.begin(), values.end(), std::make_pair(field, value)) == values.end()) {
+                    values.emplace_back(field, value);
+                }
+            }
+        };
+        if (node.is_array()) {
+            for (const auto& item : node) addValue(item);
+        } else {
+            addValue(node);
+        }
+    }
+}
+
+void FacetIndex::upsert(const std::string& id, const nlohmann::json& source) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    tables_.upsert(fields_, id, source);
+}
+
+void FacetIndex::remove(const std::string& id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    tables_.remove(id);
+}
+
+size_t FacetIndex::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return tables_.by_id.size();
+}
+
+RoaringBitmap FacetIndex::candidates(const std::vector<std::string>& ids) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return candidatesLocked(ids);
+}
+
+RoaringBitmap FacetIndex::candidatesLocked(const std::vector<std::string>& ids) const {
+    RoaringBitmap bitmap;
+    for (const auto& id : ids) {
+        auto it = tables_.by_id.find(id);
+        if (it != tables_.by_id.end()) {
+            bitmap.add(it->second);
+        }
+    }
+    return bitmap;
+}
+
+std::vector<FacetCount> FacetIndex::counts(const std::string& field, const RoaringBitmap& candidates,
+                                           size_t top_n) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return countsLocked(field, candidates, top_n);
+}
+
+std::vector<FacetResult> FacetIndex::facets(const std::vector<std::string>& ids,
+                                            const std::vector<std::string>& fields,
+                                            size_t top_n) const {
+    std::vector<FacetResult> results;
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    RoaringBitmap bitmap = candidatesLocked(ids);
+    for (const auto& field : fields) {
+        results.push_back({field, countsLocked(field, bitmap, top_n)});
+    }
+    return results;
+}
+
+std::vector<FacetCount> FacetIndex::countsLocked(const std::string& field, const RoaringBitmap& candidates,
+                                                 size_t top_n) const {
+    std::vector<FacetCount> counts;
+    auto field_it = std::find(fields_.begin(), fields_.end(), field);
+    if (field_it == fields_.end() || candidates.empty()) {
+        return counts;
+    }
+
+    size_t field_index = field_it - fields_.begin();
+    const auto& postings = tables_.postings[field_index];
+    if (candidates.cardinality() < postings.size()) {
+        // A high-cardinality field (brand, seller) against a small window:
+        // tally the candidates' own values instead of intersecting every
+        // value's posting list
+        std::unordered_map<std::string_view, int> tally;
+        candidates.forEach([&](uint32_t ordinal) {
+            auto values = tables_.doc_values.find(ordinal);
+            if (values == tables_.doc_values.end()) {
+                return;
+            }
+            for (const auto& [field, value] : values->second) {
+                if (field == field_index) {
+                    tally[value]++;
+                }
+            }
+        });
+        for (const auto& [value, count] : tally) {
+            counts.push_back({std::string(value), count});
+        }
+    } else {
+        for (const auto& [value, docs] : postings) {
+            uint64_t count = docs.andCardinality(candidates);
+            if (count > 0) {
+                counts.push_back({value, static_cast<int>(count)});
+            }
+        }
+    }
+
+    // Highest count first; ties by value so the order is stable
+    auto byCount = [](const FacetCount& a, const FacetCount& b) {
+        return a.count != b.count ? a.count > b.count : a.value < b.value;
+    };
+    if (counts.size() > top_n) {
+        std::partial_sort(counts.begin(), counts.begin() + top_n, counts.end(), byCount);
+        counts.resize(top_n);
+    } else {
+        std::sort(counts.begin(), counts.end(), byCount);
+    }
+    return counts;
+}
+
+size_t FacetIndex::refresh(ElasticsearchClient& es, bool full) {
+    std::vector<std::string> source_fields = fields_;
+    for (const auto& field : IndexSyncWatermark::fields()) source_fields.push_back(field);
+
+    // A full scan starts over, so deleted products drop out
+    IndexSyncWatermark watermark = full ? IndexSyncWatermark() : watermark_;
+    nlohmann::json query = watermark.query();
+    auto apply = [&](Tables& tables, const nlohmann::json& hit) {
+        std::string id = hit.value("_id", "");
+        if (id.empty() || !hit.contains("_source")) {
+            return;
+        }
+        const auto& source = hit["_source"];
+        watermark.observe(source);
+        tables.upsert(fields_, id, source);
+    };
+
+    size_t scanned;
+    if (full) {
+        Tables fresh;
+        fresh.postings.resize(fields_.size());
+        scanned = es.scan(query, source_fields, [&](const nlohmann::json& hit) {
+            apply(fresh, hit);
+        });
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        tables_ = std::move(fresh);
+    } else {
+        scanned = es.scan(query, source_fields, [&](const nlohmann::json& hit) {
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            apply(tables_, hit);
+        });
+    }
+
+    watermark_ = watermark;
+    return scanned;
+}
+
+} // namespace atlas
@@ -0,0 +1,215 @@
+#include "federation.h"
+#include <queue>
+#include <stdexcept>
+#include <algorithm>
+
+namespace atlas {
+
+FederatedSearcher::FederatedSearcher(const std::vector<BackendConfig>& backends)
+    : backends_(backends) {
+    for (const auto& backend : backends_) {
+        clients_.push_back(std::make_unique<ElasticsearchClient>(backend.host, backend.port, backend.index));
+    }
+}
+
+FederatedSearcher::~FederatedSearcher() = default;
+
+std::vector<BackendConfig> FederatedSearcher::parseBackends(const std::string& spec,
+                                                            int default_deadline_ms) {
+    std::vector<BackendConfig> backends;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(start, end - start);
+        start = end + 1;
+        if (item.empty()) continue;
+
+        // name=host:port/index[@deadline_ms]
+        size_t eq = item.find('=');
+        size_t colon = item.find(':', eq == std::string::npos ? 0 : eq);
+        size_t slash = item.find('/', colon == std::string::npos ? 0 : colon);
+        if (eq == std::string::npos || colon == std::string::npos || slash == std::string::npos ||
+            eq == 0 || colon == eq + 1 || slash == colon + 1 || slash + 1 == item.size()) {
+            throw std::invalid_argument("Malformed federation backend: " + item);
+        }
+
+        BackendConfig backend;
+        backend.name = item.substr(0, eq);
+        backend.host = item.substr(eq + 1, colon - eq - 1);
+        backend.deadline_ms = default_deadline_ms;
+
+        size_t at = item.find('@', slash);
+        backend.index = item.substr(slash + 1, (at == std::string::npos ? item.size() : at) - slash - 1);
+
+        try {
+            backend.port = std::stoi(item.substr(colon + 1, slash - colon - 1));
+            if (at != std::string::npos) {
+                backend.deadline_ms = std::stoi(item.substr(at + 1));
+            }
+        } catch (const std::exception&) {
+            throw std::invalid_argument("Malformed federation backend: " + item);
+        }
+
+        backends.push_back(backend);
+    }
+    return backends;
+}
+
+int FederatedSearcher::esTimeoutMs(int deadline_ms) {
+    // Leave the larger of 20ms and a fifth of the deadline for the network
+    // and for ES to serialize what it collected
+    int margin = std::max(20, deadline_ms / 5);
+    return std::max(1, deadline_ms - margin);
+}
+
+std::vector<nlohmann::json> FederatedSearcher::mergeTopK(
+        const std::vector<std::vector<nlohmann::json>>& hit_lists, size_t k) {
+    // Heap entry: (score, list index, position in list); max-heap on score
+    using Entry = std::tuple<double, size_t, size_t>;
+    std::priority_queue<Entry> heap;
+
+    for (size_t list = 0; list < hit_lists.size(); ++list) {
+        if (!hit_lists[list].empty()) {
+            heap.emplace(hit_lists[list][0].value("_score", 0.0), list, 0);
+        }
+    }
+
+    std::vector<nlohmann::json> merged;
+    merged.reserve(k);
+    while (!heap.empty() && merged.size() < k) {
+        auto [score, list, pos] = heap.top();
+        heap.pop();
+        merged.push_back(hit_lists[list][pos]);
+
+        if (pos + 1 < hit_lists[list].size()) {
+            heap.emplace(hit_lists[list][pos + 1].value("_score", 0.0), list, pos + 1);
+        }
+    }
+    return merged;
+}
+
+nlohmann::json FederatedSearcher::search(const std::string& query, int size,
+                                         const SearchFilters& filters,
+                                         const EsQueryOptions& options) {
+    size_t n = backends_.size();
+
+    // Scatter, all from this thread over one curl multi handle. The curl
+    // timeout is the deadline, so no backend holds the request up for
+    // longer. ES gets a shorter timeout, so a slow backend answers with the
+    // hits it has before curl gives up on it.
+    std::vector<ConcurrentSearch> searches;
+    searches.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        ConcurrentSearch search;
+        search.client = clients_[i].get();
+        search.timeout_ms = esTimeoutMs(backends_[i].deadline_ms);
+        search.options = options;
+        search.options.client_timeout_ms = backends_[i].deadline_ms;
+        searches.push_back(std::move(search));
+    }
+    ElasticsearchClient::searchConcurrently(searches, query, size, filters);
+
+    std::vector<nlohmann::json> responses(n);
+    std::vector<std::string> errors(n);
+    std::vector<int> elapsed_ms(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        responses[i] = std::move(searches[i].response);
+        errors[i] = std::move(searches[i].error);
+        elapsed_ms[i] = searches[i].elapsed_ms;
+        if (errors[i].empty() && !responses[i].contains("hits")) {
+            errors[i] = responses[i].contains("error") ? responses[i]["error"].dump() : "response without hits";
+        }
+    }
+
+    // Gather: normalize scores per backend, collect stats
+    std::vector<std::vector<nlohmann::json>> hit_lists(n);
+    nlohmann::json statuses = nlohmann::json::array();
+    int64_t total = 0;
+    int took = 0;
+    bool timed_out = false;
+    bool partial = false;
+    nlohmann::json shards = {{"total", 0}, {"successful", 0}, {"skipped", 0}, {"failed", 0}};
+
+    for (size_t i = 0; i < n; ++i) {
+        nlohmann::json status = {
+            {"name", backends_[i].name},
+            {"ok", errors[i].empty()},
+            {"took_ms", elapsed_ms[i]},
+            {"hits", 0}
+        };
+
+        if (!errors[i].empty()) {
+            partial = true;
+            status["error"] = errors[i];
+            statuses.push_back(status);
+            continue;
+        }
+
+        const auto& response = responses[i];
+        const auto& hits = response["hits"];
+        double max_score = hits.contains("max_score") && hits["max_score"].is_number()
+            ? hits["max_score"].get<double>() : 0.0;
+        if (max_score <= 0.0) max_score = 1.0;
+
+        auto& list = hit_lists[i];
+        for (const auto& hit : hits.value("hits", nlohmann::json::array())) {
+            nlohmann::json normalized = hit;
+            double raw = hit.contains("_score") && hit["_score"].is_number() ? hit["_score"].get<double>() : 0.0;
+            normalized["_score"] = raw / max_score;
+            normalized["_backend"] = backends_[i].name;
+            list.push_back(std::move(normalized));
+        }
+
+        if (hits.contains("total") && hits["total"].contains("value")) {
+            total += hits["total"]["value"].get<int64_t>();
+        }
+        took = std::max(took, response.value("took", 0));
+        if (response.value("timed_out", false)) {
+            // ES hit its own timeout and returned what it had
+            timed_out = true;
+            partial = true;
+        }
+        if (response.contains("_shards")) {
+            for (const char* field : {"total", "successful", "skipped", "failed"}) {
+                shards[field] = shards[field].get<int>() + response["_shards"].value(field, 0);
+            }
+        }
+
+        status["hits"] = static_cast<int>(list.size());
+        statuses.push_back(status);
+    }
+
+    return {
+        {"took", took},
+        {"timed_out", timed_out},
+        {"_shards", shards},
+        {"hits", {
+            {"total", {{"value", total}}},
+            {"hits", mergeTopK(hit_lists, static_cast<size_t>(std::max(size, 0)))}
+        }},
+        {"federation", {
+            {"partial", partial},
+            {"backends", statuses}
+        }}
+    };
+}
+
+std::vector<BackendStatus> FederatedSearcher::parseBackendStatuses(const nlohmann::json& merged_response) {
+    std::vector<BackendStatus> statuses;
+    if (!merged_response.contains("federation")) {
+        return statuses;
+    }
+    for (const auto& item : merged_response["federation"].value("backends", nlohmann::json::array())) {
+        BackendStatus status;
+        status.name = item.value("name", "");
+        status.ok = item.value("ok", false);
+        status.took_ms = item.value("took_ms", 0);
+        status.hits = item.value("hits", 0);
+        status.error = item.value("error", "");
+        statuses.push_back(status);
+    }
+    return statuses;
+}
+
+} // namespace atlas
@@ -0,0 +1,62 @@
+#include "incremental_search.h"
+
+namespace atlas {
+
+IncrementalSessionStore::IncrementalSessionStore(size_t max_sessions, int max_age_ms)
+    : max_sessions_(max_sessions), max_age_(max_age_ms) {}
+
+bool IncrementalSessionStore::isRefinement(const std::string& previous, const std::string& next) {
+    return !previous.empty() && next.size() >= previous.size() &&
+           next.compare(0, previous.size(), previous) == 0;
+}
+
+std::optional<CandidateSet> IncrementalSessionStore::lookup(const std::string& session,
+                                                            const std::string& normalized_query,
+                                                            const std::string& filters_key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(session);
+    if (it == index_.end()) {
+        return std::nullopt;
+    }
+
+    const CandidateSet& set = it->second->candidates;
+    if (set.filters_key != filters_key ||
+        !isRefinement(set.normalized_query, normalized_query) ||
+        std::chrono::steady_clock::now() - set.fetched_at > max_age_) {
+        return std::nullopt;
+    }
+
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return set;
+}
+
+void IncrementalSessionStore::store(const std::string& session, const CandidateSet& candidates) {
+    if (max_sessions_ == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(session);
+    if (it != index_.end()) {
+        it->second->candidates = candidates;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+
+    lru_.push_front(Entry{session, candidates});
+    index_[session] = lru_.begin();
+
+    if (lru_.size() > max_sessions_) {
+        index_.erase(lru_.back().session);
+        lru_.pop_back();
+    }
+}
+
+size_t IncrementalSessionStore::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+} // namespace atlas
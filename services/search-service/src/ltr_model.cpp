@@ -0,0 +1,261 @@
+#include "ltr_model.h"
+#include "search_service.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <functional>
+
+namespace atlas {
+
+const char* ltrFeatureName(int feature) {
+    static const char* names[kNumLtrFeatures] = {
+        "es_score", "recency", "title_match", "es_rank", "query_terms", "title_terms",
+        "semantic", "category_proximity"
+    };
+    return feature >= 0 && feature < kNumLtrFeatures ? names[feature] : "";
+}
+
+// Our feature index for a split name: a LtrFeature name or "f<index>"
+static int featureIndex(const std::string& name) {
+    for (int feature = 0; feature < kNumLtrFeatures; ++feature) {
+        if (name == ltrFeatureName(feature)) {
+            return feature;
+        }
+    }
+    if (name.size() > 1 && name[0] == 'f' &&
+        std::all_of(name.begin() + 1, name.end(), ::isdigit)) {
+        int feature = std::stoi(name.substr(1));
+        if (feature < kNumLtrFeatures) {
+            return feature;
+        }
+    }
+    throw std::invalid_argument("Unknown LTR feature: " + name);
+}
+
+std::shared_ptr<const LtrModel> LtrModel::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot read LTR model: " + path);
+    }
+    nlohmann::json model;
+    try {
+        model = nlohmann::json::parse(file);
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument("Malformed LTR model " + path + ": " + e.what());
+    }
+    return fromJson(model);
+}
+
+uint32_t LtrModel::addXgboostNode(const nlohmann::json& node) {
+    uint32_t index = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(Node{-1, 0.0f, 0, 0, 0.0f});
+
+    if (node.contains("leaf")) {
+        nodes_[index].leaf_value = node["leaf"].get<float>();
+        return index;
+    }
+
+    if (!node.contains("split") || !node.contains("children") || !node["children"].is_array()) {
+        throw std::invalid_argument("Malformed XGBoost node: " + node.dump());
+    }
+    int yes = node.at("yes").get<int>();
+    int no = node.at("no").get<int>();
+    const nlohmann::json* yes_child = nullptr;
+    const nlohmann::json* no_child = nullptr;
+    for (const auto& child : node["children"]) {
+        int id = child.at("nodeid").get<int>();
+        if (id == yes) yes_child = &child;
+        if (id == no) no_child = &child;
+    }
+    if (!yes_child || !no_child) {
+        throw std::invalid_argument("XGBoost node without both children: " + node.dump());
+    }
+
+    // XGBoost goes left ("yes") when x < split_condition; the largest float
+    // below the condition turns that into our x <= threshold
+    float condition = node.at("split_condition").get<float>();
+    int feature = featureIndex(node["split"].get<std::string>());
+
+    uint32_t left = addXgboostNode(*yes_child);
+    uint32_t right = addXgboostNode(*no_child);
+    nodes_[index] = Node{feature, std::nextafter(condition, -INFINITY), left, right, 0.0f};
+    return index;
+}
+
+// Largest float not above `threshold`. Features are floats, so for any
+// feature x, x <= result exactly when x <= threshold; rounding to nearest
+// could land above the double and send x == result the wrong way.
+static float floatAtMost(double threshold) {
+    float narrowed = static_cast<float>(threshold);
+    if (static_cast<double>(narrowed) > threshold) {
+        narrowed = std::nextafter(narrowed, -INFINITY);
+    }
+    return narrowed;
+}
+
+uint32_t LtrModel::addLightgbmNode(const nlohmann::json& node, const std::vector<int>& feature_map) {
+    uint32_t index = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(Node{-1, 0.0f, 0, 0, 0.0f});
+
+    if (node.contains("leaf_value")) {
+        nodes_[index].leaf_value = node["leaf_value"].get<float>();
+        return index;
+    }
+
+    if (node.value("decision_type", "<=") != "<=") {
+        throw std::invalid_argument("Unsupported LightGBM decision type: " + node.dump());
+    }
+    int split_feature = node.at("split_feature").get<int>();
+    if (split_feature < 0 || split_feature >= static_cast<int>(feature_map.size())) {
+        throw std::invalid_argument("LightGBM split on unknown feature " + std::to_string(split_feature));
+    }
+
+    uint32_t left = addLightgbmNode(node.at("left_child"), feature_map);
+    uint32_t right = addLightgbmNode(node.at("right_child"), feature_map);
+    // LightGBM thresholds are doubles
+    nodes_[index] = Node{feature_map[split_feature], floatAtMost(node.at("threshold").get<double>()),
+                         left, right, 0.0f};
+    return index;
+}
+
+std::shared_ptr<const LtrModel> LtrModel::fromJson(const nlohmann::json& model) {
+    auto result = std::make_shared<LtrModel>();
+    result->fingerprint_ = stableHash(model.dump());
+
+    try {
+        if (model.is_object() && model.contains("tree_info")) {
+            // LightGBM: features are referenced by position in feature_names
+            std::vector<int> feature_map;
+            for (const auto& name : model.at("feature_names")) {
+                feature_map.push_back(featureIndex(name.get<std::string>()));
+            }
+            for (const auto& tree : model["tree_info"]) {
+                result->roots_.push_back(result->addLightgbmNode(tree.at("tree_structure"), feature_map));
+            }
+        } else {
+            // XGBoost: a bare array of trees, or wrapped with a base score
+            const nlohmann::json& trees = model.is_array() ? model : model.at("trees");
+            if (model.is_object()) {
+                result->base_score_ = model.value("base_score", 0.0);
+            }
+            for (const auto& tree : trees) {
+                result->roots_.push_back(result->addXgboostNode(tree));
+            }
+        }
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument(std::string("Malformed LTR model: ") + e.what());
+    }
+
+    if (result->roots_.empty()) {
+        throw std::invalid_argument("LTR model has no trees");
+    }
+    result->buildQuickScorer();
+    return result;
+}
+
+void LtrModel::buildQuickScorer() {
+    struct FeatureSplit {
+        int feature;
+        Split split;
+    };
+    std::vector<FeatureSplit> splits;
+    leaf_values_.assign(roots_.size() * 64, 0.0f);
+
+    for (uint32_t tree = 0; tree < roots_.size(); ++tree) {
+        // Number leaves left to right; each internal node masks out its left
+        // subtree's leaves [first, end) when its test is false
+        uint32_t next_leaf = 0;
+        bool too_deep = false;
+        std::function<void(uint32_t)> visit = [&](uint32_t index) {
+            const Node& node = nodes_[index];
+            if (node.feature < 0) {
+                if (next_leaf >= 64) {
+                    too_deep = true;
+                } else {
+                    leaf_values_[tree * 64 + next_leaf] = node.leaf_value;
+                }
+                next_leaf++;
+                return;
+            }
+            uint32_t first = next_leaf;
+            visit(node.left);
+            uint32_t end = next_leaf;
+            visit(node.right);
+            if (end <= 64) {
+                uint64_t left_leaves = (end - first == 64 ? ~uint64_t(0)
+                                                          : ((uint64_t(1) << (end - first)) - 1) << first);
+                splits.push_back({node.feature, {node.threshold, tree, ~left_leaves}});
+            }
+        };
+        visit(roots_[tree]);
+        if (too_deep) {
+            quick_scorer_ = false;
+            return;
+        }
+    }
+
+    std::stable_sort(splits.begin(), splits.end(), [](const FeatureSplit& a, const FeatureSplit& b) {
+        return a.feature != b.feature ? a.feature < b.feature : a.split.threshold < b.split.threshold;
+    });
+
+    feature_offsets_.assign(kNumLtrFeatures + 1, 0);
+    for (const auto& item : splits) {
+        feature_offsets_[item.feature + 1]++;
+        splits_.push_back(item.split);
+    }
+    for (int feature = 0; feature < kNumLtrFeatures; ++feature) {
+        feature_offsets_[feature + 1] += feature_offsets_[feature];
+    }
+    quick_scorer_ = true;
+}
+
+double LtrModel::scoreTraversal(const float* features) const {
+    double score = base_score_;
+    for (uint32_t root : roots_) {
+        uint32_t index = root;
+        while (nodes_[index].feature >= 0) {
+            const Node& node = nodes_[index];
+            index = features[node.feature] <= node.threshold ? node.left : node.right;
+        }
+        score += nodes_[index].leaf_value;
+    }
+    return score;
+}
+
+void LtrModel::score(const float* features, size_t num_docs, double* out) const {
+    if (!quick_scorer_) {
+        for (size_t doc = 0; doc < num_docs; ++doc) {
+            out[doc] = scoreTraversal(features + doc * kNumLtrFeatures);
+        }
+        return;
+    }
+
+    size_t num_trees = roots_.size();
+    std::vector<uint64_t> leaves(num_trees);
+    for (size_t doc = 0; doc < num_docs; ++doc) {
+        const float* x = features + doc * kNumLtrFeatures;
+        std::fill(leaves.begin(), leaves.end(), ~uint64_t(0));
+
+        for (int feature = 0; feature < kNumLtrFeatures; ++feature) {
+            float value = x[feature];
+            // data(), not &splits_[0]: a model may have no splits at all
+            const Split* split = splits_.data() + feature_offsets_[feature];
+            const Split* end = splits_.data() + feature_offsets_[feature + 1];
+            // Thresholds ascend: every split below the value is false and
+            // drops its left subtree
+            for (; split != end && value > split->threshold; ++split) {
+                leaves[split->tree] &= split->mask;
+            }
+        }
+
+        double score = base_score_;
+        for (size_t tree = 0; tree < num_trees; ++tree) {
+            score += leaf_values_[tree * 64 + __builtin_ctzll(leaves[tree])];
+        }
+        out[doc] = score;
+    }
+}
+
+} // namespace atlas
@@ -1,26 +1,371 @@
 #include "search_service.h"
+#include "response_writer.h"
+#include "federation.h"
+#include "facet_index.h"
+#include "ltr_model.h"
+#include "embeddings.h"
+#include "spelling.h"
+#include "taxonomy.h"
+#include "dedup.h"
+#include "query_stats.h"
 #include <httplib.h>
 #include <iostream>
 #include <nlohmann/json.hpp>
+#include <cstdlib>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+#include <sys/stat.h>
 
 using json = nlohmann::json;
 
+// Responses are compressed by compressBody below. httplib must not compress
+// them again: a gzip'ed body would be gzip'ed twice.
+#if defined(CPPHTTPLIB_ZLIB_SUPPORT) || defined(CPPHTTPLIB_BROTLI_SUPPORT)
+#error "Build cpp-httplib with HTTPLIB_USE_ZLIB_IF_AVAILABLE and HTTPLIB_USE_BROTLI_IF_AVAILABLE off"
+#endif
+
+// Responses smaller than this are sent uncompressed
+static const size_t kMinCompressBytes = 1024;
+
+// httplib worker pool that reports how long each task waited for a worker.
+// Tasks are per connection, so this is connection queueing delay, which is
+// what grows first when the service is overloaded. A keep-alive connection
+// is sampled only once; the controller decays the signal between samples.
+class TimedTaskQueue : public httplib::TaskQueue {
+public:
+    TimedTaskQueue(size_t threads, atlas::BrownoutController* brownout)
+        : pool_(threads), brownout_(brownout) {}
+
+    void enqueue(std::function<void()> fn) override {
+        auto queued_at = std::chrono::steady_clock::now();
+        pool_.enqueue([this, queued_at, fn = std::move(fn)]() {
+            brownout_->recordQueueDelay(std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - queued_at).count());
+            fn();
+        });
+    }
+
+    void shutdown() override { pool_.shutdown(); }
+
+private:
+    httplib::ThreadPool pool_;
+    atlas::BrownoutController* brownout_;
+};
+
+// Read an environment variable, falling back to a default
+static std::string getEnv(const char* name, const std::string& default_value) {
+    const char* value = std::getenv(name);
+    return value ? std::string(value) : default_value;
+}
+
+// Split a comma-separated list, dropping empty items
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        if (end > start) {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+// Poll `path` every `interval_ms` and call `reload` when its mtime (to the
+// nanosecond) or size changes, until `stopping` is set. `reload` reports its
+// own failures and returns false on one; the file then counts as unloaded
+// and is retried on the next poll, so a half-written file is picked up once
+// the writer finishes.
+static std::thread watchFile(const std::string& path, int interval_ms, const std::atomic<bool>& stopping,
+                             std::function<bool()> reload) {
+    return std::thread([path, interval_ms, &stopping, reload = std::move(reload)]() {
+        struct Version {
+            time_t sec = 0;
+            long nsec = 0;
+            off_t size = -1;
+            bool operator!=(const Version& other) const {
+                return sec != other.sec || nsec != other.nsec || size != other.size;
+            }
+        };
+        auto versionOf = [&path]() {
+            struct stat info {};
+            Version version;
+            if (stat(path.c_str(), &info) == 0) {
+                version = {info.st_mtim.tv_sec, info.st_mtim.tv_nsec, info.st_size};
+            }
+            return version;
+        };
+        // The file as loaded at startup
+        Version loaded = versionOf();
+        while (!stopping) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+            Version current = versionOf();
+            if (current.size >= 0 && current != loaded && reload()) {
+                loaded = current;
+            }
+        }
+    });
+}
+
+// Parse typed filter parameters (category, min_price, max_price, in_stock).
+// Returns false and sets `error` on malformed input.
+static bool parseFilters(const httplib::Request& req, atlas::SearchFilters& filters,
+                         std::string& error) {
+    if (req.has_param("category")) {
+        // Comma-separated list, matches any
+        filters.categories = splitList(req.get_param_value("category"));
+    }
+
+    try {
+        if (req.has_param("min_price")) {
+            filters.min_price = std::stod(req.get_param_value("min_price"));
+        }
+        if (req.has_param("max_price")) {
+            filters.max_price = std::stod(req.get_param_value("max_price"));
+        }
+    } catch (const std::exception&) {
+        error = "Invalid price filter";
+        return false;
+    }
+
+    if (req.has_param("in_stock")) {
+        std::string in_stock = req.get_param_value("in_stock");
+        if (in_stock == "true" || in_stock == "1") {
+            filters.in_stock = true;
+        } else if (in_stock == "false" || in_stock == "0") {
+            filters.in_stock = false;
+        } else {
+            error = "Invalid in_stock filter, expected true or false";
+            return false;
+        }
+    }
+
+    return true;
+}
+
 int main() {
     std::cout << "Starting AtlasSearch Service..." << std::endl;
 
+    std::string es_host = getEnv("ES_HOST", "localhost");
+    int es_port = std::stoi(getEnv("ES_PORT", "9200"));
+    // The saved top-queries list doubles as the next start's warm-up list
+    std::string top_queries_file = getEnv("ATLAS_TOP_QUERIES_FILE", "");
+    std::string warmup_file = getEnv("ATLAS_WARMUP_FILE", top_queries_file);
+    int warmup_connections = std::stoi(getEnv("ATLAS_WARMUP_CONNECTIONS", "4"));
+    size_t result_cache_size = std::stoul(getEnv("ATLAS_RESULT_CACHE_SIZE", "10000"));
+    int result_cache_ttl_ms = std::stoi(getEnv("ATLAS_RESULT_CACHE_TTL_MS", "5000"));
+
     // Initialize search service
-    atlas::SearchService search_service("localhost", 9200);
+    atlas::SearchService search_service(es_host, es_port);
+    if (result_cache_size > 0) {
+        search_service.enableResultCache(result_cache_size, result_cache_ttl_ms);
+    }
+
+    // Streaming top/trending queries in fixed memory; also gates result
+    // cache admission
+    bool query_stats = getEnv("ATLAS_QUERY_STATS", "1") == "1";
+    if (query_stats) {
+        atlas::QueryStatsConfig stats_config;
+        stats_config.capacity = std::stoul(getEnv("ATLAS_QUERY_STATS_CAPACITY", "4096"));
+        stats_config.half_life_s = std::stod(getEnv("ATLAS_QUERY_STATS_HALF_LIFE_S", "3600"));
+        stats_config.trend_half_life_s = std::stod(getEnv("ATLAS_QUERY_STATS_TREND_HALF_LIFE_S", "300"));
+        auto stats = std::make_shared<atlas::QueryStats>(stats_config);
+        std::cout << "Query stats: " << stats_config.capacity << " counters, "
+                  << stats->memoryBytes() / 1024 << " KiB" << std::endl;
+        search_service.enableQueryStats(stats, std::stod(getEnv("ATLAS_CACHE_ADMIT_MIN_COUNT", "1.5")));
+    }
+    size_t top_queries_count = std::stoul(getEnv("ATLAS_TOP_QUERIES_COUNT", "500"));
+    int top_queries_save_ms = std::stoi(getEnv("ATLAS_TOP_QUERIES_SAVE_MS", "60000"));
+
+    // Search-as-you-type sessions (0 disables)
+    size_t incremental_sessions = std::stoul(getEnv("ATLAS_INCREMENTAL_SESSIONS", "2000"));
+    if (incremental_sessions > 0) {
+        search_service.enableIncrementalSearch(
+            incremental_sessions,
+            std::stoi(getEnv("ATLAS_INCREMENTAL_MAX_AGE_MS", "30000")),
+            std::stoi(getEnv("ATLAS_INCREMENTAL_CANDIDATES", "100")));
+    }
+
+    // Federated mode: fan each query out to several indexes/clusters
+    std::string federation_spec = getEnv("ATLAS_FEDERATION_BACKENDS", "");
+    if (!federation_spec.empty()) {
+        int deadline_ms = std::stoi(getEnv("ATLAS_FEDERATION_DEADLINE_MS", "200"));
+        auto backends = atlas::FederatedSearcher::parseBackends(federation_spec, deadline_ms);
+        std::cout << "Federated search across " << backends.size() << " backends" << std::endl;
+        search_service.enableFederation(std::make_unique<atlas::FederatedSearcher>(backends));
+    }
+
+    // Rerank weights and query template. The environment sets the base; the
+    // file, re-read when it changes, overrides it key by key.
+    atlas::RankingConfig base_ranking_config;
+    base_ranking_config.semantic_weight = std::stod(getEnv("ATLAS_SEMANTIC_WEIGHT", "0.2"));
+    base_ranking_config.taxonomy_weight = std::stod(getEnv("ATLAS_TAXONOMY_WEIGHT", "0.1"));
+    std::string ranking_config_path = getEnv("ATLAS_RANKING_CONFIG", "");
+    int ranking_config_reload_ms = std::stoi(getEnv("ATLAS_RANKING_CONFIG_RELOAD_MS", "5000"));
+    search_service.setRankingConfig(ranking_config_path.empty()
+        ? base_ranking_config : atlas::RankingConfig::load(ranking_config_path, base_ranking_config));
+    std::cout << "Ranking config: " << search_service.rankingConfig().version
+              << (ranking_config_path.empty() ? " (defaults)" : " from " + ranking_config_path) << std::endl;
+
+    // Learned-to-rank model replacing the linear rerank formula
+    std::string ltr_model_path = getEnv("ATLAS_LTR_MODEL", "");
+    if (!ltr_model_path.empty()) {
+        auto model = atlas::LtrModel::load(ltr_model_path);
+        std::cout << "LTR model: " << model->treeCount() << " trees"
+                  << (model->usesQuickScorer() ? " (QuickScorer)" : "") << std::endl;
+        search_service.enableLtr(std::move(model));
+    }
+
+    // Semantic rerank from precomputed int8 embeddings (memory-mapped)
+    std::shared_ptr<const atlas::EmbeddingStore> product_embeddings;
+    std::string product_embeddings_path = getEnv("ATLAS_PRODUCT_EMBEDDINGS", "");
+    if (!product_embeddings_path.empty()) {
+        product_embeddings = atlas::EmbeddingStore::open(product_embeddings_path);
+        std::string query_embeddings_path = getEnv("ATLAS_QUERY_EMBEDDINGS", "");
+        auto query_embeddings = query_embeddings_path.empty()
+            ? nullptr : atlas::EmbeddingStore::open(query_embeddings_path);
+        std::cout << "Semantic rerank: " << product_embeddings->size() << " product embeddings"
+                  << (query_embeddings ? ", " + std::to_string(query_embeddings->size()) + " head queries" : "")
+                  << ", dim " << product_embeddings->dim() << ", "
+                  << atlas::dotKernelName(product_embeddings->kernel()) << " kernel" << std::endl;
+        search_service.enableSemantic(product_embeddings, query_embeddings);
+    }
+    // HNSW candidates when ES returns less than a page
+    bool ann = product_embeddings && getEnv("ATLAS_ANN", "0") == "1";
+    size_t ann_m = std::stoul(getEnv("ATLAS_ANN_M", "16"));
+    size_t ann_ef_construction = std::stoul(getEnv("ATLAS_ANN_EF_CONSTRUCTION", "100"));
+    size_t ann_ef_search = std::stoul(getEnv("ATLAS_ANN_EF_SEARCH", "64"));
+
+    // Exact-title index for navigational queries
+    bool title_index = getEnv("ATLAS_TITLE_INDEX", "1") == "1";
+    if (title_index) {
+        search_service.enableTitleIndex(std::stoul(getEnv("ATLAS_TITLE_INDEX_MAX_PINNED", "3")));
+    }
+
+    // Bitmap facet index (empty field list disables)
+    std::vector<std::string> facet_fields = splitList(getEnv("ATLAS_FACET_FIELDS", "category,brand"));
+    if (!facet_fields.empty()) {
+        search_service.enableFacets(facet_fields,
+                                    std::stoi(getEnv("ATLAS_FACET_WINDOW", "1000")),
+                                    std::stoul(getEnv("ATLAS_FACET_TOP_N", "10")));
+        std::cout << "Facet index: " << facet_fields.size() << " fields, "
+                  << atlas::popcountKernelName(atlas::bestPopcountKernel()) << " kernel" << std::endl;
+    }
+
+    // Local spelling correction for low-hit queries (instead of ES fuzziness)
+    bool spelling = getEnv("ATLAS_SPELLING", "1") == "1";
+    if (spelling) {
+        search_service.enableSpelling(std::stoi(getEnv("ATLAS_SPELLING_MAX_EDIT_DISTANCE", "2")),
+                                      std::stoi(getEnv("ATLAS_SPELLING_MIN_HITS", "3")));
+        std::string query_log = getEnv("ATLAS_SPELLING_QUERY_LOG", "");
+        if (!query_log.empty()) {
+            size_t added = search_service.spellingIndex()->loadQueryLog(
+                query_log, std::stoull(getEnv("ATLAS_SPELLING_MIN_QUERY_COUNT", "10")));
+            std::cout << "Spelling: " << added << " terms from query log " << query_log << std::endl;
+        }
+    }
+
+    // Category tree for ancestry boosts; the file is re-read when it changes
+    std::string taxonomy_path = getEnv("ATLAS_TAXONOMY", "");
+    int taxonomy_reload_ms = std::stoi(getEnv("ATLAS_TAXONOMY_RELOAD_MS", "10000"));
+    if (!taxonomy_path.empty()) {
+        auto taxonomy = atlas::Taxonomy::load(taxonomy_path);
+        search_service.enableTaxonomy(taxonomy);
+        std::cout << "Taxonomy: " << taxonomy->size() - 1 << " categories from " << taxonomy_path << std::endl;
+    }
+
+    // Near-duplicate clusters from dedup_tool; re-read when the job rewrites them
+    std::string dedup_path = getEnv("ATLAS_DEDUP_CLUSTERS", "");
+    int dedup_reload_ms = std::stoi(getEnv("ATLAS_DEDUP_RELOAD_MS", "60000"));
+    if (!dedup_path.empty()) {
+        auto clusters = atlas::DuplicateClusters::load(dedup_path);
+        search_service.enableDedup(clusters, std::stod(getEnv("ATLAS_DEDUP_OVERFETCH", "0.5")));
+        std::cout << "Dedup: " << clusters->products() << " products in " << clusters->clusterCount()
+                  << " clusters from " << dedup_path << std::endl;
+    }
+
+    // The local indexes are synced from the products index by one thread
+    bool index_sync = title_index || !facet_fields.empty() || spelling;
+    int sync_refresh_ms = std::stoi(getEnv("ATLAS_INDEX_SYNC_REFRESH_MS", "5000"));
+    int sync_rebuild_ms = std::stoi(getEnv("ATLAS_INDEX_SYNC_REBUILD_MS", "3600000"));
 
     // Create HTTP server
     httplib::Server server;
 
+    if (getEnv("ATLAS_BROWNOUT", "1") == "1") {
+        atlas::BrownoutConfig brownout_config;
+        brownout_config.queue_delay_ms = std::stod(getEnv("ATLAS_BROWNOUT_QUEUE_DELAY_MS", "50"));
+        brownout_config.es_rtt_ms = std::stod(getEnv("ATLAS_BROWNOUT_ES_RTT_MS", "250"));
+        search_service.enableBrownout(brownout_config);
+
+        atlas::BrownoutController* brownout = search_service.brownout();
+        server.new_task_queue = [brownout]() {
+            return new TimedTaskQueue(CPPHTTPLIB_THREAD_POOL_COUNT, brownout);
+        };
+    }
+
     // Health check endpoint
-    server.Get("/health", [](const httplib::Request&, httplib::Response& res) {
+    server.Get("/health", [&search_service](const httplib::Request&, httplib::Response& res) {
         json response = {
             {"status", "healthy"},
             {"service", "atlas-search"},
             {"version", "1.0.0"}
         };
+        if (auto* brownout = search_service.brownout()) {
+            response["brownout"] = {
+                {"level", brownout->level()},
+                {"plan", atlas::SearchPlan::forLevel(brownout->level()).name},
+                {"queue_delay_ms", brownout->queueDelayMs()},
+                {"es_rtt_ms", brownout->esRttMs()}
+            };
+        }
+        res.set_content(response.dump(), "application/json");
+    });
+
+    // Readiness endpoint: 503 until warm-up has finished
+    server.Get("/ready", [&search_service](const httplib::Request&, httplib::Response& res) {
+        bool ready = search_service.isReady();
+        json response = {
+            {"status", ready ? "ready" : "warming_up"},
+            {"service", "atlas-search"}
+        };
+        res.status = ready ? 200 : 503;
+        res.set_content(response.dump(), "application/json");
+    });
+
+    // Heavy hitters and trending queries: GET /debug/top-queries?k=20
+    server.Get("/debug/top-queries", [&search_service](const httplib::Request& req, httplib::Response& res) {
+        auto* stats = search_service.queryStats();
+        if (!stats) {
+            res.status = 404;
+            res.set_content(json({{"error", "Query stats are disabled"}, {"status", 404}}).dump(),
+                            "application/json");
+            return;
+        }
+        size_t k = req.has_param("k") ? std::stoul(req.get_param_value("k")) : 20;
+        k = std::min<size_t>(std::max<size_t>(k, 1), 1000);
+
+        json top = json::array();
+        for (const auto& query : stats->top(k)) {
+            top.push_back({{"query", query.query}, {"count", query.count}, {"error", query.error}});
+        }
+        json trending = json::array();
+        for (const auto& query : stats->trending(k)) {
+            trending.push_back({{"query", query.query},
+                                {"recent_per_min", query.recent_rate * 60},
+                                {"baseline_per_min", query.baseline_rate * 60}});
+        }
+        json response = {
+            {"top", top},
+            {"trending", trending},
+            {"tracked", stats->tracked()},
+            {"memory_bytes", stats->memoryBytes()}
+        };
         res.set_content(response.dump(), "application/json");
     });
 
@@ -29,6 +374,17 @@ int main() {
         // Extract query parameters
         std::string query = req.has_param("q") ? req.get_param_value("q") : "";
         int size = req.has_param("size") ? std::stoi(req.get_param_value("size")) : 10;
+        // Per-hit score breakdown is opt-in
+        std::string explain_param = req.has_param("explain") ? req.get_param_value("explain") : "";
+        bool explain = explain_param == "true" || explain_param == "1";
+        // Snippets are generated here for the returned page, not by ES
+        auto highlight = atlas::parseHighlightMode(
+            req.has_param("highlight") ? req.get_param_value("highlight") : "");
+        // Search-as-you-type session token
+        std::string session = req.has_param("session") ? req.get_param_value("session") : "";
+        // Caller's embedding of the query, for queries without a precomputed one
+        std::vector<std::string> query_vector_items = req.has_param("query_vector")
+            ? splitList(req.get_param_value("query_vector")) : std::vector<std::string>();
 
         if (query.empty()) {
             json error_response = {
@@ -45,37 +401,145 @@ int main() {
             size = 10;
         }
 
+        atlas::SearchFilters filters;
+        std::string filter_error;
+        if (!parseFilters(req, filters, filter_error)) {
+            json error_response = {
+                {"error", filter_error},
+                {"status", 400}
+            };
+            res.status = 400;
+            res.set_content(error_response.dump(), "application/json");
+            return;
+        }
+
+        // Ignored unless semantic rerank is on, then it must match its dimension
+        std::vector<float> query_vector;
+        if (!query_vector_items.empty() && search_service.semanticDim() > 0) {
+            try {
+                for (const auto& item : query_vector_items) {
+                    query_vector.push_back(std::stof(item));
+                }
+            } catch (const std::exception&) {
+                query_vector.clear();
+            }
+            if (query_vector.size() != search_service.semanticDim()) {
+                json error_response = {
+                    {"error", "'query_vector' must be " + std::to_string(search_service.semanticDim()) +
+                              " comma-separated numbers"},
+                    {"status", 400}
+                };
+                res.status = 400;
+                res.set_content(error_response.dump(), "application/json");
+                return;
+            }
+        }
+
+        // Facet fields must be ones the facet index holds
+        std::vector<std::string> facets = req.has_param("facets")
+            ? splitList(req.get_param_value("facets")) : std::vector<std::string>();
+        std::sort(facets.begin(), facets.end());
+        facets.erase(std::unique(facets.begin(), facets.end()), facets.end());
+        for (const auto& field : facets) {
+            auto* facet_index = search_service.facetIndex();
+            if (!facet_index || std::find(facet_index->fields().begin(), facet_index->fields().end(),
+                                          field) == facet_index->fields().end()) {
+                json error_response = {
+                    {"error", "Unknown facet field '" + field + "'"},
+                    {"status", 400}
+                };
+                res.status = 400;
+                res.set_content(error_response.dump(), "application/json");
+                return;
+            }
+        }
+
         try {
             // Perform search
-            auto search_response = search_service.search(query, size);
-
-            // Build JSON response
-            json results_json = json::array();
-            for (const auto& result : search_response.results) {
-                results_json.push_back({
-                    {"id", result.id},
-                    {"title", result.title},
-                    {"description", result.description},
-                    {"score", result.score},
-                    {"es_score", result.es_score},
-                    {"recency_score", result.recency_score},
-                    {"title_match_score", result.title_match_score},
-                    {"updated_at", result.updated_at}
-                });
-            }
-
-            json response = {
-                {"results", results_json},
-                {"total", search_response.total},
-                {"latency_ms", search_response.latency_ms},
-                {"query", query},
-                {"size", size}
-            };
+            auto search_response = session.empty()
+                ? search_service.search(query, size, filters, query_vector)
+                : search_service.searchIncremental(session, query, size, filters, query_vector);
+
+            if (search_response.shed) {
+                json error_response = {
+                    {"error", "Shed under brownout: not in the result cache"},
+                    {"status", 503},
+                    {"plan", search_response.plan}
+                };
+                res.status = 503;
+                res.set_header("Retry-After", "1");
+                res.set_header("X-Search-Plan", search_response.plan);
+                res.set_content(error_response.dump(), "application/json");
+                std::cout << "Search query: '" << query << "' - shed (" << search_response.plan << ")" << std::endl;
+                return;
+            }
+
+            // Then the facet candidate query, on this same request thread:
+            // no thread is started per request
+            if (!facets.empty()) {
+                bool facets_sampled = false;
+                search_response.facets = search_service.facetCounts(query, filters, facets, &facets_sampled);
+                search_response.facets_sampled = facets_sampled;
+                if (search_response.results_hash != 0) {
+                    search_response.results_hash = atlas::SearchService::hashFacets(
+                        search_response.results_hash, search_response.facets);
+                }
+            }
+
+            auto format = atlas::negotiateFormat(req.get_header_value("Accept"));
+            auto encoding = atlas::negotiateEncoding(req.get_header_value("Accept-Encoding"));
+            res.set_header("Vary", "Accept, Accept-Encoding");
+            res.set_header("X-Search-Plan", search_response.plan);
+            res.set_header("X-Ranking-Config", search_response.config_version);
+            if (search_response.partial) {
+                res.set_header("X-Search-Partial", "true");
+            }
+            if (!session.empty()) {
+                res.set_header("X-Search-Incremental", search_response.incremental ? "local" : "es");
+            }
+            if (search_response.pinned > 0) {
+                res.set_header("X-Search-Pinned", std::to_string(search_response.pinned));
+            }
+            if (search_response.ann > 0) {
+                res.set_header("X-Search-Ann", std::to_string(search_response.ann));
+            }
+            if (search_response.collapsed > 0) {
+                res.set_header("X-Search-Collapsed", std::to_string(search_response.collapsed));
+            }
+
+            // Conditional request: answer 304 before serializing anything.
+            // A zero hash means the search failed and the page has no identity.
+            if (search_response.results_hash != 0) {
+                std::string etag = atlas::makeETag(search_response.results_hash, format,
+                                                   explain, encoding, highlight);
+                res.set_header("ETag", etag);
+                res.set_header("Cache-Control", "no-cache");
+                if (req.has_header("If-None-Match") &&
+                    atlas::etagMatches(req.get_header_value("If-None-Match"), etag)) {
+                    res.status = 304;
+                    std::cout << "Search query: '" << query << "' - not modified"
+                              << (search_response.cache_hit ? " (cached)" : "") << std::endl;
+                    return;
+                }
+            }
+
+            // Stream the response straight into the negotiated format
+            std::string body = atlas::encodeSearchResponse(search_response, query, size,
+                                                           explain, format, highlight);
+
+            // Compress only when it pays off; tiny bodies cost more CPU than they save
+            if (encoding != atlas::ContentEncoding::Identity && body.size() >= kMinCompressBytes) {
+                body = atlas::compressBody(body, encoding);
+                res.set_header("Content-Encoding", atlas::contentEncodingName(encoding));
+            }
+            res.set_content(std::move(body), atlas::contentTypeFor(format));
 
-            res.set_content(response.dump(2), "application/json");
             std::cout << "Search query: '" << query << "' - " 
                       << search_response.results.size() << " results in " 
-                      << search_response.latency_ms << "ms" << std::endl;
+                      << search_response.latency_ms << "ms"
+                      << (search_response.corrected_query.empty()
+                              ? "" : " (corrected to '" + search_response.corrected_query + "')")
+                      << std::endl;
 
         } catch (const std::exception& e) {
             json error_response = {
@@ -88,13 +552,146 @@ int main() {
         }
     });
 
+    // Warm up in the background so /health answers while /ready gates traffic
+    std::thread warmup_thread([&search_service, warmup_file, warmup_connections]() {
+        search_service.warmUp(warmup_file, warmup_connections);
+    });
+
+    // The HNSW graph takes a while over a large catalog; searches run
+    // without ANN candidates until it's in place
+    std::thread ann_build_thread;
+    if (ann) {
+        ann_build_thread = std::thread([&search_service, product_embeddings, ann_m,
+                                        ann_ef_construction, ann_ef_search]() {
+            auto start = std::chrono::steady_clock::now();
+            auto index = std::make_shared<const atlas::HnswIndex>(product_embeddings, ann_m,
+                                                                  ann_ef_construction);
+            search_service.enableAnnCandidates(index, ann_ef_search);
+            std::cout << "HNSW index built over " << index->size() << " products in "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - start).count()
+                      << "ms" << std::endl;
+        });
+    }
+
+    // Keep the local indexes in step with the products index: a full scan at
+    // startup and every rebuild interval (the only way deletions are seen),
+    // pulls of recently updated products in between
+    std::atomic<bool> stopping{false};
+    std::thread index_sync_thread;
+    if (index_sync) {
+        index_sync_thread = std::thread([&search_service, &stopping, sync_refresh_ms, sync_rebuild_ms]() {
+            auto last_rebuild = std::chrono::steady_clock::time_point();
+            while (!stopping) {
+                auto now = std::chrono::steady_clock::now();
+                bool full = last_rebuild == std::chrono::steady_clock::time_point() ||
+                            now - last_rebuild >= std::chrono::milliseconds(sync_rebuild_ms);
+                try {
+                    size_t scanned = search_service.refreshLocalIndexes(full);
+                    if (full) {
+                        last_rebuild = now;
+                        std::cout << "Local indexes rebuilt, " << scanned << " documents scanned" << std::endl;
+                    }
+                } catch (const std::exception& e) {
+                    std::cerr << "Local index refresh failed: " << e.what() << std::endl;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(sync_refresh_ms));
+            }
+        });
+    }
+
+    // Swap in an edited taxonomy or ranking config without a restart. A file
+    // that fails to load keeps the current one in place.
+    std::thread taxonomy_reload_thread;
+    if (!taxonomy_path.empty() && taxonomy_reload_ms > 0) {
+        taxonomy_reload_thread = watchFile(taxonomy_path, taxonomy_reload_ms, stopping,
+                                           [&search_service, taxonomy_path]() {
+            try {
+                auto taxonomy = atlas::Taxonomy::load(taxonomy_path);
+                search_service.setTaxonomy(taxonomy);
+                std::cout << "Taxonomy reloaded: " << taxonomy->size() - 1 << " categories" << std::endl;
+                return true;
+            } catch (const std::exception& e) {
+                std::cerr << "Taxonomy reload failed, keeping the current one: " << e.what() << std::endl;
+                return false;
+            }
+        });
+    }
+    std::thread dedup_reload_thread;
+    if (!dedup_path.empty() && dedup_reload_ms > 0) {
+        dedup_reload_thread = watchFile(dedup_path, dedup_reload_ms, stopping, [&search_service, dedup_path]() {
+            try {
+                auto clusters = atlas::DuplicateClusters::load(dedup_path);
+                search_service.setDuplicateClusters(clusters);
+                std::cout << "Dedup clusters reloaded: " << clusters->clusterCount() << " clusters" << std::endl;
+                return true;
+            } catch (const std::exception& e) {
+                std::cerr << "Dedup cluster reload failed, keeping the current ones: " << e.what() << std::endl;
+                return false;
+            }
+        });
+    }
+    // Keep the warm-up list current, so a restart warms what users search now
+    std::thread top_queries_thread;
+    if (query_stats && !top_queries_file.empty() && top_queries_save_ms > 0) {
+        top_queries_thread = std::thread([&search_service, &stopping, top_queries_file,
+                                          top_queries_count, top_queries_save_ms]() {
+            while (!stopping) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(top_queries_save_ms));
+                try {
+                    search_service.queryStats()->writeTopQueries(top_queries_file, top_queries_count);
+                } catch (const std::exception& e) {
+                    std::cerr << "Saving top queries failed: " << e.what() << std::endl;
+                }
+            }
+        });
+    }
+    std::thread ranking_config_reload_thread;
+    if (!ranking_config_path.empty() && ranking_config_reload_ms > 0) {
+        ranking_config_reload_thread = watchFile(ranking_config_path, ranking_config_reload_ms, stopping,
+                                                 [&search_service, ranking_config_path, base_ranking_config]() {
+            try {
+                search_service.setRankingConfig(atlas::RankingConfig::load(ranking_config_path, base_ranking_config));
+                std::cout << "Ranking config reloaded: " << search_service.rankingConfig().version << std::endl;
+                return true;
+            } catch (const std::exception& e) {
+                std::cerr << "Ranking config reload failed, keeping the current one: " << e.what() << std::endl;
+                return false;
+            }
+        });
+    }
+
     // Start server
     std::cout << "Server listening on http://localhost:8080" << std::endl;
     std::cout << "Endpoints:" << std::endl;
     std::cout << "  GET /health" << std::endl;
-    std::cout << "  GET /search?q=<query>&size=<size>" << std::endl;
+    std::cout << "  GET /ready" << std::endl;
+    std::cout << "  GET /debug/top-queries?k=<k>" << std::endl;
+    std::cout << "  GET /search?q=<query>&size=<size>"
+              << "[&category=<a,b>&min_price=<n>&max_price=<n>&in_stock=<bool>&explain=<bool>&highlight=<markup|offsets>&facets=<a,b>&session=<token>&query_vector=<f1,f2,...>]"
+              << std::endl;
 
     server.listen("0.0.0.0", 8080);
+    warmup_thread.join();
+    if (ann_build_thread.joinable()) {
+        ann_build_thread.join();
+    }
+    stopping = true;
+    if (index_sync_thread.joinable()) {
+        index_sync_thread.join();
+    }
+    if (taxonomy_reload_thread.joinable()) {
+        taxonomy_reload_thread.join();
+    }
+    if (dedup_reload_thread.joinable()) {
+        dedup_reload_thread.join();
+    }
+    if (ranking_config_reload_thread.joinable()) {
+        ranking_config_reload_thread.join();
+    }
+    if (top_queries_thread.joinable()) {
+        top_queries_thread.join();
+    }
 
     return 0;
 }
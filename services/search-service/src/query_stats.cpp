@@ -0,0 +1,280 @@
+#include "query_stats.h"
+#include "search_service.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace atlas {
+
+// Forward-decay weights are rescaled before they pass e^30, far from
+// overflowing a double even when summed over billions of queries
+static const double kMaxDecayExponent = 30.0;
+
+// Row hashes must not depend on the bits that picked the shard
+static uint64_t mixHash(uint64_t hash) {
+    hash += 0x9e3779b97f4a7c15ULL;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+    return hash ^ (hash >> 31);
+}
+
+struct alignas(64) QueryStats::Shard {
+    using Positions = std::unordered_map<std::string, size_t>;
+
+    struct Counter {
+        Positions::iterator slot;  // the query, and this counter's heap position
+        double count;              // forward-decayed from `landmark`
+        double error;
+    };
+
+    mutable std::mutex mutex;
+    double landmark = 0.0;
+    size_t capacity;
+    std::vector<Counter> heap;  // min-heap on count
+    Positions positions;        // reserved up front, so slots never move
+    size_t width;
+    std::vector<double> sketch;  // depth rows of `width` counters
+
+    Shard(size_t counters, size_t sketch_width, size_t sketch_depth, double now)
+        : landmark(now), capacity(counters), width(sketch_width), sketch(sketch_width * sketch_depth, 0.0) {
+        heap.reserve(capacity);
+        positions.reserve(capacity);
+    }
+
+    void place(size_t i) { heap[i].slot->second = i; }
+
+    void siftUp(size_t i) {
+        while (i > 0) {
+            size_t parent = (i - 1) / 2;
+            if (heap[parent].count <= heap[i].count) break;
+            std::swap(heap[parent], heap[i]);
+            place(parent);
+            place(i);
+            i = parent;
+        }
+    }
+
+    void siftDown(size_t i) {
+        for (;;) {
+            size_t smallest = i;
+            for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); ++child) {
+                if (heap[child].count < heap[smallest].count) smallest = child;
+            }
+            if (smallest == i) break;
+            std::swap(heap[smallest], heap[i]);
+            place(smallest);
+            place(i);
+            i = smallest;
+        }
+    }
+
+    // Move the landmark to `now`, shrinking every stored weight to match
+    void rescale(double now, double decay, double trend_decay) {
+        double factor = std::exp(-decay * (now - landmark));
+        for (auto& counter : heap) {
+            counter.count *= factor;
+            counter.error *= factor;
+        }
+        double trend_factor = std::exp(-trend_decay * (now - landmark));
+        for (auto& cell : sketch) {
+            cell *= trend_factor;
+        }
+        landmark = now;
+    }
+
+    // Cell of `row` for a query; rows use double hashing of one mixed hash
+    size_t cell(uint64_t mixed, size_t row) const {
+        return row * width + (mixed + row * ((mixed >> 32) | 1)) % width;
+    }
+
+    double sketchMin(uint64_t mixed) const {
+        double result = HUGE_VAL;
+        for (size_t row = 0, rows = sketch.size() / width; row < rows; ++row) {
+            result = std::min(result, sketch[cell(mixed, row)]);
+        }
+        return result;
+    }
+};
+
+QueryStats::QueryStats(const QueryStatsConfig& config, std::function<double()> clock)
+    : config_(config), clock_(std::move(clock)) {
+    if (!clock_) {
+        clock_ = []() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        };
+    }
+    config_.shards = std::max<size_t>(1, std::min(config_.shards, config_.capacity));
+    decay_ = std::log(2.0) / config_.half_life_s;
+    trend_decay_ = std::log(2.0) / config_.trend_half_life_s;
+
+    double now = clock_();
+    size_t per_shard = std::max<size_t>(1, config_.capacity / config_.shards);
+    for (size_t i = 0; i < config_.shards; ++i) {
+        shards_.push_back(std::make_unique<Shard>(per_shard, std::max<size_t>(1, config_.sketch_width),
+                                                  std::max<size_t>(1, config_.sketch_depth), now));
+    }
+}
+
+QueryStats::~QueryStats() = default;
+
+std::string QueryStats::key(const std::string& query) const {
+    if (query.size() <= config_.max_query_bytes) {
+        return query;
+    }
+    // Cut on a UTF-8 character boundary
+    size_t length = config_.max_query_bytes;
+    while (length > 0 && (static_cast<unsigned char>(query[length]) & 0xC0) == 0x80) {
+        length--;
+    }
+    return query.substr(0, length);
+}
+
+void QueryStats::record(const std::string& query) {
+    std::string tracked = key(query);
+    uint64_t hash = stableHash(tracked);
+    Shard& shard = shardFor(hash);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    double now = clock_();
+    if ((now - shard.landmark) * std::max(decay_, trend_decay_) > kMaxDecayExponent) {
+        shard.rescale(now, decay_, trend_decay_);
+    }
+    double weight = std::exp(decay_ * (now - shard.landmark));
+    double trend_weight = std::exp(trend_decay_ * (now - shard.landmark));
+
+    // Space-Saving
+    auto it = shard.positions.find(tracked);
+    if (it != shard.positions.end()) {
+        shard.heap[it->second].count += weight;
+        shard.siftDown(it->second);
+    } else if (shard.heap.size() < shard.capacity) {
+        auto slot = shard.positions.emplace(std::move(tracked), shard.heap.size()).first;
+        shard.heap.push_back({slot, weight, 0.0});
+        shard.siftUp(shard.heap.size() - 1);
+    } else {
+        // Take over the smallest counter; its count bounds our overestimate
+        Shard::Counter& smallest = shard.heap.front();
+        double inherited = smallest.count;
+        shard.positions.erase(smallest.slot);
+        smallest.slot = shard.positions.emplace(std::move(tracked), 0).first;
+        smallest.count = inherited + weight;
+        smallest.error = inherited;
+        shard.siftDown(0);
+    }
+
+    // Count-Min, conservative update: raise only the cells below the new
+    // estimate, which keeps collisions from compounding
+    uint64_t mixed = mixHash(hash);
+    double estimate = shard.sketchMin(mixed) + trend_weight;
+    for (size_t row = 0, rows = shard.sketch.size() / shard.width; row < rows; ++row) {
+        double& cell = shard.sketch[shard.cell(mixed, row)];
+        cell = std::max(cell, estimate);
+    }
+}
+
+double QueryStats::recentCount(const std::string& query) const {
+    uint64_t hash = stableHash(key(query));
+    Shard& shard = shardFor(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.sketchMin(mixHash(hash)) * std::exp(-trend_decay_ * (clock_() - shard.landmark));
+}
+
+std::vector<QueryCount> QueryStats::top(size_t k) const {
+    std::vector<QueryCount> counts;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        double factor = std::exp(-decay_ * (clock_() - shard->landmark));
+        for (const auto& counter : shard->heap) {
+            counts.push_back({counter.slot->first, counter.count * factor, counter.error * factor});
+        }
+    }
+    size_t n = std::min(k, counts.size());
+    std::partial_sort(counts.begin(), counts.begin() + n, counts.end(),
+        [](const QueryCount& a, const QueryCount& b) {
+            if (a.count != b.count) return a.count > b.count;
+            return a.query < b.query;
+        });
+    counts.resize(n);
+    return counts;
+}
+
+std::vector<TrendingQuery> QueryStats::trending(size_t k, double min_ratio, double min_recent) const {
+    // A decayed count settles at rate / decay constant, so each count
+    // converts to a rate over its own horizon
+    std::vector<TrendingQuery> result;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        double elapsed = clock_() - shard->landmark;
+        double factor = std::exp(-decay_ * elapsed);
+        double trend_factor = std::exp(-trend_decay_ * elapsed);
+        for (const auto& counter : shard->heap) {
+            const std::string& query = counter.slot->first;
+            double recent = shard->sketchMin(mixHash(stableHash(query))) * trend_factor;
+            double recent_rate = recent * trend_decay_;
+            double baseline_rate = counter.count * factor * decay_;
+            if (recent >= min_recent && recent_rate >= min_ratio * baseline_rate) {
+                result.push_back({query, recent_rate, baseline_rate});
+            }
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const TrendingQuery& a, const TrendingQuery& b) {
+        double excess_a = a.recent_rate - a.baseline_rate;
+        double excess_b = b.recent_rate - b.baseline_rate;
+        if (excess_a != excess_b) return excess_a > excess_b;
+        return a.query < b.query;
+    });
+    if (result.size() > k) {
+        result.resize(k);
+    }
+    return result;
+}
+
+size_t QueryStats::writeTopQueries(const std::string& path, size_t k) const {
+    auto queries = top(k);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        if (!file.is_open()) {
+            throw std::runtime_error("Cannot write top queries: " + temporary);
+        }
+        file << "# Heaviest queries by decayed count, heaviest first\n";
+        for (const auto& query : queries) {
+            file << query.query << '\n';
+        }
+        if (!file.good()) {
+            throw std::runtime_error("Cannot write top queries: " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Cannot replace " + path);
+    }
+    return queries.size();
+}
+
+size_t QueryStats::memoryBytes() const {
+    // Tracked text is capped, so this bound holds whatever the traffic
+    size_t bytes = 0;
+    for (const auto& shard : shards_) {
+        size_t per_query = sizeof(Shard::Counter) + sizeof(Shard::Positions::value_type) +
+                           2 * sizeof(void*) + config_.max_query_bytes;
+        bytes += sizeof(Shard) + shard->capacity * per_query +
+                 shard->positions.bucket_count() * sizeof(void*) +
+                 shard->sketch.size() * sizeof(double);
+    }
+    return bytes;
+}
+
+size_t QueryStats::tracked() const {
+    size_t count = 0;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        count += shard->heap.size();
+    }
+    return count;
+}
+
+} // namespace atlas
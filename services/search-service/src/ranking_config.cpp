@@ -0,0 +1,107 @@
+#include "ranking_config.h"
+#include "search_service.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+namespace atlas {
+
+RankingConfig RankingConfig::load(const std::string& path, const RankingConfig& base) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot read ranking config: " + path);
+    }
+    nlohmann::json config;
+    try {
+        config = nlohmann::json::parse(file);
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument("Malformed ranking config " + path + ": " + e.what());
+    }
+    return fromJson(config, base);
+}
+
+// Overwrite `target` with config[key] if present; weights may be zero but
+// must be finite
+static void readWeight(const nlohmann::json& config, const char* key, double& target) {
+    if (!config.contains(key)) {
+        return;
+    }
+    double value = config[key].get<double>();
+    if (!std::isfinite(value)) {
+        throw std::invalid_argument(std::string("Ranking weight '") + key + "' is not finite");
+    }
+    target = value;
+}
+
+RankingConfig RankingConfig::fromJson(const nlohmann::json& config, const RankingConfig& base) {
+    static const std::vector<std::string> kMatchTypes = {
+        "best_fields", "most_fields", "cross_fields", "phrase", "phrase_prefix", "bool_prefix"};
+
+    RankingConfig result = base;
+    result.version.clear();
+    try {
+        if (config.contains("version")) {
+            result.version = config["version"].get<std::string>();
+        }
+        if (config.contains("weights")) {
+            const auto& weights = config["weights"];
+            readWeight(weights, "es_score", result.es_weight);
+            readWeight(weights, "recency", result.recency_weight);
+            readWeight(weights, "title_match", result.title_match_weight);
+            readWeight(weights, "semantic", result.semantic_weight);
+            readWeight(weights, "category", result.taxonomy_weight);
+        }
+        if (config.contains("recency_decay_days")) {
+            result.recency_decay_days = config["recency_decay_days"].get<double>();
+            if (!(result.recency_decay_days > 0.0) || !std::isfinite(result.recency_decay_days)) {
+                throw std::invalid_argument("recency_decay_days must be positive");
+            }
+        }
+        if (config.contains("query")) {
+            const auto& query = config["query"];
+            if (query.contains("fields")) {
+                result.query_fields = query["fields"].get<std::vector<std::string>>();
+                if (result.query_fields.empty()) {
+                    throw std::invalid_argument("Query template needs at least one field");
+                }
+            }
+            if (query.contains("type")) {
+                result.match_type = query["type"].get<std::string>();
+                if (std::find(kMatchTypes.begin(), kMatchTypes.end(), result.match_type) == kMatchTypes.end()) {
+                    throw std::invalid_argument("Unknown multi_match type: " + result.match_type);
+                }
+            }
+        }
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument(std::string("Malformed ranking config: ") + e.what());
+    }
+    result.seal();
+    return result;
+}
+
+nlohmann::json RankingConfig::toJson() const {
+    return {
+        {"weights", {
+            {"es_score", es_weight},
+            {"recency", recency_weight},
+            {"title_match", title_match_weight},
+            {"semantic", semantic_weight},
+            {"category", taxonomy_weight}
+        }},
+        {"recency_decay_days", recency_decay_days},
+        {"query", {{"fields", query_fields}, {"type", match_type}}}
+    };
+}
+
+void RankingConfig::seal() {
+    fingerprint = stableHash(toJson().dump());
+    if (version.empty()) {
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(fingerprint));
+        version = hex;
+    }
+}
+
+} // namespace atlas
@@ -0,0 +1,110 @@
+#include "rcu.h"
+#include <algorithm>
+#include <limits>
+
+namespace atlas {
+
+// The calling thread's slot, handed back for reuse when the thread exits
+struct ThreadReader {
+    EpochDomain::Reader* reader = nullptr;
+    int depth = 0;
+
+    ~ThreadReader() {
+        if (reader) {
+            EpochDomain::releaseReader(reader);
+        }
+    }
+};
+
+static thread_local ThreadReader thread_reader;
+
+EpochDomain& EpochDomain::instance() {
+    // Leaked on purpose: thread_local slots may be released after static
+    // destructors have run
+    static EpochDomain* domain = new EpochDomain();
+    return *domain;
+}
+
+EpochDomain::Reader* EpochDomain::acquireReader() {
+    for (Reader* reader = readers_.load(std::memory_order_acquire); reader; reader = reader->next) {
+        bool expected = false;
+        if (!reader->in_use.load(std::memory_order_relaxed) &&
+            reader->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return reader;
+        }
+    }
+
+    auto* reader = new Reader();
+    reader->in_use.store(true, std::memory_order_relaxed);
+    Reader* head = readers_.load(std::memory_order_relaxed);
+    do {
+        reader->next = head;
+    } while (!readers_.compare_exchange_weak(head, reader, std::memory_order_release,
+                                             std::memory_order_relaxed));
+    return reader;
+}
+
+void EpochDomain::releaseReader(Reader* reader) {
+    reader->epoch.store(0, std::memory_order_release);
+    reader->in_use.store(false, std::memory_order_release);
+}
+
+void EpochDomain::enter() {
+    ThreadReader& local = thread_reader;
+    if (local.depth++ > 0) {
+        return;
+    }
+    if (!local.reader) {
+        local.reader = acquireReader();
+    }
+    local.reader->epoch.store(epoch_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    // Pairs with the fence in reclaimLocked(): either the writer sees this
+    // announcement, or this reader's loads see the writer's unlink
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EpochDomain::leave() {
+    ThreadReader& local = thread_reader;
+    if (--local.depth == 0) {
+        local.reader->epoch.store(0, std::memory_order_release);
+    }
+}
+
+void EpochDomain::retire(void* object, void (*deleter)(void*)) {
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    // Readers that can still hold `object` announced this epoch or an
+    // earlier one; everyone entering from now on announces a later one
+    uint64_t epoch = epoch_.fetch_add(1, std::memory_order_seq_cst);
+    retired_.push_back({object, deleter, epoch});
+    reclaimLocked();
+}
+
+size_t EpochDomain::reclaim() {
+    std::lock_guard<std::mutex> lock(retired_mutex_);
+    return reclaimLocked();
+}
+
+size_t EpochDomain::reclaimLocked() {
+    if (retired_.empty()) {
+        return 0;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    uint64_t oldest_active = std::numeric_limits<uint64_t>::max();
+    for (Reader* reader = readers_.load(std::memory_order_acquire); reader; reader = reader->next) {
+        uint64_t epoch = reader->epoch.load(std::memory_order_acquire);
+        if (epoch != 0) {
+            oldest_active = std::min(oldest_active, epoch);
+        }
+    }
+
+    auto still_visible = std::partition(retired_.begin(), retired_.end(),
+        [oldest_active](const Retired& retired) { return retired.epoch >= oldest_active; });
+    for (auto it = still_visible; it != retired_.end(); ++it) {
+        it->deleter(it->object);
+    }
+    retired_.erase(still_visible, retired_.end());
+    return retired_.size();
+}
+
+} // namespace atlas
@@ -0,0 +1,642 @@
+#include "response_writer.h"
+#include <zlib.h>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <iomanip>
+#include <memory>
+
+namespace atlas {
+
+// Parse "a;q=0.5, b" into (token, q) pairs, lowercased
+static std::vector<std::pair<std::string, double>> parseQualityList(const std::string& header) {
+    std::vector<std::pair<std::string, double>> entries;
+    size_t start = 0;
+    while (start < header.size()) {
+        size_t end = header.find(',', start);
+        if (end == std::string::npos) end = header.size();
+        std::string item = header.substr(start, end - start);
+        start = end + 1;
+
+        double q = 1.0;
+        size_t semicolon = item.find(';');
+        if (semicolon != std::string::npos) {
+            size_t q_pos = item.find("q=", semicolon);
+            if (q_pos != std::string::npos) {
+                q = std::atof(item.c_str() + q_pos + 2);
+            }
+            item.resize(semicolon);
+        }
+
+        size_t first = item.find_first_not_of(" \t");
+        if (first == std::string::npos) continue;
+        size_t last = item.find_last_not_of(" \t");
+        std::string token = item.substr(first, last - first + 1);
+        std::transform(token.begin(), token.end(), token.begin(), ::tolower);
+        entries.emplace_back(token, q);
+    }
+    return entries;
+}
+
+ResponseFormat negotiateFormat(const std::string& accept) {
+    ResponseFormat best = ResponseFormat::Json;
+    double best_q = 0.0;
+    for (const auto& [type, q] : parseQualityList(accept)) {
+        ResponseFormat format;
+        if (type == "application/cbor") {
+            format = ResponseFormat::Cbor;
+        } else if (type == "application/msgpack" || type == "application/x-msgpack") {
+            format = ResponseFormat::MessagePack;
+        } else if (type == "application/json" || type == "application/*" || type == "*/*") {
+            format = ResponseFormat::Json;
+        } else {
+            continue;
+        }
+        // Strictly greater: on ties the first listed type wins
+        if (q > best_q) {
+            best = format;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+ContentEncoding negotiateEncoding(const std::string& accept_encoding) {
+    ContentEncoding best = ContentEncoding::Identity;
+    double best_q = 0.0;
+    for (const auto& [coding, q] : parseQualityList(accept_encoding)) {
+        ContentEncoding encoding;
+        if (coding == "gzip" || coding == "x-gzip") {
+            encoding = ContentEncoding::Gzip;
+        } else if (coding == "deflate") {
+            encoding = ContentEncoding::Deflate;
+        } else {
+            continue;
+        }
+        if (q > best_q) {
+            best = encoding;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+const char* contentTypeFor(ResponseFormat format) {
+    switch (format) {
+        case ResponseFormat::Cbor: return "application/cbor";
+        case ResponseFormat::MessagePack: return "application/msgpack";
+        default: return "application/json";
+    }
+}
+
+const char* contentEncodingName(ContentEncoding encoding) {
+    switch (encoding) {
+        case ContentEncoding::Gzip: return "gzip";
+        case ContentEncoding::Deflate: return "deflate";
+        default: return "identity";
+    }
+}
+
+std::string makeETag(uint64_t results_hash, ResponseFormat format, bool explain,
+                     ContentEncoding encoding, HighlightMode highlight) {
+    static const char format_codes[] = {'j', 'c', 'm'};
+    static const char encoding_codes[] = {'i', 'g', 'd'};
+
+    std::ostringstream etag;
+    etag << '"' << std::hex << std::setw(16) << std::setfill('0') << results_hash << '-'
+         << format_codes[static_cast<int>(format)] << (explain ? '1' : '0')
+         << encoding_codes[static_cast<int>(encoding)];
+    // Suffix only when highlighting, so existing tags stay valid
+    if (highlight == HighlightMode::Markup) etag << 'h';
+    if (highlight == HighlightMode::Offsets) etag << 'o';
+    etag << '"';
+    return etag.str();
+}
+
+bool etagMatches(const std::string& if_none_match, const std::string& etag) {
+    size_t start = 0;
+    while (start < if_none_match.size()) {
+        size_t end = if_none_match.find(',', start);
+        if (end == std::string::npos) end = if_none_match.size();
+        std::string candidate = if_none_match.substr(start, end - start);
+        start = end + 1;
+
+        size_t first = candidate.find_first_not_of(" \t");
+        if (first == std::string::npos) continue;
+        size_t last = candidate.find_last_not_of(" \t");
+        candidate = candidate.substr(first, last - first + 1);
+
+        if (candidate == "*") {
+            return true;
+        }
+        // If-None-Match uses weak comparison
+        if (candidate.rfind("W/", 0) == 0) {
+            candidate = candidate.substr(2);
+        }
+        if (candidate == etag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string compressBody(const std::string& body, ContentEncoding encoding) {
+    if (encoding == ContentEncoding::Identity) {
+        return body;
+    }
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+
+    // windowBits 15 = zlib wrapper (HTTP "deflate"), +16 = gzip wrapper.
+    // Level 1: on small payloads the CPU saving beats the extra ratio.
+    int window_bits = encoding == ContentEncoding::Gzip ? 15 + 16 : 15;
+    if (deflateInit2(&stream, 1, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialize zlib");
+    }
+
+    std::string compressed;
+    compressed.resize(deflateBound(&stream, body.size()));
+
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(body.data()));
+    stream.avail_in = static_cast<uInt>(body.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+    stream.avail_out = static_cast<uInt>(compressed.size());
+
+    int ret = deflate(&stream, Z_FINISH);
+    size_t written = stream.total_out;
+    deflateEnd(&stream);
+
+    if (ret != Z_STREAM_END) {
+        throw std::runtime_error("zlib compression failed");
+    }
+
+    compressed.resize(written);
+    return compressed;
+}
+
+// ResponseWriter implementation
+ResponseWriter::ResponseWriter(ResponseFormat format)
+    : format_(format), after_key_(false) {
+    out_.reserve(4096);
+}
+
+void ResponseWriter::beforeValue() {
+    if (format_ != ResponseFormat::Json) {
+        return;
+    }
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (!needs_comma_.empty()) {
+        if (needs_comma_.back()) {
+            out_.push_back(',');
+        }
+        needs_comma_.back() = true;
+    }
+}
+
+void ResponseWriter::writeBigEndian(uint64_t value, int bytes) {
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+        out_.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+}
+
+void ResponseWriter::writeCborHeader(uint8_t major_type, uint64_t length) {
+    uint8_t major = static_cast<uint8_t>(major_type << 5);
+    if (length < 24) {
+        out_.push_back(static_cast<char>(major | length));
+    } else if (length <= 0xff) {
+        out_.push_back(static_cast<char>(major | 24));
+        writeBigEndian(length, 1);
+    } else if (length <= 0xffff) {
+        out_.push_back(static_cast<char>(major | 25));
+        writeBigEndian(length, 2);
+    } else if (length <= 0xffffffffULL) {
+        out_.push_back(static_cast<char>(major | 26));
+        writeBigEndian(length, 4);
+    } else {
+        out_.push_back(static_cast<char>(major | 27));
+        writeBigEndian(length, 8);
+    }
+}
+
+void ResponseWriter::beginObject(size_t num_fields) {
+    beforeValue();
+    switch (format_) {
+        case ResponseFormat::Json:
+            out_.push_back('{');
+            needs_comma_.push_back(false);
+            break;
+        case ResponseFormat::Cbor:
+            writeCborHeader(5, num_fields);
+            break;
+        case ResponseFormat::MessagePack:
+            if (num_fields < 16) {
+                out_.push_back(static_cast<char>(0x80 | num_fields));
+            } else if (num_fields <= 0xffff) {
+                out_.push_back(static_cast<char>(0xde));
+                writeBigEndian(num_fields, 2);
+            } else {
+                out_.push_back(static_cast<char>(0xdf));
+                writeBigEndian(num_fields, 4);
+            }
+            break;
+    }
+}
+
+void ResponseWriter::endObject() {
+    if (format_ == ResponseFormat::Json) {
+        out_.push_back('}');
+        needs_comma_.pop_back();
+    }
+}
+
+void ResponseWriter::beginArray(size_t num_items) {
+    beforeValue();
+    switch (format_) {
+        case ResponseFormat::Json:
+            out_.push_back('[');
+            needs_comma_.push_back(false);
+            break;
+        case ResponseFormat::Cbor:
+            writeCborHeader(4, num_items);
+            break;
+        case ResponseFormat::MessagePack:
+            if (num_items < 16) {
+                out_.push_back(static_cast<char>(0x90 | num_items));
+            } else if (num_items <= 0xffff) {
+                out_.push_back(static_cast<char>(0xdc));
+                writeBigEndian(num_items, 2);
+            } else {
+                out_.push_back(static_cast<char>(0xdd));
+                writeBigEndian(num_items, 4);
+            }
+            break;
+    }
+}
+
+void ResponseWriter::endArray() {
+    if (format_ == ResponseFormat::Json) {
+        out_.push_back(']');
+        needs_comma_.pop_back();
+    }
+}
+
+void ResponseWriter::key(const std::string& name) {
+    beforeValue();
+    writeString(name);
+    if (format_ == ResponseFormat::Json) {
+        out_.push_back(':');
+        after_key_ = true;
+    }
+}
+
+void ResponseWriter::value(const std::string& str) {
+    beforeValue();
+    writeString(str);
+}
+
+void ResponseWriter::writeString(const std::string& str) {
+    switch (format_) {
+        case ResponseFormat::Json: {
+            static const char* hex = "0123456789abcdef";
+            out_.push_back('"');
+            for (char ch : str) {
+                unsigned char c = static_cast<unsigned char>(ch);
+                switch (c) {
+                    case '"': out_ += "\\\""; break;
+                    case '\\': out_ += "\\\\"; break;
+                    case '\b': out_ += "\\b"; break;
+                    case '\f': out_ += "\\f"; break;
+                    case '\n': out_ += "\\n"; break;
+                    case '\r': out_ += "\\r"; break;
+                    case '\t': out_ += "\\t"; break;
+                    default:
+                        if (c < 0x20) {
+                            out_ += "\\u00";
+                            out_.push_back(hex[c >> 4]);
+                            out_.push_back(hex[c & 0xf]);
+                        } else {
+                            out_.push_back(ch);
+                        }
+                }
+            }
+            out_.push_back('"');
+            break;
+        }
+        case ResponseFormat::Cbor:
+            writeCborHeader(3, str.size());
+            out_ += str;
+            break;
+        case ResponseFormat::MessagePack:
+            if (str.size() < 32) {
+                out_.push_back(static_cast<char>(0xa0 | str.size()));
+            } else if (str.size() <= 0xff) {
+                out_.push_back(static_cast<char>(0xd9));
+                writeBigEndian(str.size(), 1);
+            } else if (str.size() <= 0xffff) {
+                out_.push_back(static_cast<char>(0xda));
+                writeBigEndian(str.size(), 2);
+            } else {
+                out_.push_back(static_cast<char>(0xdb));
+                writeBigEndian(str.size(), 4);
+            }
+            out_ += str;
+            break;
+    }
+}
+
+void ResponseWriter::value(double number) {
+    beforeValue();
+    switch (format_) {
+        case ResponseFormat::Json: {
+            if (!std::isfinite(number)) {
+                out_ += "null";
+                break;
+            }
+            // Shortest round-trip representation
+            char buffer[32];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+            out_.append(buffer, result.ptr);
+            break;
+        }
+        case ResponseFormat::Cbor:
+        case ResponseFormat::MessagePack: {
+            uint64_t bits;
+            std::memcpy(&bits, &number, sizeof(bits));
+            out_.push_back(static_cast<char>(format_ == ResponseFormat::Cbor ? 0xfb : 0xcb));
+            writeBigEndian(bits, 8);
+            break;
+        }
+    }
+}
+
+void ResponseWriter::value(int64_t number) {
+    beforeValue();
+    switch (format_) {
+        case ResponseFormat::Json:
+            out_ += std::to_string(number);
+            break;
+        case ResponseFormat::Cbor:
+            if (number >= 0) {
+                writeCborHeader(0, static_cast<uint64_t>(number));
+            } else {
+                writeCborHeader(1, static_cast<uint64_t>(-(number + 1)));
+            }
+            break;
+        case ResponseFormat::MessagePack:
+            if (number >= 0 && number < 128) {
+                out_.push_back(static_cast<char>(number));
+            } else if (number >= -32 && number < 0) {
+                out_.push_back(static_cast<char>(number));
+            } else if (number >= 0) {
+                out_.push_back(static_cast<char>(0xcf));
+                writeBigEndian(static_cast<uint64_t>(number), 8);
+            } else {
+                out_.push_back(static_cast<char>(0xd3));
+                writeBigEndian(static_cast<uint64_t>(number), 8);
+            }
+            break;
+    }
+}
+
+void ResponseWriter::value(bool flag) {
+    beforeValue();
+    switch (format_) {
+        case ResponseFormat::Json:
+            out_ += flag ? "true" : "false";
+            break;
+        case ResponseFormat::Cbor:
+            out_.push_back(static_cast<char>(flag ? 0xf5 : 0xf4));
+            break;
+        case ResponseFormat::MessagePack:
+            out_.push_back(static_cast<char>(flag ? 0xc3 : 0xc2));
+            break;
+    }
+}
+
+static void writeSpans(ResponseWriter& writer, const std::vector<TextSpan>& spans) {
+    writer.beginArray(spans.size());
+    for (const auto& span : spans) {
+        writer.beginArray(2);
+        writer.value(static_cast<int64_t>(span.begin));
+        writer.value(static_cast<int64_t>(span.end));
+        writer.endArray();
+    }
+    writer.endArray();
+}
+
+// {"title": "...", "description": "..."} with <em> markup, or
+// {"title": [[b,e],...], "description": {"fragment": [b,e], "matches": [[b,e],...]}}
+static void writeHighlight(ResponseWriter& writer, const SearchResult& result,
+                           const SnippetGenerator& snippets, HighlightMode mode) {
+    Snippet snippet = snippets.makeSnippet(result.title, result.description);
+
+    writer.beginObject(2);
+    writer.key("title");
+    if (mode == HighlightMode::Markup) {
+        writer.value(SnippetGenerator::markup(result.title, {0, result.title.size()},
+                                              snippet.title_matches));
+        writer.key("description");
+        writer.value(SnippetGenerator::markup(result.description, snippet.fragment,
+                                              snippet.fragment_matches));
+    } else {
+        writeSpans(writer, snippet.title_matches);
+        writer.key("description");
+        writer.beginObject(2);
+        writer.key("fragment");
+        writer.beginArray(2);
+        writer.value(static_cast<int64_t>(snippet.fragment.begin));
+        writer.value(static_cast<int64_t>(snippet.fragment.end));
+        writer.endArray();
+        writer.key("matches");
+        writeSpans(writer, snippet.fragment_matches);
+        writer.endObject();
+    }
+    writer.endObject();
+}
+
+std::string encodeSearchResponse(const SearchResponse& response, const std::string& query,
+                                 int size, bool explain, ResponseFormat format,
+                                 HighlightMode highlight) {
+    ResponseWriter writer(format);
+
+    // Built once; only the returned page is highlighted
+    std::unique_ptr<SnippetGenerator> snippets;
+    if (highlight != HighlightMode::None) {
+        // Highlight what was actually searched
+        snippets = std::make_unique<SnippetGenerator>(
+            response.corrected_query.empty() ? query : response.corrected_query);
+    }
+
+    bool federated = !response.backends.empty();
+    bool faceted = !response.facets.empty();
+    bool corrected = !response.corrected_query.empty();
+    bool predicted = explain && !response.predicted_category.empty();
+    bool configured = !response.config_version.empty();
+    bool collapsed = response.collapsed > 0;
+    writer.beginObject(7 + (configured ? 1 : 0) + (federated ? 1 : 0) + (faceted ? 2 : 0) + (corrected ? 1 : 0) +
+                       (predicted ? 1 : 0) + (collapsed ? 1 : 0) + (response.total_lower_bound ? 1 : 0));
+
+    writer.key("results");
+    writer.beginArray(response.results.size());
+    for (const auto& result : response.results) {
+        bool semantic = explain && response.semantic;
+        bool categorized = explain && !response.predicted_category.empty();
+        writer.beginObject((explain ? 8 : 5) + (semantic ? 1 : 0) + (categorized ? 1 : 0) +
+                           (result.pinned ? 1 : 0) + (result.ann ? 1 : 0) + (snippets ? 1 : 0));
+        writer.key("id");
+        writer.value(result.id);
+        writer.key("title");
+        writer.value(result.title);
+        writer.key("description");
+        writer.value(result.description);
+        writer.key("score");
+        writer.value(result.score);
+        if (explain) {
+            writer.key("es_score");
+            writer.value(result.es_score);
+            writer.key("recency_score");
+            writer.value(result.recency_score);
+            writer.key("title_match_score");
+            writer.value(result.title_match_score);
+        }
+        if (semantic) {
+            writer.key("semantic_score");
+            writer.value(result.semantic_score);
+        }
+        if (categorized) {
+            writer.key("category_score");
+            writer.value(result.category_score);
+        }
+        writer.key("updated_at");
+        writer.value(result.updated_at);
+        if (result.pinned) {
+            writer.key("pinned");
+            writer.value(true);
+        }
+        if (result.ann) {
+            writer.key("ann");
+            writer.value(true);
+        }
+        if (snippets) {
+            writer.key("highlight");
+            writeHighlight(writer, result, *snippets, highlight);
+        }
+        writer.endObject();
+    }
+    writer.endArray();
+
+    writer.key("total");
+    writer.value(response.total);
+    if (response.total_lower_bound) {
+        // Same spelling as ES's hits.total.relation
+        writer.key("total_relation");
+        writer.value("gte");
+    }
+    writer.key("latency_ms");
+    writer.value(response.latency_ms);
+    writer.key("query");
+    writer.value(query);
+    writer.key("size");
+    writer.value(size);
+    writer.key("plan");
+    writer.value(response.plan);
+    if (configured) {
+        writer.key("config_version");
+        writer.value(response.config_version);
+    }
+    if (collapsed) {
+        writer.key("collapsed");
+        writer.value(response.collapsed);
+    }
+
+    if (corrected) {
+        writer.key("corrected_query");
+        writer.value(response.corrected_query);
+    }
+    if (predicted) {
+        writer.key("predicted_category");
+        writer.value(response.predicted_category);
+    }
+
+    if (federated) {
+        writer.key("federation");
+        writer.beginObject(2);
+        writer.key("partial");
+        writer.value(response.partial);
+        writer.key("backends");
+        writer.beginArray(response.backends.size());
+        for (const auto& backend : response.backends) {
+            writer.beginObject(backend.ok ? 4 : 5);
+            writer.key("name");
+            writer.value(backend.name);
+            writer.key("ok");
+            writer.value(backend.ok);
+            writer.key("took_ms");
+            writer.value(backend.took_ms);
+            writer.key("hits");
+            writer.value(backend.hits);
+            if (!backend.ok) {
+                writer.key("error");
+                writer.value(backend.error);
+            }
+            writer.endObject();
+        }
+        writer.endArray();
+        writer.endObject();
+    }
+
+    if (faceted) {
+        writer.key("facets");
+        writer.beginObject(response.facets.size());
+        for (const auto& facet : response.facets) {
+            writer.key(facet.field);
+            writer.beginArray(facet.values.size());
+            for (const auto& value : facet.values) {
+                writer.beginObject(2);
+                writer.key("value");
+                writer.value(value.value);
+                writer.key("count");
+                writer.value(value.count);
+                writer.endObject();
+            }
+            writer.endArray();
+        }
+        writer.endObject();
+        writer.key("facets_sampled");
+        writer.value(response.facets_sampled);
+    }
+
+    const auto& stats = response.es_stats;
+    writer.key("es");
+    writer.beginObject(3);
+    writer.key("took_ms");
+    writer.value(stats.took_ms);
+    writer.key("timed_out");
+    writer.value(stats.timed_out);
+    writer.key("shards");
+    writer.beginObject(4);
+    writer.key("total");
+    writer.value(stats.shards_total);
+    writer.key("successful");
+    writer.value(stats.shards_successful);
+    writer.key("skipped");
+    writer.value(stats.shards_skipped);
+    writer.key("failed");
+    writer.value(stats.shards_failed);
+    writer.endObject();
+    writer.endObject();
+
+    writer.endObject();
+
+    return writer.take();
+}
+
+} // namespace atlas
@@ -0,0 +1,56 @@
+#include "result_cache.h"
+
+namespace atlas {
+
+ResultCache::ResultCache(size_t capacity, int ttl_ms)
+    : capacity_(capacity), ttl_(ttl_ms) {}
+
+std::optional<SearchResponse> ResultCache::get(const std::string& key, bool allow_stale) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return std::nullopt;
+    }
+
+    if (!allow_stale && std::chrono::steady_clock::now() >= it->second->expires_at) {
+        return std::nullopt;
+    }
+
+    // Move to front (most recently used)
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->response;
+}
+
+void ResultCache::put(const std::string& key, const SearchResponse& response) {
+    if (capacity_ == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto expires_at = std::chrono::steady_clock::now() + ttl_;
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+        it->second->response = response;
+        it->second->expires_at = expires_at;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+
+    lru_.push_front(Entry{key, response, expires_at});
+    index_[key] = lru_.begin();
+
+    // Evict least recently used
+    if (lru_.size() > capacity_) {
+        index_.erase(lru_.back().key);
+        lru_.pop_back();
+    }
+}
+
+size_t ResultCache::size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+} // namespace atlas
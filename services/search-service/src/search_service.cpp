@@ -1,12 +1,28 @@
 #include "search_service.h"
+#include "result_cache.h"
+#include "federation.h"
+#include "incremental_search.h"
+#include "title_index.h"
+#include "facet_index.h"
+#include "ltr_model.h"
+#include "embeddings.h"
+#include "spelling.h"
+#include "taxonomy.h"
+#include "query_stats.h"
+#include "dedup.h"
 #include <curl/curl.h>
 #include <chrono>
 #include <sstream>
 #include <algorithm>
+#include <cmath>
 #include <ctime>
 #include <iomanip>
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <cctype>
+#include <unordered_set>
 
 namespace atlas {
 
@@ -16,142 +32,1361 @@ static size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::stri
     return size * nmemb;
 }
 
+// Version of the compiled-in reranking formula below
+static const uint64_t kRankingConfigVersion = 1;
+
+// FNV-1a 64-bit, stable across processes (unlike std::hash)
+static const uint64_t kFnvOffset = 14695981039346656037ULL;
+static const uint64_t kFnvPrime = 1099511628211ULL;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t len) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= kFnvPrime;
+    }
+    return hash;
+}
+
+uint64_t stableHash(const std::string& data) {
+    return fnv1a(kFnvOffset, data.data(), data.size());
+}
+
+std::string firstCategory(const nlohmann::json& source) {
+    if (!source.contains("category")) {
+        return "";
+    }
+    const auto& category = source["category"];
+    if (category.is_string()) {
+        return category.get<std::string>();
+    }
+    if (category.is_array() && !category.empty() && category[0].is_string()) {
+        return category[0].get<std::string>();
+    }
+    return "";
+}
+
+const std::vector<std::string>& IndexSyncWatermark::fields() {
+    static const std::vector<std::string> kFields = {"indexed_at", "updated_at"};
+    return kFields;
+}
+
+nlohmann::json IndexSyncWatermark::query() const {
+    if (newest_.empty()) {
+        return {{"match_all", nlohmann::json::object()}};
+    }
+    return {{"range", {{"indexed_at", {{"gte", newest_ + "||-" + kOverlap}}}}}};
+}
+
+void IndexSyncWatermark::observe(const nlohmann::json& source) {
+    std::string stamp = source.value("indexed_at", source.value("updated_at", ""));
+    if (stamp > newest_) {
+        newest_ = std::move(stamp);
+    }
+}
+
+std::string normalizeQuery(const std::string& query) {
+    std::string normalized;
+    normalized.reserve(query.size());
+    bool pending_space = false;
+    for (unsigned char c : query) {
+        if (std::isspace(c)) {
+            pending_space = !normalized.empty();
+            continue;
+        }
+        if (pending_space) {
+            normalized.push_back(' ');
+            pending_space = false;
+        }
+        normalized.push_back(static_cast<char>(std::tolower(c)));
+    }
+    return normalized;
+}
+
+// Every filter value, '\x1f'-separated
+static std::string filtersKey(const SearchFilters& filters) {
+    std::ostringstream key;
+    for (const auto& category : filters.categories) {
+        key << "\x1f" << "c=" << category;
+    }
+    if (filters.min_price) key << "\x1f" << "min=" << *filters.min_price;
+    if (filters.max_price) key << "\x1f" << "max=" << *filters.max_price;
+    if (filters.in_stock) key << "\x1f" << "stock=" << *filters.in_stock;
+    return key.str();
+}
+
+// Cache key: normalized query, page size and every filter value
+static std::string resultCacheKey(const std::string& query, int size, const SearchFilters& filters) {
+    return normalizeQuery(query) + '\x1f' + std::to_string(size) + filtersKey(filters);
+}
+
 // ElasticsearchClient implementation
-ElasticsearchClient::ElasticsearchClient(const std::string& host, int port)
-    : host_(host), port_(port) {
+ElasticsearchClient::ElasticsearchClient(const std::string& host, int port, const std::string& index)
+    : host_(host), port_(port), index_(index) {
     base_url_ = "http://" + host_ + ":" + std::to_string(port_);
     curl_global_init(CURL_GLOBAL_DEFAULT);
 }
 
 ElasticsearchClient::~ElasticsearchClient() {
+    for (void* handle : idle_handles_) {
+        curl_easy_cleanup(static_cast<CURL*>(handle));
+    }
     curl_global_cleanup();
 }
 
-std::string ElasticsearchClient::performRequest(const std::string& url, const std::string& post_data) {
+// Upper bound on parked handles; extra handles are closed on release
+static const size_t kMaxIdleHandles = 32;
+
+void* ElasticsearchClient::acquireHandle() {
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        if (!idle_handles_.empty()) {
+            void* handle = idle_handles_.back();
+            idle_handles_.pop_back();
+            return handle;
+        }
+    }
+
     CURL* curl = curl_easy_init();
     if (!curl) {
         throw std::runtime_error("Failed to initialize CURL");
     }
+    return curl;
+}
+
+void ElasticsearchClient::releaseHandle(void* handle) {
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        if (idle_handles_.size() < kMaxIdleHandles) {
+            idle_handles_.push_back(handle);
+            return;
+        }
+    }
+    curl_easy_cleanup(static_cast<CURL*>(handle));
+}
+
+void ElasticsearchClient::prepareHandle(void* handle, const std::string& url, const std::string& post_data,
+                                        long timeout_ms, const char* method, void*& header_list,
+                                        std::string& response_string) {
+    CURL* curl = static_cast<CURL*>(handle);
+
+    // Reset options from the previous request; the connection cache is kept
+    curl_easy_reset(curl);
 
-    std::string response_string;
     struct curl_slist* headers = nullptr;
     headers = curl_slist_append(headers, "Content-Type: application/json");
+    header_list = headers;
 
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_string);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
-    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 5L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, std::min(timeout_ms, 5000L));
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
 
     if (!post_data.empty()) {
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, post_data.c_str());
     }
+    if (method) {
+        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+    }
+}
+
+std::string ElasticsearchClient::performRequest(const std::string& url, const std::string& post_data,
+                                               long timeout_ms, const char* method) {
+    CURL* curl = static_cast<CURL*>(acquireHandle());
+    std::string response_string;
+    void* headers = nullptr;
+    prepareHandle(curl, url, post_data, timeout_ms, method, headers, response_string);
 
     CURLcode res = curl_easy_perform(curl);
     
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
+    curl_slist_free_all(static_cast<curl_slist*>(headers));
 
     if (res != CURLE_OK) {
+        // Drop the handle so a broken connection is not reused
+        curl_easy_cleanup(curl);
         throw std::runtime_error("CURL request failed: " + std::string(curl_easy_strerror(res)));
     }
 
+    releaseHandle(curl);
     return response_string;
 }
 
-nlohmann::json ElasticsearchClient::search(const std::string& query, int size, int timeout_ms) {
-    // Build multi_match query with title boosted by 3
+int ElasticsearchClient::warmConnections(int connections) {
+    // Run the pings concurrently so each one holds its own handle and
+    // therefore opens its own connection
+    std::atomic<int> opened{0};
+    std::vector<std::thread> workers;
+    for (int i = 0; i < connections; ++i) {
+        workers.emplace_back([this, &opened]() {
+            try {
+                performRequest(base_url_ + "/");
+                opened++;
+            } catch (const std::exception& e) {
+                std::cerr << "Warm-up connection failed: " << e.what() << std::endl;
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return opened.load();
+}
+
+size_t ElasticsearchClient::scan(const nlohmann::json& query, const std::vector<std::string>& source_fields,
+                                 const std::function<void(const nlohmann::json& hit)>& visit,
+                                 int batch_size) {
+    // `_doc` order is the cheapest for ES to page through
+    nlohmann::json body = {
+        {"size", batch_size},
+        {"query", query},
+        {"_source", source_fields},
+        {"sort", {"_doc"}}
+    };
+    auto page = nlohmann::json::parse(
+        performRequest(base_url_ + "/" + index_ + "/_search?scroll=1m", body.dump(), 60000));
+
+    size_t visited = 0;
+    std::string scroll_id;
+    while (true) {
+        if (page.contains("error")) {
+            throw std::runtime_error("Scan failed: " + page["error"].dump());
+        }
+        scroll_id = page.value("_scroll_id", scroll_id);
+
+        const auto& hits = page["hits"]["hits"];
+        if (hits.empty()) {
+            break;
+        }
+        for (const auto& hit : hits) {
+            visit(hit);
+            visited++;
+        }
+
+        nlohmann::json next = {{"scroll", "1m"}, {"scroll_id", scroll_id}};
+        page = nlohmann::json::parse(performRequest(base_url_ + "/_search/scroll", next.dump(), 60000));
+    }
+
+    // Free the search context now rather than when the keep-alive lapses
+    if (!scroll_id.empty()) {
+        try {
+            nlohmann::json clear = {{"scroll_id", scroll_id}};
+            performRequest(base_url_ + "/_search/scroll", clear.dump(), 5000, "DELETE");
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to clear scroll: " << e.what() << std::endl;
+        }
+    }
+    return visited;
+}
+
+nlohmann::json ElasticsearchClient::buildSearchBody(const std::string& query, int size, int timeout_ms,
+                                                    const SearchFilters& filters,
+                                                    const EsQueryOptions& options) {
+    // multi_match over the config's fields (title boosted by 3 by default)
+    nlohmann::json text_query = {
+        {"multi_match", {
+            {"query", query},
+            {"fields", options.query_fields},
+            {"type", options.match_type}
+        }}
+    };
+
     nlohmann::json search_body = {
-        {"query", {
-            {"multi_match", {
-                {"query", query},
-                {"fields", {"title^3", "description"}},
-                {"type", "best_fields"}
-            }}
-        }},
         {"size", size},
         {"timeout", std::to_string(timeout_ms) + "ms"}
     };
 
-    std::string url = base_url_ + "/products/_search";
-    std::string response = performRequest(url, search_body.dump());
+    // Cheaper fetch phase: skip the largest stored field, or all of them
+    if (options.ids_only) {
+        search_body["_source"] = false;
+    } else if (!options.include_description) {
+        search_body["_source"] = {{"excludes", {"description"}}};
+    }
+    if (options.terminate_after > 0) {
+        search_body["terminate_after"] = options.terminate_after;
+    }
+
+    if (filters.empty() && options.exclude_ids.empty()) {
+        search_body["query"] = text_query;
+        return search_body;
+    }
+
+    // Filter clauses don't contribute to _score and are cached per segment
+    nlohmann::json filter_clauses = nlohmann::json::array();
+    if (!filters.categories.empty()) {
+        filter_clauses.push_back({{"terms", {{"category.keyword", filters.categories}}}});
+    }
+    if (filters.min_price || filters.max_price) {
+        nlohmann::json range = nlohmann::json::object();
+        if (filters.min_price) range["gte"] = *filters.min_price;
+        if (filters.max_price) range["lte"] = *filters.max_price;
+        filter_clauses.push_back({{"range", {{"price", range}}}});
+    }
+    if (filters.in_stock) {
+        filter_clauses.push_back({{"term", {{"in_stock", *filters.in_stock}}}});
+    }
+
+    nlohmann::json bool_query = {{"must", text_query}};
+    if (!filter_clauses.empty()) {
+        bool_query["filter"] = filter_clauses;
+    }
+    if (!options.exclude_ids.empty()) {
+        bool_query["must_not"] = {{"ids", {{"values", options.exclude_ids}}}};
+    }
+    search_body["query"] = {{"bool", bool_query}};
+    return search_body;
+}
+
+nlohmann::json ElasticsearchClient::search(const std::string& query, int size, int timeout_ms,
+                                           const SearchFilters& filters,
+                                           const EsQueryOptions& options) {
+    nlohmann::json search_body = buildSearchBody(query, size, timeout_ms, filters, options);
+    long client_timeout_ms = options.client_timeout_ms > 0 ? options.client_timeout_ms : 10000;
+    std::string response = performRequest(searchUrl(query, search_body), search_body.dump(), client_timeout_ms);
     
     return nlohmann::json::parse(response);
 }
 
+std::string ElasticsearchClient::searchUrl(const std::string& query, const nlohmann::json& search_body) const {
+    std::string url = base_url_ + "/" + index_ + "/_search";
+
+    // Shard affinity: the same normalized query always hits the same shard
+    // copies. request_cache must be explicit because ES only caches size=0
+    // requests by default.
+    std::string params;
+    if (shard_affinity_) {
+        params += "preference=" + preferenceKey(query);
+    }
+    if (isCacheable(search_body)) {
+        params += std::string(params.empty() ? "" : "&") + "request_cache=true";
+    }
+    if (!params.empty()) {
+        url += "?" + params;
+    }
+    return url;
+}
+
+void ElasticsearchClient::searchConcurrently(std::vector<ConcurrentSearch>& searches, const std::string& query,
+                                             int size, const SearchFilters& filters) {
+    struct Transfer {
+        CURL* curl = nullptr;
+        void* headers = nullptr;
+        std::string body;
+        std::string response;
+        CURLcode result = CURLE_OK;
+    };
+    std::vector<Transfer> transfers(searches.size());
+    auto start = std::chrono::steady_clock::now();
+
+    CURLM* multi = curl_multi_init();
+    if (!multi) {
+        for (auto& search : searches) search.error = "Failed to initialize CURL multi";
+        return;
+    }
+    for (size_t i = 0; i < searches.size(); ++i) {
+        ConcurrentSearch& search = searches[i];
+        Transfer& transfer = transfers[i];
+        try {
+            nlohmann::json search_body = buildSearchBody(query, size, search.timeout_ms, filters, search.options);
+            transfer.body = search_body.dump();
+            long client_timeout_ms = search.options.client_timeout_ms > 0 ? search.options.client_timeout_ms : 10000;
+            transfer.curl = static_cast<CURL*>(search.client->acquireHandle());
+            prepareHandle(transfer.curl, search.client->searchUrl(query, search_body), transfer.body,
+                          client_timeout_ms, nullptr, transfer.headers, transfer.response);
+            curl_easy_setopt(transfer.curl, CURLOPT_PRIVATE, reinterpret_cast<char*>(&transfer));
+            curl_multi_add_handle(multi, transfer.curl);
+        } catch (const std::exception& e) {
+            search.error = e.what();
+        }
+    }
+
+    // Every handle has its own timeout, so this loop ends by the latest deadline
+    int running = 0;
+    do {
+        curl_multi_perform(multi, &running);
+        int queued = 0;
+        while (CURLMsg* message = curl_multi_info_read(multi, &queued)) {
+            if (message->msg != CURLMSG_DONE) continue;
+            char* owner = nullptr;
+            curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &owner);
+            Transfer* transfer = reinterpret_cast<Transfer*>(owner);
+            transfer->result = message->data.result;
+            searches[transfer - transfers.data()].elapsed_ms = static_cast<int>(
+                std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+        if (running > 0) {
+            curl_multi_poll(multi, nullptr, 0, 100, nullptr);
+        }
+    } while (running > 0);
+
+    for (size_t i = 0; i < searches.size(); ++i) {
+        Transfer& transfer = transfers[i];
+        if (!transfer.curl) continue;
+        curl_multi_remove_handle(multi, transfer.curl);
+        curl_slist_free_all(static_cast<curl_slist*>(transfer.headers));
+        if (transfer.result != CURLE_OK) {
+            // Drop the handle so a broken connection is not reused
+            curl_easy_cleanup(transfer.curl);
+            searches[i].error = "CURL request failed: " + std::string(curl_easy_strerror(transfer.result));
+            continue;
+        }
+        searches[i].client->releaseHandle(transfer.curl);
+        try {
+            searches[i].response = nlohmann::json::parse(transfer.response);
+        } catch (const std::exception& e) {
+            searches[i].error = e.what();
+        }
+    }
+    curl_multi_cleanup(multi);
+}
+
+nlohmann::json ElasticsearchClient::getDocuments(const std::vector<std::string>& ids,
+                                                 const EsQueryOptions& options) {
+    std::string url = base_url_ + "/" + index_ + "/_mget";
+    if (!options.include_description) {
+        url += "?_source_excludes=description";
+    }
+    nlohmann::json body = {{"ids", ids}};
+    long client_timeout_ms = options.client_timeout_ms > 0 ? options.client_timeout_ms : 10000;
+    return nlohmann::json::parse(performRequest(url, body.dump(), client_timeout_ms));
+}
+
+std::string ElasticsearchClient::preferenceKey(const std::string& query) {
+    std::string normalized = normalizeQuery(query);
+    uint64_t hash = fnv1a(kFnvOffset, normalized.data(), normalized.size());
+
+    std::ostringstream key;
+    key << "q" << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return key.str();
+}
+
+// True if any string under `node` uses date math relative to now ("now-7d")
+static bool usesNowDateMath(const nlohmann::json& node) {
+    if (node.is_string()) {
+        return node.get_ref<const std::string&>().rfind("now", 0) == 0;
+    }
+    if (node.is_structured()) {
+        for (const auto& item : node) {
+            if (usesNowDateMath(item)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool ElasticsearchClient::isCacheable(const nlohmann::json& search_body) {
+    if (search_body.is_object()) {
+        for (const auto& [key, value] : search_body.items()) {
+            // Only range bounds can carry date math; free text like "now playing" is fine
+            if (key == "range" ? usesNowDateMath(value) : !isCacheable(value)) {
+                return false;
+            }
+        }
+    } else if (search_body.is_array()) {
+        for (const auto& item : search_body) {
+            if (!isCacheable(item)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+EsQueryStats ElasticsearchClient::parseQueryStats(const nlohmann::json& es_response) {
+    EsQueryStats stats;
+    stats.took_ms = es_response.value("took", 0);
+    stats.timed_out = es_response.value("timed_out", false);
+    if (es_response.contains("_shards")) {
+        const auto& shards = es_response["_shards"];
+        stats.shards_total = shards.value("total", 0);
+        stats.shards_successful = shards.value("successful", 0);
+        stats.shards_skipped = shards.value("skipped", 0);
+        stats.shards_failed = shards.value("failed", 0);
+    }
+    return stats;
+}
+
 // SearchService implementation
 SearchService::SearchService(const std::string& es_host, int es_port) {
     es_client_ = std::make_unique<ElasticsearchClient>(es_host, es_port);
+    setRankingConfig(RankingConfig());
 }
 
 SearchService::~SearchService() = default;
 
-SearchResponse SearchService::search(const std::string& query, int size) {
+void SearchService::enableResultCache(size_t capacity, int ttl_ms) {
+    result_cache_ = std::make_unique<ResultCache>(capacity, ttl_ms);
+}
+
+void SearchService::setRankingConfig(RankingConfig config) {
+    config.seal();
+    ranking_config_.publish(std::make_unique<const RankingConfig>(std::move(config)));
+}
+
+RankingConfig SearchService::rankingConfig() const {
+    RcuReadGuard guard;
+    return *ranking_config_.get();
+}
+
+uint64_t SearchService::rankingConfigVersion() const {
+    RcuReadGuard guard;
+    return rankingConfigVersion(*ranking_config_.get());
+}
+
+uint64_t SearchService::rankingConfigVersion(const RankingConfig& config) const {
+    uint64_t version = fnv1a(kFnvOffset, &kRankingConfigVersion, sizeof(kRankingConfigVersion));
+    version = fnv1a(version, &config.fingerprint, sizeof(config.fingerprint));
+    if (ltr_model_) {
+        uint64_t fingerprint = ltr_model_->fingerprint();
+        version = fnv1a(version, &fingerprint, sizeof(fingerprint));
+    }
+    // The config carries every weight; these only say which terms apply
+    if (product_embeddings_) {
+        version = fnv1a(version, "semantic", 8);
+    }
+    if (auto taxonomy = std::atomic_load(&taxonomy_)) {
+        uint64_t fingerprint = taxonomy->fingerprint();
+        version = fnv1a(version, &fingerprint, sizeof(fingerprint));
+    }
+    if (auto clusters = std::atomic_load(&dedup_clusters_)) {
+        uint64_t fingerprint = clusters->fingerprint();
+        version = fnv1a(version, &fingerprint, sizeof(fingerprint));
+    }
+    return version;
+}
+
+void SearchService::enableDedup(std::shared_ptr<const DuplicateClusters> clusters, double overfetch) {
+    dedup_overfetch_ = std::max(0.0, overfetch);
+    setDuplicateClusters(std::move(clusters));
+}
+
+void SearchService::setDuplicateClusters(std::shared_ptr<const DuplicateClusters> clusters) {
+    std::atomic_store(&dedup_clusters_, std::move(clusters));
+}
+
+void SearchService::enableTaxonomy(std::shared_ptr<const Taxonomy> taxonomy) {
+    setTaxonomy(std::move(taxonomy));
+}
+
+void SearchService::setTaxonomy(std::shared_ptr<const Taxonomy> taxonomy) {
+    std::atomic_store(&taxonomy_, std::move(taxonomy));
+}
+
+std::string SearchService::applyTaxonomy(const RankingConfig& config, std::vector<SearchResult>& results,
+                                         size_t count, const std::string& query,
+                                         const std::string& prediction) const {
+    // One snapshot per request, so a concurrent swap can't mix trees
+    auto taxonomy = std::atomic_load(&taxonomy_);
+    count = std::min(count, results.size());
+    if (!taxonomy || count == 0) {
+        return "";
+    }
+
+    std::vector<int> nodes(count);
+    for (size_t i = 0; i < count; ++i) {
+        nodes[i] = results[i].category.empty() ? -1 : taxonomy->node(results[i].category);
+    }
+
+    int predicted = prediction.empty() ? taxonomy->predictedCategory(normalizeQuery(query))
+                                       : taxonomy->node(prediction);
+    if (predicted < 0 && prediction.empty()) {
+        // No head-query prediction: the category ES puts the most score behind
+        std::unordered_map<int, double> votes;
+        for (size_t i = 0; i < count; ++i) {
+            if (nodes[i] >= 0) {
+                votes[nodes[i]] += std::max(results[i].es_score, 0.0);
+            }
+        }
+        double best = 0.0;
+        for (const auto& [node, weight] : votes) {
+            if (weight > best || (weight == best && predicted >= 0 && node < predicted)) {
+                best = weight;
+                predicted = node;
+            }
+        }
+    }
+    if (predicted < 0) {
+        return "";
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        results[i].category_score = nodes[i] >= 0 ? taxonomy->proximity(nodes[i], predicted) : 0.0;
+        results[i].score += config.taxonomy_weight * results[i].category_score;
+    }
+    return taxonomy->category(predicted);
+}
+
+void SearchService::enableLtr(std::shared_ptr<const LtrModel> model) {
+    ltr_model_ = std::move(model);
+}
+
+void SearchService::enableSemantic(std::shared_ptr<const EmbeddingStore> products,
+                                   std::shared_ptr<const EmbeddingStore> queries) {
+    if (queries && queries->dim() != products->dim()) {
+        throw std::invalid_argument("Query embeddings have " + std::to_string(queries->dim()) +
+                                    " dimensions, product embeddings " +
+                                    std::to_string(products->dim()));
+    }
+    product_embeddings_ = std::move(products);
+    query_embeddings_ = std::move(queries);
+}
+
+size_t SearchService::semanticDim() const {
+    return product_embeddings_ ? product_embeddings_->dim() : 0;
+}
+
+void SearchService::enableAnnCandidates(std::shared_ptr<const HnswIndex> index, size_t ef_search) {
+    ann_ef_search_ = ef_search;
+    std::atomic_store(&ann_index_, std::move(index));
+}
+
+std::optional<QuantizedVector> SearchService::queryEmbedding(const std::string& query,
+                                                             const std::vector<float>& supplied) const {
+    if (!product_embeddings_) {
+        return std::nullopt;
+    }
+    if (query_embeddings_) {
+        int64_t row = query_embeddings_->find(normalizeQuery(query));
+        if (row >= 0) {
+            return query_embeddings_->quantize(static_cast<size_t>(row));
+        }
+    }
+    if (supplied.size() == product_embeddings_->dim()) {
+        return product_embeddings_->quantize(supplied.data());
+    }
+    return std::nullopt;
+}
+
+void SearchService::applySemantic(const RankingConfig& config, std::vector<SearchResult>& results,
+                                  size_t count, const QuantizedVector* query) const {
+    count = std::min(count, results.size());
+    for (size_t i = 0; i < count; ++i) {
+        results[i].semantic_score = 0.0;
+        if (!query) {
+            continue;
+        }
+        int64_t row = product_embeddings_->find(results[i].id);
+        if (row >= 0) {
+            results[i].semantic_score = product_embeddings_->similarity(*query, static_cast<size_t>(row));
+            results[i].score += config.semantic_weight * results[i].semantic_score;
+        }
+    }
+}
+
+std::string SearchService::rankPinned(const RankingConfig& config, std::vector<SearchResult>& pinned,
+                                      const std::string& query, const QuantizedVector* embedding,
+                                      const std::string& prediction) {
+    applySemantic(config, pinned, pinned.size(), embedding);
+    std::string predicted = applyTaxonomy(config, pinned, pinned.size(), query, prediction);
+    applyLtr(pinned, pinned.size(), query);
+    std::stable_sort(pinned.begin(), pinned.end(),
+        [](const SearchResult& a, const SearchResult& b) {
+            return a.score > b.score;
+        });
+    return predicted;
+}
+
+void SearchService::appendAnnCandidates(const RankingConfig& config, SearchResponse& response,
+                                        const std::vector<SearchResult>& pinned, int page_size,
+                                        const QuantizedVector& query, const EsQueryOptions& options,
+                                        const std::string& text_query, const DuplicateClusters* clusters) {
+    auto index = std::atomic_load(&ann_index_);
+    if (!index || response.results.size() >= static_cast<size_t>(page_size)) {
+        return;
+    }
+
+    std::unordered_set<std::string> on_page;
+    std::unordered_set<uint32_t> clusters_on_page;
+    auto claim = [&](const SearchResult& result) {
+        on_page.insert(result.id);
+        if (clusters) clusters_on_page.insert(clusters->cluster(result.id));
+    };
+    for (const auto& result : response.results) claim(result);
+    for (const auto& result : pinned) claim(result);
+    clusters_on_page.erase(0);
+
+    // Ask for enough neighbors to fill the page even if all of the page's
+    // hits come back among them
+    size_t needed = static_cast<size_t>(page_size) - response.results.size();
+    size_t k = needed + on_page.size();
+    std::vector<std::string> ids;
+    std::vector<float> similarities;
+    for (const auto& neighbor : index->search(query, k, std::max(ann_ef_search_, k))) {
+        std::string id(index->store().key(neighbor.row));
+        uint32_t cluster = clusters ? clusters->cluster(id) : 0;
+        if (on_page.count(id) == 0 && (cluster == 0 || clusters_on_page.insert(cluster).second)) {
+            ids.push_back(std::move(id));
+            similarities.push_back(neighbor.similarity);
+            if (ids.size() == needed) break;
+        }
+    }
+    if (ids.empty()) {
+        return;
+    }
+
+    nlohmann::json documents;
+    try {
+        documents = es_client_->getDocuments(ids, options);
+    } catch (const std::exception& e) {
+        std::cerr << "ANN candidate fetch error: " << e.what() << std::endl;
+        return;
+    }
+    if (!documents.contains("docs") || !documents["docs"].is_array()) {
+        return;
+    }
+
+    // _mget answers in request order, which is already most similar first.
+    // Without an ES match these rank below every ES hit.
+    int added = 0;
+    for (size_t i = 0; i < documents["docs"].size() && i < ids.size(); ++i) {
+        const auto& doc = documents["docs"][i];
+        if (!doc.value("found", false) || !doc.contains("_source")) {
+            continue;
+        }
+        const auto& source = doc["_source"];
+        SearchResult result;
+        result.id = ids[i];
+        result.title = source.value("title", "");
+        result.description = source.value("description", "");
+        result.updated_at = source.value("updated_at", "");
+        result.version = source.value("version", static_cast<int64_t>(0));
+        result.category = firstCategory(source);
+        result.es_score = 0.0;
+        result.recency_score = calculateRecencyScore(config, result.updated_at);
+        result.title_match_score = calculateTitleMatchScore(result.title, text_query);
+        result.semantic_score = similarities[i];
+        result.score = config.recency_weight * result.recency_score +
+                       config.title_match_weight * result.title_match_score +
+                       config.semantic_weight * result.semantic_score;
+        result.ann = true;
+        response.results.push_back(std::move(result));
+        added++;
+    }
+    response.total += added;
+    response.ann = added;
+}
+
+static size_t countWords(const std::string& text) {
+    std::istringstream stream(text);
+    size_t words = 0;
+    for (std::string word; stream >> word;) {
+        words++;
+    }
+    return words;
+}
+
+void SearchService::applyLtr(std::vector<SearchResult>& results, size_t count, const std::string& query) {
+    count = std::min(count, results.size());
+    if (!ltr_model_ || count == 0) {
+        return;
+    }
+
+    // One row per hit, scored as a batch so the model's tables stay in cache
+    float query_terms = static_cast<float>(countWords(query));
+    std::vector<float> features(count * kNumLtrFeatures);
+    for (size_t i = 0; i < count; ++i) {
+        float* row = &features[i * kNumLtrFeatures];
+        row[kLtrEsScore] = static_cast<float>(results[i].es_score);
+        row[kLtrRecency] = static_cast<float>(results[i].recency_score);
+        row[kLtrTitleMatch] = static_cast<float>(results[i].title_match_score);
+        row[kLtrEsRank] = static_cast<float>(i);
+        row[kLtrQueryTerms] = query_terms;
+        row[kLtrTitleTerms] = static_cast<float>(countWords(results[i].title));
+        row[kLtrSemantic] = static_cast<float>(results[i].semantic_score);
+        row[kLtrCategoryProximity] = static_cast<float>(results[i].category_score);
+    }
+
+    std::vector<double> scores(count);
+    ltr_model_->score(features.data(), count, scores.data());
+    for (size_t i = 0; i < count; ++i) {
+        results[i].score = scores[i];
+    }
+}
+
+void SearchService::enableFederation(std::unique_ptr<FederatedSearcher> federation) {
+    federation_ = std::move(federation);
+}
+
+void SearchService::enableIncrementalSearch(size_t max_sessions, int max_age_ms, int candidate_count) {
+    sessions_ = std::make_unique<IncrementalSessionStore>(max_sessions, max_age_ms);
+    incremental_candidates_ = candidate_count;
+}
+
+// True if every term of the (normalized) query occurs in the title or
+// description. The last term may be a partial word, which substring
+// matching handles as a prefix.
+static bool matchesAllTerms(const SearchResult& candidate, const std::vector<std::string>& terms) {
+    std::string text = candidate.title + " " + candidate.description;
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+    for (const auto& term : terms) {
+        if (text.find(term) == std::string::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+SearchResponse SearchService::searchIncremental(const std::string& session, const std::string& query,
+                                                int size, const SearchFilters& filters,
+                                                const std::vector<float>& query_vector) {
+    if (!sessions_ || session.empty()) {
+        return search(query, size, filters, query_vector);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::string normalized = normalizeQuery(query);
+    std::string filters_key = filtersKey(filters);
+
+    RcuReadGuard guard;
+    const RankingConfig& config = *ranking_config_.get();
+
+    if (auto set = sessions_->lookup(session, normalized, filters_key)) {
+        std::vector<std::string> terms;
+        std::istringstream term_stream(normalized);
+        for (std::string term; term_stream >> term;) {
+            terms.push_back(term);
+        }
+
+        std::vector<SearchResult> kept;
+        kept.reserve(set->candidates.size());
+        for (const auto& candidate : set->candidates) {
+            if (!matchesAllTerms(candidate, terms)) {
+                continue;
+            }
+            // es_score and recency are per document; only title match depends
+            // on the query, so that's all we recompute
+            SearchResult result = candidate;
+            result.title_match_score = calculateTitleMatchScore(result.title, query);
+            result.score = config.es_weight * result.es_score +
+                           config.recency_weight * result.recency_score +
+                           config.title_match_weight * result.title_match_score;
+            kept.push_back(std::move(result));
+        }
+
+        // Serve locally only if a full page survives. Fewer never proves the
+        // refinement has no more hits: the shorter query was matched by whole
+        // words, so the longer one may match documents it did not.
+        if (kept.size() >= static_cast<size_t>(size)) {
+            recordQuery(query);
+            auto embedding = queryEmbedding(query, query_vector);
+            applySemantic(config, kept, kept.size(), embedding ? &*embedding : nullptr);
+            std::string predicted_category = applyTaxonomy(config, kept, kept.size(), query);
+            applyLtr(kept, kept.size(), query);
+            std::stable_sort(kept.begin(), kept.end(),
+                [](const SearchResult& a, const SearchResult& b) {
+                    return a.score > b.score;
+                });
+
+            // Narrow the session so the next keystroke filters fewer candidates.
+            // fetched_at is kept: staleness counts from the ES fetch.
+            CandidateSet narrowed = *set;
+            narrowed.normalized_query = normalized;
+            narrowed.candidates = kept;
+            sessions_->store(session, narrowed);
+
+            // Only the candidate window was filtered, so matches ranked below
+            // it went uncounted
+            SearchResponse response;
+            response.total = static_cast<int>(kept.size());
+            response.total_lower_bound = true;
+            if (kept.size() > static_cast<size_t>(size)) {
+                kept.resize(size);
+            }
+            response.results = std::move(kept);
+            response.incremental = true;
+            response.semantic = embedding.has_value();
+            response.predicted_category = predicted_category;
+            response.config_version = config.version;
+            response.results_hash = computeResultsHash(response, rankingConfigVersion(config));
+            response.latency_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - start).count();
+            return response;
+        }
+    }
+
+    // Go to ES with a wider window so later keystrokes have candidates to filter
+    int fetch_size = std::max(size, incremental_candidates_);
+    SearchResponse response = search(query, fetch_size, filters, query_vector);
+
+    if (response.results_hash != 0 && !response.partial) {
+        CandidateSet set;
+        set.normalized_query = normalized;
+        set.filters_key = filters_key;
+        set.candidates = response.results;
+        set.fetched_at = std::chrono::steady_clock::now();
+        sessions_->store(session, set);
+    }
+
+    // The hash still covers the wider window: a superset of this page, so the
+    // ETag changes whenever the page does
+    if (response.results.size() > static_cast<size_t>(size)) {
+        response.results.resize(size);
+    }
+    return response;
+}
+
+void SearchService::enableTitleIndex(size_t max_pinned) {
+    title_index_ = std::make_unique<TitleIndex>();
+    max_pinned_ = max_pinned;
+}
+
+void SearchService::enableFacets(const std::vector<std::string>& fields, int window, size_t top_n) {
+    facet_index_ = std::make_unique<FacetIndex>(fields);
+    facet_window_ = window;
+    facet_top_n_ = top_n;
+}
+
+void SearchService::enableSpelling(int max_edit_distance, int min_hits) {
+    spelling_ = std::make_unique<SpellingIndex>(max_edit_distance);
+    spelling_min_hits_ = min_hits;
+}
+
+size_t SearchService::refreshLocalIndexes(bool full) {
+    size_t scanned = 0;
+    if (title_index_) {
+        scanned += title_index_->refresh(*es_client_, full);
+    }
+    if (facet_index_) {
+        scanned += facet_index_->refresh(*es_client_, full);
+    }
+    if (spelling_) {
+        scanned += spelling_->refresh(*es_client_, full);
+    }
+    return scanned;
+}
+
+std::vector<FacetResult> SearchService::facetCounts(const std::string& query, const SearchFilters& filters,
+                                                    const std::vector<std::string>& fields,
+                                                    bool* sampled) {
+    if (!facet_index_ || fields.empty() || (brownout_ && brownout_->level() > 0)) {
+        return {};
+    }
+
+    EsQueryOptions options;
+    options.ids_only = true;
+    {
+        RcuReadGuard guard;
+        options.query_fields = ranking_config_.get()->query_fields;
+        options.match_type = ranking_config_.get()->match_type;
+    }
+    nlohmann::json es_response;
+    try {
+        es_response = es_client_->search(query, facet_window_, 5000, filters, options);
+    } catch (const std::exception& e) {
+        // Facets are an extra; the page is still served without them
+        std::cerr << "Facet query error: " << e.what() << std::endl;
+        return {};
+    }
+    if (!es_response.contains("hits") || !es_response["hits"].contains("hits")) {
+        return {};
+    }
+
+    std::vector<std::string> ids;
+    for (const auto& hit : es_response["hits"]["hits"]) {
+        ids.push_back(hit.value("_id", ""));
+    }
+    if (sampled) {
+        *sampled = es_response["hits"]["total"].value("value", 0) > static_cast<int>(ids.size());
+    }
+    return facet_index_->facets(ids, fields, facet_top_n_);
+}
+
+uint64_t SearchService::hashFacets(uint64_t results_hash, const std::vector<FacetResult>& facets) {
+    uint64_t hash = results_hash;
+    for (const auto& facet : facets) {
+        hash = fnv1a(hash, facet.field.data(), facet.field.size() + 1);  // include the NUL separator
+        for (const auto& value : facet.values) {
+            hash = fnv1a(hash, value.value.data(), value.value.size() + 1);
+            hash = fnv1a(hash, &value.count, sizeof(value.count));
+        }
+    }
+    return hash;
+}
+
+void SearchService::enableBrownout(const BrownoutConfig& config) {
+    brownout_ = std::make_unique<BrownoutController>(config);
+}
+
+uint64_t SearchService::computeResultsHash(const SearchResponse& response, uint64_t ranking_version,
+                                           int plan_level) {
+    uint64_t hash = fnv1a(kFnvOffset, &ranking_version, sizeof(ranking_version));
+    hash = fnv1a(hash, &plan_level, sizeof(plan_level));
+    int64_t total = response.total;
+    hash = fnv1a(hash, &total, sizeof(total));
+    for (const auto& result : response.results) {
+        // Length prefix keeps ("ab","c") distinct from ("a","bc")
+        uint64_t id_len = result.id.size();
+        hash = fnv1a(hash, &id_len, sizeof(id_len));
+        hash = fnv1a(hash, result.id.data(), result.id.size());
+        hash = fnv1a(hash, &result.version, sizeof(result.version));
+    }
+    return hash;
+}
+
+std::vector<std::string> SearchService::loadWarmupQueries(const std::string& path) {
+    std::vector<std::string> queries;
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return queries;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        // Trim surrounding whitespace (and CR from files edited on Windows)
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#') {
+            continue;
+        }
+        size_t last = line.find_last_not_of(" \t\r");
+        queries.push_back(line.substr(first, last - first + 1));
+    }
+    return queries;
+}
+
+int SearchService::warmUp(const std::string& queries_file, int connections) {
+    auto start = std::chrono::steady_clock::now();
+
+    int opened = es_client_->warmConnections(connections);
+
+    int replayed = 0;
+    if (!queries_file.empty()) {
+        auto queries = loadWarmupQueries(queries_file);
+        if (queries.empty()) {
+            std::cerr << "Warm-up file empty or unreadable: " << queries_file << std::endl;
+        }
+        for (const auto& query : queries) {
+            search(query);
+            replayed++;
+        }
+    }
+
+    auto elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    std::cout << "Warm-up complete: " << opened << "/" << connections
+              << " ES connections, " << replayed << " queries replayed in "
+              << elapsed_ms << "ms" << std::endl;
+
+    ready_ = true;
+    return replayed;
+}
+
+// Low-confidence page: hits, but none whose title shares a query term
+static bool hasTitleMatch(const SearchResponse& response) {
+    return std::any_of(response.results.begin(), response.results.end(),
+                       [](const SearchResult& result) { return result.title_match_score > 0.0; });
+}
+
+void SearchService::enableQueryStats(std::shared_ptr<QueryStats> stats, double cache_admit_count) {
+    query_stats_ = std::move(stats);
+    cache_admit_count_ = cache_admit_count;
+}
+
+void SearchService::recordQuery(const std::string& query) {
+    if (query_stats_ && ready_) {
+        query_stats_->record(normalizeQuery(query));
+    }
+}
+
+bool SearchService::admitToCache(const std::string& query) const {
+    // Warm-up replays aren't counted (recordQuery), but they are the last
+    // run's head queries: their pages are exactly what the cache should hold
+    return !query_stats_ || cache_admit_count_ <= 0.0 || !ready_ ||
+           query_stats_->recentCount(normalizeQuery(query)) >= cache_admit_count_;
+}
+
+bool SearchService::isHeadQuery(const std::string& query) const {
+    return query_stats_ && admitToCache(query);
+}
+
+SearchResponse SearchService::search(const std::string& query, int size,
+                                     const SearchFilters& filters,
+                                     const std::vector<float>& query_vector) {
+    recordQuery(query);
+    SearchPlan plan = brownout_ ? brownout_->currentPlan() : SearchPlan::normal();
+    return searchWithPlan(query, size, filters, plan, query_vector);
+}
+
+SearchResponse SearchService::searchWithPlan(const std::string& query, int size,
+                                             const SearchFilters& filters, const SearchPlan& plan,
+                                             const std::vector<float>& query_vector) {
     auto start = std::chrono::high_resolution_clock::now();
 
+    // One config snapshot for the whole request, however long it runs
+    RcuReadGuard guard;
+    const RankingConfig& config = *ranking_config_.get();
+    // Likewise one cluster table, so the page and its hash agree
+    auto clusters = std::atomic_load(&dedup_clusters_);
+
+    std::string cache_key;
+    if (result_cache_) {
+        // Pages ranked under an earlier config, LTR model, taxonomy or
+        // cluster table are never served after a reload
+        cache_key = resultCacheKey(query, size, filters) + '\x1f' +
+                    std::to_string(rankingConfigVersion(config));
+        // A caller-supplied embedding changes the ranking, so it's part of the key
+        if (product_embeddings_ && !query_vector.empty()) {
+            cache_key += '\x1f' + std::to_string(fnv1a(kFnvOffset, query_vector.data(),
+                                                       query_vector.size() * sizeof(float)));
+        }
+        // Under heavy brownout, a stale page for a query we've seen recently
+        // beats another ES round trip
+        if (auto cached = result_cache_->get(cache_key, plan.cache_only_head)) {
+            SearchResponse response = std::move(*cached);
+            response.cache_hit = true;
+            response.plan = plan.name;
+            response.latency_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::high_resolution_clock::now() - start).count();
+            return response;
+        }
+    }
+
+    // Navigational fast path. The title index only mirrors the primary index
+    // and knows nothing about filters, so it sits out when either applies.
+    std::vector<SearchResult> pinned;
+    if (title_index_ && filters.empty() && !federation_) {
+        for (const auto& entry : title_index_->lookup(query, max_pinned_)) {
+            SearchResult result;
+            result.id = entry.id;
+            result.title = entry.title;
+            result.updated_at = entry.updated_at;
+            result.version = entry.version;
+            result.category = entry.category;
+            if (plan.include_description) {
+                result.description = entry.description;
+            }
+            // No ES score: pinned hits are ranked by the other features
+            result.es_score = 0.0;
+            result.recency_score = calculateRecencyScore(config, entry.updated_at);
+            result.title_match_score = 1.0;
+            result.score = config.recency_weight * result.recency_score +
+                           config.title_match_weight * result.title_match_score;
+            result.pinned = true;
+            pinned.push_back(result);
+        }
+    }
+
+    if (!pinned.empty() && pinned.size() >= static_cast<size_t>(size)) {
+        // The exact matches fill the page, so the page is built without any
+        // ES round trip. That also means nobody counted the other matches:
+        // `total` is a lower bound.
+        SearchResponse response;
+        response.total = static_cast<int>(pinned.size());
+        response.total_lower_bound = true;
+        response.plan = plan.name;
+        auto embedding = queryEmbedding(query, query_vector);
+        response.semantic = embedding.has_value();
+        response.predicted_category = rankPinned(config, pinned, query,
+                                                 embedding ? &*embedding : nullptr, "");
+        pinned.resize(size);
+        response.results = std::move(pinned);
+        response.pinned = static_cast<int>(response.results.size());
+        response.config_version = config.version;
+        response.results_hash = computeResultsHash(response, rankingConfigVersion(config), plan.level);
+        if (result_cache_ && plan.level == 0 && admitToCache(query)) {
+            result_cache_->put(cache_key, response);
+        }
+        response.latency_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+        return response;
+    }
+
     SearchResponse response;
-    
+    response.total = 0;
+    response.plan = plan.name;
+    response.config_version = config.version;
+
+    // Under heavy brownout, only head queries may still miss the cache.
+    // The rest are refused here, which is what caps the load on ES.
+    if (plan.cache_only_head && !isHeadQuery(query)) {
+        response.shed = true;
+        response.latency_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::high_resolution_clock::now() - start).count();
+        return response;
+    }
+
+    auto es_start = std::chrono::steady_clock::now();
+    auto recordEsRtt = [this, es_start]() {
+        if (brownout_) {
+            brownout_->recordEsRtt(std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - es_start).count());
+        }
+    };
+
     try {
-        // Query Elasticsearch
-        auto es_response = es_client_->search(query, size);
+        EsQueryOptions options;
+        options.include_description = plan.include_description;
+        options.terminate_after = plan.terminate_after;
+        options.query_fields = config.query_fields;
+        options.match_type = config.match_type;
+
+        // ES only fills the rest of the page below the pinned hits
+        int es_size = size - static_cast<int>(pinned.size());
+        for (const auto& result : pinned) {
+            options.exclude_ids.push_back(result.id);
+        }
+
+        // Collapsing drops hits, so ask for more than the page needs
+        int fetch_size = clusters
+            ? es_size + static_cast<int>(std::ceil(es_size * dedup_overfetch_))
+            : es_size;
+
+        // Query Elasticsearch (or every federated backend)
+        auto es_response = federation_
+            ? federation_->search(query, fetch_size, filters, options)
+            : es_client_->search(query, fetch_size, 5000, filters, options);
+        recordEsRtt();
+        response.es_stats = ElasticsearchClient::parseQueryStats(es_response);
+        if (federation_) {
+            response.backends = FederatedSearcher::parseBackendStatuses(es_response);
+            response.partial = es_response["federation"].value("partial", false);
+        }
         
         // Parse results
         if (es_response.contains("hits") && es_response["hits"].contains("hits")) {
             auto hits = es_response["hits"]["hits"];
             response.total = es_response["hits"]["total"]["value"];
 
+            // Only the top `window` hits (in ES order) get the full rerank; the
+            // rest keep their ES order below them
+            size_t window = plan.rerank_window > 0
+                ? std::min(hits.size(), static_cast<size_t>(plan.rerank_window))
+                : hits.size();
+
+            // Clusters already on the page; a pinned hit claims its cluster
+            std::unordered_set<uint32_t> seen_clusters;
+            if (clusters) {
+                for (const auto& result : pinned) seen_clusters.insert(clusters->cluster(result.id));
+            }
+
             for (const auto& hit : hits) {
+                if (response.results.size() >= static_cast<size_t>(es_size)) {
+                    break;  // only the over-fetched tail is left
+                }
                 SearchResult result;
                 result.id = hit["_id"];
+                if (clusters) {
+                    uint32_t cluster = clusters->cluster(result.id);
+                    if (cluster != 0 && !seen_clusters.insert(cluster).second) {
+                        response.collapsed++;
+                        continue;
+                    }
+                }
                 result.es_score = hit["_score"];
                 
                 auto source = hit["_source"];
                 result.title = source.value("title", "");
                 result.description = source.value("description", "");
                 result.updated_at = source.value("updated_at", "");
+                result.version = source.value("version", static_cast<int64_t>(0));
+                result.category = firstCategory(source);
 
-                // Apply reranking
-                result.score = calculateRerankedScore(
-                    result.es_score, 
-                    result.updated_at, 
-                    result.title, 
-                    query
-                );
-                
-                result.recency_score = calculateRecencyScore(result.updated_at);
-                result.title_match_score = calculateTitleMatchScore(result.title, query);
+                if (response.results.size() < window) {
+                    // Apply reranking
+                    result.score = calculateRerankedScore(
+                        config,
+                        result.es_score, 
+                        result.updated_at, 
+                        result.title, 
+                        query
+                    );
+                    
+                    result.recency_score = calculateRecencyScore(config, result.updated_at);
+                    result.title_match_score = calculateTitleMatchScore(result.title, query);
+                } else {
+                    result.score = config.es_weight * result.es_score;
+                    result.recency_score = 0.0;
+                    result.title_match_score = 0.0;
+                }
 
                 response.results.push_back(result);
             }
+            window = std::min(window, response.results.size());
+
+            auto embedding = queryEmbedding(query, query_vector);
+            response.semantic = embedding.has_value();
+            applySemantic(config, response.results, window, embedding ? &*embedding : nullptr);
+            response.predicted_category = applyTaxonomy(config, response.results, window, query);
+            applyLtr(response.results, window, query);
 
-            // Sort by reranked score
-            std::sort(response.results.begin(), response.results.end(),
+            // Sort the reranked window by reranked score
+            std::stable_sort(response.results.begin(), response.results.begin() + window,
                 [](const SearchResult& a, const SearchResult& b) {
                     return a.score > b.score;
                 });
+
+            // Too few keyword matches: fill up with semantic neighbors. The
+            // graph knows nothing about filters or federated indexes, and
+            // the extra fetch is the first thing brownout sheds.
+            if (embedding && filters.empty() && !federation_ && plan.level == 0) {
+                appendAnnCandidates(config, response, pinned, es_size, *embedding, options, query,
+                                    clusters.get());
+            }
+
+            if (!pinned.empty()) {
+                // Ranked toward the same category as the ES hits
+                rankPinned(config, pinned, query, embedding ? &*embedding : nullptr,
+                           response.predicted_category);
+                response.results.insert(response.results.begin(), pinned.begin(), pinned.end());
+                response.total += static_cast<int>(pinned.size());
+                response.pinned = static_cast<int>(pinned.size());
+            }
+
+            response.results_hash = computeResultsHash(response, rankingConfigVersion(config), plan.level);
+            // Degraded and partial pages are not cached, so they never outlive
+            // the overload or backend outage
+            if (result_cache_ && plan.level == 0 && !response.partial && admitToCache(query)) {
+                result_cache_->put(cache_key, response);
+            }
         }
     } catch (const std::exception& e) {
+        // Slow failures (timeouts) are exactly the signal brownout needs
+        recordEsRtt();
         std::cerr << "Search error: " << e.what() << std::endl;
         response.total = 0;
     }
 
+    // Looks misspelled: try the corrected query once. A corrected query is
+    // all vocabulary words, so its own search never corrects again. Skipped
+    // under brownout, where the second ES call is the first thing to go.
+    if (spelling_ && plan.level == 0 && response.results_hash != 0 &&
+        (response.total < spelling_min_hits_ || !hasTitleMatch(response))) {
+        if (auto corrected = spelling_->correct(query)) {
+            SearchResponse retry = searchWithPlan(*corrected, size, filters, plan, query_vector);
+            if (retry.results_hash != 0 &&
+                (retry.total > response.total || (!hasTitleMatch(response) && hasTitleMatch(retry)))) {
+                retry.corrected_query = *corrected;
+                retry.results_hash = fnv1a(retry.results_hash, corrected->data(), corrected->size());
+                // Cache under the original query too, so the repeat skips both searches
+                if (result_cache_ && !retry.partial && admitToCache(query)) {
+                    result_cache_->put(cache_key, retry);
+                }
+                response = std::move(retry);
+            }
+        }
+    }
+
     auto end = std::chrono::high_resolution_clock::now();
     response.latency_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
 
     return response;
 }
 
-double SearchService::calculateRerankedScore(double es_score, const std::string& updated_at,
-                                              const std::string& title, const std::string& query) {
-    double recency = calculateRecencyScore(updated_at);
+double SearchService::calculateRerankedScore(const RankingConfig& config, double es_score,
+                                             const std::string& updated_at, const std::string& title,
+                                             const std::string& query) {
+    double recency = calculateRecencyScore(config, updated_at);
     double title_match = calculateTitleMatchScore(title, query);
     
-    // Reranking formula: 0.7 * es_score + 0.2 * recency + 0.1 * title_match
-    return 0.7 * es_score + 0.2 * recency + 0.1 * title_match;
+    // Reranking formula: 0.7 * es_score + 0.2 * recency + 0.1 * title_match by default
+    return config.es_weight * es_score + config.recency_weight * recency +
+           config.title_match_weight * title_match;
 }
 
-double SearchService::calculateRecencyScore(const std::string& updated_at) {
+double SearchService::calculateRecencyScore(const RankingConfig& config, const std::string& updated_at) {
     if (updated_at.empty()) {
         return 0.0;
     }
@@ -166,9 +1401,9 @@ double SearchService::calculateRecencyScore(const std::string& updated_at) {
         auto now = std::chrono::system_clock::now();
         auto days_old = std::chrono::duration_cast<std::chrono::hours>(now - updated_time).count() / 24;
 
-        // Exponential decay: score = e^(-days/30)
+        // Exponential decay: score = e^(-days/30) by default
         // Recent items get higher scores
-        double score = std::exp(-days_old / 30.0);
+        double score = std::exp(-days_old / config.recency_decay_days);
         return std::min(1.0, std::max(0.0, score));
     } catch (...) {
         return 0.5; // Default score on parse error
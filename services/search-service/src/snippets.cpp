@@ -0,0 +1,238 @@
+#include "snippets.h"
+#include "search_service.h"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace atlas {
+
+HighlightMode parseHighlightMode(const std::string& value) {
+    if (value == "markup" || value == "true" || value == "1") {
+        return HighlightMode::Markup;
+    }
+    if (value == "offsets") {
+        return HighlightMode::Offsets;
+    }
+    return HighlightMode::None;
+}
+
+// The SSE2 prefilter compares against each first byte in turn; past this
+// many it's no faster than the lookup table
+static const size_t kMaxVectorFirstBytes = 8;
+
+static bool isWordByte(unsigned char c) {
+    // Bytes >= 0x80 are parts of UTF-8 letters
+    return std::isalnum(c) || c >= 0x80;
+}
+
+SnippetGenerator::SnippetGenerator(const std::string& query, size_t fragment_size)
+    : fragment_size_(fragment_size) {
+    std::istringstream stream(normalizeQuery(query));
+    for (std::string term; stream >> term;) {
+        if (std::find(terms_.begin(), terms_.end(), term) == terms_.end()) {
+            terms_.push_back(term);
+        }
+    }
+    std::stable_sort(terms_.begin(), terms_.end(),
+        [](const std::string& a, const std::string& b) {
+            return a.size() > b.size();
+        });
+
+    for (const auto& term : terms_) {
+        uint8_t first = static_cast<uint8_t>(term[0]);
+        if (!is_first_byte_[first]) {
+            is_first_byte_[first] = true;
+            first_bytes_.push_back(first);
+        }
+    }
+}
+
+size_t SnippetGenerator::matchAt(const std::string& lower, size_t pos, size_t* term_index) const {
+    if (pos > 0 && isWordByte(static_cast<unsigned char>(lower[pos - 1]))) {
+        return 0;  // not a word start
+    }
+    for (size_t i = 0; i < terms_.size(); ++i) {
+        const auto& term = terms_[i];
+        if (lower.compare(pos, term.size(), term) == 0) {
+            *term_index = i;
+            return term.size();
+        }
+    }
+    return 0;
+}
+
+void SnippetGenerator::scan(const std::string& text, std::vector<TextSpan>& spans,
+                            std::vector<size_t>* term_ids) const {
+    if (terms_.empty() || text.empty()) {
+        return;
+    }
+
+    std::string lower = text;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    size_t pos = 0;
+    size_t n = lower.size();
+    auto check = [&](size_t candidate) {
+        size_t term_index = 0;
+        size_t len = matchAt(lower, candidate, &term_index);
+        if (len == 0) {
+            return candidate + 1;
+        }
+        spans.push_back({candidate, candidate + len});
+        if (term_ids) {
+            term_ids->push_back(term_index);
+        }
+        return candidate + len;
+    };
+
+#ifdef __SSE2__
+    if (first_bytes_.size() <= kMaxVectorFirstBytes) {
+        while (pos + 16 <= n) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lower.data() + pos));
+            __m128i hits = _mm_setzero_si128();
+            for (uint8_t first : first_bytes_) {
+                hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(static_cast<char>(first))));
+            }
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+
+            // Candidates before `next` were consumed by an earlier match
+            size_t next = pos;
+            while (mask) {
+                size_t candidate = pos + static_cast<size_t>(__builtin_ctz(mask));
+                mask &= mask - 1;
+                if (candidate >= next) {
+                    next = check(candidate);
+                }
+            }
+            pos = std::max(pos + 16, next);
+        }
+    }
+#endif
+
+    while (pos < n) {
+        if (is_first_byte_[static_cast<unsigned char>(lower[pos])]) {
+            pos = check(pos);
+        } else {
+            ++pos;
+        }
+    }
+}
+
+std::vector<TextSpan> SnippetGenerator::findMatches(const std::string& text) const {
+    std::vector<TextSpan> spans;
+    scan(text, spans, nullptr);
+    return spans;
+}
+
+TextSpan SnippetGenerator::bestWindow(const std::string& text, const std::vector<TextSpan>& matches,
+                                      const std::vector<size_t>& term_ids) const {
+    size_t n = text.size();
+    if (n <= fragment_size_) {
+        return {0, n};
+    }
+
+    TextSpan covered{0, 0};
+    if (!matches.empty()) {
+        // Slide over the matches: the widest run that fits in the fragment,
+        // scored by distinct terms, then by match count
+        std::vector<int> counts(terms_.size(), 0);
+        size_t distinct = 0;
+        size_t best_distinct = 0;
+        size_t best_count = 0;
+        size_t left = 0;
+        for (size_t right = 0; right < matches.size(); ++right) {
+            if (counts[term_ids[right]]++ == 0) distinct++;
+            while (left < right && matches[right].end - matches[left].begin > fragment_size_) {
+                if (--counts[term_ids[left]] == 0) distinct--;
+                left++;
+            }
+            size_t count = right - left + 1;
+            if (distinct > best_distinct || (distinct == best_distinct && count > best_count)) {
+                best_distinct = distinct;
+                best_count = count;
+                covered = {matches[left].begin, matches[right].end};
+            }
+        }
+    }
+
+    // Center the covered run in the fragment
+    size_t width = covered.end - covered.begin;
+    size_t slack = width < fragment_size_ ? fragment_size_ - width : 0;
+    size_t begin = covered.begin > slack / 2 ? covered.begin - slack / 2 : 0;
+    size_t end = std::min(n, begin + fragment_size_);
+    begin = end - std::min(end, fragment_size_);
+
+    // Snap to word boundaries without losing the covered run
+    auto isSpace = [&text](size_t i) { return std::isspace(static_cast<unsigned char>(text[i])) != 0; };
+    if (begin > 0) {
+        size_t snapped = begin;
+        while (snapped < covered.begin && !isSpace(snapped - 1)) snapped++;
+        if (isSpace(snapped - 1)) begin = snapped;
+    }
+    if (end < n) {
+        size_t snapped = end;
+        while (snapped > std::max(covered.end, begin) && !isSpace(snapped)) snapped--;
+        if (isSpace(snapped)) end = snapped;
+    }
+
+    // Never split a UTF-8 sequence
+    auto isContinuation = [&text](size_t i) { return (static_cast<unsigned char>(text[i]) & 0xC0) == 0x80; };
+    while (begin < end && begin < n && isContinuation(begin)) begin++;
+    while (end > begin && end < n && isContinuation(end)) end--;
+
+    return {begin, end};
+}
+
+Snippet SnippetGenerator::makeSnippet(const std::string& title, const std::string& description) const {
+    Snippet snippet;
+    snippet.title_matches = findMatches(title);
+
+    std::vector<TextSpan> matches;
+    std::vector<size_t> term_ids;
+    scan(description, matches, &term_ids);
+
+    snippet.fragment = bestWindow(description, matches, term_ids);
+    for (const auto& match : matches) {
+        if (match.begin >= snippet.fragment.begin && match.end <= snippet.fragment.end) {
+            snippet.fragment_matches.push_back(match);
+        }
+    }
+    return snippet;
+}
+
+static void appendEscaped(std::string& out, const std::string& text, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        switch (text[i]) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            case '\'': out += "&#39;"; break;
+            default: out.push_back(text[i]);
+        }
+    }
+}
+
+std::string SnippetGenerator::markup(const std::string& text, TextSpan window,
+                                     const std::vector<TextSpan>& matches) {
+    std::string out;
+    out.reserve(window.end - window.begin + matches.size() * 9);
+    size_t pos = window.begin;
+    for (const auto& match : matches) {
+        if (match.begin < pos || match.end > window.end) {
+            continue;
+        }
+        appendEscaped(out, text, pos, match.begin);
+        out += "<em>";
+        appendEscaped(out, text, match.begin, match.end);
+        out += "</em>";
+        pos = match.end;
+    }
+    appendEscaped(out, text, pos, window.end);
+    return out;
+}
+
+} // namespace atlas
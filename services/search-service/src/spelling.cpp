@@ -0,0 +1,302 @@
+#include "spelling.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <unordered_set>
+
+namespace atlas {
+
+// Every string reachable from `word` by deleting up to `max_distance`
+// characters, `word` itself included
+static std::unordered_set<std::string> deletesOf(const std::string& word, int max_distance) {
+    std::unordered_set<std::string> result = {word};
+    std::vector<std::string> frontier = {word};
+    for (int distance = 1; distance <= max_distance; ++distance) {
+        std::vector<std::string> next;
+        for (const auto& item : frontier) {
+            for (size_t i = 0; i < item.size(); ++i) {
+                std::string deleted = item.substr(0, i) + item.substr(i + 1);
+                if (result.insert(deleted).second) {
+                    next.push_back(std::move(deleted));
+                }
+            }
+        }
+        frontier = std::move(next);
+    }
+    return result;
+}
+
+// Short words tolerate less: "cat" -> "car" is a different word, not a typo
+static int allowedDistance(const std::string& word, int max_edit_distance) {
+    return std::min(max_edit_distance, word.size() <= 4 ? 1 : max_edit_distance);
+}
+
+SpellingIndex::SpellingIndex(int max_edit_distance, size_t prefix_length)
+    : max_edit_distance_(max_edit_distance), prefix_length_(prefix_length) {}
+
+std::vector<std::string> SpellingIndex::tokenize(const std::string& text) {
+    std::vector<std::string> tokens;
+    std::string token;
+    for (char c : text) {
+        if (std::isalnum(static_cast<unsigned char>(c))) {
+            token += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        } else if (!token.empty()) {
+            tokens.push_back(std::move(token));
+            token.clear();
+        }
+    }
+    if (!token.empty()) {
+        tokens.push_back(std::move(token));
+    }
+    return tokens;
+}
+
+int SpellingIndex::editDistance(const std::string& a, const std::string& b, int max_distance) {
+    int n = static_cast<int>(a.size());
+    int m = static_cast<int>(b.size());
+    if (std::abs(n - m) > max_distance) {
+        return max_distance + 1;
+    }
+
+    // Three rolling rows: transpositions look two rows back
+    std::vector<int> before(m + 1), previous(m + 1), current(m + 1);
+    for (int j = 0; j <= m; ++j) previous[j] = j;
+    for (int i = 1; i <= n; ++i) {
+        current[0] = i;
+        int row_min = current[0];
+        for (int j = 1; j <= m; ++j) {
+            int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+            current[j] = std::min({previous[j] + 1, current[j - 1] + 1, previous[j - 1] + cost});
+            if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1]) {
+                current[j] = std::min(current[j], before[j - 2] + 1);
+            }
+            row_min = std::min(row_min, current[j]);
+        }
+        if (row_min > max_distance) {
+            return max_distance + 1;
+        }
+        std::swap(before, previous);
+        std::swap(previous, current);
+    }
+    return std::min(previous[m], max_distance + 1);
+}
+
+void SpellingIndex::Tables::add(const std::string& word, uint64_t frequency, int max_edit_distance,
+                                size_t prefix_length) {
+    auto it = by_word.find(word);
+    if (it != by_word.end()) {
+        frequencies[it->second] += frequency;
+        return;
+    }
+    uint32_t id = static_cast<uint32_t>(words.size());
+    words.push_back(word);
+    frequencies.push_back(frequency);
+    by_word.emplace(word, id);
+
+    // Only the prefix is expanded: long words would otherwise produce
+    // hundreds of deletes, and typos past the prefix are still caught by
+    // the full-word distance check
+    for (const auto& deleted : deletesOf(word.substr(0, prefix_length), max_edit_distance)) {
+        deletes[stableHash(deleted)].push_back(id);
+    }
+}
+
+void SpellingIndex::addWord(const std::string& word, uint64_t frequency) {
+    if (word.empty()) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    tables_.add(word, frequency, max_edit_distance_, prefix_length_);
+}
+
+void SpellingIndex::applyQueryLog(Tables& tables) const {
+    for (const auto& [term, count] : query_log_) {
+        if (tables.by_word.count(term) || count >= query_log_min_count_) {
+            tables.add(term, count, max_edit_distance_, prefix_length_);
+        }
+    }
+}
+
+size_t SpellingIndex::loadQueryLog(const std::string& path, uint64_t min_count) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return 0;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        uint64_t count = 1;
+        size_t tab = line.find('\t');
+        if (tab != std::string::npos) {
+            try {
+                count = std::stoull(line.substr(tab + 1));
+            } catch (const std::exception&) {
+                continue;  // malformed count
+            }
+            line.resize(tab);
+        }
+        for (const auto& term : tokenize(line)) {
+            query_log_[term] += count;
+        }
+    }
+    query_log_min_count_ = min_count;
+
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    size_t before = tables_.words.size();
+    applyQueryLog(tables_);
+    return tables_.words.size() - before;
+}
+
+bool SpellingIndex::contains(const std::string& word) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return tables_.by_word.count(word) > 0;
+}
+
+size_t SpellingIndex::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return tables_.words.size();
+}
+
+std::vector<SpellingSuggestion> SpellingIndex::lookup(const std::string& word, size_t max_results) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return lookupLocked(word, max_results);
+}
+
+std::vector<SpellingSuggestion> SpellingIndex::lookupLocked(const std::string& word,
+                                                            size_t max_results) const {
+    std::vector<SpellingSuggestion> suggestions;
+    if (word.empty()) {
+        return suggestions;
+    }
+    int allowed = allowedDistance(word, max_edit_distance_);
+
+    std::unordered_set<uint32_t> seen;
+    for (const auto& deleted : deletesOf(word.substr(0, prefix_length_), allowed)) {
+        auto bucket = tables_.deletes.find(stableHash(deleted));
+        if (bucket == tables_.deletes.end()) {
+            continue;
+        }
+        for (uint32_t id : bucket->second) {
+            if (!seen.insert(id).second) {
+                continue;
+            }
+            // Hash buckets may hold unrelated words; the distance check
+            // filters them out along with prefix-only matches
+            const std::string& candidate = tables_.words[id];
+            int distance = editDistance(word, candidate, allowed);
+            if (distance <= allowed) {
+                suggestions.push_back({candidate, distance, tables_.frequencies[id]});
+            }
+        }
+    }
+
+    std::sort(suggestions.begin(), suggestions.end(),
+        [](const SpellingSuggestion& a, const SpellingSuggestion& b) {
+            if (a.distance != b.distance) return a.distance < b.distance;
+            if (a.frequency != b.frequency) return a.frequency > b.frequency;
+            return a.term < b.term;
+        });
+    if (suggestions.size() > max_results) {
+        suggestions.resize(max_results);
+    }
+    return suggestions;
+}
+
+std::optional<std::string> SpellingIndex::correct(const std::string& query) const {
+    std::istringstream stream(normalizeQuery(query));
+    std::string corrected;
+    bool changed = false;
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    for (std::string term; stream >> term;) {
+        bool alphabetic = std::all_of(term.begin(), term.end(),
+                                      [](unsigned char c) { return std::isalpha(c); });
+        if (alphabetic && term.size() >= 3 && tables_.by_word.count(term) == 0) {
+            auto suggestions = lookupLocked(term, 1);
+            if (!suggestions.empty()) {
+                term = suggestions.front().term;
+                changed = true;
+            }
+        }
+        if (!corrected.empty()) {
+            corrected += ' ';
+        }
+        corrected += term;
+    }
+    if (!changed) {
+        return std::nullopt;
+    }
+    return corrected;
+}
+
+// Text values of a source field that may be a string or an array of them
+static void collectText(const nlohmann::json& source, const char* field, std::vector<std::string>& out) {
+    if (!source.contains(field)) {
+        return;
+    }
+    const auto& node = source[field];
+    if (node.is_string()) {
+        out.push_back(node.get<std::string>());
+    } else if (node.is_array()) {
+        for (const auto& item : node) {
+            if (item.is_string()) out.push_back(item.get<std::string>());
+        }
+    }
+}
+
+size_t SpellingIndex::refresh(ElasticsearchClient& es, bool full) {
+    std::vector<std::string> fields = {"title", "category", "brand"};
+    for (const auto& field : IndexSyncWatermark::fields()) fields.push_back(field);
+
+    // A full scan starts over, so deleted products drop out
+    IndexSyncWatermark watermark = full ? IndexSyncWatermark() : watermark_;
+    nlohmann::json query = watermark.query();
+    auto wordsOf = [&watermark](const nlohmann::json& hit) {
+        std::vector<std::string> words;
+        if (!hit.contains("_source")) {
+            return words;
+        }
+        const auto& source = hit["_source"];
+        watermark.observe(source);
+        std::vector<std::string> texts;
+        for (const char* field : {"title", "category", "brand"}) {
+            collectText(source, field, texts);
+        }
+        for (const auto& text : texts) {
+            for (auto& word : tokenize(text)) {
+                words.push_back(std::move(word));
+            }
+        }
+        return words;
+    };
+
+    size_t scanned;
+    if (full) {
+        Tables fresh;
+        scanned = es.scan(query, fields, [&](const nlohmann::json& hit) {
+            for (const auto& word : wordsOf(hit)) {
+                fresh.add(word, 1, max_edit_distance_, prefix_length_);
+            }
+        });
+        applyQueryLog(fresh);
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        tables_ = std::move(fresh);
+    } else {
+        scanned = es.scan(query, fields, [&](const nlohmann::json& hit) {
+            auto words = wordsOf(hit);
+            std::unique_lock<std::shared_mutex> lock(mutex_);
+            for (const auto& word : words) {
+                if (tables_.by_word.count(word) == 0) {
+                    tables_.add(word, 1, max_edit_distance_, prefix_length_);
+                }
+            }
+        });
+    }
+
+    watermark_ = watermark;
+    return scanned;
+}
+
+} // namespace atlas
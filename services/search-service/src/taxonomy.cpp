@@ -0,0 +1,158 @@
+#include "taxonomy.h"
+#include "search_service.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+namespace atlas {
+
+std::shared_ptr<const Taxonomy> Taxonomy::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot read taxonomy: " + path);
+    }
+    nlohmann::json taxonomy;
+    try {
+        taxonomy = nlohmann::json::parse(file);
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument("Malformed taxonomy " + path + ": " + e.what());
+    }
+    return fromJson(taxonomy);
+}
+
+std::shared_ptr<const Taxonomy> Taxonomy::fromJson(const nlohmann::json& taxonomy) {
+    auto result = std::make_shared<Taxonomy>();
+    result->fingerprint_ = stableHash(taxonomy.dump());
+    result->ids_.push_back("");  // implicit root
+
+    try {
+        const auto& categories = taxonomy.at("categories");
+        for (const auto& category : categories) {
+            std::string id = category.at("id").get<std::string>();
+            int node = static_cast<int>(result->ids_.size());
+            if (id.empty() || !result->nodes_.emplace(id, node).second) {
+                throw std::invalid_argument("Empty or duplicate taxonomy category: '" + id + "'");
+            }
+            result->ids_.push_back(id);
+        }
+
+        std::vector<int> parents(result->ids_.size(), -1);
+        for (const auto& category : categories) {
+            int node = result->nodes_.at(category.at("id").get<std::string>());
+            std::string parent = category.contains("parent") && category["parent"].is_string()
+                ? category["parent"].get<std::string>() : std::string();
+            if (parent.empty()) {
+                parents[node] = 0;
+            } else if (int parent_node = result->node(parent); parent_node >= 0) {
+                parents[node] = parent_node;
+            } else {
+                throw std::invalid_argument("Unknown parent '" + parent + "' of taxonomy category '" +
+                                            result->ids_[node] + "'");
+            }
+        }
+        result->build(parents);
+
+        if (taxonomy.contains("queries")) {
+            for (const auto& [query, category] : taxonomy["queries"].items()) {
+                int node = result->node(category.get<std::string>());
+                if (node < 0) {
+                    throw std::invalid_argument("Query '" + query + "' predicts unknown category '" +
+                                                category.get<std::string>() + "'");
+                }
+                result->query_categories_[normalizeQuery(query)] = node;
+            }
+        }
+    } catch (const nlohmann::json::exception& e) {
+        throw std::invalid_argument(std::string("Malformed taxonomy: ") + e.what());
+    }
+    return result;
+}
+
+void Taxonomy::build(const std::vector<int>& parents) {
+    size_t count = ids_.size();
+    std::vector<std::vector<int>> children(count);
+    for (size_t node = 1; node < count; ++node) {
+        children[parents[node]].push_back(static_cast<int>(node));
+    }
+
+    // Iterative DFS (a deep taxonomy must not blow the stack), recording the
+    // Euler tour: a node on entry and again after each child returns
+    depths_.assign(count, 0);
+    first_visit_.assign(count, -1);
+    euler_.clear();
+    euler_.reserve(2 * count - 1);
+
+    std::vector<std::pair<int, size_t>> stack = {{0, 0}};
+    first_visit_[0] = 0;
+    euler_.push_back(0);
+    while (!stack.empty()) {
+        auto& [node, next_child] = stack.back();
+        if (next_child < children[node].size()) {
+            int child = children[node][next_child++];
+            depths_[child] = depths_[node] + 1;
+            first_visit_[child] = static_cast<int>(euler_.size());
+            euler_.push_back(child);
+            stack.push_back({child, 0});
+        } else {
+            stack.pop_back();
+            if (!stack.empty()) {
+                euler_.push_back(stack.back().first);
+            }
+        }
+    }
+
+    // Every node hangs off the root unless parents form a cycle
+    for (size_t node = 1; node < count; ++node) {
+        if (first_visit_[node] < 0) {
+            throw std::invalid_argument("Taxonomy cycle through category '" + ids_[node] + "'");
+        }
+    }
+
+    // Sparse table: level k holds the shallowest node of each window of 2^k
+    size_t length = euler_.size();
+    log2_.assign(length + 1, 0);
+    for (size_t i = 2; i <= length; ++i) {
+        log2_[i] = static_cast<uint8_t>(log2_[i / 2] + 1);
+    }
+    sparse_.assign(log2_[length] + 1, {});
+    sparse_[0] = euler_;
+    for (size_t k = 1; k < sparse_.size(); ++k) {
+        size_t half = size_t(1) << (k - 1);
+        size_t windows = length - (size_t(1) << k) + 1;
+        sparse_[k].resize(windows);
+        for (size_t i = 0; i < windows; ++i) {
+            sparse_[k][i] = shallower(sparse_[k - 1][i], sparse_[k - 1][i + half]);
+        }
+    }
+}
+
+int Taxonomy::node(const std::string& category) const {
+    auto it = nodes_.find(category);
+    return it == nodes_.end() ? -1 : it->second;
+}
+
+int Taxonomy::lca(int a, int b) const {
+    int left = first_visit_[a];
+    int right = first_visit_[b];
+    if (left > right) {
+        std::swap(left, right);
+    }
+    // Two windows of 2^k that together cover [left, right]
+    int k = log2_[right - left + 1];
+    return shallower(sparse_[k][left], sparse_[k][right - (1 << k) + 1]);
+}
+
+double Taxonomy::proximity(int a, int b) const {
+    int deepest = std::max(depths_[a], depths_[b]);
+    if (deepest == 0) {
+        return 0.0;
+    }
+    return static_cast<double>(depths_[lca(a, b)]) / deepest;
+}
+
+int Taxonomy::predictedCategory(const std::string& normalized_query) const {
+    auto it = query_categories_.find(normalized_query);
+    return it == query_categories_.end() ? -1 : it->second;
+}
+
+} // namespace atlas
@@ -0,0 +1,184 @@
+#include "title_index.h"
+#include <cctype>
+#include <functional>
+#include <mutex>
+
+namespace atlas {
+
+std::string TitleIndex::normalizeTitle(const std::string& title) {
+    std::string normalized;
+    normalized.reserve(title.size());
+    bool pending_space = false;
+    for (unsigned char c : title) {
+        if (!std::isalnum(c)) {
+            pending_space = !normalized.empty();
+            continue;
+        }
+        if (pending_space) {
+            normalized.push_back(' ');
+            pending_space = false;
+        }
+        normalized.push_back(static_cast<char>(std::tolower(c)));
+    }
+    return normalized;
+}
+
+uint64_t TitleIndex::titleKey(const std::string& normalized_title) {
+    // In-process only, so std::hash is fine
+    return std::hash<std::string>{}(normalized_title);
+}
+
+void TitleIndex::Tables::remove(const std::string& id) {
+    auto it = by_id.find(id);
+    if (it == by_id.end()) {
+        return;
+    }
+    uint32_t ordinal = it->second;
+    by_id.erase(it);
+
+    TitleEntry& entry = entries[ordinal];
+    auto bucket = by_title.find(titleKey(normalizeTitle(entry.title)));
+    if (bucket != by_title.end()) {
+        auto& ordinals = bucket->second;
+        for (size_t i = 0; i < ordinals.size(); ++i) {
+            if (ordinals[i] == ordinal) {
+                ordinals[i] = ordinals.back();
+                ordinals.pop_back();
+                break;
+            }
+        }
+        if (ordinals.empty()) {
+            by_title.erase(bucket);
+        }
+    }
+
+    entry = TitleEntry();
+    free_slots.push_back(ordinal);
+}
+
+void TitleIndex::Tables::upsert(const TitleEntry& entry) {
+    auto it = by_id.find(entry.id);
+    if (it != by_id.end()) {
+        TitleEntry& existing = entries[it->second];
+        if (normalizeTitle(existing.title) == normalizeTitle(entry.title)) {
+            // Same bucket; just refresh the stored fields
+            existing = entry;
+            return;
+        }
+        remove(entry.id);
+    }
+
+    uint32_t ordinal;
+    if (!free_slots.empty()) {
+        ordinal = free_slots.back();
+        free_slots.pop_back();
+        entries[ordinal] = entry;
+    } else {
+        ordinal = static_cast<uint32_t>(entries.size());
+        entries.push_back(entry);
+    }
+    by_id[entry.id] = ordinal;
+    by_title[titleKey(normalizeTitle(entry.title))].push_back(ordinal);
+}
+
+std::vector<TitleEntry> TitleIndex::lookup(const std::string& query, size_t limit) const {
+    std::vector<TitleEntry> matches;
+    std::string normalized = normalizeTitle(query);
+    if (normalized.empty()) {
+        return matches;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto bucket = tables_.by_title.find(titleKey(normalized));
+    if (bucket == tables_.by_title.end()) {
+        return matches;
+    }
+
+    for (uint32_t ordinal : bucket->second) {
+        const TitleEntry& entry = tables_.entries[ordinal];
+        if (normalizeTitle(entry.title) != normalized) {
+            continue;  // hash collision
+        }
+        if (matches.size() == limit) {
+            return {};
+        }
+        matches.push_back(entry);
+    }
+    return matches;
+}
+
+void TitleIndex::upsert(const TitleEntry& entry) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    tables_.upsert(entry);
+}
+
+void TitleIndex::remove(const std::string& id) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    tables_.remove(id);
+}
+
+size_t TitleIndex::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return tables_.by_id.size();
+}
+
+TitleEntry TitleIndex::entryFromHit(const nlohmann::json& hit) {
+    TitleEntry entry;
+    entry.id = hit.value("_id", "");
+    const auto& source = hit["_source"];
+    entry.title = source.value("title", "");
+    entry.updated_at = source.value("updated_at", "");
+    entry.version = source.value("version", static_cast<int64_t>(0));
+    entry.category = firstCategory(source);
+    entry.description = descriptionPrefix(source.value("description", ""));
+    return entry;
+}
+
+std::string TitleIndex::descriptionPrefix(const std::string& description) {
+    if (description.size() <= kDescriptionBytes) {
+        return description;
+    }
+    size_t end = kDescriptionBytes;
+    // Back off continuation bytes (10xxxxxx) so no character is split
+    while (end > 0 && (static_cast<unsigned char>(description[end]) & 0xC0) == 0x80) {
+        end--;
+    }
+    return description.substr(0, end);
+}
+
+size_t TitleIndex::refresh(ElasticsearchClient& es, bool full) {
+    std::vector<std::string> fields = {"title", "version", "category", "description"};
+    for (const auto& field : IndexSyncWatermark::fields()) fields.push_back(field);
+
+    // A full scan starts over, so deleted products drop out
+    IndexSyncWatermark watermark = full ? IndexSyncWatermark() : watermark_;
+    nlohmann::json query = watermark.query();
+
+    size_t scanned;
+    if (full) {
+        // Build off to the side so lookups keep working during the scan
+        Tables fresh;
+        scanned = es.scan(query, fields, [&](const nlohmann::json& hit) {
+            TitleEntry entry = entryFromHit(hit);
+            watermark.observe(hit["_source"]);
+            if (!entry.id.empty() && !entry.title.empty()) {
+                fresh.upsert(entry);
+            }
+        });
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        tables_ = std::move(fresh);
+    } else {
+        scanned = es.scan(query, fields, [&](const nlohmann::json& hit) {
+            TitleEntry entry = entryFromHit(hit);
+            watermark.observe(hit["_source"]);
+            if (!entry.id.empty() && !entry.title.empty()) {
+                upsert(entry);
+            }
+        });
+    }
+
+    watermark_ = watermark;
+    return scanned;
+}
+
+} // namespace atlas
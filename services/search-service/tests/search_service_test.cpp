@@ -1,5 +1,30 @@
 #include <gtest/gtest.h>
 #include "search_service.h"
+#include "response_writer.h"
+#include "result_cache.h"
+#include "federation.h"
+#include "incremental_search.h"
+#include "title_index.h"
+#include "snippets.h"
+#include "facet_index.h"
+#include "ltr_model.h"
+#include "embeddings.h"
+#include "spelling.h"
+#include "taxonomy.h"
+#include "rcu.h"
+#include "ranking_config.h"
+#include "query_stats.h"
+#include "dedup.h"
+#include <httplib.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <zlib.h>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <cmath>
+#include <set>
 
 using namespace atlas;
 
@@ -79,6 +104,1557 @@ TEST_F(SearchServiceTest, SearchResultsSortedByScore) {
     }
 }
 
+TEST_F(SearchServiceTest, LoadWarmupQueriesSkipsBlanksAndComments) {
+    std::string path = "./test-warmup-queries.txt";
+    {
+        std::ofstream file(path);
+        file << "# head queries\n"
+             << "laptop\n"
+             << "\n"
+             << "  gaming mouse  \r\n"
+             << "   # indented comment\n";
+    }
+
+    auto queries = SearchService::loadWarmupQueries(path);
+    std::remove(path.c_str());
+
+    ASSERT_EQ(queries.size(), 2u);
+    EXPECT_EQ(queries[0], "laptop");
+    EXPECT_EQ(queries[1], "gaming mouse");
+}
+
+TEST_F(SearchServiceTest, ReadyOnlyAfterWarmUp) {
+    SearchService service("localhost", 9200);
+    EXPECT_FALSE(service.isReady());
+
+    // Missing file and unreachable ES must not block readiness
+    int replayed = service.warmUp("./does-not-exist.txt", 1);
+    EXPECT_EQ(replayed, 0);
+    EXPECT_TRUE(service.isReady());
+}
+
+TEST_F(SearchServiceTest, WarmUpFillsTheResultCache) {
+    std::atomic<int> searches(0);
+    httplib::Server es;
+    es.Post("/products/_search", [&searches](const httplib::Request&, httplib::Response& res) {
+        searches++;
+        nlohmann::json hits = {{{"_id", "P1"}, {"_score", 2.0},
+                                {"_source", {{"title", "Laptop"}, {"updated_at", "2025-12-01T00:00:00Z"}}}}};
+        nlohmann::json body = {{"took", 1}, {"timed_out", false},
+                               {"hits", {{"total", {{"value", 1}}}, {"max_score", 2.0}, {"hits", hits}}}};
+        res.set_content(body.dump(), "application/json");
+    });
+    int port = es.bind_to_any_port("127.0.0.1");
+    ASSERT_GT(port, 0);
+    std::thread listener([&es]() { es.listen_after_bind(); });
+    while (!es.is_running()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::string path = "./test-warmup-cache.txt";
+    {
+        std::ofstream file(path);
+        file << "laptop\n";
+    }
+    auto stats = std::make_shared<QueryStats>(QueryStatsConfig(), []() { return 0.0; });
+    SearchService service("127.0.0.1", port);
+    service.enableResultCache(16, 60000);
+    service.enableQueryStats(stats, 1.5);
+    service.warmUp(path, 1);
+    std::remove(path.c_str());
+    auto served = service.search("laptop");
+    es.stop();
+    listener.join();
+
+    // The replay was neither counted nor turned away by admission
+    EXPECT_TRUE(served.cache_hit);
+    EXPECT_EQ(searches.load(), 1);
+    EXPECT_DOUBLE_EQ(stats->recentCount("laptop"), 1.0);
+}
+
+TEST_F(SearchServiceTest, NormalizeQuery) {
+    EXPECT_EQ(normalizeQuery("  Gaming   LAPTOP\t"), "gaming laptop");
+    EXPECT_EQ(normalizeQuery(""), "");
+}
+
+TEST_F(SearchServiceTest, PreferenceKeyStableForEquivalentQueries) {
+    auto key = ElasticsearchClient::preferenceKey("Gaming Laptop");
+    EXPECT_EQ(key, ElasticsearchClient::preferenceKey("  gaming   laptop "));
+    EXPECT_NE(key, ElasticsearchClient::preferenceKey("gaming mouse"));
+    // Custom preference strings must not start with '_'
+    EXPECT_NE(key[0], '_');
+}
+
+TEST_F(SearchServiceTest, RequestCacheSkippedForNowRelativeQueries) {
+    nlohmann::json plain = {{"query", {{"match", {{"title", "laptop"}}}}}};
+    nlohmann::json relative = {{"query", {{"range", {{"updated_at", {{"gte", "now-7d"}}}}}}}};
+    nlohmann::json text = ElasticsearchClient::buildSearchBody("now playing", 10, 5000, {});
+    EXPECT_TRUE(ElasticsearchClient::isCacheable(plain));
+    EXPECT_FALSE(ElasticsearchClient::isCacheable(relative));
+    EXPECT_TRUE(ElasticsearchClient::isCacheable(text));
+}
+
+TEST_F(SearchServiceTest, UnfilteredSearchBodyIsPlainMultiMatch) {
+    auto body = ElasticsearchClient::buildSearchBody("laptop", 10, 5000, SearchFilters());
+    EXPECT_TRUE(body["query"].contains("multi_match"));
+    EXPECT_EQ(body["size"], 10);
+}
+
+TEST_F(SearchServiceTest, FiltersCompiledIntoFilterContext) {
+    SearchFilters filters;
+    filters.categories = {"Electronics", "Computers"};
+    filters.min_price = 100.0;
+    filters.in_stock = true;
+
+    auto body = ElasticsearchClient::buildSearchBody("laptop", 10, 5000, filters);
+    const auto& bool_query = body["query"]["bool"];
+
+    // Text stays in scoring context, filters go to non-scoring filter context
+    EXPECT_TRUE(bool_query["must"].contains("multi_match"));
+    ASSERT_EQ(bool_query["filter"].size(), 3u);
+    EXPECT_EQ(bool_query["filter"][0]["terms"]["category.keyword"].size(), 2u);
+    EXPECT_EQ(bool_query["filter"][1]["range"]["price"]["gte"], 100.0);
+    EXPECT_FALSE(bool_query["filter"][1]["range"]["price"].contains("lte"));
+    EXPECT_EQ(bool_query["filter"][2]["term"]["in_stock"], true);
+}
+
+TEST_F(SearchServiceTest, ParseQueryStats) {
+    auto es_response = nlohmann::json::parse(R"({
+        "took": 7, "timed_out": false,
+        "_shards": {"total": 5, "successful": 4, "skipped": 0, "failed": 1}
+    })");
+    auto stats = ElasticsearchClient::parseQueryStats(es_response);
+    EXPECT_EQ(stats.took_ms, 7);
+    EXPECT_EQ(stats.shards_total, 5);
+    EXPECT_EQ(stats.shards_successful, 4);
+    EXPECT_EQ(stats.shards_failed, 1);
+}
+
+static SearchResponse makeSampleResponse() {
+    SearchResponse response;
+    response.total = 42;
+    response.latency_ms = 12;
+    response.es_stats.took_ms = 4;
+    response.es_stats.shards_total = 1;
+    response.es_stats.shards_successful = 1;
+
+    SearchResult result;
+    result.id = "P123";
+    result.title = "Gaming \"Laptop\" Pro";
+    result.description = "Line one\nline two";
+    result.score = 5.25;
+    result.es_score = 7.2;
+    result.recency_score = 0.95;
+    result.title_match_score = 1.0;
+    result.updated_at = "2025-12-10T10:00:00Z";
+    response.results.push_back(result);
+    return response;
+}
+
+TEST_F(SearchServiceTest, CompactJsonEncodingWithoutBreakdown) {
+    auto body = encodeSearchResponse(makeSampleResponse(), "laptop", 5, false, ResponseFormat::Json);
+
+    // Compact: no pretty-printing whitespace
+    EXPECT_EQ(body.find('\n'), std::string::npos);
+    EXPECT_EQ(body.find(": "), std::string::npos);
+
+    auto parsed = nlohmann::json::parse(body);
+    EXPECT_EQ(parsed["total"], 42);
+    EXPECT_EQ(parsed["query"], "laptop");
+    EXPECT_EQ(parsed["results"][0]["title"], "Gaming \"Laptop\" Pro");
+    EXPECT_EQ(parsed["results"][0]["description"], "Line one\nline two");
+    EXPECT_DOUBLE_EQ(parsed["results"][0]["score"].get<double>(), 5.25);
+    EXPECT_FALSE(parsed["results"][0].contains("es_score"));
+    EXPECT_EQ(parsed["es"]["shards"]["successful"], 1);
+}
+
+TEST_F(SearchServiceTest, BinaryEncodingsMatchJson) {
+    auto response = makeSampleResponse();
+    auto expected = nlohmann::json::parse(
+        encodeSearchResponse(response, "laptop", 5, true, ResponseFormat::Json));
+
+    auto cbor = encodeSearchResponse(response, "laptop", 5, true, ResponseFormat::Cbor);
+    auto msgpack = encodeSearchResponse(response, "laptop", 5, true, ResponseFormat::MessagePack);
+
+    EXPECT_EQ(nlohmann::json::from_cbor(cbor), expected);
+    EXPECT_EQ(nlohmann::json::from_msgpack(msgpack), expected);
+    EXPECT_DOUBLE_EQ(expected["results"][0]["es_score"].get<double>(), 7.2);
+}
+
+TEST_F(SearchServiceTest, ContentNegotiation) {
+    EXPECT_EQ(negotiateFormat(""), ResponseFormat::Json);
+    EXPECT_EQ(negotiateFormat("text/html, */*;q=0.8"), ResponseFormat::Json);
+    EXPECT_EQ(negotiateFormat("application/cbor"), ResponseFormat::Cbor);
+    EXPECT_EQ(negotiateFormat("application/json;q=0.5, application/msgpack"),
+              ResponseFormat::MessagePack);
+
+    EXPECT_EQ(negotiateEncoding(""), ContentEncoding::Identity);
+    EXPECT_EQ(negotiateEncoding("gzip, deflate, br"), ContentEncoding::Gzip);
+    EXPECT_EQ(negotiateEncoding("gzip;q=0, deflate"), ContentEncoding::Deflate);
+}
+
+TEST_F(SearchServiceTest, GzipRoundTrip) {
+    std::string body(4096, 'a');
+    auto compressed = compressBody(body, ContentEncoding::Gzip);
+    ASSERT_LT(compressed.size(), body.size());
+    // gzip magic bytes
+    EXPECT_EQ(static_cast<unsigned char>(compressed[0]), 0x1f);
+    EXPECT_EQ(static_cast<unsigned char>(compressed[1]), 0x8b);
+
+    std::string restored(body.size(), '\0');
+    uLongf restored_size = restored.size();
+    z_stream stream = {};
+    inflateInit2(&stream, 15 + 32);  // auto-detect gzip/zlib
+    stream.next_in = reinterpret_cast<Bytef*>(&compressed[0]);
+    stream.avail_in = compressed.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&restored[0]);
+    stream.avail_out = restored_size;
+    EXPECT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    inflateEnd(&stream);
+    EXPECT_EQ(restored, body);
+}
+
+TEST_F(SearchServiceTest, ServedGzipBodyDecodesOnce) {
+    // Serve a compressed page the way main.cpp does, over a real connection
+    std::string body = nlohmann::json({{"results", std::vector<std::string>(200, "Wireless Headphones")}}).dump();
+    httplib::Server server;
+    server.Get("/search", [&body](const httplib::Request&, httplib::Response& res) {
+        res.set_header("Content-Encoding", contentEncodingName(ContentEncoding::Gzip));
+        res.set_content(compressBody(body, ContentEncoding::Gzip), "application/json");
+    });
+    int port = server.bind_to_any_port("127.0.0.1");
+    ASSERT_GT(port, 0);
+    std::thread listener([&server]() { server.listen_after_bind(); });
+    while (!server.is_running()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    httplib::Client client("127.0.0.1", port);
+    client.set_decompress(false);
+    auto res = client.Get("/search", {{"Accept-Encoding", "gzip"}});
+    server.stop();
+    listener.join();
+    ASSERT_TRUE(res);
+    EXPECT_EQ(res->get_header_value("Content-Encoding"), "gzip");
+
+    // One inflate must yield the JSON itself, not another gzip stream
+    std::string compressed = res->body;
+    std::string restored(body.size() + 1, '\0');
+    z_stream stream = {};
+    inflateInit2(&stream, 15 + 16);
+    stream.next_in = reinterpret_cast<Bytef*>(&compressed[0]);
+    stream.avail_in = compressed.size();
+    stream.next_out = reinterpret_cast<Bytef*>(&restored[0]);
+    stream.avail_out = restored.size();
+    EXPECT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    restored.resize(stream.total_out);
+    inflateEnd(&stream);
+    EXPECT_EQ(restored, body);
+}
+
+TEST_F(SearchServiceTest, ResultsHashTracksIdsAndVersions) {
+    auto response = makeSampleResponse();
+    uint64_t base = SearchService::computeResultsHash(response, 1);
+    EXPECT_EQ(base, SearchService::computeResultsHash(response, 1));
+
+    // Timing fields are not part of the page identity
+    response.latency_ms = 99;
+    EXPECT_EQ(base, SearchService::computeResultsHash(response, 1));
+
+    response.results[0].version = 2;
+    EXPECT_NE(base, SearchService::computeResultsHash(response, 1));
+    EXPECT_NE(SearchService::computeResultsHash(makeSampleResponse(), 1),
+              SearchService::computeResultsHash(makeSampleResponse(), 2));
+}
+
+TEST_F(SearchServiceTest, ETagPerRepresentationAndIfNoneMatch) {
+    auto json_tag = makeETag(0xabc, ResponseFormat::Json, false, ContentEncoding::Gzip);
+    auto cbor_tag = makeETag(0xabc, ResponseFormat::Cbor, false, ContentEncoding::Gzip);
+    EXPECT_NE(json_tag, cbor_tag);
+    EXPECT_EQ(json_tag.front(), '"');
+    EXPECT_EQ(json_tag.back(), '"');
+
+    EXPECT_TRUE(etagMatches(json_tag, json_tag));
+    EXPECT_TRUE(etagMatches("\"other\", W/" + json_tag, json_tag));
+    EXPECT_TRUE(etagMatches("*", json_tag));
+    EXPECT_FALSE(etagMatches(cbor_tag, json_tag));
+    EXPECT_FALSE(etagMatches("", json_tag));
+}
+
+TEST_F(SearchServiceTest, ResultCacheEvictsLeastRecentlyUsed) {
+    ResultCache cache(2, 60000);
+    SearchResponse response = makeSampleResponse();
+
+    cache.put("a", response);
+    cache.put("b", response);
+    ASSERT_TRUE(cache.get("a").has_value());  // touch "a"
+    cache.put("c", response);                 // evicts "b"
+
+    EXPECT_TRUE(cache.get("a").has_value());
+    EXPECT_FALSE(cache.get("b").has_value());
+    EXPECT_TRUE(cache.get("c").has_value());
+    EXPECT_EQ(cache.size(), 2u);
+}
+
+TEST_F(SearchServiceTest, ResultCacheExpiresEntries) {
+    ResultCache cache(10, 1);
+    cache.put("a", makeSampleResponse());
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_FALSE(cache.get("a").has_value());
+}
+
+TEST_F(SearchServiceTest, BrownoutStepsDownAndRecovers) {
+    BrownoutConfig config;
+    config.queue_delay_ms = 10.0;
+    config.es_rtt_ms = 100.0;
+    config.dwell_ms = 1000;
+    config.ewma_alpha = 1.0;  // no smoothing, easier to reason about
+    config.idle_half_life_ms = 0;  // signals hold between samples
+    BrownoutController controller(config);
+
+    auto t = std::chrono::steady_clock::now();
+    EXPECT_EQ(controller.currentPlan(t).level, 0);
+
+    // Overloaded: one step per dwell period, never skipping levels
+    controller.recordEsRtt(500.0);
+    EXPECT_EQ(controller.currentPlan(t + std::chrono::milliseconds(1000)).level, 1);
+    EXPECT_EQ(controller.currentPlan(t + std::chrono::milliseconds(1500)).level, 1);
+    EXPECT_EQ(controller.currentPlan(t + std::chrono::milliseconds(2000)).level, 2);
+    for (int i = 3; i <= 6; ++i) {
+        controller.currentPlan(t + std::chrono::milliseconds(1000 * i));
+    }
+    EXPECT_EQ(controller.level(), BrownoutController::kMaxLevel);
+
+    // In the hysteresis band: hold
+    controller.recordEsRtt(80.0);
+    EXPECT_EQ(controller.currentPlan(t + std::chrono::milliseconds(8000)).level, 4);
+
+    // Load recedes: step back up
+    controller.recordEsRtt(10.0);
+    EXPECT_EQ(controller.currentPlan(t + std::chrono::milliseconds(9000)).level, 3);
+    EXPECT_EQ(controller.currentPlan(t + std::chrono::milliseconds(10000)).level, 2);
+}
+
+TEST_F(SearchServiceTest, BrownoutSignalsDecayWithoutSamples) {
+    BrownoutConfig config;
+    config.queue_delay_ms = 10.0;
+    config.es_rtt_ms = 100.0;
+    config.dwell_ms = 1000;
+    config.ewma_alpha = 1.0;
+    config.idle_half_life_ms = 1000;
+    BrownoutController controller(config);
+
+    // One slow connection, then only keep-alive traffic: no more samples
+    auto t = std::chrono::steady_clock::now() + std::chrono::milliseconds(10);
+    controller.recordQueueDelay(40.0, t);
+    EXPECT_EQ(controller.currentPlan(t + std::chrono::milliseconds(1000)).level, 1);
+    EXPECT_DOUBLE_EQ(controller.queueDelayMs(t + std::chrono::milliseconds(2000)), 10.0);
+    EXPECT_EQ(controller.currentPlan(t + std::chrono::milliseconds(3000)).level, 0);
+
+    // A fresh sample blends with the decayed value, not the stale one
+    controller.recordEsRtt(400.0, t);
+    controller.recordEsRtt(0.0, t + std::chrono::milliseconds(1000));
+    EXPECT_DOUBLE_EQ(controller.esRttMs(t + std::chrono::milliseconds(1000)), 0.0);
+}
+
+TEST_F(SearchServiceTest, CacheOnlyHeadShedsTailMisses) {
+    // Nothing listens on port 1: a query that reaches ES fails fast
+    SearchService service("127.0.0.1", 1);
+    service.enableResultCache(16, 60000);
+    auto tail = service.searchWithPlan("laptop", 5, SearchFilters(), SearchPlan::forLevel(3));
+    EXPECT_TRUE(tail.shed);
+    EXPECT_EQ(tail.plan, "cache_only_head");
+    EXPECT_EQ(tail.results_hash, 0u);
+
+    auto stats = std::make_shared<QueryStats>();
+    service.enableQueryStats(stats, 1.5);
+    stats->record("laptop");
+    stats->record("laptop");
+    auto head = service.searchWithPlan("laptop", 5, SearchFilters(), SearchPlan::forLevel(3));
+    EXPECT_FALSE(head.shed);
+    EXPECT_FALSE(service.searchWithPlan("phone", 5, SearchFilters(), SearchPlan::forLevel(2)).shed);
+}
+
+TEST_F(SearchServiceTest, BrownoutPlansShedFeaturesCumulatively) {
+    EXPECT_EQ(SearchPlan::normal().rerank_window, 0);
+    EXPECT_TRUE(SearchPlan::normal().include_description);
+    EXPECT_GT(SearchPlan::forLevel(1).rerank_window, 0);
+    EXPECT_FALSE(SearchPlan::forLevel(2).include_description);
+    EXPECT_TRUE(SearchPlan::forLevel(3).cache_only_head);
+    EXPECT_FALSE(SearchPlan::forLevel(3).include_description);
+    EXPECT_GT(SearchPlan::forLevel(4).terminate_after, 0);
+    EXPECT_TRUE(SearchPlan::forLevel(4).cache_only_head);
+}
+
+TEST_F(SearchServiceTest, DegradedPlanQueryOptions) {
+    EsQueryOptions options;
+    options.include_description = false;
+    options.terminate_after = 1000;
+    auto body = ElasticsearchClient::buildSearchBody("laptop", 10, 5000, SearchFilters(), options);
+    EXPECT_EQ(body["_source"]["excludes"][0], "description");
+    EXPECT_EQ(body["terminate_after"], 1000);
+}
+
+TEST_F(SearchServiceTest, StaleCachedPagesOnlyWhenAllowed) {
+    ResultCache cache(10, 1);
+    cache.put("a", makeSampleResponse());
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    EXPECT_FALSE(cache.get("a").has_value());
+    EXPECT_TRUE(cache.get("a", true).has_value());
+}
+
+TEST_F(SearchServiceTest, PlanTaggedOnResponse) {
+    SearchService service("localhost", 9200);
+    auto response = service.searchWithPlan("laptop", 5, SearchFilters(), SearchPlan::forLevel(2));
+    EXPECT_EQ(response.plan, "no_description");
+}
+
+TEST_F(SearchServiceTest, ParseFederationBackends) {
+    auto backends = FederatedSearcher::parseBackends(
+        "eu=es-eu:9200/products_eu@150,us=es-us:9201/products_us", 200);
+    ASSERT_EQ(backends.size(), 2u);
+    EXPECT_EQ(backends[0].name, "eu");
+    EXPECT_EQ(backends[0].host, "es-eu");
+    EXPECT_EQ(backends[0].port, 9200);
+    EXPECT_EQ(backends[0].index, "products_eu");
+    EXPECT_EQ(backends[0].deadline_ms, 150);
+    EXPECT_EQ(backends[1].deadline_ms, 200);
+
+    EXPECT_THROW(FederatedSearcher::parseBackends("eu=es-eu/products", 200), std::invalid_argument);
+    EXPECT_THROW(FederatedSearcher::parseBackends("eu=es-eu:abc/products", 200), std::invalid_argument);
+}
+
+TEST_F(SearchServiceTest, MergeTopKAcrossBackends) {
+    auto hit = [](const std::string& id, double score) {
+        return nlohmann::json{{"_id", id}, {"_score", score}};
+    };
+    std::vector<std::vector<nlohmann::json>> lists = {
+        {hit("a1", 1.0), hit("a2", 0.5), hit("a3", 0.1)},
+        {},
+        {hit("c1", 0.9), hit("c2", 0.6)}
+    };
+
+    auto merged = FederatedSearcher::mergeTopK(lists, 4);
+    ASSERT_EQ(merged.size(), 4u);
+    EXPECT_EQ(merged[0]["_id"], "a1");
+    EXPECT_EQ(merged[1]["_id"], "c1");
+    EXPECT_EQ(merged[2]["_id"], "c2");
+    EXPECT_EQ(merged[3]["_id"], "a2");
+}
+
+TEST_F(SearchServiceTest, FederationAsksEsToStopBeforeTheDeadline) {
+    EXPECT_EQ(FederatedSearcher::esTimeoutMs(200), 160);
+    EXPECT_EQ(FederatedSearcher::esTimeoutMs(50), 30);   // at least 20ms margin
+    EXPECT_EQ(FederatedSearcher::esTimeoutMs(1000), 800);
+    EXPECT_EQ(FederatedSearcher::esTimeoutMs(10), 1);
+}
+
+TEST_F(SearchServiceTest, FederatedSearchReportsPartialOnBackendFailure) {
+    // Nothing listens on port 1: both backends fail fast
+    FederatedSearcher federation(FederatedSearcher::parseBackends(
+        "a=127.0.0.1:1/products@100,b=127.0.0.1:1/products@100", 100));
+
+    auto merged = federation.search("laptop", 10, SearchFilters(), EsQueryOptions());
+    EXPECT_TRUE(merged["federation"]["partial"].get<bool>());
+    EXPECT_EQ(merged["hits"]["hits"].size(), 0u);
+
+    auto statuses = FederatedSearcher::parseBackendStatuses(merged);
+    ASSERT_EQ(statuses.size(), 2u);
+    EXPECT_FALSE(statuses[0].ok);
+    EXPECT_FALSE(statuses[0].error.empty());
+}
+
+TEST_F(SearchServiceTest, IncrementalRefinementDetection) {
+    EXPECT_TRUE(IncrementalSessionStore::isRefinement("blu", "blue"));
+    EXPECT_TRUE(IncrementalSessionStore::isRefinement("blue", "blue s"));
+    EXPECT_TRUE(IncrementalSessionStore::isRefinement("blue", "blue"));
+    EXPECT_FALSE(IncrementalSessionStore::isRefinement("blue", "blu"));
+    EXPECT_FALSE(IncrementalSessionStore::isRefinement("blue", "red"));
+    EXPECT_FALSE(IncrementalSessionStore::isRefinement("", "blue"));
+}
+
+TEST_F(SearchServiceTest, IncrementalSessionLookupRules) {
+    IncrementalSessionStore store(10, 60000);
+    CandidateSet set;
+    set.normalized_query = "blu";
+    set.filters_key = "";
+    set.fetched_at = std::chrono::steady_clock::now();
+    store.store("s1", set);
+
+    EXPECT_TRUE(store.lookup("s1", "blue", "").has_value());
+    EXPECT_FALSE(store.lookup("s1", "red", "").has_value());        // not a refinement
+    EXPECT_FALSE(store.lookup("s1", "blue", "c=Shoes").has_value()); // filters changed
+    EXPECT_FALSE(store.lookup("s2", "blue", "").has_value());        // other session
+
+    set.fetched_at -= std::chrono::minutes(5);
+    store.store("s1", set);
+    EXPECT_FALSE(store.lookup("s1", "blue", "").has_value());        // stale
+}
+
+TEST_F(SearchServiceTest, IncrementalSearchAsksEsAfterAnEmptyPrefix) {
+    // Fake ES: a partial word matches nothing, the whole word matches
+    std::atomic<int> es_requests(0);
+    httplib::Server es;
+    es.Post("/products/_search", [&es_requests](const httplib::Request& req, httplib::Response& res) {
+        es_requests++;
+        nlohmann::json hits = nlohmann::json::array();
+        if (req.body.find("\"blue\"") != std::string::npos) {
+            hits.push_back({{"_id", "P1"}, {"_score", 2.0},
+                            {"_source", {{"title", "Blue Shirt"}, {"updated_at", "2025-12-01T00:00:00Z"}}}});
+        }
+        nlohmann::json body = {{"took", 1}, {"timed_out", false},
+                               {"hits", {{"total", {{"value", hits.size()}}}, {"max_score", 2.0}, {"hits", hits}}}};
+        res.set_content(body.dump(), "application/json");
+    });
+    int port = es.bind_to_any_port("127.0.0.1");
+    ASSERT_GT(port, 0);
+    std::thread listener([&es]() { es.listen_after_bind(); });
+    while (!es.is_running()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    SearchService service("127.0.0.1", port);
+    service.enableIncrementalSearch(10, 30000, 50);
+    auto empty = service.searchIncremental("s1", "blu", 10, SearchFilters());
+    EXPECT_TRUE(empty.results.empty());
+    auto refined = service.searchIncremental("s1", "blue", 10, SearchFilters());
+    es.stop();
+    listener.join();
+
+    EXPECT_FALSE(refined.incremental); // went to ES, not the empty candidate set
+    ASSERT_EQ(refined.results.size(), 1u);
+    EXPECT_EQ(refined.results[0].id, "P1");
+    EXPECT_EQ(es_requests.load(), 2);
+}
+
+TEST_F(SearchServiceTest, IncrementalLocalServeReportsALowerBoundTotal) {
+    // Fake ES: three shirts in the window, a thousand matches in the index
+    std::atomic<int> es_requests(0);
+    httplib::Server es;
+    es.Post("/products/_search", [&es_requests](const httplib::Request&, httplib::Response& res) {
+        es_requests++;
+        nlohmann::json hits = nlohmann::json::array();
+        for (int i = 1; i <= 3; i++) {
+            hits.push_back({{"_id", "P" + std::to_string(i)}, {"_score", 2.0},
+                            {"_source", {{"title", "Blue Shirt " + std::to_string(i)},
+                                         {"updated_at", "2025-12-01T00:00:00Z"}}}});
+        }
+        nlohmann::json body = {{"took", 1}, {"timed_out", false},
+                               {"hits", {{"total", {{"value", 1000}}}, {"max_score", 2.0}, {"hits", hits}}}};
+        res.set_content(body.dump(), "application/json");
+    });
+    int port = es.bind_to_any_port("127.0.0.1");
+    ASSERT_GT(port, 0);
+    std::thread listener([&es]() { es.listen_after_bind(); });
+    while (!es.is_running()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    SearchService service("127.0.0.1", port);
+    service.enableIncrementalSearch(10, 30000, 3);
+    auto first = service.searchIncremental("s1", "blue", 2, SearchFilters());
+    auto refined = service.searchIncremental("s1", "blue shirt", 2, SearchFilters());
+    es.stop();
+    listener.join();
+
+    EXPECT_EQ(first.total, 1000);
+    EXPECT_FALSE(first.total_lower_bound);
+    ASSERT_TRUE(refined.incremental);
+    EXPECT_EQ(refined.results.size(), 2u);
+    EXPECT_EQ(refined.total, 3);
+    EXPECT_TRUE(refined.total_lower_bound);
+    EXPECT_EQ(es_requests.load(), 1);
+}
+
+TEST_F(SearchServiceTest, IncrementalSessionStoreIsBounded) {
+    IncrementalSessionStore store(2, 60000);
+    CandidateSet set;
+    set.normalized_query = "a";
+    set.fetched_at = std::chrono::steady_clock::now();
+    store.store("s1", set);
+    store.store("s2", set);
+    store.store("s3", set);
+    EXPECT_EQ(store.size(), 2u);
+    EXPECT_FALSE(store.lookup("s1", "ab", "").has_value());
+}
+
+TEST_F(SearchServiceTest, TitleNormalization) {
+    EXPECT_EQ(TitleIndex::normalizeTitle("iPhone 15 Pro Max, 256GB"), "iphone 15 pro max 256gb");
+    EXPECT_EQ(TitleIndex::normalizeTitle("  USB-C  cable "), "usb c cable");
+    EXPECT_EQ(TitleIndex::normalizeTitle("!!!"), "");
+}
+
+TEST_F(SearchServiceTest, TitleIndexLookupAndUpdates) {
+    TitleIndex index;
+    index.upsert({"P1", "iPhone 15 Pro Max 256GB", "2025-12-10T10:00:00Z", 1, "", ""});
+    index.upsert({"P2", "USB cable", "", 1, "", ""});
+    index.upsert({"P3", "usb cable", "", 1, "", ""});
+
+    auto hits = index.lookup("iphone 15 pro max 256gb", 3);
+    ASSERT_EQ(hits.size(), 1u);
+    EXPECT_EQ(hits[0].id, "P1");
+    EXPECT_TRUE(index.lookup("iphone 15", 3).empty());  // prefix is not exact
+
+    // Too many products share the title to pin any of them
+    EXPECT_EQ(index.lookup("USB Cable", 2).size(), 2u);
+    EXPECT_TRUE(index.lookup("USB Cable", 1).empty());
+
+    // A renamed product moves buckets
+    index.upsert({"P1", "iPhone 16", "", 2, "", ""});
+    EXPECT_TRUE(index.lookup("iphone 15 pro max 256gb", 3).empty());
+    ASSERT_EQ(index.lookup("iphone 16", 3).size(), 1u);
+    EXPECT_EQ(index.lookup("iphone 16", 3)[0].version, 2);
+
+    index.remove("P2");
+    EXPECT_EQ(index.lookup("usb cable", 1).size(), 1u);
+    EXPECT_EQ(index.size(), 2u);
+}
+
+TEST_F(SearchServiceTest, PinnedHitsFillingThePageSkipES) {
+    // Nothing listens on this port, so a result proves ES was not asked
+    SearchService service("localhost", 1);
+    service.enableTitleIndex(3);
+    service.titleIndex()->upsert({"P1", "Gaming Laptop Pro", "2025-12-10T10:00:00Z", 4, "", ""});
+
+    auto response = service.search("gaming laptop pro", 1);
+    ASSERT_EQ(response.results.size(), 1u);
+    EXPECT_EQ(response.results[0].id, "P1");
+    EXPECT_TRUE(response.results[0].pinned);
+    EXPECT_EQ(response.pinned, 1);
+    EXPECT_NE(response.results_hash, 0u);
+
+    // Filters bypass the index
+    SearchFilters filters;
+    filters.in_stock = true;
+    EXPECT_TRUE(service.search("gaming laptop pro", 1, filters).results.empty());
+}
+
+TEST_F(SearchServiceTest, PinnedHitsGetDescriptionsAndAnHonestTotal) {
+    // Fake ES: one other match for the search; anything else is a failure
+    std::atomic<int> requests(0);
+    httplib::Server es;
+    es.Post("/products/_search", [&requests](const httplib::Request&, httplib::Response& res) {
+        requests++;
+        nlohmann::json hits = {{{"_id", "P2"}, {"_score", 3.0},
+                                {"_source", {{"title", "Gaming Laptop Pro Sleeve"},
+                                             {"updated_at", "2025-12-01T00:00:00Z"}}}}};
+        nlohmann::json body = {{"took", 1}, {"timed_out", false},
+                               {"hits", {{"total", {{"value", 41}}}, {"max_score", 3.0}, {"hits", hits}}}};
+        res.set_content(body.dump(), "application/json");
+    });
+    es.Post("/products/_mget", [&requests](const httplib::Request&, httplib::Response& res) {
+        requests += 100;
+        res.status = 500;
+    });
+    int port = es.bind_to_any_port("127.0.0.1");
+    ASSERT_GT(port, 0);
+    std::thread listener([&es]() { es.listen_after_bind(); });
+    while (!es.is_running()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    SearchService service("127.0.0.1", port);
+    service.enableTitleIndex(3);
+    service.enableResultCache(16, 60000);
+    service.titleIndex()->upsert({"P1", "Gaming Laptop Pro", "2025-12-10T10:00:00Z", 4, "laptops",
+                                  TitleIndex::descriptionPrefix("16GB RAM, 1TB SSD")});
+    auto alone = service.search("gaming laptop pro", 1);
+    auto repeat = service.search("gaming laptop pro", 1);
+    auto mixed = service.search("gaming laptop pro", 10);
+    es.stop();
+    listener.join();
+
+    // The page is all pinned: no ES round trip, and the total says so
+    ASSERT_EQ(alone.results.size(), 1u);
+    EXPECT_EQ(alone.results[0].description, "16GB RAM, 1TB SSD");
+    EXPECT_EQ(alone.results[0].category, "laptops");
+    EXPECT_EQ(alone.total, 1);
+    EXPECT_TRUE(alone.total_lower_bound);
+    EXPECT_NE(encodeSearchResponse(alone, "gaming laptop pro", 1, false, ResponseFormat::Json,
+                                   HighlightMode::None).find("\"total_relation\":\"gte\""),
+              std::string::npos);
+    EXPECT_TRUE(repeat.cache_hit);
+
+    // One ES search fills the rest and counts everything but the pinned hit
+    ASSERT_EQ(mixed.results.size(), 2u);
+    EXPECT_EQ(mixed.results[0].id, "P1");
+    EXPECT_EQ(mixed.results[0].description, "16GB RAM, 1TB SSD");
+    EXPECT_EQ(mixed.total, 42);
+    EXPECT_FALSE(mixed.total_lower_bound);
+    EXPECT_EQ(requests.load(), 1);
+}
+
+TEST_F(SearchServiceTest, IndexSyncWatermarkFollowsIndexTimeWithOverlap) {
+    IndexSyncWatermark watermark;
+    EXPECT_TRUE(watermark.query().contains("match_all"));
+
+    // A replayed event: old updated_at, indexed later than everything else
+    watermark.observe({{"updated_at", "2025-12-11T00:00:00Z"}, {"indexed_at", "2025-12-12T08:00:00.000Z"}});
+    watermark.observe({{"updated_at", "2025-12-12T09:00:00Z"}, {"indexed_at", "2025-12-12T07:59:59.500Z"}});
+    EXPECT_EQ(watermark.newest(), "2025-12-12T08:00:00.000Z");
+    EXPECT_EQ(watermark.query()["range"]["indexed_at"]["gte"], "2025-12-12T08:00:00.000Z||-60s");
+
+    // Documents from before the consumer stamped indexed_at
+    IndexSyncWatermark legacy;
+    legacy.observe({{"updated_at", "2025-12-10T10:00:00Z"}});
+    EXPECT_EQ(legacy.newest(), "2025-12-10T10:00:00Z");
+}
+
+TEST_F(SearchServiceTest, TitleIndexKeepsADescriptionPrefix) {
+    std::string long_description(TitleIndex::kDescriptionBytes - 1, 'a');
+    long_description += "\xc3\xa9 and more";  // a two-byte character straddles the limit
+    std::string prefix = TitleIndex::descriptionPrefix(long_description);
+    EXPECT_EQ(prefix, std::string(TitleIndex::kDescriptionBytes - 1, 'a'));
+    EXPECT_EQ(TitleIndex::descriptionPrefix("short"), "short");
+}
+
+TEST_F(SearchServiceTest, PinnedIdsExcludedFromESQuery) {
+    EsQueryOptions options;
+    options.exclude_ids = {"P1"};
+    auto body = ElasticsearchClient::buildSearchBody("laptop", 9, 5000, SearchFilters(), options);
+    EXPECT_EQ(body["query"]["bool"]["must_not"]["ids"]["values"][0], "P1");
+    EXPECT_FALSE(body["query"]["bool"].contains("filter"));
+}
+
+TEST_F(SearchServiceTest, SnippetMatcherFindsWordPrefixes) {
+    SnippetGenerator snippets("Gaming lap");
+    // Long enough to take the 16-byte vector path
+    std::string text = "Ultimate gaming LAPTOP for gamers, not a megaphone or a flap";
+    auto matches = snippets.findMatches(text);
+
+    // "gamers" doesn't start with "gaming"; "megaphone" and "flap" aren't word starts
+    ASSERT_EQ(matches.size(), 2u);
+    EXPECT_EQ(text.substr(matches[0].begin, matches[0].end - matches[0].begin), "gaming");
+    EXPECT_EQ(text.substr(matches[1].begin, matches[1].end - matches[1].begin), "LAP");
+}
+
+TEST_F(SearchServiceTest, SnippetWindowCoversMostTerms) {
+    SnippetGenerator snippets("wireless charger", 40);
+    std::string description =
+        "This wireless model ships with a long cable and plenty of accessories in the box, "
+        "and the wireless charger pad is included too.";
+    auto snippet = snippets.makeSnippet("Phone", description);
+
+    std::string fragment = description.substr(snippet.fragment.begin,
+                                              snippet.fragment.end - snippet.fragment.begin);
+    EXPECT_LE(fragment.size(), 40u);
+    EXPECT_NE(fragment.find("wireless charger"), std::string::npos);
+    EXPECT_EQ(snippet.fragment_matches.size(), 2u);
+    EXPECT_TRUE(snippet.title_matches.empty());
+}
+
+TEST_F(SearchServiceTest, SnippetMarkupEscapesText) {
+    std::string text = "Tom & Jerry <deluxe> box";
+    SnippetGenerator snippets("jerry");
+    auto matches = snippets.findMatches(text);
+    EXPECT_EQ(SnippetGenerator::markup(text, {0, text.size()}, matches),
+              "Tom &amp; <em>Jerry</em> &lt;deluxe&gt; box");
+}
+
+TEST_F(SearchServiceTest, HighlightedResponseAndETag) {
+    auto response = makeSampleResponse();
+    auto body = nlohmann::json::parse(encodeSearchResponse(
+        response, "laptop", 5, false, ResponseFormat::Json, HighlightMode::Markup));
+    EXPECT_TRUE(body["results"][0]["highlight"]["title"].get<std::string>().find("<em>")
+                != std::string::npos);
+
+    auto offsets = nlohmann::json::parse(encodeSearchResponse(
+        response, "laptop", 5, false, ResponseFormat::Json, HighlightMode::Offsets));
+    EXPECT_TRUE(offsets["results"][0]["highlight"]["description"]["fragment"].is_array());
+
+    // Plain responses and tags are unchanged
+    EXPECT_FALSE(nlohmann::json::parse(encodeSearchResponse(
+        response, "laptop", 5, false, ResponseFormat::Json))["results"][0].contains("highlight"));
+    EXPECT_EQ(makeETag(0xabc, ResponseFormat::Json, false, ContentEncoding::Gzip),
+              makeETag(0xabc, ResponseFormat::Json, false, ContentEncoding::Gzip, HighlightMode::None));
+    EXPECT_NE(makeETag(0xabc, ResponseFormat::Json, false, ContentEncoding::Gzip),
+              makeETag(0xabc, ResponseFormat::Json, false, ContentEncoding::Gzip, HighlightMode::Markup));
+}
+
+TEST_F(SearchServiceTest, RoaringBitmapContainers) {
+    RoaringBitmap sparse;
+    RoaringBitmap dense;
+    for (uint32_t i = 0; i < 10000; ++i) {
+        dense.add(i);                // becomes a bitmap container past 4096
+        if (i % 3 == 0) sparse.add(i);
+    }
+    sparse.add(70000);  // second container
+    dense.add(70000);
+
+    EXPECT_EQ(dense.cardinality(), 10001u);
+    EXPECT_EQ(sparse.cardinality(), 3335u);
+    EXPECT_EQ(dense.andCardinality(sparse), 3335u);
+    EXPECT_EQ(dense.andCardinality(dense), 10001u);
+
+    for (uint32_t i = 0; i < 9000; ++i) {
+        dense.remove(i);             // back to an array container
+    }
+    EXPECT_EQ(dense.cardinality(), 1001u);
+    EXPECT_TRUE(dense.contains(9999));
+    EXPECT_FALSE(dense.contains(5));
+    EXPECT_EQ(dense.andCardinality(sparse), 335u);
+}
+
+TEST_F(SearchServiceTest, FacetCountsOverCandidates) {
+    FacetIndex index({"category", "brand"});
+    index.upsert("P1", {{"category", "Laptops"}, {"brand", "Acme"}});
+    index.upsert("P2", {{"category", "Laptops"}, {"brand", "Globex"}});
+    index.upsert("P3", {{"category", {"Laptops", "Gaming"}}, {"brand", "Acme"}});
+    index.upsert("P4", {{"category", "Phones"}, {"brand", "Acme"}});
+
+    auto facets = index.facets({"P1", "P3", "P4", "unknown"}, {"category", "brand"}, 10);
+    ASSERT_EQ(facets.size(), 2u);
+    ASSERT_EQ(facets[0].values.size(), 3u);
+    EXPECT_EQ(facets[0].values[0].value, "Laptops");
+    EXPECT_EQ(facets[0].values[0].count, 2);
+    ASSERT_EQ(facets[1].values.size(), 1u);
+    EXPECT_EQ(facets[1].values[0].count, 3);  // Acme
+
+    // Updates move the product's bits
+    index.upsert("P4", {{"category", "Laptops"}, {"brand", "Globex"}});
+    auto laptops = index.counts("category", index.candidates({"P4"}), 10);
+    ASSERT_EQ(laptops.size(), 1u);
+    EXPECT_EQ(laptops[0].value, "Laptops");
+
+    index.remove("P4");
+    EXPECT_TRUE(index.counts("category", index.candidates({"P4"}), 10).empty());
+    EXPECT_EQ(index.counts("category", index.candidates({"P1", "P2", "P3"}), 1).size(), 1u);
+}
+
+TEST_F(SearchServiceTest, AndPopcountKernelsAgree) {
+    std::mt19937_64 rng(11);
+    std::vector<uint64_t> x(1024), y(1024);
+    for (size_t i = 0; i < x.size(); ++i) {
+        x[i] = rng();
+        y[i] = rng();
+    }
+    x[0] = y[0] = ~uint64_t(0);
+    uint64_t expected = andPopcount(x.data(), y.data(), x.size(), PopcountKernel::Scalar);
+
+    PopcountKernel best = bestPopcountKernel();
+    if (best == PopcountKernel::Popcnt || best == PopcountKernel::Avx512Vpopcnt) {
+        EXPECT_EQ(andPopcount(x.data(), y.data(), x.size(), PopcountKernel::Popcnt), expected);
+    }
+    if (best == PopcountKernel::Avx512Vpopcnt) {
+        EXPECT_EQ(andPopcount(x.data(), y.data(), x.size(), PopcountKernel::Avx512Vpopcnt), expected);
+    }
+}
+
+TEST_F(SearchServiceTest, FacetCountsSameForFewAndManyCandidates) {
+    // 500 brands over 6000 products: a small window tallies candidates, a
+    // large one intersects posting lists; both must agree with a plain count
+    FacetIndex index({"brand"});
+    std::vector<std::string> ids;
+    for (int i = 0; i < 6000; ++i) {
+        ids.push_back("P" + std::to_string(i));
+        index.upsert(ids.back(), {{"brand", {"B" + std::to_string(i % 500), "B" + std::to_string(i % 500)}}});
+    }
+    for (size_t window : {50u, 6000u}) {
+        std::vector<std::string> candidates(ids.begin(), ids.begin() + window);
+        auto counts = index.counts("brand", index.candidates(candidates), 3);
+        ASSERT_EQ(counts.size(), 3u);
+        int expected = static_cast<int>((window + 499) / 500);
+        EXPECT_EQ(counts[0].value, "B0");
+        EXPECT_EQ(counts[0].count, expected);
+        EXPECT_EQ(counts[2].value, "B10");
+    }
+}
+
+TEST_F(SearchServiceTest, FacetsEncodedAndHashed) {
+    auto response = makeSampleResponse();
+    response.facets = {{"category", {{"Laptops", 2}, {"Gaming", 1}}}};
+    auto body = nlohmann::json::parse(encodeSearchResponse(response, "laptop", 5, false, ResponseFormat::Json));
+    EXPECT_EQ(body["facets"]["category"][0]["value"], "Laptops");
+    EXPECT_EQ(body["facets"]["category"][1]["count"], 1);
+    EXPECT_EQ(body["facets_sampled"], false);
+
+    auto other = response.facets;
+    other[0].values[1].count = 2;
+    EXPECT_NE(SearchService::hashFacets(1, response.facets), SearchService::hashFacets(1, other));
+
+    EsQueryOptions options;
+    options.ids_only = true;
+    auto ids_only = ElasticsearchClient::buildSearchBody("laptop", 1000, 5000, SearchFilters(), options);
+    EXPECT_EQ(ids_only["_source"], false);
+}
+
+// Two-leaf XGBoost stump: x[feature] < condition ? yes_leaf : no_leaf
+static nlohmann::json xgbStump(const std::string& feature, double condition, double yes_leaf, double no_leaf) {
+    return {
+        {"nodeid", 0}, {"split", feature}, {"split_condition", condition},
+        {"yes", 1}, {"no", 2}, {"missing", 1},
+        {"children", {{{"nodeid", 1}, {"leaf", yes_leaf}}, {{"nodeid", 2}, {"leaf", no_leaf}}}}
+    };
+}
+
+TEST_F(SearchServiceTest, LtrXgboostModelScoring) {
+    nlohmann::json deeper = xgbStump("title_match", 0.5, 0.0, 0.0);
+    deeper["children"][1] = xgbStump("f0", 2.0, -1.0, 3.0);
+    deeper["children"][1]["nodeid"] = 2;
+    nlohmann::json model = {{"base_score", 0.5}, {"trees", {xgbStump("recency", 0.5, 0.1, 0.2), deeper}}};
+    auto ltr = LtrModel::fromJson(model);
+    EXPECT_EQ(ltr->treeCount(), 2u);
+    EXPECT_TRUE(ltr->usesQuickScorer());
+
+    float rows[3][kNumLtrFeatures] = {};
+    rows[0][kLtrRecency] = 0.9f;                                   // 0.5 + 0.2 + 0.0
+    rows[1][kLtrTitleMatch] = 1.0f; rows[1][kLtrEsScore] = 1.0f;   // 0.5 + 0.1 - 1.0
+    rows[2][kLtrTitleMatch] = 1.0f; rows[2][kLtrEsScore] = 2.0f;   // x == condition goes "no"
+    double scores[3];
+    ltr->score(&rows[0][0], 3, scores);
+    EXPECT_NEAR(scores[0], 0.7, 1e-6);
+    EXPECT_NEAR(scores[1], -0.4, 1e-6);
+    EXPECT_NEAR(scores[2], 3.6, 1e-6);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_NEAR(scores[i], ltr->scoreTraversal(rows[i]), 1e-9);
+    }
+}
+
+TEST_F(SearchServiceTest, LtrLightgbmModelScoring) {
+    nlohmann::json model = {
+        {"feature_names", {"es_score", "es_rank"}},
+        {"tree_info", {{{"tree_structure", {
+            {"split_feature", 1}, {"threshold", 2.0}, {"decision_type", "<="},
+            {"left_child", {{"leaf_value", 1.0}}},
+            {"right_child", {{"leaf_value", -1.0}}}
+        }}}}}
+    };
+    auto ltr = LtrModel::fromJson(model);
+    float row[kNumLtrFeatures] = {};
+    row[kLtrEsRank] = 2.0f;  // <= goes left
+    double score;
+    ltr->score(row, 1, &score);
+    EXPECT_DOUBLE_EQ(score, 1.0);
+
+    // 0.1f is just above the double 0.1, so LightGBM sends it right;
+    // rounding the threshold to the nearest float would send it left
+    auto& split = model["tree_info"][0]["tree_structure"];
+    split["split_feature"] = 0;
+    split["threshold"] = 0.1;
+    ltr = LtrModel::fromJson(model);
+    row[kLtrEsScore] = 0.1f;
+    ltr->score(row, 1, &score);
+    EXPECT_DOUBLE_EQ(score, -1.0);
+    EXPECT_DOUBLE_EQ(ltr->scoreTraversal(row), -1.0);
+    row[kLtrEsScore] = std::nextafter(0.1f, 0.0f);
+    ltr->score(row, 1, &score);
+    EXPECT_DOUBLE_EQ(score, 1.0);
+
+    // A lone leaf: no splits to walk
+    model["tree_info"][0]["tree_structure"] = {{"leaf_value", 0.5}};
+    ltr = LtrModel::fromJson(model);
+    ltr->score(row, 1, &score);
+    EXPECT_DOUBLE_EQ(score, 0.5);
+
+    model["feature_names"][0] = "price";
+    EXPECT_THROW(LtrModel::fromJson(model), std::invalid_argument);
+}
+
+TEST_F(SearchServiceTest, LtrModelChangesRankingVersion) {
+    SearchService service("localhost", 1);
+    uint64_t linear = service.rankingConfigVersion();
+    service.enableLtr(LtrModel::fromJson(nlohmann::json::array({xgbStump("f1", 0.5, 0.0, 1.0)})));
+    uint64_t first = service.rankingConfigVersion();
+    service.enableLtr(LtrModel::fromJson(nlohmann::json::array({xgbStump("f1", 0.5, 0.0, 2.0)})));
+    EXPECT_NE(linear, first);
+    EXPECT_NE(first, service.rankingConfigVersion());
+}
+
+TEST_F(SearchServiceTest, Int8DotKernelsAgree) {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> value(-127, 127);
+    std::vector<int8_t> a(384), b(384);
+    for (size_t i = 0; i < a.size(); ++i) {
+        a[i] = static_cast<int8_t>(value(rng));
+        b[i] = static_cast<int8_t>(value(rng));
+    }
+    a[0] = -127; b[0] = -127;  // extremes must not saturate
+    a[1] = 127; b[1] = -127;
+    int32_t expected = dotInt8(a.data(), b.data(), a.size(), DotKernel::Scalar);
+
+    DotKernel best = bestDotKernel();
+    if (best == DotKernel::Avx2 || best == DotKernel::Avx512Vnni) {
+        EXPECT_EQ(dotInt8(a.data(), b.data(), a.size(), DotKernel::Avx2), expected);
+    }
+    if (best == DotKernel::Avx512Vnni) {
+        EXPECT_EQ(dotInt8(a.data(), b.data(), a.size(), DotKernel::Avx512Vnni), expected);
+    }
+}
+
+TEST_F(SearchServiceTest, EmbeddingStoreRoundTrip) {
+    std::string path = "./test-embeddings.bin";
+    EmbeddingStore::write(path, 3, {
+        {"p1", {1.0f, 0.0f, 0.0f}},
+        {"p2", {3.0f, 4.0f, 0.0f}},  // normalized on write
+        {"p3", {0.0f, 0.0f, -2.0f}}
+    });
+    auto store = EmbeddingStore::open(path);
+    std::remove(path.c_str());  // the mapping outlives the name
+
+    EXPECT_EQ(store->dim(), 3u);
+    EXPECT_EQ(store->stride(), kEmbeddingAlign);
+    EXPECT_EQ(store->size(), 3u);
+    EXPECT_EQ(store->find("p2"), 1);
+    EXPECT_EQ(store->find("p4"), -1);
+    EXPECT_EQ(store->key(2), "p3");
+
+    float query[3] = {0.0f, 1.0f, 0.0f};
+    auto quantized = store->quantize(query);
+    EXPECT_NEAR(store->similarity(quantized, 1), 0.8, 0.01);
+    EXPECT_NEAR(store->similarity(quantized, 0), 0.0, 0.01);
+    EXPECT_NEAR(store->similarity(0, 1), 0.6, 0.01);
+    EXPECT_NEAR(store->similarity(2, 2), 1.0, 0.01);
+
+    EXPECT_THROW(EmbeddingStore::write(path, 3, {{"p1", {1.0f}}}), std::invalid_argument);
+    EXPECT_THROW(EmbeddingStore::open("./no-such-embeddings.bin"), std::runtime_error);
+    {
+        std::ofstream file(path);
+        file << std::string(128, 'x');
+    }
+    EXPECT_THROW(EmbeddingStore::open(path), std::invalid_argument);
+    std::remove(path.c_str());
+}
+
+TEST_F(SearchServiceTest, HnswIndexFindsNearestNeighbors) {
+    const size_t dim = 32;
+    std::mt19937 rng(11);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    std::vector<std::pair<std::string, std::vector<float>>> vectors;
+    for (int i = 0; i < 2000; ++i) {
+        std::vector<float> values(dim);
+        for (auto& v : values) v = normal(rng);
+        vectors.push_back({"p" + std::to_string(i), values});
+    }
+    std::string path = "./test-hnsw-embeddings.bin";
+    EmbeddingStore::write(path, dim, vectors);
+    auto store = EmbeddingStore::open(path);
+    std::remove(path.c_str());
+
+    HnswIndex index(store, 16, 100);
+    EXPECT_EQ(index.size(), 2000u);
+
+    // Recall@10 against exact search over the same quantized vectors
+    size_t found = 0;
+    const int queries = 50;
+    for (int q = 0; q < queries; ++q) {
+        std::vector<float> values(dim);
+        for (auto& v : values) v = normal(rng);
+        auto query = store->quantize(values.data());
+
+        std::vector<std::pair<float, uint32_t>> exact;
+        for (uint32_t row = 0; row < store->size(); ++row) {
+            exact.push_back({store->similarity(query, row), row});
+        }
+        std::partial_sort(exact.begin(), exact.begin() + 10, exact.end(),
+                          [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        auto approximate = index.search(query, 10, 64);
+        ASSERT_EQ(approximate.size(), 10u);
+        EXPECT_GE(approximate[0].similarity, approximate[9].similarity);
+        for (int i = 0; i < 10; ++i) {
+            for (const auto& neighbor : approximate) {
+                if (neighbor.row == exact[i].second) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    EXPECT_GE(static_cast<double>(found) / (queries * 10), 0.9);
+}
+
+TEST_F(SearchServiceTest, SemanticRerankConfiguration) {
+    std::string path = "./test-semantic-embeddings.bin";
+    EmbeddingStore::write(path, 4, {{"p1", {1.0f, 0.0f, 0.0f, 0.0f}}});
+    auto products = EmbeddingStore::open(path);
+    EmbeddingStore::write(path, 2, {{"laptop", {1.0f, 0.0f}}});
+    auto wrong_dim = EmbeddingStore::open(path);
+    std::remove(path.c_str());
+
+    SearchService service("localhost", 1);
+    EXPECT_EQ(service.semanticDim(), 0u);
+    uint64_t linear = service.rankingConfigVersion();
+    EXPECT_THROW(service.enableSemantic(products, wrong_dim), std::invalid_argument);
+    service.enableSemantic(products, nullptr);
+    EXPECT_EQ(service.semanticDim(), 4u);
+    EXPECT_NE(service.rankingConfigVersion(), linear);
+}
+
+TEST_F(SearchServiceTest, SpellingEditDistance) {
+    EXPECT_EQ(SpellingIndex::editDistance("laptop", "laptop", 2), 0);
+    EXPECT_EQ(SpellingIndex::editDistance("latpop", "laptop", 2), 1);  // transposition
+    EXPECT_EQ(SpellingIndex::editDistance("lapto", "laptop", 2), 1);
+    EXPECT_EQ(SpellingIndex::editDistance("lptpo", "laptop", 2), 2);
+    EXPECT_EQ(SpellingIndex::editDistance("keyboard", "laptop", 2), 3);  // capped at max + 1
+}
+
+TEST_F(SearchServiceTest, SpellingLookupRanksByDistanceThenFrequency) {
+    SpellingIndex index;
+    index.addWord("laptop", 50);
+    index.addWord("laptops", 5);
+    index.addWord("lapdog", 1);
+    index.addWord("headphones", 20);
+
+    auto suggestions = index.lookup("labtop");
+    ASSERT_GE(suggestions.size(), 2u);
+    EXPECT_EQ(suggestions[0].term, "laptop");
+    EXPECT_EQ(suggestions[0].distance, 1);
+    EXPECT_EQ(suggestions[1].term, "laptops");
+
+    // Typos past the indexed prefix are still found
+    EXPECT_EQ(index.lookup("headphnoes").at(0).term, "headphones");
+    // Short words only get one edit
+    index.addWord("cat", 10);
+    EXPECT_TRUE(index.lookup("cxx").empty());
+    EXPECT_TRUE(index.lookup("zzzzzz").empty());
+}
+
+TEST_F(SearchServiceTest, SpellingCorrectsUnknownTermsOnly) {
+    SpellingIndex index;
+    for (const auto& word : SpellingIndex::tokenize("Gaming Laptop Pro, Wireless Gaming Mouse")) {
+        index.addWord(word);
+    }
+    EXPECT_EQ(index.correct("Gamign  LAPTPO"), std::optional<std::string>("gaming laptop"));
+    EXPECT_EQ(index.correct("gaming mouse"), std::nullopt);       // nothing to fix
+    EXPECT_EQ(index.correct("rtx4090 laptop"), std::nullopt);     // model codes left alone
+    EXPECT_EQ(index.correct("qqqqqq"), std::nullopt);             // no suggestion
+
+    // Query log: frequent new terms join the vocabulary, rare ones don't
+    std::string path = "./test-spelling-log.tsv";
+    {
+        std::ofstream file(path);
+        file << "ultrabook\t25\n"
+             << "ultrabok\t2\n"
+             << "gaming laptop\t40\n";
+    }
+    EXPECT_EQ(index.loadQueryLog(path, 10), 1u);
+    std::remove(path.c_str());
+    EXPECT_TRUE(index.contains("ultrabook"));
+    EXPECT_FALSE(index.contains("ultrabok"));
+    EXPECT_EQ(index.correct("ultrabok"), std::optional<std::string>("ultrabook"));
+}
+
+TEST_F(SearchServiceTest, CorrectedQueryEncoded) {
+    SearchResponse response;
+    response.total = 0;
+    response.latency_ms = 1;
+    EXPECT_FALSE(nlohmann::json::parse(encodeSearchResponse(
+        response, "laptpo", 10, false, ResponseFormat::Json)).contains("corrected_query"));
+    response.corrected_query = "laptop";
+    auto body = nlohmann::json::parse(encodeSearchResponse(response, "laptpo", 10, false, ResponseFormat::Json));
+    EXPECT_EQ(body["corrected_query"], "laptop");
+    EXPECT_EQ(body["query"], "laptpo");
+}
+
+static nlohmann::json sampleTaxonomy() {
+    return {
+        {"categories", nlohmann::json::array({
+            {{"id", "electronics"}},
+            {{"id", "computers"}, {"parent", "electronics"}},
+            {{"id", "laptops"}, {"parent", "computers"}},
+            {{"id", "gaming-laptops"}, {"parent", "laptops"}},
+            {{"id", "desktops"}, {"parent", "computers"}},
+            {{"id", "audio"}, {"parent", "electronics"}},
+            {{"id", "headphones"}, {"parent", "audio"}},
+            {{"id", "home"}},
+            {{"id", "furniture"}, {"parent", "home"}}
+        })},
+        {"queries", {{"Gaming Laptop", "gaming-laptops"}}}
+    };
+}
+
+TEST_F(SearchServiceTest, TaxonomyLcaMatchesParentWalk) {
+    auto taxonomy = Taxonomy::fromJson(sampleTaxonomy());
+    ASSERT_EQ(taxonomy->size(), 10u);  // plus the implicit root
+
+    std::unordered_map<std::string, std::string> parents;
+    for (const auto& category : sampleTaxonomy()["categories"]) {
+        parents[category["id"]] = category.value("parent", "");
+    }
+    auto ancestors = [&parents](std::string id) {
+        std::vector<std::string> path;
+        for (; !id.empty(); id = parents[id]) path.push_back(id);
+        path.push_back("");
+        return path;
+    };
+
+    for (const auto& [a, pa] : parents) {
+        for (const auto& [b, pb] : parents) {
+            auto path_a = ancestors(a);
+            auto path_b = ancestors(b);
+            std::string expected;
+            for (const auto& id : path_a) {
+                if (std::find(path_b.begin(), path_b.end(), id) != path_b.end()) {
+                    expected = id;
+                    break;
+                }
+            }
+            int lca = taxonomy->lca(taxonomy->node(a), taxonomy->node(b));
+            EXPECT_EQ(taxonomy->category(lca), expected) << a << " / " << b;
+        }
+    }
+
+    int gaming = taxonomy->node("gaming-laptops");
+    int desktops = taxonomy->node("desktops");
+    EXPECT_EQ(taxonomy->depth(gaming), 4);
+    EXPECT_EQ(taxonomy->distance(gaming, desktops), 3);
+    EXPECT_DOUBLE_EQ(taxonomy->proximity(gaming, gaming), 1.0);
+    EXPECT_DOUBLE_EQ(taxonomy->proximity(gaming, desktops), 0.5);
+    EXPECT_DOUBLE_EQ(taxonomy->proximity(gaming, taxonomy->node("furniture")), 0.0);
+    EXPECT_EQ(taxonomy->node("toys"), -1);
+}
+
+TEST_F(SearchServiceTest, TaxonomyRejectsBadTrees) {
+    auto cycle = sampleTaxonomy();
+    cycle["categories"][0]["parent"] = "laptops";
+    EXPECT_THROW(Taxonomy::fromJson(cycle), std::invalid_argument);
+
+    auto orphan = sampleTaxonomy();
+    orphan["categories"].push_back({{"id", "toys"}, {"parent", "games"}});
+    EXPECT_THROW(Taxonomy::fromJson(orphan), std::invalid_argument);
+
+    auto duplicate = sampleTaxonomy();
+    duplicate["categories"].push_back({{"id", "audio"}});
+    EXPECT_THROW(Taxonomy::fromJson(duplicate), std::invalid_argument);
+
+    auto unknown_query = sampleTaxonomy();
+    unknown_query["queries"]["sofa"] = "sofas";
+    EXPECT_THROW(Taxonomy::fromJson(unknown_query), std::invalid_argument);
+
+    EXPECT_THROW(Taxonomy::load("./no-such-taxonomy.json"), std::runtime_error);
+}
+
+TEST_F(SearchServiceTest, TaxonomyPredictsHeadQueries) {
+    auto taxonomy = Taxonomy::fromJson(sampleTaxonomy());
+    EXPECT_EQ(taxonomy->predictedCategory(normalizeQuery("  gaming   LAPTOP ")),
+              taxonomy->node("gaming-laptops"));
+    EXPECT_EQ(taxonomy->predictedCategory(normalizeQuery("sofa")), -1);
+}
+
+TEST_F(SearchServiceTest, TaxonomyChangesRankingVersion) {
+    SearchService service("localhost", 1);
+    uint64_t plain = service.rankingConfigVersion();
+    service.enableTaxonomy(Taxonomy::fromJson(sampleTaxonomy()));
+    uint64_t first = service.rankingConfigVersion();
+
+    auto edited = sampleTaxonomy();
+    edited["categories"].push_back({{"id", "tablets"}, {"parent", "computers"}});
+    service.setTaxonomy(Taxonomy::fromJson(edited));
+    EXPECT_NE(plain, first);
+    EXPECT_NE(first, service.rankingConfigVersion());
+}
+
+TEST_F(SearchServiceTest, TaxonomyReloadBypassesCachedPages) {
+    // Pinned-only pages need no ES, and are cached like any other
+    SearchService service("localhost", 1);
+    service.enableResultCache(16, 60000);
+    service.enableTitleIndex(3);
+    service.titleIndex()->upsert({"P1", "Gaming Laptop Pro", "2025-12-10T10:00:00Z", 4, "laptops", ""});
+    service.enableTaxonomy(Taxonomy::fromJson(sampleTaxonomy()));
+    service.search("gaming laptop pro", 1);
+    EXPECT_TRUE(service.search("gaming laptop pro", 1).cache_hit);
+
+    auto edited = sampleTaxonomy();
+    edited["categories"].push_back({{"id", "tablets"}, {"parent", "computers"}});
+    service.setTaxonomy(Taxonomy::fromJson(edited));
+    EXPECT_FALSE(service.search("gaming laptop pro", 1).cache_hit);
+}
+
+TEST_F(SearchServiceTest, RankingConfigOverlaysBase) {
+    RankingConfig base;
+    base.semantic_weight = 0.3;
+    auto config = RankingConfig::fromJson({
+        {"version", "r42"},
+        {"weights", {{"es_score", 0.5}, {"title_match", 0.3}}},
+        {"recency_decay_days", 14},
+        {"query", {{"fields", {"title^5", "brand^2", "description"}}, {"type", "cross_fields"}}}
+    }, base);
+    EXPECT_EQ(config.version, "r42");
+    EXPECT_DOUBLE_EQ(config.es_weight, 0.5);
+    EXPECT_DOUBLE_EQ(config.recency_weight, 0.2);     // default kept
+    EXPECT_DOUBLE_EQ(config.semantic_weight, 0.3);    // base kept
+    EXPECT_DOUBLE_EQ(config.recency_decay_days, 14.0);
+    EXPECT_EQ(config.match_type, "cross_fields");
+
+    // The label doesn't change the fingerprint; a missing one is derived from it
+    auto relabeled = RankingConfig::fromJson({{"version", "r43"}}, config);
+    EXPECT_EQ(relabeled.fingerprint, config.fingerprint);
+    auto unlabeled = RankingConfig::fromJson(nlohmann::json::object());
+    EXPECT_EQ(unlabeled.version.size(), 16u);
+    EXPECT_NE(unlabeled.fingerprint, config.fingerprint);
+
+    EXPECT_THROW(RankingConfig::fromJson({{"recency_decay_days", 0}}), std::invalid_argument);
+    EXPECT_THROW(RankingConfig::fromJson({{"query", {{"type", "fuzzy"}}}}), std::invalid_argument);
+    EXPECT_THROW(RankingConfig::fromJson({{"query", {{"fields", nlohmann::json::array()}}}}),
+                 std::invalid_argument);
+    EXPECT_THROW(RankingConfig::fromJson({{"weights", {{"recency", "high"}}}}), std::invalid_argument);
+    EXPECT_THROW(RankingConfig::load("./no-such-ranking.json"), std::runtime_error);
+
+    EsQueryOptions options;
+    options.query_fields = config.query_fields;
+    options.match_type = config.match_type;
+    auto body = ElasticsearchClient::buildSearchBody("laptop", 10, 5000, SearchFilters(), options);
+    EXPECT_EQ(body["query"]["multi_match"]["fields"][0], "title^5");
+    EXPECT_EQ(body["query"]["multi_match"]["type"], "cross_fields");
+}
+
+TEST_F(SearchServiceTest, RankingConfigSwapChangesVersion) {
+    SearchService service("localhost", 1);
+    uint64_t defaults = service.rankingConfigVersion();
+    EXPECT_EQ(service.rankingConfig().version.size(), 16u);
+
+    service.setRankingConfig(RankingConfig::fromJson({{"version", "tuned"}, {"weights", {{"recency", 0.4}}}}));
+    EXPECT_EQ(service.rankingConfig().version, "tuned");
+    EXPECT_DOUBLE_EQ(service.rankingConfig().recency_weight, 0.4);
+    EXPECT_NE(service.rankingConfigVersion(), defaults);
+
+    service.setRankingConfig(RankingConfig());
+    EXPECT_EQ(service.rankingConfigVersion(), defaults);
+
+    // A failed search still reports the config that would have ranked it
+    auto response = service.search("laptop");
+    EXPECT_EQ(response.config_version, service.rankingConfig().version);
+    auto body = nlohmann::json::parse(encodeSearchResponse(response, "laptop", 10, false, ResponseFormat::Json));
+    EXPECT_EQ(body["config_version"], response.config_version);
+}
+
+// Counts live instances, so the test can see when retired ones are freed
+struct TrackedConfig {
+    static std::atomic<int> live;
+    int first;
+    int second;  // always first + 1
+    TrackedConfig(int value) : first(value), second(value + 1) { live++; }
+    ~TrackedConfig() { live--; }
+};
+std::atomic<int> TrackedConfig::live{0};
+
+TEST_F(SearchServiceTest, RcuReadersSeeWholeSnapshots) {
+    {
+        RcuPtr<TrackedConfig> config(std::make_unique<const TrackedConfig>(0));
+        std::atomic<bool> done{false};
+        std::atomic<int> torn{0};
+
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&]() {
+                while (!done) {
+                    RcuReadGuard guard;
+                    const TrackedConfig* snapshot = config.get();
+                    int first = snapshot->first;
+                    std::this_thread::yield();
+                    {
+                        RcuReadGuard nested;  // guards nest
+                        if (config.get()->second < first + 1) torn++;
+                    }
+                    if (snapshot->second != first + 1) torn++;
+                }
+            });
+        }
+        for (int value = 1; value <= 2000; ++value) {
+            config.publish(std::make_unique<const TrackedConfig>(value));
+        }
+        done = true;
+        for (auto& reader : readers) reader.join();
+
+        EXPECT_EQ(torn.load(), 0);
+        // With no reader inside a critical section, every retired snapshot goes
+        EXPECT_EQ(EpochDomain::instance().reclaim(), 0u);
+        EXPECT_EQ(TrackedConfig::live.load(), 1);
+
+        // A reader still inside its section holds back what it may have seen
+        RcuReadGuard guard;
+        const TrackedConfig* held = config.get();
+        config.publish(std::make_unique<const TrackedConfig>(5000));
+        EXPECT_GE(EpochDomain::instance().reclaim(), 1u);
+        EXPECT_EQ(held->second, 2001);
+    }
+    EXPECT_EQ(EpochDomain::instance().reclaim(), 0u);
+    EXPECT_EQ(TrackedConfig::live.load(), 0);
+}
+
+TEST_F(SearchServiceTest, QueryStatsFindsHeavyHittersInFixedMemory) {
+    QueryStatsConfig config;
+    config.capacity = 64;
+    config.shards = 4;
+    double now = 0.0;
+    QueryStats stats(config, [&now]() { return now; });
+    size_t memory = stats.memoryBytes();
+
+    // Three head queries among 20000 one-off tail queries
+    for (int i = 0; i < 20000; ++i) {
+        stats.record("tail query " + std::to_string(i));
+        if (i % 10 == 0) stats.record("laptop");
+        if (i % 20 == 0) stats.record("gaming mouse");
+        if (i % 40 == 0) stats.record("usb c cable");
+    }
+
+    auto top = stats.top(3);
+    ASSERT_EQ(top.size(), 3u);
+    EXPECT_EQ(top[0].query, "laptop");
+    EXPECT_EQ(top[1].query, "gaming mouse");
+    EXPECT_EQ(top[2].query, "usb c cable");
+    // Space-Saving never underestimates, and the error bound covers the gap
+    EXPECT_GE(top[0].count, 2000.0);
+    EXPECT_LE(top[0].count - top[0].error, 2000.0 + 1e-6);
+    EXPECT_LE(stats.tracked(), 64u);
+    EXPECT_EQ(stats.memoryBytes(), memory);
+
+    // Count-Min never underestimates either
+    EXPECT_GE(stats.recentCount("laptop"), 2000.0 - 1e-6);
+    EXPECT_GE(stats.recentCount("tail query 7"), 1.0 - 1e-9);
+
+    // Long queries are tracked by a bounded prefix
+    std::string long_query(1000, 'x');
+    stats.record(long_query);
+    EXPECT_GE(stats.recentCount(long_query), 1.0 - 1e-9);
+    EXPECT_EQ(stats.memoryBytes(), memory);
+}
+
+TEST_F(SearchServiceTest, QueryStatsDecayAndTrending) {
+    QueryStatsConfig config;
+    config.half_life_s = 3600;
+    config.trend_half_life_s = 300;
+    double now = 0.0;
+    QueryStats stats(config, [&now]() { return now; });
+
+    // Steady traffic for four hours, a burst in the last minute
+    for (int second = 0; second < 4 * 3600; second += 10) {
+        now = second;
+        stats.record("laptop");
+    }
+    for (int i = 0; i < 60; ++i) {
+        now = 4 * 3600 + i;
+        stats.record("eclipse glasses");
+    }
+
+    auto trending = stats.trending(10);
+    ASSERT_EQ(trending.size(), 1u);
+    EXPECT_EQ(trending[0].query, "eclipse glasses");
+    EXPECT_GT(trending[0].recent_rate, 2.0 * trending[0].baseline_rate);
+
+    // Steady traffic settles at its rate: 0.1/s over either horizon
+    auto top = stats.top(2);
+    ASSERT_EQ(top.size(), 2u);
+    EXPECT_EQ(top[0].query, "laptop");
+    EXPECT_NEAR(top[0].count * std::log(2.0) / 3600, 0.1, 0.01);
+
+    // One trend half-life later the recent count has halved
+    double recent = stats.recentCount("eclipse glasses");
+    now += 300;
+    EXPECT_NEAR(stats.recentCount("eclipse glasses"), recent / 2, recent * 1e-6);
+
+    // Days of forward decay rescale the counters instead of overflowing
+    now += 30 * 86400;
+    stats.record("laptop");
+    EXPECT_NEAR(stats.recentCount("laptop"), 1.0, 1e-6);
+    EXPECT_TRUE(std::isfinite(stats.top(1)[0].count));
+}
+
+TEST_F(SearchServiceTest, QueryStatsWritesWarmupList) {
+    QueryStats stats;
+    for (int i = 0; i < 3; ++i) stats.record("laptop");
+    stats.record("gaming mouse");
+
+    std::string path = "./test-top-queries.txt";
+    EXPECT_EQ(stats.writeTopQueries(path, 10), 2u);
+    auto queries = SearchService::loadWarmupQueries(path);
+    std::remove(path.c_str());
+    EXPECT_EQ(queries, (std::vector<std::string>{"laptop", "gaming mouse"}));
+    EXPECT_THROW(stats.writeTopQueries("./no-such-dir/top.txt", 10), std::runtime_error);
+}
+
+static double shingleJaccard(const std::string& a, const std::string& b, size_t k) {
+    std::set<std::string> left, right;
+    for (size_t i = 0; i + k <= a.size(); ++i) left.insert(a.substr(i, k));
+    for (size_t i = 0; i + k <= b.size(); ++i) right.insert(b.substr(i, k));
+    size_t shared = 0;
+    for (const auto& shingle : left) shared += right.count(shingle);
+    return static_cast<double>(shared) / (left.size() + right.size() - shared);
+}
+
+TEST_F(SearchServiceTest, MinHashEstimatesJaccard) {
+    MinHasher hasher(256, 4);
+    std::string a = "acme gaming laptop 15 inch 16gb ram 512gb ssd";
+    std::vector<std::string> others = {
+        a, "acme gaming laptop 15 inch 16gb ram 1tb ssd", "acme gaming laptop 17 inch 32gb ram",
+        "wireless noise cancelling headphones"};
+    auto signature = hasher.signature(a);
+    ASSERT_EQ(signature.size(), 256u);
+    for (const auto& other : others) {
+        double estimate = MinHasher::similarity(signature.data(), hasher.signature(other).data(), 256);
+        EXPECT_NEAR(estimate, shingleJaccard(a, other, 4), 0.1) << other;
+    }
+    // Punctuation and case don't change the shingles
+    EXPECT_EQ(hasher.signature("ACME Gaming-Laptop"), hasher.signature("acme gaming laptop"));
+    EXPECT_TRUE(hasher.signature("--- !!").empty());
+}
+
+TEST_F(SearchServiceTest, ConcurrentUnionFindRootsAreLowestMembers) {
+    const uint32_t n = 10000;
+    ConcurrentUnionFind sets(n);
+    // Four threads link i with i + 2 (evens and odds) in different orders
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&sets, t]() {
+            for (uint32_t j = 0; j + 2 < n; ++j) {
+                uint32_t i = t % 2 == 0 ? j : n - 3 - j;
+                sets.unite(i, i + 2);
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    for (uint32_t i = 0; i < n; ++i) {
+        EXPECT_EQ(sets.find(i), i % 2) << i;
+    }
+    EXPECT_FALSE(sets.unite(4, 8));
+    EXPECT_TRUE(sets.unite(n - 1, n - 2));
+    EXPECT_EQ(sets.find(n - 1), 0u);
+}
+
+TEST_F(SearchServiceTest, NearDuplicateTitlesCluster) {
+    std::vector<std::string> titles = {
+        "Acme Gaming Laptop 15 inch 16GB RAM 512GB SSD Black",
+        "Wireless Noise Cancelling Headphones",
+        "ACME gaming laptop, 15 inch, 16GB RAM, 512GB SSD - black",
+        "Acme Gaming Laptop 15 inch 16GB RAM 512GB SSD (Black)",
+        "Oak Dining Table",
+        "",
+        "Wireless Noise Cancelling Headphones Midnight Blue Edition",
+        "",
+    };
+    DedupOptions options;
+    options.threads = 4;
+    auto roots = clusterNearDuplicates(titles, options);
+    EXPECT_EQ(roots, (std::vector<uint32_t>{0, 1, 0, 0, 4, 5, 6, 7}));
+
+    // A looser threshold (and shorter bands to find it) also catches the
+    // color variant
+    options.threshold = 0.4;
+    options.bands = 32;
+    EXPECT_EQ(clusterNearDuplicates(titles, options)[6], 1u);
+}
+
+TEST_F(SearchServiceTest, DuplicateClustersLoadAndVersion) {
+    std::string path = "./test-dedup-clusters.tsv";
+    {
+        std::ofstream file(path);
+        file << "# product_id\tcluster_id\n" << "p1\tp1\n" << "p2\tp1\n" << "p7\tp7\n" << "p9\tp7\n";
+    }
+    auto clusters = DuplicateClusters::load(path);
+    std::remove(path.c_str());
+    EXPECT_EQ(clusters->products(), 4u);
+    EXPECT_EQ(clusters->clusterCount(), 2u);
+    EXPECT_EQ(clusters->cluster("p1"), clusters->cluster("p2"));
+    EXPECT_NE(clusters->cluster("p1"), clusters->cluster("p9"));
+    EXPECT_NE(clusters->cluster("p7"), 0u);
+    EXPECT_EQ(clusters->cluster("p3"), 0u);
+    EXPECT_THROW(DuplicateClusters::load("./no-such-clusters.tsv"), std::runtime_error);
+
+    SearchService service("localhost", 1);
+    uint64_t plain = service.rankingConfigVersion();
+    service.enableDedup(clusters, 0.5);
+    EXPECT_NE(plain, service.rankingConfigVersion());
+
+    SearchResponse response;
+    response.total = 0;
+    response.latency_ms = 1;
+    EXPECT_FALSE(nlohmann::json::parse(encodeSearchResponse(
+        response, "laptop", 10, false, ResponseFormat::Json)).contains("collapsed"));
+    response.collapsed = 3;
+    auto body = nlohmann::json::parse(encodeSearchResponse(response, "laptop", 10, false, ResponseFormat::Json));
+    EXPECT_EQ(body["collapsed"], 3);
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();